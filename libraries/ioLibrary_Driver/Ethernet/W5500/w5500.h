@@ -1239,6 +1239,25 @@ void     WIZCHIP_READ_BUF (uint32_t AddrSel, uint8_t* pBuf, uint16_t len);
  */
 void     WIZCHIP_WRITE_BUF(uint32_t AddrSel, uint8_t* pBuf, uint16_t len);
 
+/**
+ * @ingroup Basic_IO_function
+ * @brief It reads 2 byte value from a register pair in one VDM frame.
+ * @details The block select bits in <i>AddrSel</i> pick the socket register block,
+ * so the high and low bytes are fetched without a second address phase.
+ * @param AddrSel Register address of the high byte
+ * @return The value of register pair
+ */
+uint16_t WIZCHIP_READ_16(uint32_t AddrSel);
+
+/**
+ * @ingroup Basic_IO_function
+ * @brief It writes 2 byte value to a register pair in one VDM frame.
+ * @param AddrSel Register address of the high byte
+ * @param wb Write data
+ * @return void
+ */
+void     WIZCHIP_WRITE_16(uint32_t AddrSel, uint16_t wb);
+
 /////////////////////////////////
 // Common Register I/O function //
 /////////////////////////////////
@@ -1951,7 +1970,7 @@ uint16_t getSn_TX_FSR(uint8_t sn);
 		((WIZCHIP_READ(Sn_TX_RD(sn)) << 8) + WIZCHIP_READ(WIZCHIP_OFFSET_INC(Sn_TX_RD(sn),1)))
 */
 #define getSn_TX_RD(sn) \
-		(((uint16_t)WIZCHIP_READ(Sn_TX_RD(sn)) << 8) + WIZCHIP_READ(WIZCHIP_OFFSET_INC(Sn_TX_RD(sn),1)))		
+		WIZCHIP_READ_16(Sn_TX_RD(sn))
 
 /**
  * @ingroup Socket_register_access_function
@@ -1960,10 +1979,8 @@ uint16_t getSn_TX_FSR(uint8_t sn);
  * @param (uint16_t)txwr Value to set @ref Sn_TX_WR
  * @sa GetSn_TX_WR()
  */
-#define setSn_TX_WR(sn, txwr) { \
-		WIZCHIP_WRITE(Sn_TX_WR(sn),   (uint8_t)(txwr>>8)); \
-		WIZCHIP_WRITE(WIZCHIP_OFFSET_INC(Sn_TX_WR(sn),1), (uint8_t) txwr); \
-		}
+#define setSn_TX_WR(sn, txwr) \
+		WIZCHIP_WRITE_16(Sn_TX_WR(sn), txwr)
 
 /**
  * @ingroup Socket_register_access_function
@@ -1978,7 +1995,7 @@ uint16_t getSn_TX_FSR(uint8_t sn);
 		((WIZCHIP_READ(Sn_TX_WR(sn)) << 8) + WIZCHIP_READ(WIZCHIP_OFFSET_INC(Sn_TX_WR(sn),1)))
 */
 #define getSn_TX_WR(sn) \
-		(((uint16_t)WIZCHIP_READ(Sn_TX_WR(sn)) << 8) + WIZCHIP_READ(WIZCHIP_OFFSET_INC(Sn_TX_WR(sn),1)))		
+		WIZCHIP_READ_16(Sn_TX_WR(sn))
 
 
 /**
@@ -1997,10 +2014,8 @@ uint16_t getSn_RX_RSR(uint8_t sn);
  * @param (uint16_t)rxrd Value to set @ref Sn_RX_RD
  * @sa getSn_RX_RD()
  */
-#define setSn_RX_RD(sn, rxrd) { \
-		WIZCHIP_WRITE(Sn_RX_RD(sn),   (uint8_t)(rxrd>>8)); \
-		WIZCHIP_WRITE(WIZCHIP_OFFSET_INC(Sn_RX_RD(sn),1), (uint8_t) rxrd); \
-	}
+#define setSn_RX_RD(sn, rxrd) \
+		WIZCHIP_WRITE_16(Sn_RX_RD(sn), rxrd)
 
 /**
  * @ingroup Socket_register_access_function
@@ -2015,7 +2030,7 @@ uint16_t getSn_RX_RSR(uint8_t sn);
 		((WIZCHIP_READ(Sn_RX_RD(sn)) << 8) + WIZCHIP_READ(WIZCHIP_OFFSET_INC(Sn_RX_RD(sn),1)))
 */		
 #define getSn_RX_RD(sn) \
-		(((uint16_t)WIZCHIP_READ(Sn_RX_RD(sn)) << 8) + WIZCHIP_READ(WIZCHIP_OFFSET_INC(Sn_RX_RD(sn),1)))		
+		WIZCHIP_READ_16(Sn_RX_RD(sn))
 
 /**
  * @ingroup Socket_register_access_function
@@ -2029,7 +2044,7 @@ uint16_t getSn_RX_RSR(uint8_t sn);
 		((WIZCHIP_READ(Sn_RX_WR(sn)) << 8) + WIZCHIP_READ(WIZCHIP_OFFSET_INC(Sn_RX_WR(sn),1)))
 */		
 #define getSn_RX_WR(sn) \
-		(((uint16_t)WIZCHIP_READ(Sn_RX_WR(sn)) << 8) + WIZCHIP_READ(WIZCHIP_OFFSET_INC(Sn_RX_WR(sn),1)))		
+		WIZCHIP_READ_16(Sn_RX_WR(sn))
 
 /**
  * @ingroup Socket_register_access_function
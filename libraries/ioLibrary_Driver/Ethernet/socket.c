@@ -70,6 +70,13 @@ static uint16_t sock_remained_size[_WIZCHIP_SOCK_NUM_] = {0,0,};
 uint8_t  sock_pack_info[_WIZCHIP_SOCK_NUM_] = {0,};
 //
 
+// sock_io_mode and sock_is_sending keep one bit per socket. When sockets are driven from both cores of a
+// dual-core MCU, a plain read-modify-write loses the other core's bit, so update them inside the
+// WIZCHIP critical section (register it with reg_wizchip_cris_cbfunc() as a cross-core lock).
+// Per-socket entries such as sock_remained_size[sn] only belong to the core that owns the socket.
+#define SOCK_BIT_SET(bits, sn)	do { WIZCHIP_CRITICAL_ENTER(); (bits) |= (1 << (sn)); WIZCHIP_CRITICAL_EXIT(); } while(0)
+#define SOCK_BIT_CLR(bits, sn)	do { WIZCHIP_CRITICAL_ENTER(); (bits) &= ~(1 << (sn)); WIZCHIP_CRITICAL_EXIT(); } while(0)
+
 #if _WIZCHIP_ == 5200
    static uint16_t sock_next_rd[_WIZCHIP_SOCK_NUM_] ={0,};
 #endif
@@ -175,17 +182,19 @@ int8_t socket(uint8_t sn, uint8_t protocol, uint16_t port, uint8_t flag)
     #endif
 	if(!port)
 	{
+	   WIZCHIP_CRITICAL_ENTER();
 	   port = sock_any_port++;
 	   if(sock_any_port == 0xFFF0) sock_any_port = SOCK_ANY_PORT_NUM;
+	   WIZCHIP_CRITICAL_EXIT();
 	}
    setSn_PORT(sn,port);	
    setSn_CR(sn,Sn_CR_OPEN);
    while(getSn_CR(sn));
    //A20150401 : For release the previous sock_io_mode
-   sock_io_mode &= ~(1 <<sn);
+   SOCK_BIT_CLR(sock_io_mode, sn);
    //
-	sock_io_mode |= ((flag & SF_IO_NONBLOCK) << sn);   
-   sock_is_sending &= ~(1<<sn);
+	if(flag & SF_IO_NONBLOCK) SOCK_BIT_SET(sock_io_mode, sn);
+   SOCK_BIT_CLR(sock_is_sending, sn);
    sock_remained_size[sn] = 0;
    //M20150601 : repalce 0 with PACK_COMPLETED
    //sock_pack_info[sn] = 0;
@@ -229,9 +238,9 @@ int8_t close(uint8_t sn)
 	/* clear all interrupt of the socket. */
 	setSn_IR(sn, 0xFF);
 	//A20150401 : Release the sock_io_mode of socket n.
-	sock_io_mode &= ~(1<<sn);
+	SOCK_BIT_CLR(sock_io_mode, sn);
 	//
-	sock_is_sending &= ~(1<<sn);
+	SOCK_BIT_CLR(sock_is_sending, sn);
 	sock_remained_size[sn] = 0;
 	sock_pack_info[sn] = 0;
 	while(getSn_SR(sn) != SOCK_CLOSED);
@@ -301,7 +310,7 @@ int8_t disconnect(uint8_t sn)
 	setSn_CR(sn,Sn_CR_DISCON);
 	/* wait to process the command... */
 	while(getSn_CR(sn));
-	sock_is_sending &= ~(1<<sn);
+	SOCK_BIT_CLR(sock_is_sending, sn);
    if(sock_io_mode & (1<<sn)) return SOCK_BUSY;
 	while(getSn_SR(sn) != SOCK_CLOSED)
 	{
@@ -340,7 +349,7 @@ int32_t send(uint8_t sn, uint8_t * buf, uint16_t len)
                return SOCK_BUSY;
             }
          #endif
-         sock_is_sending &= ~(1<<sn);         
+         SOCK_BIT_CLR(sock_is_sending, sn);
       }
       else if(tmp & Sn_IR_TIMEOUT)
       {
@@ -375,7 +384,7 @@ int32_t send(uint8_t sn, uint8_t * buf, uint16_t len)
    setSn_CR(sn,Sn_CR_SEND);
    /* wait to process the command... */
    while(getSn_CR(sn));
-   sock_is_sending |= (1 << sn);
+   SOCK_BIT_SET(sock_is_sending, sn);
    //M20150409 : Explicit Type Casting
    //return len;
    return (int32_t)len;
@@ -781,8 +790,8 @@ int8_t  ctlsocket(uint8_t sn, ctlsock_type cstype, void* arg)
    {
       case CS_SET_IOMODE:
          tmp = *((uint8_t*)arg);
-         if(tmp == SOCK_IO_NONBLOCK)  sock_io_mode |= (1<<sn);
-         else if(tmp == SOCK_IO_BLOCK) sock_io_mode &= ~(1<<sn);
+         if(tmp == SOCK_IO_NONBLOCK)  SOCK_BIT_SET(sock_io_mode, sn);
+         else if(tmp == SOCK_IO_BLOCK) SOCK_BIT_CLR(sock_io_mode, sn);
          else return SOCKERR_ARG;
          break;
       case CS_GET_IOMODE:   
@@ -6,6 +6,8 @@
 //! \version 1.1.1
 //! \date 2019/10/08
 //! \par  Revision history
+//!       <2024/07/01> INIT-REBOOT with a stored lease (DHCP_init_reboot())
+//!       <2024/07/01> non-blocking: the leased IP check is polled, the time source can be a clock (reg_dhcp_clock())
 //!       <2019/10/08> compare DHCP server ip address
 //!       <2013/11/18> 1st Release
 //!       <2012/12/20> V1.1.0
@@ -50,6 +52,8 @@
 //
 //*****************************************************************************
 
+#include <string.h>
+
 #include "socket.h"
 #include "dhcp.h"
 
@@ -67,6 +71,8 @@
 #define STATE_DHCP_REREQUEST     4        ///< send REQUEST for maintaining leased IP
 #define STATE_DHCP_RELEASE       5        ///< No use
 #define STATE_DHCP_STOP          6        ///< Stop processing DHCP
+#define STATE_DHCP_ARP_CHECK     7        ///< Received ACK, probing the leased IP with ARP
+#define STATE_DHCP_REBOOT        8        ///< INIT-REBOOT; send REQUEST for the stored IP and wait ACK or NACK
 
 #define DHCP_FLAGSBROADCAST      0x8000   ///< The broadcast value of flags in @ref RIP_MSG 
 #define DHCP_FLAGSUNICAST        0x0000   ///< The unicast   value of flags in @ref RIP_MSG
@@ -210,7 +216,16 @@ uint32_t dhcp_lease_time   			= INFINITE_LEASETIME;
 volatile uint32_t dhcp_tick_1s      = 0;                 // unit 1 second
 uint32_t dhcp_tick_next    			= DHCP_WAIT_TIME ;
 
+uint32_t (*dhcp_clock)(void)        = 0;                 // seconds clock; replaces DHCP_time_handler() when registered
+uint32_t dhcp_tick_base             = 0;                 // dhcp_clock() at the last timeout reset
+
+#if _WIZCHIP_ < 5500
+uint8_t  dhcp_arp_subr[4];                              // SUBR saved during the ARP probe (WIZCHIP Errata #4, #5)
+uint8_t  dhcp_arp_subr_saved        = 0;
+#endif
+
 uint32_t DHCP_XID;      // Any number
+uint8_t  dhcp_reboot_pending        = 0;                 // INIT-REBOOT REQUEST not sent yet
 
 RIP_MSG* pDHCPMSG;      // Buffer pointer for DHCP processing
 
@@ -241,9 +256,13 @@ void     send_DHCP_REQUEST(void);
 /* send DECLINE message to DHCP server */
 void     send_DHCP_DECLINE(void);
 
-/* IP conflict check by sending ARP-request to leased IP and wait ARP-response. */
+/* IP conflict check by sending ARP-request to leased IP; the ARP-response is polled by check_DHCP_leasedIP(). */
+void     start_DHCP_leasedIP_check(void);
 int8_t   check_DHCP_leasedIP(void);
 
+/* Seconds since the last timeout reset */
+uint32_t dhcp_tick(void);
+
 /* check the timeout in DHCP process */
 uint8_t  check_DHCP_timeout(void);
 
@@ -479,12 +498,16 @@ void send_DHCP_REQUEST(void)
 		pDHCPMSG->OPT[k++] = DHCP_allocated_ip[2];
 		pDHCPMSG->OPT[k++] = DHCP_allocated_ip[3];
 	
-		pDHCPMSG->OPT[k++] = dhcpServerIdentifier;
-		pDHCPMSG->OPT[k++] = 0x04;
-		pDHCPMSG->OPT[k++] = DHCP_SIP[0];
-		pDHCPMSG->OPT[k++] = DHCP_SIP[1];
-		pDHCPMSG->OPT[k++] = DHCP_SIP[2];
-		pDHCPMSG->OPT[k++] = DHCP_SIP[3];
+		// INIT-REBOOT has no server identifier (RFC 2131 4.3.2)
+		if(dhcp_state != STATE_DHCP_REBOOT)
+		{
+			pDHCPMSG->OPT[k++] = dhcpServerIdentifier;
+			pDHCPMSG->OPT[k++] = 0x04;
+			pDHCPMSG->OPT[k++] = DHCP_SIP[0];
+			pDHCPMSG->OPT[k++] = DHCP_SIP[1];
+			pDHCPMSG->OPT[k++] = DHCP_SIP[2];
+			pDHCPMSG->OPT[k++] = DHCP_SIP[3];
+		}
 	}
 
 	// host name
@@ -716,6 +739,11 @@ uint8_t DHCP_run(void)
 	ret = DHCP_RUNNING;
 	type = parseDHCPMSG();
 
+	if (dhcp_reboot_pending) {
+		dhcp_reboot_pending = 0;
+		send_DHCP_REQUEST();
+	}
+
 	switch ( dhcp_state ) {
 	   case STATE_DHCP_INIT     :
          DHCP_allocated_ip[0] = 0;
@@ -746,18 +774,10 @@ uint8_t DHCP_run(void)
 #ifdef _DHCP_DEBUG_
 				printf("> Receive DHCP_ACK\r\n");
 #endif
-				if (check_DHCP_leasedIP()) {
-					// Network info assignment from DHCP
-					dhcp_ip_assign();
-					reset_DHCP_timeout();
-
-					dhcp_state = STATE_DHCP_LEASED;
-				} else {
-					// IP address conflict occurred
-					reset_DHCP_timeout();
-					dhcp_ip_conflict();
-				    dhcp_state = STATE_DHCP_INIT;
-				}
+				// The ARP probe completes in the following DHCP_run() calls
+				start_DHCP_leasedIP_check();
+				reset_DHCP_timeout();
+				dhcp_state = STATE_DHCP_ARP_CHECK;
 			} else if (type == DHCP_NAK) {
 
 #ifdef _DHCP_DEBUG_
@@ -770,9 +790,54 @@ uint8_t DHCP_run(void)
 			} else ret = check_DHCP_timeout();
 		break;
 
+		case STATE_DHCP_REBOOT :
+			if (type == DHCP_ACK) {
+#ifdef _DHCP_DEBUG_
+				printf("> Receive DHCP_ACK for the stored lease\r\n");
+#endif
+				// The stored IP is in use since boot; no ARP check
+				dhcp_ip_assign();
+				reset_DHCP_timeout();
+				dhcp_state = STATE_DHCP_LEASED;
+				ret = DHCP_IP_ASSIGN;
+			} else if (type == DHCP_NAK) {
+#ifdef _DHCP_DEBUG_
+				printf("> Receive DHCP_NACK, the stored lease is not valid\r\n");
+#endif
+				reset_DHCP_timeout();
+				send_DHCP_DISCOVER();
+				dhcp_state = STATE_DHCP_DISCOVER;
+			} else ret = check_DHCP_timeout();
+			break;
+
+		case STATE_DHCP_ARP_CHECK :
+			switch (check_DHCP_leasedIP()) {
+				case 1 :
+					// Network info assignment from DHCP
+					dhcp_ip_assign();
+					reset_DHCP_timeout();
+					dhcp_state = STATE_DHCP_LEASED;
+					ret = DHCP_IP_ASSIGN;
+					break;
+				case 0 :
+					// IP address conflict occurred
+					reset_DHCP_timeout();
+					dhcp_ip_conflict();
+					dhcp_state = STATE_DHCP_INIT;
+					break;
+				default :
+					// No SENDOK nor TIMEOUT; give up the lease
+					if (dhcp_tick() > DHCP_WAIT_TIME) {
+						reset_DHCP_timeout();
+						dhcp_state = STATE_DHCP_INIT;
+					}
+					break;
+			}
+			break;
+
 		case STATE_DHCP_LEASED :
 		   ret = DHCP_IP_LEASED;
-			if ((dhcp_lease_time != INFINITE_LEASETIME) && ((dhcp_lease_time/2) < dhcp_tick_1s)) {
+			if ((dhcp_lease_time != INFINITE_LEASETIME) && ((dhcp_lease_time/2) < dhcp_tick())) {
 				
 #ifdef _DHCP_DEBUG_
  				printf("> Maintains the IP address \r\n");
@@ -844,7 +909,7 @@ uint8_t check_DHCP_timeout(void)
 	uint8_t ret = DHCP_RUNNING;
 	
 	if (dhcp_retry_count < MAX_DHCP_RETRY) {
-		if (dhcp_tick_next < dhcp_tick_1s) {
+		if (dhcp_tick_next < dhcp_tick()) {
 
 			switch ( dhcp_state ) {
 				case STATE_DHCP_DISCOVER :
@@ -863,13 +928,18 @@ uint8_t check_DHCP_timeout(void)
 					
 					send_DHCP_REQUEST();
 				break;
+
+				case STATE_DHCP_REBOOT :
+					send_DHCP_REQUEST();
+				break;
 		
 				default :
 				break;
 			}
 
 			dhcp_tick_1s = 0;
-			dhcp_tick_next = dhcp_tick_1s + DHCP_WAIT_TIME;
+			if (dhcp_clock) dhcp_tick_base = dhcp_clock();
+			dhcp_tick_next = DHCP_WAIT_TIME;
 			dhcp_retry_count++;
 		}
 	} else { // timeout occurred
@@ -884,6 +954,11 @@ uint8_t check_DHCP_timeout(void)
 				send_DHCP_DISCOVER();
 				dhcp_state = STATE_DHCP_DISCOVER;
 				break;
+			case STATE_DHCP_REBOOT:
+				// No server answered; keep the stored IP and REQUEST again on the next DHCP_run(), DISCOVER only on NAK
+				dhcp_reboot_pending = 1;
+				ret = DHCP_FAILED;
+				break;
 			default :
 				break;
 		}
@@ -892,40 +967,66 @@ uint8_t check_DHCP_timeout(void)
 	return ret;
 }
 
-int8_t check_DHCP_leasedIP(void)
+void start_DHCP_leasedIP_check(void)
 {
-	uint8_t tmp;
-	int32_t ret;
-
-	//WIZchip RCR value changed for ARP Timeout count control
-	tmp = getRCR();
-	setRCR(0x03);
+#if _WIZCHIP_ < 5500
+	uint8_t zeroip[4] = {0, 0, 0, 0};
+	uint8_t sip[4];
+#endif
 
 	// IP conflict detection : ARP request - ARP reply
-	// Broadcasting ARP Request for check the IP conflict using UDP sendto() function
-	ret = sendto(DHCP_SOCKET, (uint8_t *)"CHECK_IP_CONFLICT", 17, DHCP_allocated_ip, 5000);
+	// The UDP packet is only sent when the leased IP answers the ARP request
+	setSn_DIPR(DHCP_SOCKET, DHCP_allocated_ip);
+	setSn_DPORT(DHCP_SOCKET, 5000);
+	wiz_send_data(DHCP_SOCKET, (uint8_t *)"CHECK_IP_CONFLICT", 17);
+
+#if _WIZCHIP_ < 5500   // for WIZCHIP Errata #4, #5 (ARP errata), as sendto()
+	getSIPR(sip);
+	if ((sip[0] | sip[1] | sip[2] | sip[3]) == 0) {
+		getSUBR(dhcp_arp_subr);
+		setSUBR(zeroip);
+		dhcp_arp_subr_saved = 1;
+	}
+#endif
 
-	// RCR value restore
-	setRCR(tmp);
+	setSn_CR(DHCP_SOCKET, Sn_CR_SEND);
+	/* wait to process the command... */
+	while(getSn_CR(DHCP_SOCKET));
+}
 
-	if(ret == SOCKERR_TIMEOUT) {
-		// UDP send Timeout occurred : allocated IP address is unique, DHCP Success
+/* 1: the leased IP is unique, 0: conflict (DECLINE sent), -1: ARP still in progress */
+int8_t check_DHCP_leasedIP(void)
+{
+	uint8_t ir;
+	int8_t ret;
+
+	ir = getSn_IR(DHCP_SOCKET);
+	if (ir & Sn_IR_TIMEOUT) {
+		// ARP Timeout occurred : allocated IP address is unique, DHCP Success
+		setSn_IR(DHCP_SOCKET, Sn_IR_TIMEOUT);
+		ret = 1;
+	} else if (ir & Sn_IR_SENDOK) {
+		// Received ARP reply : IP address conflict occur, DHCP Failed
+		setSn_IR(DHCP_SOCKET, Sn_IR_SENDOK);
+		ret = 0;
+	} else {
+		return -1;
+	}
 
-#ifdef _DHCP_DEBUG_
-		printf("\r\n> Check leased IP - OK\r\n");
+#if _WIZCHIP_ < 5500
+	if (dhcp_arp_subr_saved) {
+		setSUBR(dhcp_arp_subr);
+		dhcp_arp_subr_saved = 0;
+	}
 #endif
 
-		return 1;
-	} else {
-		// Received ARP reply or etc : IP address conflict occur, DHCP Failed
-		send_DHCP_DECLINE();
-
-		ret = dhcp_tick_1s;
-		while((dhcp_tick_1s - ret) < 2) ;   // wait for 1s over; wait to complete to send DECLINE message;
+#ifdef _DHCP_DEBUG_
+	printf("\r\n> Check leased IP - %s\r\n", ret ? "OK" : "Conflict");
+#endif
 
-		return 0;
-	}
-}	
+	if (ret == 0) send_DHCP_DECLINE();
+	return ret;
+}
 
 void DHCP_init(uint8_t s, uint8_t * buf)
 {
@@ -958,13 +1059,26 @@ void DHCP_init(uint8_t s, uint8_t * buf)
 
 	reset_DHCP_timeout();
 	dhcp_state = STATE_DHCP_INIT;
+	dhcp_reboot_pending = 0;
 }
 
+void DHCP_init_reboot(uint8_t s, uint8_t * buf, uint8_t * ip)
+{
+	DHCP_init(s, buf);
+
+	memcpy(DHCP_allocated_ip, ip, 4);
+	// Any server may answer INIT-REBOOT; parseDHCPMSG() takes its identifier from the ACK
+	memset(DHCP_SIP, 0, 4);
+	memset(DHCP_REAL_SIP, 0, 4);
+	dhcp_state = STATE_DHCP_REBOOT;
+	dhcp_reboot_pending = 1;
+}
 
 /* Reset the DHCP timeout count and retry count. */
 void reset_DHCP_timeout(void)
 {
 	dhcp_tick_1s = 0;
+	if (dhcp_clock) dhcp_tick_base = dhcp_clock();
 	dhcp_tick_next = DHCP_WAIT_TIME;
 	dhcp_retry_count = 0;
 }
@@ -974,6 +1088,52 @@ void DHCP_time_handler(void)
 	dhcp_tick_1s++;
 }
 
+void reg_dhcp_clock(uint32_t (*clock_1s)(void))
+{
+	dhcp_clock = clock_1s;
+	if (dhcp_clock) dhcp_tick_base = dhcp_clock() - dhcp_tick_1s;
+}
+
+uint32_t dhcp_tick(void)
+{
+	if (dhcp_clock) return dhcp_clock() - dhcp_tick_base;
+	return dhcp_tick_1s;
+}
+
+uint32_t DHCP_time_to_next(void)
+{
+	uint32_t now = dhcp_tick();
+
+	switch (dhcp_state) {
+		case STATE_DHCP_LEASED :
+			if (dhcp_lease_time == INFINITE_LEASETIME) return INFINITE_LEASETIME;
+			return ((dhcp_lease_time/2) < now) ? 0 : (dhcp_lease_time/2) - now + 1;
+		case STATE_DHCP_DISCOVER :
+		case STATE_DHCP_REQUEST :
+		case STATE_DHCP_REREQUEST :
+		case STATE_DHCP_REBOOT :
+			return (dhcp_tick_next < now) ? 0 : dhcp_tick_next - now + 1;
+		case STATE_DHCP_STOP :
+			return INFINITE_LEASETIME;
+		default :
+			return 0;
+	}
+}
+
+uint8_t DHCP_in_progress(void)
+{
+	switch (dhcp_state) {
+		case STATE_DHCP_DISCOVER :
+		case STATE_DHCP_REQUEST :
+		case STATE_DHCP_REREQUEST :
+		case STATE_DHCP_ARP_CHECK :
+		case STATE_DHCP_REBOOT :
+			return 1;
+		default :
+			return 0;
+	}
+}
+
 void getIPfromDHCP(uint8_t* ip)
 {
 	ip[0] = DHCP_allocated_ip[0];
@@ -998,6 +1158,14 @@ void getSNfromDHCP(uint8_t* ip)
    ip[3] = DHCP_allocated_sn[3];         
 }
 
+void getServerIPfromDHCP(uint8_t* ip)
+{
+	ip[0] = DHCP_SIP[0];
+	ip[1] = DHCP_SIP[1];
+	ip[2] = DHCP_SIP[2];
+	ip[3] = DHCP_SIP[3];
+}
+
 void getDNSfromDHCP(uint8_t* ip)
 {
    ip[0] = DHCP_allocated_dns[0];
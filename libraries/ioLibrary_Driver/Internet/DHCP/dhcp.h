@@ -89,15 +89,46 @@ enum
  * @brief DHCP client initialization (outside of the main loop)
  * @param s   - socket number
  * @param buf - buffer for processing DHCP message
+ * @note  SIPR and GAR are cleared; to keep serving while DHCP runs, set them again afterwards
+ *        (DISCOVER and REQUEST are broadcast, so the source address does not matter)
  */
 void DHCP_init(uint8_t s, uint8_t * buf);
 
+/*
+ * @brief DHCP client initialization with a stored lease; starts with REQUEST (INIT-REBOOT) instead of DISCOVER
+ * @param s   - socket number
+ * @param buf - buffer for processing DHCP message
+ * @param ip  - IP address of the stored lease
+ * @note  DISCOVER is sent only when the server answers NAK; without an answer the REQUEST is repeated
+ *        and DHCP_run() returns @ref DHCP_FAILED after each @ref MAX_DHCP_RETRY
+ */
+void DHCP_init_reboot(uint8_t s, uint8_t * buf, uint8_t * ip);
+
 /*
  * @brief DHCP 1s Tick Timer handler
  * @note SHOULD BE register to your system 1s Tick timer handler 
  */
 void DHCP_time_handler(void);
 
+/*
+ * @brief Register a clock counting seconds, used instead of DHCP_time_handler() ticks
+ * @param clock_1s - returns a free running seconds count (e.g. from a hardware timer)
+ */
+void reg_dhcp_clock(uint32_t (*clock_1s)(void));
+
+/*
+ * @brief Seconds until DHCP_run() has work to do when no DHCP message arrives
+ * @return 0 when DHCP_run() should be called now, 0xFFFFFFFF when never (infinite lease or stopped)
+ * @note While @ref DHCP_in_progress, replies arrive at any time; poll DHCP_run() until it ends
+ */
+uint32_t DHCP_time_to_next(void);
+
+/*
+ * @brief Check whether a reply or the leased IP check is outstanding
+ * @return 1 while DISCOVER, REQUEST or the ARP check of the leased IP is in progress
+ */
+uint8_t DHCP_in_progress(void);
+
 /* 
  * @brief Register call back function 
  * @param ip_assign   - callback func when IP is assigned from DHCP server first
@@ -142,6 +173,11 @@ void getGWfromDHCP(uint8_t* ip);
  * @param ip  - Subnet mask to be returned
  */
 void getSNfromDHCP(uint8_t* ip);
+/*
+ * @brief Get DHCP server address (server identifier)
+ * @param ip  - DHCP server address to be returned
+ */
+void getServerIPfromDHCP(uint8_t* ip);
 /*
  * @brief Get DNS address
  * @param ip  - DNS address to be returned
@@ -101,6 +101,11 @@ uint8_t connect_state_data = 0;
 
 struct ftpd ftp;
 
+#if !defined(F_FILESYSTEM)
+static ftpd_file files[MAX_FTPD_FILE];
+static uint8_t total_file_cnt = 0;
+#endif
+
 int current_year = 2014;
 int current_month = 12;
 int current_day = 31;
@@ -129,64 +134,116 @@ int fsprintf(uint8_t s, const char *format, ...)
 	return i;
 }
 
-void ftpd_init(uint8_t * src_ip)
+void ftpd_init(uint8_t ctrl_sn, uint8_t data_sn)
 {
+	ftp.control = ctrl_sn;
+	ftp.data = data_sn;
 	ftp.state = FTPS_NOT_LOGIN;
 	ftp.current_cmd = NO_CMD;
 	ftp.dsock_mode = ACTIVE_MODE;
 
-	local_ip.cVal[0] = src_ip[0];
-	local_ip.cVal[1] = src_ip[1];
-	local_ip.cVal[2] = src_ip[2];
-	local_ip.cVal[3] = src_ip[3];
 	local_port = 35000;
 	
 	strcpy(ftp.workingdir, "/");
 
-	socket(CTRL_SOCK, Sn_MR_TCP, IPPORT_FTP, 0x0);
+	socket(ftp.control, Sn_MR_TCP, IPPORT_FTP, 0x0);
+}
+
+#if !defined(F_FILESYSTEM)
+void reg_ftpd_file(const char * name, ftpd_file_size size, ftpd_file_read read)
+{
+	if(name == NULL || size == NULL || read == NULL) return;
+	if(total_file_cnt >= MAX_FTPD_FILE) return;
+	if(strlen(name) >= LINELEN) return;
+
+	strcpy(files[total_file_cnt].name, name);
+	files[total_file_cnt].size = size;
+	files[total_file_cnt].read = read;
+	total_file_cnt++;
+}
+
+/* Every registered file is in "/", path is "/name" or "name" */
+static int find_file(const char * path)
+{
+	uint8_t i;
+
+	if(path[0] == '/') path++;
+	for(i = 0; i < total_file_cnt; i++)
+	{
+		if(!strcmp(files[i].name, path)) return i;
+	}
+	return -1;
+}
+
+/* Send the next chunk of the RETR file, as much as the data socket TX memory takes. 1: all sent, 0: in progress, < 0: error */
+static int32_t send_file_chunk(void)
+{
+	const uint8_t * data;
+	uint32_t len;
+	int32_t ret;
+
+	if(ftp.offset >= ftp.size)
+	{
+		// wait until the peer has acknowledged everything before disconnecting
+		return (getSn_TX_FSR(ftp.data) == getSn_TxMAX(ftp.data)) ? 1 : 0;
+	}
+
+	len = getSn_TX_FSR(ftp.data);
+	if(len == 0) return 0;
+	if(len > ftp.size - ftp.offset) len = ftp.size - ftp.offset;
+
+	ret = files[ftp.file].read(ftp.offset, &data, len);
+	if(ret <= 0) return ret;
+
+	ret = send(ftp.data, (uint8_t *)data, (uint16_t)ret);
+	if(ret == SOCK_BUSY) return 0;
+	if(ret < 0) return ret;
+	ftp.offset += ret;
+	return 0;
 }
+#endif
 
 uint8_t ftpd_run(uint8_t * dbuf)
 {
 	uint16_t size = 0, i;
 	long ret = 0;
+#if defined(F_FILESYSTEM)
 	uint32_t blocklen, send_byte, recv_byte;
 	uint32_t remain_filesize;
 	uint32_t remain_datasize;
-#if defined(F_FILESYSTEM)
 	//FILINFO fno;
 #endif
 
 	//memset(dbuf, 0, sizeof(_MAX_SS));
 	
-    switch(getSn_SR(CTRL_SOCK))
+    switch(getSn_SR(ftp.control))
     {
     	case SOCK_ESTABLISHED :
     		if(!connect_state_control)
     		{
 #if defined(_FTP_DEBUG_)
-    			printf("%d:FTP Connected\r\n", CTRL_SOCK);
+    			printf("%d:FTP Connected\r\n", ftp.control);
 #endif
-    			//fsprintf(CTRL_SOCK, banner, HOSTNAME, VERSION);
+    			//fsprintf(ftp.control, banner, HOSTNAME, VERSION);
     			strcpy(ftp.workingdir, "/");
     			sprintf((char *)dbuf, "220 %s FTP version %s ready.\r\n", HOSTNAME, VERSION);
-    			ret = send(CTRL_SOCK, (uint8_t *)dbuf, strlen((const char *)dbuf));
+    			ret = send(ftp.control, (uint8_t *)dbuf, strlen((const char *)dbuf));
     			if(ret < 0)
     			{
 #if defined(_FTP_DEBUG_)
-    				printf("%d:send() error:%ld\r\n",CTRL_SOCK,ret);
+    				printf("%d:send() error:%ld\r\n",ftp.control,ret);
 #endif
-    				close(CTRL_SOCK);
+    				close(ftp.control);
     				return ret;
     			}
     			connect_state_control = 1;
     		}
 	
 #if defined(_FTP_DEBUG_)
-    		//printf("ftp socket %d\r\n", CTRL_SOCK);
+    		//printf("ftp socket %d\r\n", ftp.control);
 #endif
 			 
-    		if((size = getSn_RX_RSR(CTRL_SOCK)) > 0) // Don't need to check SOCKERR_BUSY because it doesn't not occur.
+    		if((size = getSn_RX_RSR(ftp.control)) > 0) // Don't need to check SOCKERR_BUSY because it doesn't not occur.
     		{
 #if defined(_FTP_DEBUG_)
     			printf("size: %d\r\n", size);
@@ -196,7 +253,7 @@ uint8_t ftpd_run(uint8_t * dbuf)
 
     			if(size > _MAX_SS) size = _MAX_SS - 1;
 
-    			ret = recv(CTRL_SOCK,dbuf,size);
+    			ret = recv(ftp.control,dbuf,size);
     			dbuf[ret] = '\0';
     			if(ret != size)
     			{
@@ -204,9 +261,9 @@ uint8_t ftpd_run(uint8_t * dbuf)
     				if(ret < 0)
     				{
 #if defined(_FTP_DEBUG_)
-    					printf("%d:recv() error:%ld\r\n",CTRL_SOCK,ret);
+    					printf("%d:recv() error:%ld\r\n",ftp.control,ret);
 #endif
-    					close(CTRL_SOCK);
+    					close(ftp.control);
     					return ret;
     				}
     			}
@@ -219,44 +276,44 @@ uint8_t ftpd_run(uint8_t * dbuf)
 
     	case SOCK_CLOSE_WAIT :
 #if defined(_FTP_DEBUG_)
-    		printf("%d:CloseWait\r\n",CTRL_SOCK);
+    		printf("%d:CloseWait\r\n",ftp.control);
 #endif
-    		if((ret=disconnect(CTRL_SOCK)) != SOCK_OK) return ret;
+    		if((ret=disconnect(ftp.control)) != SOCK_OK) return ret;
 #if defined(_FTP_DEBUG_)
-    		printf("%d:Closed\r\n",CTRL_SOCK);
+    		printf("%d:Closed\r\n",ftp.control);
 #endif
     		break;
 
     	case SOCK_CLOSED :
 #if defined(_FTP_DEBUG_)
-    		printf("%d:FTPStart\r\n",CTRL_SOCK);
+    		printf("%d:FTPStart\r\n",ftp.control);
 #endif
-    		if((ret=socket(CTRL_SOCK, Sn_MR_TCP, IPPORT_FTP, 0x0)) != CTRL_SOCK)
+    		if((ret=socket(ftp.control, Sn_MR_TCP, IPPORT_FTP, 0x0)) != ftp.control)
     		{
 #if defined(_FTP_DEBUG_)
-    			printf("%d:socket() error:%ld\r\n", CTRL_SOCK, ret);
+    			printf("%d:socket() error:%ld\r\n", ftp.control, ret);
 #endif
-    			close(CTRL_SOCK);
+    			close(ftp.control);
     			return ret;
     		}
     		break;
 
     	case SOCK_INIT :
 #if defined(_FTP_DEBUG_)
-    		printf("%d:Opened\r\n",CTRL_SOCK);
+    		printf("%d:Opened\r\n",ftp.control);
 #endif
     		//strcpy(ftp.workingdir, "/");
-    		if( (ret = listen(CTRL_SOCK)) != SOCK_OK)
+    		if( (ret = listen(ftp.control)) != SOCK_OK)
     		{
 #if defined(_FTP_DEBUG_)
-    			printf("%d:Listen error\r\n",CTRL_SOCK);
+    			printf("%d:Listen error\r\n",ftp.control);
 #endif
     			return ret;
     		}
 			connect_state_control = 0;
 
 #if defined(_FTP_DEBUG_)
-			printf("%d:Listen ok\r\n",CTRL_SOCK);
+			printf("%d:Listen ok\r\n",ftp.control);
 #endif
 			break;
 
@@ -265,13 +322,13 @@ uint8_t ftpd_run(uint8_t * dbuf)
     }
 
 #if 1
-    switch(getSn_SR(DATA_SOCK))
+    switch(getSn_SR(ftp.data))
     {
     	case SOCK_ESTABLISHED :
     		if(!connect_state_data)
     		{
 #if defined(_FTP_DEBUG_)
-    			printf("%d:FTP Data socket Connected\r\n", DATA_SOCK);
+    			printf("%d:FTP Data socket Connected\r\n", ftp.data);
 #endif
     			connect_state_data = 1;
     		}
@@ -291,15 +348,22 @@ uint8_t ftpd_run(uint8_t * dbuf)
     				printf("%s\r\n", dbuf);
 #endif
 #if !defined(F_FILESYSTEM)
-    				if (strncmp(ftp.workingdir, "/$Recycle.Bin", sizeof("/$Recycle.Bin")) != 0)
-    					size = sprintf(dbuf, "drwxr-xr-x 1 ftp ftp 0 Dec 31 2014 $Recycle.Bin\r\n-rwxr-xr-x 1 ftp ftp 512 Dec 31 2014 test.txt\r\n");
+    				size = 0;
+    				for (i = 0; i < total_file_cnt && size + LINELEN + 64 < _MAX_SS; i++)
+    				{
+    					if (ftp.current_cmd == MLSD_CMD)
+    						size += sprintf((char *)dbuf + size, "type=file;size=%lu; %s\r\n", (unsigned long)files[i].size(), files[i].name);
+    					else
+    						size += sprintf((char *)dbuf + size, "-r--r--r-- 1 ftp ftp %lu Jan 1 2024 %s\r\n", (unsigned long)files[i].size(), files[i].name);
+    				}
+    				dbuf[size] = 0;
 #endif
     				size = strlen(dbuf);
-    				send(DATA_SOCK, dbuf, size);
+    				send(ftp.data, dbuf, size);
     				ftp.current_cmd = NO_CMD;
-    				disconnect(DATA_SOCK);
+    				disconnect(ftp.data);
     				size = sprintf(dbuf, "226 Successfully transferred \"%s\"\r\n", ftp.workingdir);
-    				send(CTRL_SOCK, dbuf, size);
+    				send(ftp.control, dbuf, size);
     				break;
 
     			case RETR_CMD:
@@ -333,7 +397,7 @@ uint8_t ftpd_run(uint8_t * dbuf)
     						//printf("----->fsize:%d recv:%d len:%d \r\n", remain_filesize, send_byte, blocklen);
     						//printf("----->fn:%s data:%s \r\n", ftp.filename, dbuf);
 #endif
-    						send(DATA_SOCK, dbuf, blocklen);
+    						send(ftp.data, dbuf, blocklen);
     						remain_filesize -= blocklen;
     					}while(remain_filesize != 0);
 #if defined(_FTP_DEBUG_)
@@ -345,25 +409,22 @@ uint8_t ftpd_run(uint8_t * dbuf)
     					printf("File Open Error: %d\r\n", ftp.fr);
 #endif
     				}
-#else
-					remain_filesize = strlen(ftp.filename);
-
-					do{
-						memset(dbuf, 0, _MAX_SS);
-
-						blocklen = sprintf(dbuf, "%s", ftp.filename);
-
-						printf("########## dbuf:%s\r\n", dbuf);
-
-						send(DATA_SOCK, dbuf, blocklen);
-						remain_filesize -= blocklen;
-					}while(remain_filesize != 0);
-
-#endif
     				ftp.current_cmd = NO_CMD;
-    				disconnect(DATA_SOCK);
+    				disconnect(ftp.data);
     				size = sprintf(dbuf, "226 Successfully transferred \"%s\"\r\n", ftp.filename);
-    				send(CTRL_SOCK, dbuf, size);
+    				send(ftp.control, dbuf, size);
+#else
+    				// one chunk per call, the main loop keeps running during the transfer
+    				ret = send_file_chunk();
+    				if(ret == 0) break;
+    				ftp.current_cmd = NO_CMD;
+    				disconnect(ftp.data);
+    				if(ret > 0)
+    					size = sprintf((char *)dbuf, "226 Successfully transferred \"%s\"\r\n", ftp.filename);
+    				else
+    					size = sprintf((char *)dbuf, "451 Read error \"%s\"\r\n", ftp.filename);
+    				send(ftp.control, dbuf, size);
+#endif
     				break;
 
     			case STOR_CMD:
@@ -378,7 +439,7 @@ uint8_t ftpd_run(uint8_t * dbuf)
     					printf("f_open return FR_OK\r\n");
 #endif
     					while(1){
-    						if((remain_datasize = getSn_RX_RSR(DATA_SOCK)) > 0){
+    						if((remain_datasize = getSn_RX_RSR(ftp.data)) > 0){
     							while(1){
     								memset(dbuf, 0, _MAX_SS);
 
@@ -387,7 +448,7 @@ uint8_t ftpd_run(uint8_t * dbuf)
     								else
     									recv_byte = remain_datasize;
 
-    								ret = recv(DATA_SOCK, dbuf, recv_byte);
+    								ret = recv(ftp.data, dbuf, recv_byte);
 #if defined(_FTP_DEBUG_)
     								//printf("----->fn:%s data:%s \r\n", ftp.filename, dbuf);
 #endif
@@ -420,7 +481,7 @@ uint8_t ftpd_run(uint8_t * dbuf)
     							printf("#");
 #endif
     						}else{
-    							if(getSn_SR(DATA_SOCK) != SOCK_ESTABLISHED)
+    							if(getSn_SR(ftp.data) != SOCK_ESTABLISHED)
     								break;
     						}
     					}
@@ -437,36 +498,11 @@ uint8_t ftpd_run(uint8_t * dbuf)
     				//fno.fdate = (WORD)(((current_year - 1980) << 9) | (current_month << 5) | current_day);
     				//fno.ftime = (WORD)((current_hour << 11) | (current_min << 5) | (current_sec >> 1));
     				//f_utime((const char *)ftp.filename, &fno);
-#else
-					while(1){
-						if((remain_datasize = getSn_RX_RSR(DATA_SOCK)) > 0){
-							while(1){
-								memset(dbuf, 0, _MAX_SS);
-
-								if(remain_datasize > _MAX_SS)
-									recv_byte = _MAX_SS;
-								else
-									recv_byte = remain_datasize;
-
-								ret = recv(DATA_SOCK, dbuf, recv_byte);
-
-								printf("########## dbuf:%s\r\n", dbuf);
-
-								remain_datasize -= ret;
-
-								if(remain_datasize <= 0)
-									break;
-							}
-						}else{
-							if(getSn_SR(DATA_SOCK) != SOCK_ESTABLISHED)
-								break;
-						}
-					}
 #endif
     				ftp.current_cmd = NO_CMD;
-    				disconnect(DATA_SOCK);
+    				disconnect(ftp.data);
     				size = sprintf(dbuf, "226 Successfully transferred \"%s\"\r\n", ftp.filename);
-    				send(CTRL_SOCK, dbuf, size);
+    				send(ftp.control, dbuf, size);
     				break;
 
     			case NO_CMD:
@@ -477,11 +513,20 @@ uint8_t ftpd_run(uint8_t * dbuf)
 
    		case SOCK_CLOSE_WAIT :
 #if defined(_FTP_DEBUG_)
-   			printf("%d:CloseWait\r\n",DATA_SOCK);
+   			printf("%d:CloseWait\r\n",ftp.data);
+#endif
+#if !defined(F_FILESYSTEM)
+   			if(ftp.current_cmd == RETR_CMD)
+   			{
+   				// the client closed the data connection before the end of the file
+   				ftp.current_cmd = NO_CMD;
+   				size = sprintf((char *)dbuf, "426 Connection closed; transfer aborted\r\n");
+   				send(ftp.control, dbuf, size);
+   			}
 #endif
-   			if((ret=disconnect(DATA_SOCK)) != SOCK_OK) return ret;
+   			if((ret=disconnect(ftp.data)) != SOCK_OK) return ret;
 #if defined(_FTP_DEBUG_)
-   			printf("%d:Closed\r\n",DATA_SOCK);
+   			printf("%d:Closed\r\n",ftp.data);
 #endif
    			break;
 
@@ -490,14 +535,14 @@ uint8_t ftpd_run(uint8_t * dbuf)
    			{
    				if(ftp.dsock_mode == PASSIVE_MODE){
 #if defined(_FTP_DEBUG_)
-   					printf("%d:FTPDataStart, port : %d\r\n",DATA_SOCK, local_port);
+   					printf("%d:FTPDataStart, port : %d\r\n",ftp.data, local_port);
 #endif
-   					if((ret=socket(DATA_SOCK, Sn_MR_TCP, local_port, 0x0)) != DATA_SOCK)
+   					if((ret=socket(ftp.data, Sn_MR_TCP, local_port, SF_IO_NONBLOCK)) != ftp.data)
    					{
 #if defined(_FTP_DEBUG_)
-   						printf("%d:socket() error:%ld\r\n", DATA_SOCK, ret);
+   						printf("%d:socket() error:%ld\r\n", ftp.data, ret);
 #endif
-   						close(DATA_SOCK);
+   						close(ftp.data);
    						return ret;
    					}
 
@@ -506,14 +551,14 @@ uint8_t ftpd_run(uint8_t * dbuf)
    						local_port = 35000;
    				}else{
 #if defined(_FTP_DEBUG_)
-   					printf("%d:FTPDataStart, port : %d\r\n",DATA_SOCK, IPPORT_FTPD);
+   					printf("%d:FTPDataStart, port : %d\r\n",ftp.data, IPPORT_FTPD);
 #endif
-   					if((ret=socket(DATA_SOCK, Sn_MR_TCP, IPPORT_FTPD, 0x0)) != DATA_SOCK)
+   					if((ret=socket(ftp.data, Sn_MR_TCP, IPPORT_FTPD, SF_IO_NONBLOCK)) != ftp.data)
    					{
 #if defined(_FTP_DEBUG_)
-   						printf("%d:socket() error:%ld\r\n", DATA_SOCK, ret);
+   						printf("%d:socket() error:%ld\r\n", ftp.data, ret);
 #endif
-   						close(DATA_SOCK);
+   						close(ftp.data);
    						return ret;
    					}
    				}
@@ -524,24 +569,24 @@ uint8_t ftpd_run(uint8_t * dbuf)
 
    		case SOCK_INIT :
 #if defined(_FTP_DEBUG_)
-   			printf("%d:Opened\r\n",DATA_SOCK);
+   			printf("%d:Opened\r\n",ftp.data);
 #endif
    			if(ftp.dsock_mode == PASSIVE_MODE){
-   				if( (ret = listen(DATA_SOCK)) != SOCK_OK)
+   				if( (ret = listen(ftp.data)) != SOCK_OK)
    				{
 #if defined(_FTP_DEBUG_)
-   					printf("%d:Listen error\r\n",DATA_SOCK);
+   					printf("%d:Listen error\r\n",ftp.data);
 #endif
    					return ret;
    				}
 
 #if defined(_FTP_DEBUG_)
-   				printf("%d:Listen ok\r\n",DATA_SOCK);
+   				printf("%d:Listen ok\r\n",ftp.data);
 #endif
    			}else{
-   				if((ret = connect(DATA_SOCK, remote_ip.cVal, remote_port)) != SOCK_OK){
+   				if((ret = connect(ftp.data, remote_ip.cVal, remote_port)) != SOCK_OK && ret != SOCK_BUSY){
 #if defined(_FTP_DEBUG_)
-   					printf("%d:Connect error\r\n", DATA_SOCK);
+   					printf("%d:Connect error\r\n", ftp.data);
 #endif
    					return ret;
    				}
@@ -559,7 +604,10 @@ uint8_t ftpd_run(uint8_t * dbuf)
 
 char proc_ftpd(char * buf)
 {
-	char **cmdp, *cp, *arg, *tmpstr;
+	char **cmdp, *cp, *arg;
+#if defined(F_FILESYSTEM)
+	char *tmpstr;
+#endif
 	char sendbuf[200];
 	int slen;
 	long ret;
@@ -576,9 +624,9 @@ char proc_ftpd(char * buf)
 
 	if (*cmdp == NULL)
 	{
-		//fsprintf(CTRL_SOCK, badcmd, buf);
+		//fsprintf(ftp.control, badcmd, buf);
 		slen = sprintf(sendbuf, "500 Unknown command '%s'\r\n", buf);
-		send(CTRL_SOCK, (uint8_t *)sendbuf, slen);
+		send(ftp.control, (uint8_t *)sendbuf, slen);
 		return 0;
 	}
 	/* Allow only USER, PASS and QUIT before logging in */
@@ -591,9 +639,9 @@ char proc_ftpd(char * buf)
 			case QUIT_CMD:
 				break;
 			default:
-				//fsprintf(CTRL_SOCK, notlog);
+				//fsprintf(ftp.control, notlog);
 				slen = sprintf(sendbuf, "530 Please log in with USER and PASS\r\n");
-				send(CTRL_SOCK, (uint8_t *)sendbuf, slen);
+				send(ftp.control, (uint8_t *)sendbuf, slen);
 				return 0;
 		}
 	}
@@ -612,15 +660,15 @@ char proc_ftpd(char * buf)
 			arg[slen - 1] = 0x00;
 			arg[slen - 2] = 0x00;
 			strcpy(ftp.username, arg);
-			//fsprintf(CTRL_SOCK, givepass);
+			//fsprintf(ftp.control, givepass);
 			slen = sprintf(sendbuf, "331 Enter PASS command\r\n");
-			ret = send(CTRL_SOCK, (uint8_t *)sendbuf, slen);
+			ret = send(ftp.control, (uint8_t *)sendbuf, slen);
 			if(ret < 0)
 			{
 #if defined(_FTP_DEBUG_)
-				printf("%d:send() error:%ld\r\n",CTRL_SOCK,ret);
+				printf("%d:send() error:%ld\r\n",ftp.control,ret);
 #endif
-				close(CTRL_SOCK);
+				close(ftp.control);
 				return ret;
 			}
 			break;
@@ -644,9 +692,9 @@ char proc_ftpd(char * buf)
 				case 'A':
 				case 'a':	/* Ascii */
 					ftp.type = ASCII_TYPE;
-					//fsprintf(CTRL_SOCK, typeok, arg);
+					//fsprintf(ftp.control, typeok, arg);
 					slen = sprintf(sendbuf, "200 Type set to %s\r\n", arg);
-					send(CTRL_SOCK, (uint8_t *)sendbuf, slen);
+					send(ftp.control, (uint8_t *)sendbuf, slen);
 					break;
 
 				case 'B':
@@ -654,32 +702,32 @@ char proc_ftpd(char * buf)
 				case 'I':
 				case 'i':	/* Image */
 					ftp.type = IMAGE_TYPE;
-					//fsprintf(CTRL_SOCK, typeok, arg);
+					//fsprintf(ftp.control, typeok, arg);
 					slen = sprintf(sendbuf, "200 Type set to %s\r\n", arg);
-					send(CTRL_SOCK, (uint8_t *)sendbuf, slen);
+					send(ftp.control, (uint8_t *)sendbuf, slen);
 					break;
 
 				default:	/* Invalid */
-					//fsprintf(CTRL_SOCK, badtype, arg);
+					//fsprintf(ftp.control, badtype, arg);
 					slen = sprintf(sendbuf, "501 Unknown type \"%s\"\r\n", arg);
-					send(CTRL_SOCK, (uint8_t *)sendbuf, slen);
+					send(ftp.control, (uint8_t *)sendbuf, slen);
 					break;
 			}
 			break;
 
 		case FEAT_CMD :
 			slen = sprintf(sendbuf, "211-Features:\r\n MDTM\r\n REST STREAM\r\n SIZE\r\n MLST size*;type*;create*;modify*;\r\n MLSD\r\n UTF8\r\n CLNT\r\n MFMT\r\n211 END\r\n");
-			send(CTRL_SOCK, (uint8_t *)sendbuf, slen);
+			send(ftp.control, (uint8_t *)sendbuf, slen);
 			break;
 
 		case QUIT_CMD :
 #if defined(_FTP_DEBUG_)
 			printf("QUIT_CMD\r\n");
 #endif
-			//fsprintf(CTRL_SOCK, bye);
+			//fsprintf(ftp.control, bye);
 			slen = sprintf(sendbuf, "221 Goodbye!\r\n");
-			send(CTRL_SOCK, (uint8_t *)sendbuf, slen);
-			disconnect(CTRL_SOCK);
+			send(ftp.control, (uint8_t *)sendbuf, slen);
+			disconnect(ftp.control);
 			break;
 
 		case RETR_CMD :
@@ -693,13 +741,29 @@ char proc_ftpd(char * buf)
 				sprintf(ftp.filename, "/%s", arg);
 			else
 				sprintf(ftp.filename, "%s/%s", ftp.workingdir, arg);
+#if !defined(F_FILESYSTEM)
+			if((ret = find_file(ftp.filename)) < 0)
+			{
+				slen = sprintf(sendbuf, "550 File not found\r\n");
+				send(ftp.control, (uint8_t *)sendbuf, slen);
+				break;
+			}
+			ftp.file = ret;
+			ftp.offset = 0;
+			ftp.size = files[ftp.file].size();
+#endif
 			slen = sprintf(sendbuf, "150 Opening data channel for file downloand from server of \"%s\"\r\n", ftp.filename);
-			send(CTRL_SOCK, (uint8_t *)sendbuf, slen);
+			send(ftp.control, (uint8_t *)sendbuf, slen);
 			ftp.current_cmd = RETR_CMD;
 			break;
 
 		case APPE_CMD :
 		case STOR_CMD:
+#if !defined(F_FILESYSTEM)
+			slen = sprintf(sendbuf, "550 Permission denied\r\n");
+			send(ftp.control, (uint8_t *)sendbuf, slen);
+			break;
+#endif
 			slen = strlen(arg);
 			arg[slen - 1] = 0x00;
 			arg[slen - 2] = 0x00;
@@ -711,11 +775,11 @@ char proc_ftpd(char * buf)
 			else
 				sprintf(ftp.filename, "%s/%s", ftp.workingdir, arg);
 			slen = sprintf(sendbuf, "150 Opening data channel for file upload to server of \"%s\"\r\n", ftp.filename);
-			send(CTRL_SOCK, (uint8_t *)sendbuf, slen);
+			send(ftp.control, (uint8_t *)sendbuf, slen);
 			ftp.current_cmd = STOR_CMD;
-			if((ret = connect(DATA_SOCK, remote_ip.cVal, remote_port)) != SOCK_OK){
+			if((ret = connect(ftp.data, remote_ip.cVal, remote_port)) != SOCK_OK){
 #if defined(_FTP_DEBUG_)
-				printf("%d:Connect error\r\n", DATA_SOCK);
+				printf("%d:Connect error\r\n", ftp.data);
 #endif
 				return ret;
 			}
@@ -727,15 +791,15 @@ char proc_ftpd(char * buf)
 			printf("PORT_CMD\r\n");
 #endif
 			if (pport(arg) == -1){
-				//fsprintf(CTRL_SOCK, badport);
+				//fsprintf(ftp.control, badport);
 				slen = sprintf(sendbuf, "501 Bad port syntax\r\n");
-				send(CTRL_SOCK, (uint8_t *)sendbuf, slen);
+				send(ftp.control, (uint8_t *)sendbuf, slen);
 			} else{
-				//fsprintf(CTRL_SOCK, portok);
+				//fsprintf(ftp.control, portok);
 				ftp.dsock_mode = ACTIVE_MODE;
 				ftp.dsock_state = DATASOCK_READY;
 				slen = sprintf(sendbuf, "200 PORT command successful.\r\n");
-				send(CTRL_SOCK, (uint8_t *)sendbuf, slen);
+				send(ftp.control, (uint8_t *)sendbuf, slen);
 			}
 			break;
 
@@ -744,7 +808,7 @@ char proc_ftpd(char * buf)
 			printf("MLSD_CMD\r\n");
 #endif
 			slen = sprintf(sendbuf, "150 Opening data channel for directory listing of \"%s\"\r\n", ftp.workingdir);
-			send(CTRL_SOCK, (uint8_t *)sendbuf, slen);
+			send(ftp.control, (uint8_t *)sendbuf, slen);
 			ftp.current_cmd = MLSD_CMD;
 			break;
 
@@ -753,7 +817,7 @@ char proc_ftpd(char * buf)
 			printf("LIST_CMD\r\n");
 #endif
 			slen = sprintf(sendbuf, "150 Opening data channel for directory listing of \"%s\"\r\n", ftp.workingdir);
-			send(CTRL_SOCK, (uint8_t *)sendbuf, slen);
+			send(ftp.control, (uint8_t *)sendbuf, slen);
 			ftp.current_cmd = LIST_CMD;
 			break;
 
@@ -765,19 +829,21 @@ char proc_ftpd(char * buf)
 
 		case SYST_CMD:
 			slen = sprintf(sendbuf, "215 UNIX emulated by WIZnet\r\n");
-			send(CTRL_SOCK, (uint8_t *)sendbuf, slen);
+			send(ftp.control, (uint8_t *)sendbuf, slen);
 			break;
 
 		case PWD_CMD:
 		case XPWD_CMD:
 			slen = sprintf(sendbuf, "257 \"%s\" is current directory.\r\n", ftp.workingdir);
-			send(CTRL_SOCK, (uint8_t *)sendbuf, slen);
+			send(ftp.control, (uint8_t *)sendbuf, slen);
 			break;
 
 		case PASV_CMD:
+			// the address may have changed (DHCP) since ftpd_init()
+			getSIPR(local_ip.cVal);
 			slen = sprintf(sendbuf, "227 Entering Passive Mode (%d,%d,%d,%d,%d,%d)\r\n", local_ip.cVal[0], local_ip.cVal[1], local_ip.cVal[2], local_ip.cVal[3], local_port >> 8, local_port & 0x00ff);
-			send(CTRL_SOCK, (uint8_t *)sendbuf, slen);
-			disconnect(DATA_SOCK);
+			send(ftp.control, (uint8_t *)sendbuf, slen);
+			disconnect(ftp.data);
 			ftp.dsock_mode = PASSIVE_MODE;
 			ftp.dsock_state = DATASOCK_READY;
 #if defined(_FTP_DEBUG_)
@@ -789,15 +855,17 @@ char proc_ftpd(char * buf)
 			slen = strlen(arg);
 			arg[slen - 1] = 0x00;
 			arg[slen - 2] = 0x00;
+#if !defined(F_FILESYSTEM)
+			if((ret = find_file(arg)) >= 0)
+				slen = sprintf(sendbuf, "213 %lu\r\n", (unsigned long)files[ret].size());
+			else
+				slen = sprintf(sendbuf, "550 File not Found\r\n");
+#else
 			if(slen > 3)
 			{
 				tmpstr = strrchr(arg, '/');
 				*tmpstr = 0;
-#if defined(F_FILESYSTEM)
 				slen = get_filesize(arg, tmpstr + 1);
-#else
-				slen = _MAX_SS;
-#endif
 				if(slen > 0)
 					slen = sprintf(sendbuf, "213 %d\r\n", slen);
 				else
@@ -807,13 +875,21 @@ char proc_ftpd(char * buf)
 			{
 				slen = sprintf(sendbuf, "550 File not Found\r\n");
 			}
-			send(CTRL_SOCK, (uint8_t *)sendbuf, slen);
+#endif
+			send(ftp.control, (uint8_t *)sendbuf, slen);
 			break;
 
 		case CWD_CMD:
 			slen = strlen(arg);
 			arg[slen - 1] = 0x00;
 			arg[slen - 2] = 0x00;
+#if !defined(F_FILESYSTEM)
+			// only the root directory
+			if(!strcmp(arg, "/") || !strcmp(arg, "."))
+				slen = sprintf(sendbuf, "250 CWD successful. \"%s\" is current directory.\r\n", ftp.workingdir);
+			else
+				slen = sprintf(sendbuf, "550 CWD failed. \"%s\"\r\n", arg);
+#else
 			if(slen > 3)
 			{
 				arg[slen - 3] = 0x00;
@@ -840,7 +916,8 @@ char proc_ftpd(char * buf)
 				strcpy(ftp.workingdir, arg);
 				slen = sprintf(sendbuf, "250 CWD successful. \"%s\" is current directory.\r\n", ftp.workingdir);
 			}
-			send(CTRL_SOCK, (uint8_t *)sendbuf, slen);
+#endif
+			send(ftp.control, (uint8_t *)sendbuf, slen);
 			break;
 
 		case MKD_CMD:
@@ -861,7 +938,7 @@ char proc_ftpd(char * buf)
 #else
 			slen = sprintf(sendbuf, "550 Can't create directory. Permission denied\r\n");
 #endif
-			send(CTRL_SOCK, (uint8_t *)sendbuf, slen);
+			send(ftp.control, (uint8_t *)sendbuf, slen);
 			break;
 
 		case DELE_CMD:
@@ -880,7 +957,7 @@ char proc_ftpd(char * buf)
 #else
 			slen = sprintf(sendbuf, "550 Could not delete. Permission denied\r\n");
 #endif
-			send(CTRL_SOCK, (uint8_t *)sendbuf, slen);
+			send(ftp.control, (uint8_t *)sendbuf, slen);
 			break;
 
 		case XCWD_CMD:
@@ -890,15 +967,15 @@ char proc_ftpd(char * buf)
 		case STRU_CMD:
 		case MODE_CMD:
 		case XMD5_CMD:
-			//fsprintf(CTRL_SOCK, unimp);
+			//fsprintf(ftp.control, unimp);
 			slen = sprintf(sendbuf, "502 Command does not implemented yet.\r\n");
-			send(CTRL_SOCK, (uint8_t *)sendbuf, slen);
+			send(ftp.control, (uint8_t *)sendbuf, slen);
 			break;
 
 		default:	/* Invalid */
-			//fsprintf(CTRL_SOCK, badcmd, arg);
+			//fsprintf(ftp.control, badcmd, arg);
 			slen = sprintf(sendbuf, "500 Unknown command \'%s\'\r\n", arg);
-			send(CTRL_SOCK, (uint8_t *)sendbuf, slen);
+			send(ftp.control, (uint8_t *)sendbuf, slen);
 			break;
 	}
 	
@@ -916,9 +993,9 @@ char ftplogin(char * pass)
 #if defined(_FTP_DEBUG_)
 	printf("%s logged in\r\n", ftp.username);
 #endif
-	//fsprintf(CTRL_SOCK, logged);
+	//fsprintf(ftp.control, logged);
 	slen = sprintf(sendbuf, "230 Logged on\r\n");
-	send(CTRL_SOCK, (uint8_t *)sendbuf, slen);
+	send(ftp.control, (uint8_t *)sendbuf, slen);
 	ftp.state = FTPS_LOGIN;
 	
 	return 1;
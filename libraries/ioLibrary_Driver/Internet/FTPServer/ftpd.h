@@ -25,7 +25,7 @@ extern "C" {
 #endif
 
 #define F_APP_FTP
-#define _FTP_DEBUG_
+//#define _FTP_DEBUG_
 
 
 #define LINELEN		100
@@ -34,8 +34,10 @@ extern "C" {
 #define _MAX_SS		512
 #endif
 
-#define CTRL_SOCK	2
-#define DATA_SOCK	3
+/* Without a file system, files are registered with reg_ftpd_file() and are read only */
+#if !defined(F_FILESYSTEM)
+#define MAX_FTPD_FILE	4
+#endif
 
 #define	IPPORT_FTPD	20	/* FTP Data port */
 #define	IPPORT_FTP	21	/* FTP Control port */
@@ -120,10 +122,31 @@ struct ftpd {
 #if defined(F_FILESYSTEM)
 	FIL fil;	// FatFs File objects
 	FRESULT fr;	// FatFs function common result code
+#else
+	uint8_t file;			/* RETR file, index of reg_ftpd_file() */
+	uint32_t offset;		/* RETR bytes sent */
+	uint32_t size;			/* RETR bytes to send */
 #endif
 
 };
 
+#if !defined(F_FILESYSTEM)
+/* Size of the file in bytes, read when RETR, SIZE or LIST asks for it */
+typedef uint32_t (*ftpd_file_size)(void);
+/*
+ * Point *data at the file content from offset on and return how many bytes are there, at most len.
+ * Return 0 if the data is not ready yet (RETR asks again on the next ftpd_run()), < 0 to abort the transfer.
+ * The data is sent to the socket as is, so memory mapped storage needs no copy.
+ */
+typedef int32_t (*ftpd_file_read)(uint32_t offset, const uint8_t ** data, uint32_t len);
+
+typedef struct _ftpd_file {
+	char name[LINELEN];
+	ftpd_file_size size;
+	ftpd_file_read read;
+} ftpd_file;
+#endif
+
 #ifndef un_I2cval
 typedef union _un_l2cval {
 	uint32_t	lVal;
@@ -131,7 +154,11 @@ typedef union _un_l2cval {
 }un_l2cval;
 #endif
 
-void ftpd_init(uint8_t * src_ip);
+/*
+ * ctrl_sn listens on port 21, data_sn is the data connection.
+ * The data socket is non-blocking, RETR sends one chunk as large as the free TX memory per ftpd_run().
+ */
+void ftpd_init(uint8_t ctrl_sn, uint8_t data_sn);
 uint8_t ftpd_run(uint8_t * dbuf);
 char proc_ftpd(char * buf);
 char ftplogin(char * pass);
@@ -145,6 +172,8 @@ long recvfile(uint8_t s);
 
 #if defined(F_FILESYSTEM)
 void print_filedsc(FIL *fil);
+#else
+void reg_ftpd_file(const char * name, ftpd_file_size size, ftpd_file_read read);
 #endif
 
 #ifdef __cplusplus
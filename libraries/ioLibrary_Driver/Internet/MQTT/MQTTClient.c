@@ -14,6 +14,8 @@
  *    Allan Stockdill-Mander/Ian Craggs - initial API and implementation and/or initial documentation
  *******************************************************************************/
 #include "MQTTClient.h"
+#include <stdlib.h>
+#include <string.h>
 
 static void NewMessageData(MessageData* md, MQTTString* aTopicName, MQTTMessage* aMessage) {
     md->topicName = aTopicName;
@@ -52,11 +54,9 @@ static int sendPacket(MQTTClient* c, int length, Timer* timer)
 void MQTTClientInit(MQTTClient* c, Network* network, unsigned int command_timeout_ms,
 		unsigned char* sendbuf, size_t sendbuf_size, unsigned char* readbuf, size_t readbuf_size)
 {
-    int i;
     c->ipstack = network;
 
-    for (i = 0; i < MAX_MESSAGE_HANDLERS; ++i)
-        c->messageHandlers[i].topicFilter = 0;
+    c->topicTrie = NULL;
     c->command_timeout_ms = command_timeout_ms;
     c->buf = sendbuf;
     c->buf_size = sendbuf_size;
@@ -128,62 +128,178 @@ exit:
 }
 
 
-// assume topic filter and name is in correct format
-// # can only be at end
-// + and # can only be next to separator
-static char isTopicMatched(char* topicFilter, MQTTString* topicName)
+// find the end of the topic level starting at level
+static const char* topicLevelEnd(const char* level, const char* end)
 {
-    char* curf = topicFilter;
-    char* curn = topicName->lenstring.data;
-    char* curn_end = curn + topicName->lenstring.len;
+    while (level < end && *level != '/')
+        level++;
+    return level;
+}
+
+
+static MQTTTopicNode* topicNodeNew(const char* level, int len)
+{
+    MQTTTopicNode* node = malloc(sizeof(MQTTTopicNode) + len);
+
+    if (node != NULL)
+    {
+        memset(node, 0, sizeof(MQTTTopicNode));
+        node->len = len;
+        if (len > 0)
+            memcpy(node->level, level, len);
+    }
+    return node;
+}
 
-    while (*curf && curn < curn_end)
+
+static void topicNodeFree(MQTTTopicNode* node)
+{
+    while (node != NULL)
     {
-        if (*curn == '/' && *curf != '/')
+        MQTTTopicNode* next = node->next;
+        topicNodeFree(node->child);
+        topicNodeFree(node->plus);
+        topicNodeFree(node->hash);
+        free(node);
+        node = next;
+    }
+}
+
+
+// return the slot holding the child for one level of a topic filter
+static MQTTTopicNode** topicNodeSlot(MQTTTopicNode* parent, const char* level, int len)
+{
+    MQTTTopicNode** slot;
+
+    if (len == 1 && *level == '+')
+        return &parent->plus;
+    if (len == 1 && *level == '#')
+        return &parent->hash;
+    for (slot = &parent->child; *slot != NULL; slot = &(*slot)->next)
+    {
+        if ((*slot)->len == len && memcmp((*slot)->level, level, len) == 0)
             break;
-        if (*curf != '+' && *curf != '#' && *curf != *curn)
+    }
+    return slot;
+}
+
+
+static int topicTrieInsert(MQTTClient* c, const char* topicFilter, messageHandler fp)
+{
+    const char* curf = topicFilter;
+    const char* end = topicFilter + strlen(topicFilter);
+    MQTTTopicNode* node;
+
+    if (c->topicTrie == NULL && (c->topicTrie = topicNodeNew(NULL, 0)) == NULL)
+        return FAILURE;
+    node = c->topicTrie;
+    while (1)
+    {
+        const char* next = topicLevelEnd(curf, end);
+        MQTTTopicNode** slot = topicNodeSlot(node, curf, next - curf);
+
+        if (*slot == NULL && (*slot = topicNodeNew(curf, next - curf)) == NULL)
+            return FAILURE;
+        node = *slot;
+        if (next == end)
             break;
-        if (*curf == '+')
-        {   // skip until we meet the next separator, or end of string
-            char* nextpos = curn + 1;
-            while (nextpos < curn_end && *nextpos != '/')
-                nextpos = ++curn + 1;
-        }
-        else if (*curf == '#')
-            curn = curn_end - 1;    // skip until end of string
-        curf++;
-        curn++;
-    };
+        curf = next + 1;
+    }
+    node->fp = fp;
+    return SUCCESSS;
+}
+
+
+// clear the handler of topicFilter below node, and prune the levels left without handlers
+// returns 1 when node itself is no longer needed
+static int topicTrieRemove(MQTTTopicNode* node, const char* curf, const char* end)
+{
+    const char* next = topicLevelEnd(curf, end);
+    MQTTTopicNode** slot = topicNodeSlot(node, curf, next - curf);
+    MQTTTopicNode* child = *slot;
+
+    if (child == NULL)
+        return 0;
+    if (next == end)
+        child->fp = NULL;
+    else if (!topicTrieRemove(child, next + 1, end))
+        return 0;
+    if (child->fp == NULL && child->child == NULL && child->plus == NULL && child->hash == NULL)
+    {
+        *slot = child->next;
+        free(child);
+    }
+    return node->fp == NULL && node->child == NULL && node->plus == NULL && node->hash == NULL;
+}
+
+
+static int topicNodeDeliver(MQTTTopicNode* node, MessageData* md)
+{
+    if (node == NULL || node->fp == NULL)
+        return 0;
+    node->fp(md);
+    return 1;
+}
+
+
+// walk the trie one topic level at a time, following the literal, '+' and '#' children
+// curn is NULL once every level of the topic name has been consumed
+static int topicTrieMatch(MQTTTopicNode* node, const char* curn, const char* end, MessageData* md)
+{
+    int delivered = 0;
+    const char* next;
+    MQTTTopicNode* child;
+
+    // '#' also matches the parent level itself
+    delivered += topicNodeDeliver(node->hash, md);
+    if (curn == NULL)
+        return delivered + topicNodeDeliver(node, md);
 
-    return (curn == curn_end) && (*curf == '\0');
+    next = topicLevelEnd(curn, end);
+    for (child = node->child; child != NULL; child = child->next)
+    {
+        if (child->len == next - curn && memcmp(child->level, curn, child->len) == 0)
+        {
+            delivered += topicTrieMatch(child, next == end ? NULL : next + 1, end, md);
+            break;
+        }
+    }
+    if (node->plus != NULL)
+        delivered += topicTrieMatch(node->plus, next == end ? NULL : next + 1, end, md);
+    return delivered;
 }
 
 
 int deliverMessage(MQTTClient* c, MQTTString* topicName, MQTTMessage* message)
 {
-    int i;
     int rc = FAILURE;
+    MessageData md;
+    const char* curn = topicName->lenstring.data;
+    const char* end = curn + topicName->lenstring.len;
+
+    if (curn == NULL)
+    {
+        curn = topicName->cstring;
+        end = curn + strlen(curn);
+    }
+    NewMessageData(&md, topicName, message);
 
     // we have to find the right message handler - indexed by topic
-    for (i = 0; i < MAX_MESSAGE_HANDLERS; ++i)
+    if (c->topicTrie != NULL)
     {
-        if (c->messageHandlers[i].topicFilter != 0 && (MQTTPacket_equals(topicName, (char*)c->messageHandlers[i].topicFilter) ||
-                isTopicMatched((char*)c->messageHandlers[i].topicFilter, topicName)))
-        {
-            if (c->messageHandlers[i].fp != NULL)
-            {
-                MessageData md;
-                NewMessageData(&md, topicName, message);
-                c->messageHandlers[i].fp(&md);
+        if (curn < end && *curn == '$')
+        {   // wildcards at the first level must not match topics beginning with '$'
+            const char* next = topicLevelEnd(curn, end);
+            MQTTTopicNode* child = *topicNodeSlot(c->topicTrie, curn, next - curn);
+            if (child != NULL && topicTrieMatch(child, next == end ? NULL : next + 1, end, &md) > 0)
                 rc = SUCCESSS;
-            }
         }
+        else if (topicTrieMatch(c->topicTrie, curn, end, &md) > 0)
+            rc = SUCCESSS;
     }
 
     if (rc == FAILURE && c->defaultMessageHandler != NULL)
     {
-        MessageData md;
-        NewMessageData(&md, topicName, message);
         c->defaultMessageHandler(&md);
         rc = SUCCESSS;
     }
@@ -192,6 +308,13 @@ int deliverMessage(MQTTClient* c, MQTTString* topicName, MQTTMessage* message)
 }
 
 
+void MQTTClearSubscriptions(MQTTClient* c)
+{
+    topicNodeFree(c->topicTrie);
+    c->topicTrie = NULL;
+}
+
+
 int keepalive(MQTTClient* c)
 {
     int rc = FAILURE;
@@ -432,19 +555,7 @@ int MQTTSubscribe(MQTTClient* c, const char* topicFilter, enum QoS qos, messageH
         if (MQTTDeserialize_suback(&mypacketid, 1, &count, &grantedQoS, c->readbuf, c->readbuf_size) == 1)
             rc = grantedQoS; // 0, 1, 2 or 0x80
         if (rc != 0x80)
-        {
-            int i;
-            for (i = 0; i < MAX_MESSAGE_HANDLERS; ++i)
-            {
-                if (c->messageHandlers[i].topicFilter == 0)
-                {
-                    c->messageHandlers[i].topicFilter = topicFilter;
-                    c->messageHandlers[i].fp = messageHandler;
-                    rc = 0;
-                    break;
-                }
-            }
-        }
+            rc = topicTrieInsert(c, topicFilter, messageHandler);
     }
     else
         rc = FAILURE;
@@ -483,7 +594,11 @@ int MQTTUnsubscribe(MQTTClient* c, const char* topicFilter)
     {
         unsigned short mypacketid;  // should be the same as the packetid above
         if (MQTTDeserialize_unsuback(&mypacketid, c->readbuf, c->readbuf_size) == 1)
+        {
+            if (c->topicTrie != NULL && topicTrieRemove(c->topicTrie, topicFilter, topicFilter + strlen(topicFilter)))
+                MQTTClearSubscriptions(c);
             rc = 0;
+        }
     }
     else
         rc = FAILURE;
@@ -39,10 +39,6 @@
 
 #define MAX_PACKET_ID 65535 /* according to the MQTT specification - do not change! */
 
-#if !defined(MAX_MESSAGE_HANDLERS)
-#define MAX_MESSAGE_HANDLERS 5 /* redefinable - how many subscriptions do you want? */
-#endif
-
 enum QoS { QOS0, QOS1, QOS2 };
 
 /* all failure return codes must be negative */
@@ -83,6 +79,20 @@ typedef struct MessageData
 
 typedef void (*messageHandler)(MessageData*);
 
+/* One level of a subscribed topic filter. Nodes are allocated at subscribe time
+ * and form a trie keyed by topic level, so dispatch cost depends on the depth of
+ * the topic rather than on the number of subscriptions. */
+typedef struct MQTTTopicNode
+{
+    struct MQTTTopicNode* next;   /* sibling literal level under the same parent */
+    struct MQTTTopicNode* child;  /* first literal child level */
+    struct MQTTTopicNode* plus;   /* '+' child level */
+    struct MQTTTopicNode* hash;   /* '#' child level */
+    messageHandler fp;            /* handler of the filter ending at this level */
+    unsigned short len;
+    char level[];
+} MQTTTopicNode;
+
 typedef struct MQTTClient
 {
     unsigned int next_packetid,
@@ -95,11 +105,7 @@ typedef struct MQTTClient
     char ping_outstanding;
     int isconnected;
 
-    struct MessageHandlers
-    {
-        const char* topicFilter;
-        void (*fp) (MessageData*);
-    } messageHandlers[MAX_MESSAGE_HANDLERS];      /* Message handlers are indexed by subscription topic */
+    MQTTTopicNode* topicTrie;      /* Message handlers are indexed by subscription topic */
 
     void (*defaultMessageHandler) (MessageData*);
 
@@ -124,6 +130,13 @@ typedef struct MQTTClient
 DLLExport void MQTTClientInit(MQTTClient* client, Network* network, unsigned int command_timeout_ms,
 		unsigned char* sendbuf, size_t sendbuf_size, unsigned char* readbuf, size_t readbuf_size);
 
+/**
+ * Release every message handler registered by MQTTSubscribe.
+ * Call before re-initialising a client that still holds subscriptions.
+ * @param client - the client object to use
+ */
+DLLExport void MQTTClearSubscriptions(MQTTClient* client);
+
 /** MQTT Connect - send an MQTT connect packet down the network and wait for a Connack
  *  The nework object must be connected to the network endpoint before calling this
  *  @param options - connect options
@@ -140,6 +153,8 @@ DLLExport int MQTTConnect(MQTTClient* client, MQTTPacket_connectData* options);
 DLLExport int MQTTPublish(MQTTClient* client, const char*, MQTTMessage*);
 
 /** MQTT Subscribe - send an MQTT subscribe packet and wait for suback before returning.
+ *  There is no fixed limit on the number of subscriptions; subscribing again to the
+ *  same filter replaces its handler.
  *  @param client - the client object to use
  *  @param topicFilter - the topic filter to subscribe to
  *  @param message - the message to send
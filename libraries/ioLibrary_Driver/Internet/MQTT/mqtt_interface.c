@@ -40,6 +40,8 @@
 //
 //*****************************************************************************
 
+#include <string.h>
+
 #include "mqtt_interface.h"
 #include "wizchip_conf.h"
 #include "socket.h"
@@ -115,6 +117,34 @@ void NewNetwork(Network* n, int sn) {
 	n->mqttread = w5x00_read;
 	n->mqttwrite = w5x00_write;
 	n->disconnect = w5x00_disconnect;
+	n->rxbuf = NULL;
+	n->rxbuf_size = 0;
+	n->rx_head = 0;
+	n->rx_count = 0;
+	n->txbuf = NULL;
+	n->txbuf_size = 0;
+	n->tx_len = 0;
+}
+
+/*
+ * @brief New buffered network setting
+ * @param  n : pointer to a Network structure
+ *         that contains the configuration information for the Network.
+ *         sn : socket number where x can be (0..7).
+ *         rxbuf : ring buffer the socket RX window is copied into.
+ *         rxbuf_size : rxbuf length, at least the largest packet to receive.
+ *         txbuf : buffer outgoing packets are collected in.
+ *         txbuf_size : txbuf length.
+ * @retval None
+ */
+void NewBufferedNetwork(Network* n, int sn, unsigned char* rxbuf, int rxbuf_size, unsigned char* txbuf, int txbuf_size) {
+	NewNetwork(n, sn);
+	n->mqttread = w5x00_buffered_read;
+	n->mqttwrite = w5x00_buffered_write;
+	n->rxbuf = rxbuf;
+	n->rxbuf_size = rxbuf_size;
+	n->txbuf = txbuf;
+	n->txbuf_size = txbuf_size;
 }
 
 /*
@@ -150,6 +180,154 @@ int w5x00_write(Network* n, unsigned char* buffer, int len, long time)
 	return SOCK_ERROR;
 }
 
+/*
+ * @brief fill the ring buffer from the socket
+ * @param  n : pointer to a Network structure
+ *         that contains the configuration information for the Network.
+ * @retval number of bytes copied or SOCKERR code
+ * @note   Copies as much of the RX window as fits with at most two recv() calls
+ *         (one per side of the ring wrap), instead of one recv() per MQTT field.
+ */
+static int w5x00_fill(Network* n)
+{
+	int filled = 0;
+	int tail;
+	int chunk;
+	int ret;
+	uint16_t rsr;
+
+	if(getSn_SR(n->my_socket) != SOCK_ESTABLISHED)
+		return SOCK_ERROR;
+
+	rsr = getSn_RX_RSR(n->my_socket);
+
+	while(rsr > 0 && n->rx_count < n->rxbuf_size)
+	{
+		tail = (n->rx_head + n->rx_count) % n->rxbuf_size;
+		chunk = (tail >= n->rx_head) ? (n->rxbuf_size - tail) : (n->rx_head - tail);
+		if(chunk > n->rxbuf_size - n->rx_count) chunk = n->rxbuf_size - n->rx_count;
+		if(chunk > rsr) chunk = rsr;
+
+		ret = recv(n->my_socket, n->rxbuf + tail, chunk);
+		if(ret <= 0)
+			return (filled > 0) ? filled : ret;
+
+		n->rx_count += ret;
+		filled += ret;
+		rsr -= ret;
+	}
+
+	return filled;
+}
+
+/*
+ * @brief buffered read function
+ * @param  n : pointer to a Network structure
+ *         that contains the configuration information for the Network.
+ *         buffer : pointer to a read buffer.
+ *         len : buffer length.
+ *         time : timeout millisecond to wait for the rest of a partly received packet.
+ * @retval len or SOCKERR code
+ * @note   Returns immediately when nothing has been received, like w5x00_read().
+ *         Pending outgoing packets are flushed first, since the caller may be waiting for their reply.
+ */
+int w5x00_buffered_read(Network* n, unsigned char* buffer, int len, long time)
+{
+	Timer timer;
+	int first;
+
+	if(len > n->rxbuf_size)
+		return SOCK_ERROR;
+
+	if(n->tx_len > 0 && w5x00_flush(n) < 0)
+		return SOCK_ERROR;
+
+	if(n->rx_count < len)
+	{
+		if(w5x00_fill(n) < 0)
+			return SOCK_ERROR;
+
+		if(n->rx_count == 0)
+			return SOCK_ERROR;
+
+		TimerInit(&timer);
+		TimerCountdownMS(&timer, (unsigned int)time);
+
+		while(n->rx_count < len)
+		{
+			if(TimerIsExpired(&timer))
+				return SOCK_ERROR;
+			if(w5x00_fill(n) < 0)
+				return SOCK_ERROR;
+		}
+	}
+
+	first = n->rxbuf_size - n->rx_head;
+	if(first > len) first = len;
+	memcpy(buffer, n->rxbuf + n->rx_head, first);
+	memcpy(buffer + first, n->rxbuf, len - first);
+
+	n->rx_head = (n->rx_head + len) % n->rxbuf_size;
+	n->rx_count -= len;
+	if(n->rx_count == 0) n->rx_head = 0;
+
+	return len;
+}
+
+/*
+ * @brief buffered write function
+ * @param  n : pointer to a Network structure
+ *         that contains the configuration information for the Network.
+ *         buffer : pointer to a write buffer.
+ *         len : buffer length.
+ * @retval len or SOCKERR code
+ * @note   Packets are collected in txbuf and sent together by the next read or w5x00_flush(),
+ *         so several QoS0 PUBLISH packets go out in one Sn_CR_SEND.
+ */
+int w5x00_buffered_write(Network* n, unsigned char* buffer, int len, long time)
+{
+	if(getSn_SR(n->my_socket) != SOCK_ESTABLISHED)
+		return SOCK_ERROR;
+
+	if(n->tx_len + len > n->txbuf_size && w5x00_flush(n) < 0)
+		return SOCK_ERROR;
+
+	if(len > n->txbuf_size)
+		return send(n->my_socket, buffer, len);
+
+	memcpy(n->txbuf + n->tx_len, buffer, len);
+	n->tx_len += len;
+
+	return len;
+}
+
+/*
+ * @brief flush function
+ * @param  n : pointer to a Network structure
+ *         that contains the configuration information for the Network.
+ * @retval length of data sent or SOCKERR code
+ */
+int w5x00_flush(Network* n)
+{
+	int sent = 0;
+	int ret;
+
+	while(sent < n->tx_len)
+	{
+		ret = send(n->my_socket, n->txbuf + sent, n->tx_len - sent);
+		if(ret < 0)
+		{
+			n->tx_len = 0;
+			return ret;
+		}
+		sent += ret;
+	}
+
+	n->tx_len = 0;
+
+	return sent;
+}
+
 /*
  * @brief disconnect function
  * @param  n : pointer to a Network structure
@@ -157,6 +335,10 @@ int w5x00_write(Network* n, unsigned char* buffer, int len, long time)
  */
 void w5x00_disconnect(Network* n)
 {
+	if(n->tx_len > 0)
+		w5x00_flush(n);
+	n->rx_head = 0;
+	n->rx_count = 0;
 	disconnect(n->my_socket);
 }
 
@@ -236,6 +236,9 @@ struct Timer {
 
 /*
  * @brief Network structure
+ * @note  rxbuf/txbuf are only used by the buffered network (NewBufferedNetwork).
+ *        rxbuf is a ring filled with whole RX windows of the socket,
+ *        txbuf collects outgoing packets until the next read or w5x00_flush().
  */
 typedef struct Network Network;
 struct Network
@@ -244,6 +247,13 @@ struct Network
 	int (*mqttread) (Network*, unsigned char*, int, long);
 	int (*mqttwrite) (Network*, unsigned char*, int, long);
 	void (*disconnect) (Network*);
+	unsigned char* rxbuf;
+	int rxbuf_size;
+	int rx_head;
+	int rx_count;
+	unsigned char* txbuf;
+	int txbuf_size;
+	int tx_len;
 };
 
 /*
@@ -262,6 +272,14 @@ int w5x00_read(Network*, unsigned char*, int, long);
 int w5x00_write(Network*, unsigned char*, int, long);
 void w5x00_disconnect(Network*);
 void NewNetwork(Network* n, int sn);
+
+/*
+ * @brief Buffered network interface porting
+ */
+int w5x00_buffered_read(Network*, unsigned char*, int, long);
+int w5x00_buffered_write(Network*, unsigned char*, int, long);
+int w5x00_flush(Network*);
+void NewBufferedNetwork(Network* n, int sn, unsigned char* rxbuf, int rxbuf_size, unsigned char* txbuf, int txbuf_size);
 int ConnectNetwork(Network* n, uint8_t* ip, uint16_t port);
 
 #ifdef __cplusplus
@@ -12,7 +12,9 @@
 /* SNMP : Functions declaration                                                             */
 /********************************************************************************************/
 // SNMP Parsing functions
+int32_t compareOID(const uint8_t *a, int32_t alen, const uint8_t *b, int32_t blen);
 int32_t findEntry(uint8_t *oid, int32_t len);
+int32_t findNextEntry(uint8_t *oid, int32_t len);
 int32_t getOID(int32_t id, uint8_t *oid, uint8_t *len);
 int32_t getValue( uint8_t *vptr, int32_t vlen);
 int32_t getEntry(int32_t id, uint8_t *dataType, void *ptr, int32_t *len);
@@ -109,6 +111,18 @@ void snmpd_init(uint8_t * managerIP, uint8_t * agentIP, uint8_t sn_agent, uint8_
 
     startTime = getSNMPTimeTick(); // Start time (unit: 10ms)
     initTable(); // Settings for OID entry values
+
+    // findEntry() and findNextEntry() use binary search: snmpData[] must be sorted by OID
+    {
+        int32_t i;
+        for (i = 1 ; i < maxData ; i++)
+        {
+            if (compareOID(snmpData[i-1].oid, snmpData[i-1].oidlen, snmpData[i].oid, snmpData[i].oidlen) >= 0)
+            {
+                printf(" - SNMP : snmpData[%ld] is out of order, lookups will fail\r\n", (long)i);
+            }
+        }
+    }
     
     initial_Trap(managerIP, agentIP);
 
@@ -204,22 +218,83 @@ int32_t snmpd_run(void)
 }
 
 
-int32_t findEntry(uint8_t *oid, int32_t len)
+/* Decode one base-128 sub-identifier, returns the number of bytes used */
+static int32_t decodeSubID(const uint8_t *oid, int32_t len, uint32_t *value)
 {
-	int32_t i;
+	int32_t i = 0;
 
-	for (i = 0 ; i < maxData ; i++)
+	*value = 0;
+	while (i < len)
 	{
-		if (len == snmpData[i].oidlen)
-		{
-			if (!memcmp(snmpData[i].oid, oid, len)) return(i);
-		}
+		*value = (*value << 7) | (oid[i] & 0x7F);
+		if (!(oid[i++] & 0x80)) break;
+	}
+
+	return i;
+}
+
+
+/*
+ * Compare two BER encoded OIDs in lexicographic OID order.
+ * Sub-identifiers are decoded and compared as numbers, the raw bytes do not sort right when
+ * their encodings differ in length (127 = 0x7F would sort after 128 = 0x81 0x00). A prefix sorts first.
+ */
+int32_t compareOID(const uint8_t *a, int32_t alen, const uint8_t *b, int32_t blen)
+{
+	int32_t i = 0, j = 0;
+	uint32_t x, y;
+
+	while ((i < alen) && (j < blen))
+	{
+		i += decodeSubID(a + i, alen - i, &x);
+		j += decodeSubID(b + j, blen - j, &y);
+		if (x != y) return (x < y) ? -1 : 1;
 	}
+	if (i < alen) return 1;
+	if (j < blen) return -1;
+
+	return 0;
+}
+
+
+/* Lower bound: index of the first entry not less than oid (maxData if none) */
+static int32_t searchEntry(uint8_t *oid, int32_t len)
+{
+	int32_t lo = 0, hi = maxData, mid;
+
+	while (lo < hi)
+	{
+		mid = lo + (hi - lo) / 2;
+		if (compareOID(snmpData[mid].oid, snmpData[mid].oidlen, oid, len) < 0) lo = mid + 1;
+		else hi = mid;
+	}
+
+	return lo;
+}
+
+
+int32_t findEntry(uint8_t *oid, int32_t len)
+{
+	int32_t i = searchEntry(oid, len);
+
+	if ((i < maxData) && !compareOID(snmpData[i].oid, snmpData[i].oidlen, oid, len)) return(i);
 
 	return OID_NOT_FOUND;
 }
 
 
+/* GETNEXT: the first entry after oid, oid does not need to exist in the table */
+int32_t findNextEntry(uint8_t *oid, int32_t len)
+{
+	int32_t i = searchEntry(oid, len);
+
+	if ((i < maxData) && !compareOID(snmpData[i].oid, snmpData[i].oidlen, oid, len)) i++;
+	if (i >= maxData) return OID_NOT_FOUND;
+
+	return i;
+}
+
+
 int32_t getOID(int32_t id, uint8_t *oid, uint8_t *len)
 {
 	int32_t j;
@@ -471,7 +546,8 @@ int32_t parseVarBind(int32_t reqType, int32_t index)
 
 	if ( request_msg.buffer[name.start] != SNMPDTYPE_OBJ_ID ) return -1;
 
-	id = findEntry(&request_msg.buffer[name.vstart], name.len);
+	if (reqType == GET_NEXT_REQUEST)	id = findNextEntry(&request_msg.buffer[name.vstart], name.len);
+	else								id = findEntry(&request_msg.buffer[name.vstart], name.len);
 
 	if ((reqType == GET_REQUEST) || (reqType == SET_REQUEST))
 	{
@@ -483,9 +559,8 @@ int32_t parseVarBind(int32_t reqType, int32_t index)
 	{
 		response_msg.buffer[response_msg.index] = request_msg.buffer[name.start];
 
-		if (++id >= maxData)
+		if (id == OID_NOT_FOUND)
 		{
-			id = OID_NOT_FOUND;
 			seglen = name.nstart - name.start;
 			COPY_SEGMENT(name);
 			size = seglen;
@@ -6,7 +6,7 @@ extern "C" {
 #endif
 
 // SNMP Debug Message (dump) Enable
-#define _SNMP_DEBUG_
+//#define _SNMP_DEBUG_
 
 #define PORT_SNMP_AGENT				161
 #define PORT_SNMP_TRAP				162
@@ -75,6 +75,7 @@ extern "C" {
          (((x) << 24) & 0xff000000))
 #endif
 
+/* snmpData[] entries must be sorted by OID, lookups are binary searches */
 typedef struct {
 	uint8_t oidlen;
 	uint8_t oid[MAX_OID];
@@ -19,6 +19,12 @@ uint8_t NTP_SOCKET;
 uint8_t time_zone;
 uint16_t ntp_retry_cnt=0; //counting the ntp retry number
 
+/* Four-timestamp exchange (SNTP_exchange) */
+static uint64_t (*ntp_clock)(void) = 0;	// local clock in microseconds, registered by SNTP_reg_clock()
+static uint8_t  ntp_waiting = 0;		// request sent, waiting for the reply
+static uint64_t ntp_t1;					// local time the request left
+static uint8_t  ntp_cookie[8];			// transmit field of the request, echoed back as origin
+
 /*
 00)UTC-12:00 Baker Island, Howland Island (both uninhabited)
 01) UTC-11:00 American Samoa, Samoa
@@ -313,6 +319,103 @@ int8_t SNTP_run(datetime *time)
 	return 0;
 }
 
+static tstamp get_tstamp(uint8_t *buf, uint16_t idx)
+{
+	tstamp t = 0;
+	uint8_t i;
+	for (i = 0; i < 8; i++)
+	{
+		t = (t << 8) | buf[idx + i];
+	}
+	return t;
+}
+
+void SNTP_reg_clock(uint64_t (*clock_us)(void))
+{
+	ntp_clock = clock_us;
+}
+
+int8_t SNTP_exchange(ntp_sample *sample)
+{
+	uint16_t RSR_len;
+	uint32_t destip = 0;
+	uint16_t destport;
+	uint64_t t4;
+	uint64_t cookie;
+	uint8_t i;
+
+	if(ntp_clock == 0) return -1;
+
+	switch(getSn_SR(NTP_SOCKET))
+	{
+	case SOCK_UDP:
+		if(!ntp_waiting)
+		{
+			// Only the flag byte and the transmit field are set; the server copies the transmit field to origin
+			memset(ntpmessage + 1, 0, sizeof(ntpmessage) - 1);
+			cookie = ntp_clock();
+			for (i = 0; i < 8; i++)
+			{
+				ntp_cookie[i] = (uint8_t)(cookie >> (56 - 8 * i));
+			}
+			memcpy(ntpmessage + 40, ntp_cookie, 8);
+			// sendto() returns after SENDOK, which is closer to the time the frame left than before the call
+			if(sendto(NTP_SOCKET, ntpmessage, sizeof(ntpmessage), NTPformat.dstaddr, ntp_port) <= 0)
+			{
+				close(NTP_SOCKET);
+				return -1;
+			}
+			ntp_t1 = ntp_clock();
+			ntp_waiting = 1;
+			return 0;
+		}
+
+		if((RSR_len = getSn_RX_RSR(NTP_SOCKET)) > 0)
+		{
+			// Take T4 before reading the buffer out over SPI
+			t4 = ntp_clock();
+			if (RSR_len > MAX_SNTP_BUF_SIZE) RSR_len = MAX_SNTP_BUF_SIZE;
+			RSR_len = recvfrom(NTP_SOCKET, data_buf, RSR_len, (uint8_t *)&destip, &destport);
+			ntp_waiting = 0;
+			close(NTP_SOCKET);
+
+			// mode 4 (server), not unsynchronized (LI 3), not a kiss-o'-death (stratum 0), reply to our request
+			if(RSR_len < 48 || (data_buf[0] & 0x07) != 4 || (data_buf[0] >> 6) == 3 ||
+			   data_buf[1] == 0 || data_buf[1] > 15 || memcmp(data_buf + 24, ntp_cookie, 8) != 0)
+			{
+#ifdef _SNTP_DEBUG_
+				printf("ntp reply rejected\r\n");
+#endif
+				return -1;
+			}
+			sample->t1 = ntp_t1;
+			sample->t2 = get_tstamp(data_buf, 32);
+			sample->t3 = get_tstamp(data_buf, 40);
+			sample->t4 = t4;
+			sample->stratum = data_buf[1];
+			return 1;
+		}
+
+		if((ntp_clock() - ntp_t1) > (uint64_t)SNTP_TIMEOUT_MS * 1000)
+		{
+#ifdef _SNTP_DEBUG_
+			printf("ntp timeout\r\n");
+#endif
+			ntp_waiting = 0;
+			close(NTP_SOCKET);
+			return -1;
+		}
+		break;
+	case SOCK_CLOSED:
+		ntp_waiting = 0;
+		socket(NTP_SOCKET,Sn_MR_UDP,ntp_port,0);
+		break;
+	default:
+		break;
+	}
+	return 0;
+}
+
 void calcdatetime(tstamp seconds)
 {
 	uint8_t yf=0;
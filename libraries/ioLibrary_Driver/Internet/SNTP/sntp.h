@@ -62,6 +62,22 @@ typedef struct _datetime
 #define SECS_PERDAY		86400UL             	// seconds in a day = 60*60*24
 #define UTC_ADJ_HRS		9              	        // SEOUL : GMT+9
 #define EPOCH			1900                    // NTP start year
+#define SNTP_TIMEOUT_MS		1000				// SNTP_exchange() gives up after this time without a reply
+
+/*
+ * @brief One request/reply of SNTP_exchange().
+ * @details t1 and t4 are read from the clock registered by SNTP_reg_clock(),
+ *          t2 and t3 are NTP timestamps (seconds since 1900 << 32 | fraction) from the server.
+ *          offset = ((t2 - t1) + (t3 - t4)) / 2, round trip delay = (t4 - t1) - (t3 - t2)
+ */
+typedef struct _ntp_sample
+{
+	uint64_t t1;		///< local time the request was sent (us)
+	tstamp   t2;		///< server receive timestamp
+	tstamp   t3;		///< server transmit timestamp
+	uint64_t t4;		///< local time the reply was seen (us)
+	uint8_t  stratum;	///< server stratum
+} ntp_sample;
 
 void get_seconds_from_ntp_server(uint8_t *buf, uint16_t idx);
 void SNTP_init(uint8_t s, uint8_t *ntp_server, uint8_t tz, uint8_t *buf);
@@ -69,6 +85,20 @@ int8_t SNTP_run(datetime *time);
 tstamp changedatetime_to_seconds(void);
 void calcdatetime(tstamp seconds);
 
+/*
+ * @brief Register the local clock used for T1/T4 and the SNTP_exchange() timeout.
+ * @param clock_us Returns a free running microsecond counter.
+ */
+void SNTP_reg_clock(uint64_t (*clock_us)(void));
+/*
+ * @brief Non-blocking four-timestamp exchange with the server given to SNTP_init().
+ * @details Call repeatedly; the socket is opened, the request sent and the reply polled on successive calls.
+ *          Poll often while waiting, T4 is taken when the reply is first seen.
+ *          The socket is closed when a result is returned.
+ * @return 1 - sample is valid, 0 - in progress, -1 - timeout or invalid reply
+ */
+int8_t SNTP_exchange(ntp_sample *sample);
+
 #ifdef __cplusplus
 }
 #endif
@@ -6,7 +6,10 @@
  */
 
 /* Includes -----------------------------------------------------*/
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <ctype.h>
 #include "tftp.h"
 #include "socket.h"
 #include "netutil.h"
@@ -41,10 +44,23 @@ static uint32_t tftp_retry_cnt = 0;
 
 static uint8_t *g_tftp_rcv_buf = NULL;
 
-static TFTP_OPTION default_tftp_opt = {
-	.code = (uint8_t *)"timeout",
-	.value = (uint8_t *)"5"
+/* Options (RFC 2347): requested values and the values the server accepted in OACK */
+static uint16_t g_req_blksize = TFTP_BLK_SIZE;
+static uint16_t g_req_windowsize = 1;
+static uint16_t g_blksize = TFTP_BLK_SIZE;
+static uint16_t g_windowsize = 1;
+static uint16_t g_window_cnt = 0;		// blocks received since the last ACK
+static uint8_t g_window_nak = 0;		// ACK for an out of order block already sent in this window
+
+static uint8_t g_blksize_str[6];
+static uint8_t g_windowsize_str[6];
+
+static TFTP_OPTION g_tftp_opt[3] = {
+	{ .code = (uint8_t *)"timeout", .value = (uint8_t *)"5" },
+	{ .code = (uint8_t *)"blksize", .value = g_blksize_str },
+	{ .code = (uint8_t *)"windowsize", .value = g_windowsize_str }
 };
+static uint8_t g_tftp_opt_len = 1;
 
 uint8_t g_progress_state = TFTP_PROGRESS;
 
@@ -208,6 +224,12 @@ static void init_tftp(void)
 	set_tftp_state(STATE_NONE);
 	set_block_number(0);
 
+	/* Lock-step 512 byte blocks until the server accepts the options */
+	g_blksize = TFTP_BLK_SIZE;
+	g_windowsize = 1;
+	g_window_cnt = 0;
+	g_window_nak = 0;
+
 	/* timeout flag */
 	g_resend_flag = 0;
 	tftp_retry_cnt = tftp_time_cnt = 0;
@@ -231,9 +253,47 @@ static void tftp_reg_timeout()
 	}
 }
 
-static void process_tftp_option(uint8_t *msg, uint32_t msg_len)
+static int strcasecmp_tftp(const char *a, const char *b)
+{
+	while(*a && (tolower((uint8_t)*a) == tolower((uint8_t)*b))) {
+		a++;
+		b++;
+	}
+	return tolower((uint8_t)*a) - tolower((uint8_t)*b);
+}
+
+/* Parse the option/value pairs of an OACK, returns -1 if the server answered with a value we did not allow */
+static int process_tftp_option(uint8_t *msg, uint32_t msg_len)
 {
-	/* TODO Option Process */
+	char *code, *value;
+	uint32_t pos = 2, val;
+
+	while(pos < msg_len) {
+		code = (char *)msg + pos;
+		pos += strnlen(code, msg_len - pos) + 1;
+		if(pos >= msg_len) break;
+		value = (char *)msg + pos;
+		pos += strnlen(value, msg_len - pos) + 1;
+		if(pos > msg_len) break;
+
+		val = strtoul(value, NULL, 10);
+		if(!strcasecmp_tftp(code, "blksize")) {
+			if((val < 8) || (val > g_req_blksize)) return -1;
+			g_blksize = (uint16_t)val;
+		}
+		else if(!strcasecmp_tftp(code, "windowsize")) {
+			if((val < 1) || (val > g_req_windowsize)) return -1;
+			g_windowsize = (uint16_t)val;
+		}
+		else if(!strcasecmp_tftp(code, "timeout")) {
+			if((val < 1) || (val > 255)) return -1;
+			set_tftp_timeout(val);
+		}
+#ifdef __TFTP_DEBUG__
+		DBG_PRINT(INFO_DBG, "[%s] %s = %s\r\n", __func__, code, value);
+#endif
+	}
+	return 0;
 }
 
 static void send_tftp_rrq(uint8_t *filename, uint8_t *mode, TFTP_OPTION *opt, uint8_t opt_len)
@@ -368,29 +428,34 @@ static void send_tftp_oack(TFTP_OPTION *opt, uint8_t opt_len)
 }
 #endif
 
-#if 0	// 2014.07.01 sskim
+/* An ERROR ends the transfer and is not acknowledged (RFC 1350), so no timeout is registered */
 static void send_tftp_error(uint16_t error_number, uint8_t *error_message)
 {
-	uint8_t snd_buf[MAX_MTU_SIZE];
+	uint8_t snd_buf[4 + TFTP_ERROR_MSG_MAX];
 	uint8_t *pkt = snd_buf;
 	uint32_t len;
+	uint8_t io_mode;
 
 	*((uint16_t *)pkt) = htons((uint16_t)TFTP_ERROR);
 	pkt += 2;
 	*((uint16_t *)pkt) = htons(error_number);
 	pkt += 2;
-	strcpy((char *)pkt, (const char *)error_message);
-	pkt += strlen((char *)error_message) + 1;
+	strncpy((char *)pkt, (const char *)error_message, TFTP_ERROR_MSG_MAX - 1);
+	pkt[TFTP_ERROR_MSG_MAX - 1] = '\0';
+	pkt += strlen((char *)pkt) + 1;
 
 	len = pkt - snd_buf;
 
+	/* Sent in blocking mode, so the datagram is out before the application closes the socket */
+	io_mode = SOCK_IO_BLOCK;
+	ctlsocket(g_tftp_socket, CS_SET_IOMODE, &io_mode);
 	send_udp_packet(g_tftp_socket , snd_buf, len, get_server_ip(), get_server_port());
-	tftp_reg_timeout();
+	io_mode = SOCK_IO_NONBLOCK;
+	ctlsocket(g_tftp_socket, CS_SET_IOMODE, &io_mode);
 #ifdef __TFTP_DEBUG__
 	DBG_PRINT(IPC_DBG, ">> TFTP ERROR : Error Number(%d)\r\n", error_number);
 #endif
 }
-#endif
 
 static void recv_tftp_rrq(uint8_t *msg, uint32_t msg_len)
 {
@@ -402,6 +467,33 @@ static void recv_tftp_wrq(uint8_t *msg, uint32_t msg_len)
 	/* When TFTP Server Mode */
 }
 
+/* Store the next block in order, ACK at the end of a window or of the file */
+static void recv_tftp_block(TFTP_DATA_T *data, uint32_t data_len)
+{
+	set_block_number(data->block_num);
+#ifdef F_STORAGE
+	save_data(data->data, data_len, data->block_num);
+#endif
+	tftp_cancel_timeout();
+	g_window_nak = 0;
+
+	if(data_len < g_blksize) {
+		send_tftp_ack(data->block_num);
+		init_tftp();
+		g_progress_state = TFTP_SUCCESS;
+		return;
+	}
+
+	if(++g_window_cnt >= g_windowsize) {
+		g_window_cnt = 0;
+		send_tftp_ack(data->block_num);
+	}
+	else {
+		/* the rest of the window may be lost, keep the timer running */
+		tftp_reg_timeout();
+	}
+}
+
 static void recv_tftp_data(uint8_t *msg, uint32_t msg_len)
 {
 	TFTP_DATA_T *data = (TFTP_DATA_T *)msg;
@@ -416,38 +508,25 @@ static void recv_tftp_data(uint8_t *msg, uint32_t msg_len)
 	{
 		case STATE_RRQ :
 		case STATE_OACK :
-			if(data->block_num == 1) {
-				set_tftp_state(STATE_DATA);
-				set_block_number(data->block_num);
-#ifdef F_STORAGE
-				save_data(data->data, msg_len - 4, data->block_num);
-#endif
-				tftp_cancel_timeout();
-			}
-			send_tftp_ack(data->block_num);
-
-			if((msg_len - 4) < TFTP_BLK_SIZE) {
-				init_tftp();
-				g_progress_state = TFTP_SUCCESS;
+			if(data->block_num != 1) {
+				send_tftp_ack(0);
+				break;
 			}
-
+			set_tftp_state(STATE_DATA);
+			recv_tftp_block(data, msg_len - 4);
 			break;
-			
+
 		case STATE_DATA :
-			if(data->block_num == (get_block_number() + 1)) {
-				set_block_number(data->block_num);
-#ifdef F_STORAGE
-				save_data(data->data, msg_len - 4, data->block_num);
-#endif
-				tftp_cancel_timeout();
+			if(data->block_num == (uint16_t)(get_block_number() + 1)) {
+				recv_tftp_block(data, msg_len - 4);
 			}
-			send_tftp_ack(data->block_num);
-
-			if((msg_len - 4) < TFTP_BLK_SIZE) {
-				init_tftp();
-				g_progress_state = TFTP_SUCCESS;
+			else if(!g_window_nak || (g_windowsize == 1)) {
+				/* A duplicate (our ACK was lost) or, in a window, a lost or reordered block (RFC 7440):
+				   ACK the last block in order once so the server resends from there */
+				g_window_nak = 1;
+				g_window_cnt = 0;
+				send_tftp_ack(get_block_number());
 			}
-
 			break;
 
 		default :
@@ -485,7 +564,16 @@ static void recv_tftp_oack(uint8_t *msg, uint32_t msg_len)
 	switch(get_tftp_state())
 	{
 		case STATE_RRQ :
-			process_tftp_option(msg, msg_len);	
+			if(process_tftp_option(msg, msg_len) < 0) {
+#ifdef __TFTP_DEBUG__
+				DBG_PRINT(ERROR_DBG, "[%s] option refused\r\n", __func__);
+#endif
+				/* RFC 2347: the client terminates the transfer with error code 8 */
+				send_tftp_error(TFTP_ERR_OPTION, (uint8_t *)"option refused");
+				init_tftp();
+				g_progress_state = TFTP_FAIL;
+				break;
+			}
 			set_tftp_state(STATE_OACK);
 			tftp_cancel_timeout();
 			send_tftp_ack(0);
@@ -592,7 +680,8 @@ void TFTP_exit(void)
 
 int TFTP_run(void)
 {
-	uint16_t len, from_port;
+	int len;
+	uint16_t from_port;
 	uint32_t from_ip;
 
 	/* Timeout Process */
@@ -603,7 +692,7 @@ int TFTP_run(void)
 				break;
 
 			case STATE_RRQ:
-				send_tftp_rrq(g_filename, (uint8_t *)TRANS_BINARY, &default_tftp_opt, 1);
+				send_tftp_rrq(g_filename, (uint8_t *)TRANS_BINARY, g_tftp_opt, g_tftp_opt_len);
 				break;
 
 			case STATE_OACK:
@@ -650,7 +739,41 @@ void TFTP_read_request(uint32_t server_ip, uint8_t *filename)
 #endif
 
 	g_progress_state = TFTP_PROGRESS;
-	send_tftp_rrq(filename, (uint8_t *)TRANS_BINARY, &default_tftp_opt, 1);
+	send_tftp_rrq(filename, (uint8_t *)TRANS_BINARY, g_tftp_opt, g_tftp_opt_len);
+}
+
+/*
+ * Request a block size (RFC 2348) and a window size (RFC 7440) in the next TFTP_read_request().
+ * The receive buffer passed to TFTP_init() must hold blksize + 4 bytes, and the socket RX buffer
+ * should hold windowsize blocks (each with an 8 byte UDP header) or the window will overflow.
+ * The server may answer with smaller values, or ignore the options and use 512 byte lock-step.
+ */
+void TFTP_set_options(uint16_t blksize, uint16_t windowsize)
+{
+	if(blksize < 8) blksize = 8;
+	if(blksize > TFTP_BLK_SIZE_MAX) blksize = TFTP_BLK_SIZE_MAX;
+	if(windowsize < 1) windowsize = 1;
+	if(windowsize > TFTP_WINDOW_SIZE_MAX) windowsize = TFTP_WINDOW_SIZE_MAX;
+
+	g_req_blksize = blksize;
+	g_req_windowsize = windowsize;
+	sprintf((char *)g_blksize_str, "%u", blksize);
+	sprintf((char *)g_windowsize_str, "%u", windowsize);
+
+	/* timeout is always sent, blksize and windowsize only when they differ from the default */
+	g_tftp_opt_len = 1;
+	if(blksize != TFTP_BLK_SIZE) g_tftp_opt[g_tftp_opt_len++] = (TFTP_OPTION){ (uint8_t *)"blksize", g_blksize_str };
+	if(windowsize != 1) g_tftp_opt[g_tftp_opt_len++] = (TFTP_OPTION){ (uint8_t *)"windowsize", g_windowsize_str };
+}
+
+uint16_t TFTP_get_blksize(void)
+{
+	return g_blksize;
+}
+
+uint16_t TFTP_get_windowsize(void)
+{
+	return g_windowsize;
 }
 
 void tftp_timeout_handler(void)
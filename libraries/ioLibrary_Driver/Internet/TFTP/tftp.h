@@ -14,7 +14,7 @@ extern "C" {
 #include <stdint.h>
 
 #define F_APP_TFTP
-#define __TFTP_DEBUG__
+//#define __TFTP_DEBUG__ // prints every block, slows transfers down
 
 #define F_STORAGE // If your target support a storage, you have to activate this feature and implement.
 
@@ -43,6 +43,10 @@ extern int dbg_level;
 #define TFTP_ERROR		5
 #define TFTP_OACK		6
 
+/* tftp error code */
+#define TFTP_ERR_OPTION		8		// RFC 2347: option negotiation refused
+#define TFTP_ERROR_MSG_MAX	32
+
 /* tftp state */
 #define STATE_NONE		0
 #define STATE_RRQ		1
@@ -64,6 +68,8 @@ extern int dbg_level;
 #define TFTP_SERVER_PORT		69
 #define TFTP_TEMP_PORT			51000
 #define TFTP_BLK_SIZE			512
+#define TFTP_BLK_SIZE_MAX		1468	// RFC 2348: largest block in one Ethernet frame (1500 - IP 20 - UDP 8 - TFTP 4)
+#define TFTP_WINDOW_SIZE_MAX	64		// RFC 7440
 #define MAX_MTU_SIZE			1514
 #define FILE_NAME_SIZE			20
 
@@ -92,6 +98,9 @@ void TFTP_init(uint8_t socket, uint8_t *buf);
 void TFTP_exit(void);
 int TFTP_run(void);
 void TFTP_read_request(uint32_t server_ip, uint8_t *filename);
+void TFTP_set_options(uint16_t blksize, uint16_t windowsize);
+uint16_t TFTP_get_blksize(void);
+uint16_t TFTP_get_windowsize(void);
 void tftp_timeout_handler(void);
 
 #ifdef __cplusplus
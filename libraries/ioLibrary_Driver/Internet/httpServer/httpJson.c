@@ -0,0 +1,378 @@
+/**
+ @file		httpJson.c
+ @brief 	Streaming JSON encoder / decoder for the HTTP server, without heap allocation.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "socket.h"
+#include "wizchip_conf.h"
+
+#include "httpServer.h"
+#include "httpParser.h"
+#include "httpJson.h"
+
+/* Decoder states */
+#define JSON_READ_START			0
+#define JSON_READ_KEY_WAIT		1
+#define JSON_READ_KEY			2
+#define JSON_READ_COLON			3
+#define JSON_READ_VALUE_WAIT	4
+#define JSON_READ_STRING		5
+#define JSON_READ_LITERAL		6
+#define JSON_READ_SKIP			7
+#define JSON_READ_SKIP_STRING	8
+#define JSON_READ_NEXT			9
+#define JSON_READ_DONE			10
+
+/*****************************************************************************
+ * Encoder
+ ****************************************************************************/
+static void json_flush(st_json_writer * w)
+{
+	if(!w->count_only && w->len) wiz_send_data(w->sn, w->buf, w->len);
+	w->len = 0;
+}
+
+static void json_put(st_json_writer * w, char c)
+{
+	// Never write past the Content-Length counted in the 1st pass
+	if(!w->count_only && w->total >= w->limit) return;
+	// Flush before, not after, so the last bytes stay staged for the final send()
+	if(w->len == JSON_WRITER_CHUNK_SIZE) json_flush(w);
+	w->buf[w->len++] = (uint8_t)c;
+	w->total++;
+}
+
+static void json_puts(st_json_writer * w, const char * str)
+{
+	while(*str) json_put(w, *str++);
+}
+
+static void json_put_string(st_json_writer * w, const char * str)
+{
+	char hex[7];
+
+	json_put(w, '"');
+	for(; *str; str++)
+	{
+		if(*str == '"' || *str == '\\')
+		{
+			json_put(w, '\\');
+			json_put(w, *str);
+		}
+		else if((uint8_t)*str < 0x20)
+		{
+			sprintf(hex, "\\u%04x", (uint8_t)*str);
+			json_puts(w, hex);
+		}
+		else json_put(w, *str);
+	}
+	json_put(w, '"');
+}
+
+/* Separator and key in front of a member */
+static void json_member(st_json_writer * w, const char * key)
+{
+	if(w->comma & (1 << w->depth)) json_put(w, ',');
+	w->comma |= (1 << w->depth);
+	if(key)
+	{
+		json_put_string(w, key);
+		json_put(w, ':');
+	}
+}
+
+static void json_open(st_json_writer * w, const char * key, char c)
+{
+	json_member(w, key);
+	json_put(w, c);
+	if(w->depth < JSON_WRITER_MAX_DEPTH - 1) w->depth++;
+	w->comma &= ~(1 << w->depth);
+}
+
+static void json_close(st_json_writer * w, char c)
+{
+	if(w->depth) w->depth--;
+	json_put(w, c);
+}
+
+void json_object_begin(st_json_writer * w, const char * key)	{ json_open(w, key, '{'); }
+void json_object_end(st_json_writer * w)						{ json_close(w, '}'); }
+void json_array_begin(st_json_writer * w, const char * key)		{ json_open(w, key, '['); }
+void json_array_end(st_json_writer * w)							{ json_close(w, ']'); }
+
+void json_write_string(st_json_writer * w, const char * key, const char * value)
+{
+	json_member(w, key);
+	json_put_string(w, value);
+}
+
+void json_write_int(st_json_writer * w, const char * key, int32_t value)
+{
+	char num[12];
+
+	json_member(w, key);
+	sprintf(num, "%ld", (long)value);
+	json_puts(w, num);
+}
+
+void json_write_bool(st_json_writer * w, const char * key, uint8_t value)
+{
+	json_member(w, key);
+	json_puts(w, value ? "true" : "false");
+}
+
+static void json_writer_init(st_json_writer * w, uint8_t sn, uint8_t count_only, uint32_t limit)
+{
+	memset(w, 0, sizeof(st_json_writer));
+	w->sn = sn;
+	w->count_only = count_only;
+	w->limit = limit;
+}
+
+#define HTTP_JSON_HEAD	"HTTP/1.1 %s\r\nContent-Type: application/json\r\nCache-Control: no-store\r\nContent-Length: %lu\r\n\r\n"
+
+static const char * json_status_text(uint16_t http_status)
+{
+	switch(http_status)
+	{
+		case STATUS_OK:			return "200 OK";
+		case STATUS_CREATED:	return "201 Created";
+		case STATUS_ACCEPTED:	return "202 Accepted";
+		case STATUS_BAD_REQ:	return "400 Bad Request";
+		case STATUS_UNAUTH:		return "401 Unauthorized";
+		case STATUS_FORBIDDEN:	return "403 Forbidden";
+		case STATUS_NOT_FOUND:	return "404 Not Found";
+		case STATUS_TOO_LARGE:	return "413 Payload Too Large";
+		case STATUS_UNSUPPORTED:	return "415 Unsupported Media Type";
+		case STATUS_NOT_IMPL:	return "501 Not Implemented";
+		case STATUS_SERV_UNAVAIL:	return "503 Service Unavailable";
+		case STATUS_INT_SERR:
+		default:				return "500 Internal Server Error";
+	}
+}
+
+static void json_render_too_large(st_json_writer * w, void * arg)
+{
+	json_object_begin(w, NULL);
+	json_write_string(w, "error", "response too large");
+	json_object_end(w);
+}
+
+static uint32_t json_count(uint8_t sn, json_render render, void * arg)
+{
+	st_json_writer w;
+
+	json_writer_init(&w, sn, 1, 0);
+	render(&w, arg);
+	return w.total;
+}
+
+int32_t http_json_response(uint8_t sn, uint16_t http_status, json_render render, void * arg)
+{
+	st_json_writer w;
+	char head[128];
+	uint16_t head_len;
+	uint32_t body_len;
+	int32_t ret;
+
+	// 1st pass: Content-Length
+	body_len = json_count(sn, render, arg);
+	head_len = sprintf(head, HTTP_JSON_HEAD, json_status_text(http_status), (unsigned long)body_len);
+	if((head_len + body_len) > getSn_TxMAX(sn))
+	{
+		// Does not fit one SEND; answer anyway so the client does not wait for a response that never comes
+		render = json_render_too_large;
+		arg = NULL;
+		body_len = json_count(sn, render, arg);
+		head_len = sprintf(head, HTTP_JSON_HEAD, json_status_text(STATUS_INT_SERR), (unsigned long)body_len);
+	}
+
+	// httpServer_run() only dispatches a request once the previous response has left the TX buffer,
+	// so there is room for the whole response; never wait here (the main loop would stall)
+	if(getSn_TX_FSR(sn) < (head_len + body_len))
+	{
+		close(sn);
+		return -1;
+	}
+
+	// 2nd pass: header and body straight to the TX buffer; only the last chunk goes through send().
+	// Pad with spaces if the render came out shorter than counted, so the body always matches Content-Length
+	wiz_send_data(sn, (uint8_t *)head, head_len);
+	json_writer_init(&w, sn, 0, body_len);
+	render(&w, arg);
+	while(w.total < body_len) json_put(&w, ' ');
+	if((ret = send(sn, w.buf, w.len)) == SOCK_BUSY)
+	{
+		close(sn);
+		return -1;
+	}
+
+	return (ret < 0) ? -1 : (int32_t)body_len;
+}
+
+/*****************************************************************************
+ * Decoder
+ ****************************************************************************/
+static uint8_t json_is_space(char c)
+{
+	return (c == ' ' || c == '\t' || c == '\r' || c == '\n');
+}
+
+static char json_unescape(char c)
+{
+	switch(c)
+	{
+		case 'n':	return '\n';
+		case 'r':	return '\r';
+		case 't':	return '\t';
+		case 'b':	return '\b';
+		case 'f':	return '\f';
+		default:	return c; // '"', '\\', '/'; '\uXXXX' is kept as 'uXXXX'
+	}
+}
+
+static void json_append(char * str, uint8_t * len, uint8_t size, char c)
+{
+	if(*len < size - 1)
+	{
+		str[(*len)++] = c;
+		str[*len] = '\0';
+	}
+}
+
+static void json_emit(st_json_reader * r)
+{
+	if(r->type == JSON_TYPE_NUMBER)
+	{
+		if(!strcmp(r->value, "true"))		r->type = JSON_TYPE_TRUE;
+		else if(!strcmp(r->value, "false"))	r->type = JSON_TYPE_FALSE;
+		else if(!strcmp(r->value, "null"))	r->type = JSON_TYPE_NULL;
+	}
+	if(r->cb) r->cb(r->arg, r->key, r->type, r->value);
+	r->state = JSON_READ_NEXT;
+}
+
+void json_reader_init(st_json_reader * r, json_member_cb cb, void * arg)
+{
+	memset(r, 0, sizeof(st_json_reader));
+	r->cb = cb;
+	r->arg = arg;
+}
+
+int8_t json_reader_feed(st_json_reader * r, const uint8_t * buf, uint16_t len)
+{
+	uint16_t i;
+	char c;
+
+	for(i = 0; i < len; i++)
+	{
+		c = (char)buf[i];
+		switch(r->state)
+		{
+			case JSON_READ_START:
+				if(c == '{') r->state = JSON_READ_KEY_WAIT;
+				else if(!json_is_space(c)) return JSON_READER_ERROR;
+				break;
+
+			case JSON_READ_KEY_WAIT:
+				if(c == '"')
+				{
+					r->key_len = 0;
+					r->key[0] = '\0';
+					r->state = JSON_READ_KEY;
+				}
+				else if(c == '}') r->state = JSON_READ_DONE;
+				else if(!json_is_space(c)) return JSON_READER_ERROR;
+				break;
+
+			case JSON_READ_KEY:
+				if(r->escape)
+				{
+					json_append(r->key, &r->key_len, JSON_READER_KEY_SIZE, json_unescape(c));
+					r->escape = 0;
+				}
+				else if(c == '\\') r->escape = 1;
+				else if(c == '"') r->state = JSON_READ_COLON;
+				else json_append(r->key, &r->key_len, JSON_READER_KEY_SIZE, c);
+				break;
+
+			case JSON_READ_COLON:
+				if(c == ':') r->state = JSON_READ_VALUE_WAIT;
+				else if(!json_is_space(c)) return JSON_READER_ERROR;
+				break;
+
+			case JSON_READ_VALUE_WAIT:
+				r->value_len = 0;
+				r->value[0] = '\0';
+				if(c == '"')
+				{
+					r->type = JSON_TYPE_STRING;
+					r->state = JSON_READ_STRING;
+				}
+				else if(c == '{' || c == '[')
+				{
+					r->skip_depth = 1;
+					r->state = JSON_READ_SKIP;
+				}
+				else if(c == '-' || (c >= '0' && c <= '9') || c == 't' || c == 'f' || c == 'n')
+				{
+					// true / false / null are told apart when the literal ends
+					r->type = JSON_TYPE_NUMBER;
+					json_append(r->value, &r->value_len, JSON_READER_VALUE_SIZE, c);
+					r->state = JSON_READ_LITERAL;
+				}
+				else if(!json_is_space(c)) return JSON_READER_ERROR;
+				break;
+
+			case JSON_READ_STRING:
+				if(r->escape)
+				{
+					json_append(r->value, &r->value_len, JSON_READER_VALUE_SIZE, json_unescape(c));
+					r->escape = 0;
+				}
+				else if(c == '\\') r->escape = 1;
+				else if(c == '"') json_emit(r);
+				else json_append(r->value, &r->value_len, JSON_READER_VALUE_SIZE, c);
+				break;
+
+			case JSON_READ_LITERAL:
+				if((c >= '0' && c <= '9') || (c >= 'a' && c <= 'z') || c == '.' || c == '-' || c == '+' || c == 'E')
+				{
+					json_append(r->value, &r->value_len, JSON_READER_VALUE_SIZE, c);
+					break;
+				}
+				json_emit(r);
+				// the character ending the literal belongs to JSON_READ_NEXT
+				if(c == ',') r->state = JSON_READ_KEY_WAIT;
+				else if(c == '}') r->state = JSON_READ_DONE;
+				else if(!json_is_space(c)) return JSON_READER_ERROR;
+				break;
+
+			case JSON_READ_SKIP:
+				if(c == '"') r->state = JSON_READ_SKIP_STRING;
+				else if(c == '{' || c == '[') r->skip_depth++;
+				else if((c == '}' || c == ']') && --r->skip_depth == 0) r->state = JSON_READ_NEXT;
+				break;
+
+			case JSON_READ_SKIP_STRING:
+				if(r->escape) r->escape = 0;
+				else if(c == '\\') r->escape = 1;
+				else if(c == '"') r->state = JSON_READ_SKIP;
+				break;
+
+			case JSON_READ_NEXT:
+				if(c == ',') r->state = JSON_READ_KEY_WAIT;
+				else if(c == '}') r->state = JSON_READ_DONE;
+				else if(!json_is_space(c)) return JSON_READER_ERROR;
+				break;
+
+			case JSON_READ_DONE:
+			default:
+				return JSON_READER_DONE;
+		}
+	}
+	return (r->state == JSON_READ_DONE) ? JSON_READER_DONE : JSON_READER_MORE;
+}
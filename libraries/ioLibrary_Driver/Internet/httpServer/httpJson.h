@@ -0,0 +1,94 @@
+/**
+ @file		httpJson.h
+ @brief 	Streaming JSON encoder / decoder for the HTTP server, without heap allocation.
+ */
+
+#include <stdint.h>
+
+#ifndef	__HTTPJSON_H__
+#define	__HTTPJSON_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*********************************************
+* JSON Encoder
+*********************************************/
+// Encoded bytes are staged in this many bytes and written straight to the socket TX buffer
+#define JSON_WRITER_CHUNK_SIZE		64
+#define JSON_WRITER_MAX_DEPTH		8
+
+typedef struct _st_json_writer
+{
+	uint8_t		sn;				// socket the JSON is written to
+	uint8_t		count_only;		// only count the length (for Content-Length)
+	uint8_t		depth;			// nesting depth of object / array
+	uint8_t		comma;			// bit n: a member is already written at depth n
+	uint16_t	len;			// staged bytes in buf
+	uint32_t	total;			// encoded length
+	uint32_t	limit;			// bytes written at most (the counted Content-Length)
+	uint8_t		buf[JSON_WRITER_CHUNK_SIZE];
+}st_json_writer;
+
+/* 'key' is NULL for an array element or the top-level value */
+void json_object_begin(st_json_writer * w, const char * key);
+void json_object_end(st_json_writer * w);
+void json_array_begin(st_json_writer * w, const char * key);
+void json_array_end(st_json_writer * w);
+void json_write_string(st_json_writer * w, const char * key, const char * value);
+void json_write_int(st_json_writer * w, const char * key, int32_t value);
+void json_write_bool(st_json_writer * w, const char * key, uint8_t value);
+
+/*
+ * Send a JSON response; 'render' is called twice, once to count the Content-Length and once to write
+ * the body to the socket TX buffer behind the header. Both passes must produce the same output, so
+ * 'render' reads a snapshot taken before the call, not live state. A response larger than the socket
+ * TX buffer is answered with 500. Never waits; returns the body length, or -1 on failure.
+ */
+typedef void (*json_render)(st_json_writer * w, void * arg);
+int32_t http_json_response(uint8_t sn, uint16_t http_status, json_render render, void * arg);
+
+/*********************************************
+* JSON Decoder
+*********************************************/
+#define JSON_READER_KEY_SIZE		24
+#define JSON_READER_VALUE_SIZE		72		// fits a SHA-256 digest in hex
+
+/* Value types passed to json_member_cb */
+#define JSON_TYPE_STRING			1
+#define JSON_TYPE_NUMBER			2
+#define JSON_TYPE_TRUE				3
+#define JSON_TYPE_FALSE				4
+#define JSON_TYPE_NULL				5
+
+/* json_reader_feed() return value */
+#define JSON_READER_MORE			0		// the object is not complete yet
+#define JSON_READER_DONE			1		// the object is complete
+#define JSON_READER_ERROR			-1		// not a JSON object
+
+/* Called for each member of the top-level object; nested objects / arrays are skipped */
+typedef void (*json_member_cb)(void * arg, const char * key, uint8_t type, const char * value);
+
+typedef struct _st_json_reader
+{
+	uint8_t		state;
+	uint8_t		type;			// type of the value being read
+	uint8_t		escape;			// previous character was '\'
+	uint8_t		skip_depth;		// depth of the nested value being skipped
+	uint8_t		key_len;
+	uint8_t		value_len;
+	char		key[JSON_READER_KEY_SIZE];		// truncated when longer
+	char		value[JSON_READER_VALUE_SIZE];	// truncated when longer
+	json_member_cb	cb;
+	void *		arg;
+}st_json_reader;
+
+void json_reader_init(st_json_reader * r, json_member_cb cb, void * arg);
+int8_t json_reader_feed(st_json_reader * r, const uint8_t * buf, uint16_t len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
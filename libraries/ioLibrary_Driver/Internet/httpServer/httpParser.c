@@ -69,6 +69,7 @@ void make_http_response_head(
 	else if (type == PTYPE_WOFF)	head = RES_WOFFHEAD_OK;
 	else if (type == PTYPE_EOT)		head = RES_EOTHEAD_OK;
 	else if (type == PTYPE_SVG)		head = RES_SVGHEAD_OK;
+	else if (type == PTYPE_BIN)		head = RES_BINHEAD_OK;
 #ifdef _HTTPPARSER_DEBUG_
 	else
 	{
@@ -117,53 +118,317 @@ void find_http_uri_type(
 	else if (strstr(buf, ".woff") 	|| strstr(buf,".WOFF"))	*type = PTYPE_WOFF;
 	else if (strstr(buf, ".eot") 	|| strstr(buf,".EOT"))	*type = PTYPE_EOT;
 	else if (strstr(buf, ".svg") 	|| strstr(buf,".SVG"))	*type = PTYPE_SVG;
+	else if (strstr(buf, ".bin") 	|| strstr(buf,".BIN"))	*type = PTYPE_BIN;
 	else 													*type = PTYPE_ERR;
 }
 
 
+/* Headers the parser keeps */
+#define HTTP_HEADER_OTHER			0
+#define HTTP_HEADER_CONTENT_LEN		1
+#define HTTP_HEADER_ACCEPT_ENC		2
+#define HTTP_HEADER_IF_NONE_MATCH	3
+#define HTTP_HEADER_CONNECTION		4
+#define HTTP_HEADER_CONTENT_TYPE	5
+#define HTTP_HEADER_TOKEN			6
+
+/* Media type of a JSON body, parameters such as "; charset=utf-8" may follow */
+#define HTTP_CONTENT_JSON			"application/json"
+
+/* 'Connection' header values */
+#define HTTP_CONNECTION_DEFAULT		0
+#define HTTP_CONNECTION_CLOSE		1
+#define HTTP_CONNECTION_KEEP_ALIVE	2
+
+static uint8_t http_token_equal(char * token, uint8_t len, const char * name)
+{
+	return (strlen(name) == len) && !memcmp(token, name, len);
+}
+
+static char http_tolower(char c)
+{
+	return (c >= 'A' && c <= 'Z') ? c + ('a' - 'A') : c;
+}
+
+/* Search a keyword in the header value one character at a time; the keywords do not repeat their first character */
+static uint8_t http_match_keyword(st_http_parser * parser, char c, const char * keyword)
+{
+	c = http_tolower(c);
+	if(c == keyword[parser->match]) parser->match++;
+	else parser->match = (c == keyword[0]) ? 1 : 0;
+
+	if(keyword[parser->match] == '\0')
+	{
+		parser->match = 0;
+		return 1;
+	}
+	return 0;
+}
+
+static void http_parser_method(st_http_parser * parser, st_http_request * request)
+{
+	if(http_token_equal(parser->token, parser->pos, "GET") || http_token_equal(parser->token, parser->pos, "get"))
+		request->METHOD = METHOD_GET;
+	else if(http_token_equal(parser->token, parser->pos, "HEAD") || http_token_equal(parser->token, parser->pos, "head"))
+		request->METHOD = METHOD_HEAD;
+	else if(http_token_equal(parser->token, parser->pos, "POST") || http_token_equal(parser->token, parser->pos, "post"))
+		request->METHOD = METHOD_POST;
+	else
+		request->METHOD = METHOD_ERR;
+}
+
+static void http_parser_header(st_http_parser * parser, st_http_request * request)
+{
+	if(http_token_equal(parser->token, parser->pos, "content-length"))
+	{
+		// Two 'Content-Length' headers would add their digits together; reject the request instead
+		if(parser->content_len_seen) request->METHOD = METHOD_ERR;
+		parser->content_len_seen = 1;
+		parser->header = HTTP_HEADER_CONTENT_LEN;
+	}
+	else if(http_token_equal(parser->token, parser->pos, "accept-encoding"))	parser->header = HTTP_HEADER_ACCEPT_ENC;
+	else if(http_token_equal(parser->token, parser->pos, "if-none-match"))		parser->header = HTTP_HEADER_IF_NONE_MATCH;
+	else if(http_token_equal(parser->token, parser->pos, "connection"))			parser->header = HTTP_HEADER_CONNECTION;
+	else if(http_token_equal(parser->token, parser->pos, "content-type"))
+	{
+		request->CONTENT_JSON = 0;
+		parser->header = HTTP_HEADER_CONTENT_TYPE;
+	}
+	else if(http_token_equal(parser->token, parser->pos, "x-token"))
+	{
+		request->TOKEN[0] = '\0';
+		parser->header = HTTP_HEADER_TOKEN;
+	}
+	else																		parser->header = HTTP_HEADER_OTHER;
+	parser->pos = 0;
+	parser->match = 0;
+}
+
+static void http_parser_value(st_http_parser * parser, st_http_request * request, char c)
+{
+	switch(parser->header)
+	{
+		case HTTP_HEADER_CONTENT_LEN:
+			// Anything larger than the buffer is rejected anyway; stop before the value wraps
+			if(c >= '0' && c <= '9')
+			{
+				if(parser->content_len < MAX_URI_SIZE) parser->content_len = parser->content_len * 10 + (c - '0');
+			}
+			else if(c != ' ' && c != '\t') request->METHOD = METHOD_ERR;
+			break;
+		case HTTP_HEADER_ACCEPT_ENC:
+			if(http_match_keyword(parser, c, "gzip")) request->ACCEPT_GZIP = 1;
+			break;
+		case HTTP_HEADER_IF_NONE_MATCH:
+			if(parser->pos < MAX_ETAG_SIZE - 1)
+			{
+				request->IF_NONE_MATCH[parser->pos++] = c;
+				request->IF_NONE_MATCH[parser->pos] = '\0';
+			}
+			break;
+		case HTTP_HEADER_CONTENT_TYPE:
+			if(parser->pos < strlen(HTTP_CONTENT_JSON))
+			{
+				if(http_tolower(c) != HTTP_CONTENT_JSON[parser->pos]) parser->header = HTTP_HEADER_OTHER;
+				else if(++parser->pos == strlen(HTTP_CONTENT_JSON)) request->CONTENT_JSON = 1;
+			}
+			else if(parser->pos == strlen(HTTP_CONTENT_JSON))
+			{
+				// "application/jsonp" is another type
+				if(c != ';' && c != ' ' && c != '\t') request->CONTENT_JSON = 0;
+				parser->pos++;
+			}
+			break;
+		case HTTP_HEADER_TOKEN:
+			if(parser->pos < MAX_TOKEN_SIZE - 1)
+			{
+				request->TOKEN[parser->pos++] = c;
+				request->TOKEN[parser->pos] = '\0';
+			}
+			else request->TOKEN[0] = '\0'; // longer than any token, never matches
+			break;
+		case HTTP_HEADER_CONNECTION:
+			// "close" or "keep-alive"; told apart by the first character
+			if(parser->pos == 0)
+			{
+				if(http_tolower(c) == 'c') parser->connection = HTTP_CONNECTION_CLOSE;
+				else if(http_tolower(c) == 'k') parser->connection = HTTP_CONNECTION_KEEP_ALIVE;
+				parser->pos = 1;
+			}
+			break;
+		default:
+			break;
+	}
+}
+
+/* The whole request is parsed; decide whether the connection persists */
+static void http_parser_done(st_http_parser * parser, st_http_request * request)
+{
+	if(parser->connection == HTTP_CONNECTION_CLOSE)				request->KEEP_ALIVE = 0;
+	else if(parser->connection == HTTP_CONNECTION_KEEP_ALIVE)	request->KEEP_ALIVE = 1;
+	else														request->KEEP_ALIVE = (parser->version >= 1); // HTTP/1.1 default
+	parser->state = HTTP_PARSE_DONE;
+}
+
+/* The blank line ending the header is parsed; the body follows if any */
+static void http_parser_header_end(st_http_parser * parser, st_http_request * request)
+{
+	parser->uri_len++; // body is stored after the '\0' of URI
+	request->URI[parser->uri_len] = '\0';
+	if(parser->content_len > (uint32_t)(MAX_URI_SIZE - 1 - parser->uri_len))
+	{
+		// The body is left unread, so the connection cannot carry another request
+		request->BODY_TOO_LARGE = 1;
+		http_parser_done(parser, request);
+		request->KEEP_ALIVE = 0;
+	}
+	else if(parser->content_len > 0) parser->state = HTTP_PARSE_BODY;
+	else http_parser_done(parser, request);
+}
+
 /**
- @brief	parse http request from a peer
+ @brief	reset the parser and the request for the next request
+ */
+void http_parser_init(
+	st_http_parser * parser, 	/**< parser state */
+	st_http_request * request	/**< request to be returned */
+	)
+{
+	memset(parser, 0, sizeof(st_http_parser));
+	request->METHOD = METHOD_ERR;
+	request->TYPE = PTYPE_ERR;
+	request->ACCEPT_GZIP = 0;
+	request->KEEP_ALIVE = 0;
+	request->BODY_TOO_LARGE = 0;
+	request->CONTENT_JSON = 0;
+	request->BODY_LEN = 0;
+	request->IF_NONE_MATCH[0] = '\0';
+	request->TOKEN[0] = '\0';
+	request->URI[0] = '\0';
+}
+
+/**
+ @brief	parse received bytes of a request; may be called again with the following bytes
+ @return	number of bytes consumed; bytes after the end of the request (pipelined request) are not consumed
+ */
+uint16_t http_parser_execute(
+	st_http_parser * parser, 	/**< parser state, kept between calls */
+	st_http_request * request,	/**< request to be returned */
+	uint8_t * buf,				/**< received bytes */
+	uint16_t len				/**< length of buf */
+	)
+{
+	uint16_t i;
+	char c;
+
+	for(i = 0; i < len && parser->state != HTTP_PARSE_DONE; i++)
+	{
+		c = (char)buf[i];
+		switch(parser->state)
+		{
+			case HTTP_PARSE_METHOD:
+				if(c == ' ')
+				{
+					http_parser_method(parser, request);
+					parser->pos = 0;
+					parser->state = HTTP_PARSE_URI;
+				}
+				else if(c == '\r' || c == '\n')
+				{
+					if(parser->pos) // request line without URI
+					{
+						request->METHOD = METHOD_ERR;
+						parser->state = (c == '\n') ? HTTP_PARSE_HEADER_NAME : HTTP_PARSE_VERSION;
+					}
+				}
+				else if(parser->pos < HTTP_PARSER_TOKEN_SIZE) parser->token[parser->pos++] = c;
+				else request->METHOD = METHOD_ERR;
+				break;
+
+			case HTTP_PARSE_URI:
+				if(c == ' ' || c == '\r' || c == '\n')
+				{
+					request->URI[parser->uri_len] = '\0';
+					parser->state = (c == '\n') ? HTTP_PARSE_HEADER_NAME : HTTP_PARSE_VERSION;
+				}
+				else if(parser->uri_len < MAX_URI_SIZE - 2) request->URI[parser->uri_len++] = c; // room for '\0' and an empty body
+				else request->METHOD = METHOD_ERR; // URI too long
+				break;
+
+			case HTTP_PARSE_VERSION:
+				// "HTTP/1.x"; only the minor version is kept
+				if(c == '\n')
+				{
+					parser->pos = 0;
+					parser->state = HTTP_PARSE_HEADER_NAME;
+				}
+				else if(c >= '0' && c <= '9') parser->version = c - '0';
+				break;
+
+			case HTTP_PARSE_HEADER_NAME:
+				if(c == '\r' && parser->pos == 0) parser->state = HTTP_PARSE_HEADER_END;
+				else if(c == '\n' && parser->pos == 0) http_parser_header_end(parser, request); // bare '\n' ends the header too
+				else if(c == ':')
+				{
+					http_parser_header(parser, request);
+					parser->state = HTTP_PARSE_HEADER_VALUE;
+				}
+				else if(c == '\n') parser->pos = 0; // line without ':'
+				else if(parser->pos < HTTP_PARSER_TOKEN_SIZE) parser->token[parser->pos++] = http_tolower(c);
+				break;
+
+			case HTTP_PARSE_HEADER_VALUE:
+				if(c == '\n')
+				{
+					parser->pos = 0;
+					parser->state = HTTP_PARSE_HEADER_NAME;
+				}
+				else if(c == '\r') ;
+				else if((c == ' ' || c == '\t') && parser->pos == 0 && parser->header != HTTP_HEADER_OTHER) ; // leading white space
+				else http_parser_value(parser, request, c);
+				break;
+
+			case HTTP_PARSE_HEADER_END:
+				if(c == '\n') http_parser_header_end(parser, request);
+				break;
+
+			case HTTP_PARSE_BODY:
+				// 'Content-Length' was checked against the room left at the end of the header
+				request->URI[parser->uri_len++] = c;
+				request->URI[parser->uri_len] = '\0';
+				if(++request->BODY_LEN >= parser->content_len) http_parser_done(parser, request);
+				break;
+
+			default:
+				break;
+		}
+	}
+	return i;
+}
+
+/**
+ @brief	get the request body, null terminated
+ */
+uint8_t * get_http_body(
+	st_http_request * request	/**< parsed request */
+	)
+{
+	return request->URI + strlen((char *)request->URI) + 1;
+}
+
+/**
+ @brief	parse http request from a peer; the whole request is in buf
  */ 
 void parse_http_request(
 	st_http_request * request, 	/**< request to be returned */
 	uint8_t * buf				/**< pointer to be parsed */
 	)
 {
-  char * nexttok;
-  nexttok = strtok((char*)buf," ");
-  if(!nexttok)
-  {
-    request->METHOD = METHOD_ERR;
-    return;
-  }
-  if(!strcmp(nexttok, "GET") || !strcmp(nexttok,"get"))
-  {
-    request->METHOD = METHOD_GET;
-    nexttok = strtok(NULL," ");
-
-  }
-  else if (!strcmp(nexttok, "HEAD") || !strcmp(nexttok,"head"))
-  {
-    request->METHOD = METHOD_HEAD;
-    nexttok = strtok(NULL," ");
-
-  }
-  else if (!strcmp(nexttok, "POST") || !strcmp(nexttok,"post"))
-  {
-    nexttok = strtok(NULL,"\0");
-    request->METHOD = METHOD_POST;
-  }
-  else
-  {
-    request->METHOD = METHOD_ERR;
-  }
-
-  if(!nexttok)
-  {
-    request->METHOD = METHOD_ERR;
-    return;
-  }
-  strcpy((char *)request->URI, nexttok);
+	st_http_parser parser;
+
+	http_parser_init(&parser, request);
+	http_parser_execute(&parser, request, buf, strlen((char *)buf));
+	if(parser.state != HTTP_PARSE_DONE) request->METHOD = METHOD_ERR;
 }
 
 #ifdef _OLD_
@@ -200,6 +465,7 @@ uint8_t * get_http_param_value(
 #else
 /**
  @brief	get next parameter value in the request
+ @note	'uri' is the form body of a POST request, see get_http_body()
  */
 uint8_t * get_http_param_value(char* uri, char* param_name)
 {
@@ -207,19 +473,10 @@ uint8_t * get_http_param_value(char* uri, char* param_name)
 	uint8_t * name = 0;
 	uint8_t * ret = BUFPUB;
 	uint8_t * pos2;
-	uint16_t len = 0, content_len = 0;
-	uint8_t tmp_buf[10]={0x00, };
+	uint16_t len = 0;
 
 	if(!uri || !param_name) return 0;
 
-	/***************/
-	mid(uri, "Content-Length: ", "\r\n", (char *)tmp_buf);
-	content_len = ATOI(tmp_buf, 10);
-	uri = strstr(uri, "\r\n\r\n");
-	uri += 4;
-	uri[content_len] = 0;
-	/***************/
-
 	if((name = (uint8_t *)strstr(uri, param_name)))
 	{
 		name += strlen(param_name) + 1;
@@ -44,6 +44,7 @@ extern "C" {
 #define		PTYPE_WOFF		22		/**< Font type: WOFF file. */
 #define		PTYPE_EOT		23		/**< Font type: EOT file. */
 #define		PTYPE_SVG		24		/**< Font type: SVG file. */
+#define		PTYPE_BIN		25		/**< Binary data (octet-stream). */
 
 
 /* HTTP response */
@@ -58,6 +59,8 @@ extern "C" {
 #define		STATUS_UNAUTH		401
 #define		STATUS_FORBIDDEN	403
 #define		STATUS_NOT_FOUND	404
+#define		STATUS_TOO_LARGE	413
+#define		STATUS_UNSUPPORTED	415
 #define		STATUS_INT_SERR		500
 #define		STATUS_NOT_IMPL		501
 #define		STATUS_BAD_GATEWAY	502
@@ -65,6 +68,8 @@ extern "C" {
 
 /* HTML Doc. for ERROR */
 static const char  	ERROR_HTML_PAGE[] = "HTTP/1.1 404 Not Found\r\nContent-Type: text/html\r\nContent-Length: 78\r\n\r\n<HTML>\r\n<BODY>\r\nSorry, the page you requested was not found.\r\n</BODY>\r\n</HTML>\r\n\0";
+static const char 	ERROR_TOO_LARGE_PAGE[] = "HTTP/1.1 413 Payload Too Large\r\nContent-Type: text/html\r\nContent-Length: 54\r\nConnection: close\r\n\r\n<HTML>\r\n<BODY>\r\nRequest too large.\r\n</BODY>\r\n</HTML>\r\n\0";
+static const char 	ERROR_UNAVAIL_PAGE[] = "HTTP/1.1 503 Service Unavailable\r\nContent-Type: text/html\r\nContent-Length: 59\r\nRetry-After: 5\r\n\r\n<HTML>\r\n<BODY>\r\nToo many event streams.\r\n</BODY>\r\n</HTML>\r\n\0";
 static const char 	ERROR_REQUEST_PAGE[] = "HTTP/1.1 400 OK\r\nContent-Type: text/html\r\nContent-Length: 50\r\n\r\n<HTML>\r\n<BODY>\r\nInvalid request.\r\n</BODY>\r\n</HTML>\r\n\0";
 
 /* HTML Doc. for CGI result  */
@@ -120,6 +125,13 @@ static const char 	ERROR_REQUEST_PAGE[] = "HTTP/1.1 400 OK\r\nContent-Type: text
 
 /* Response head for SVG, Font */
 #define RES_SVGHEAD_OK	"HTTP/1.1 200 OK\r\nContent-Type: image/svg+xml\r\nContent-Length: "
+#define RES_BINHEAD_OK	"HTTP/1.1 200 OK\r\nContent-Type: application/octet-stream\r\nContent-Length: "
+
+/* Response head for server-sent events */
+#define RES_EVENTHEAD_OK	"HTTP/1.1 200 OK\r\nContent-Type: text/event-stream\r\nCache-Control: no-cache\r\nConnection: keep-alive\r\n"
+
+/* Response head for cached content, not modified */
+#define RES_NOT_MODIFIED	"HTTP/1.1 304 Not Modified\r\n"
 
 /**
  @brief 	Structure of HTTP REQUEST 
@@ -127,17 +139,59 @@ static const char 	ERROR_REQUEST_PAGE[] = "HTTP/1.1 400 OK\r\nContent-Type: text
 
 //#define MAX_URI_SIZE	1461
 #define MAX_URI_SIZE	512
+#define MAX_ETAG_SIZE	64
+#define MAX_TOKEN_SIZE	33
 
 typedef struct _st_http_request
 {
 	uint8_t	METHOD;						/**< request method(METHOD_GET...). */
 	uint8_t	TYPE;						/**< request type(PTYPE_HTML...).   */
-	uint8_t	URI[MAX_URI_SIZE];			/**< request file name.             */
+	uint8_t	ACCEPT_GZIP;				/**< 'Accept-Encoding' includes gzip. */
+	uint8_t	KEEP_ALIVE;					/**< connection persists after the response. */
+	uint8_t	BODY_TOO_LARGE;				/**< 'Content-Length' does not fit after the URI; the body is not read. */
+	uint8_t	CONTENT_JSON;				/**< 'Content-Type' is application/json. */
+	uint16_t	BODY_LEN;				/**< length of the body stored after the URI, always the whole body. */
+	uint8_t	IF_NONE_MATCH[MAX_ETAG_SIZE];	/**< 'If-None-Match' header value.  */
+	uint8_t	TOKEN[MAX_TOKEN_SIZE];		/**< 'X-Token' header value, shared secret of the application. */
+	uint8_t	URI[MAX_URI_SIZE];			/**< request file name, followed by '\0' and the body. */
 }st_http_request;
 
+/**
+ @brief 	Incremental HTTP request parser
+ */
+
+/* Parser states */
+#define		HTTP_PARSE_METHOD		0		/**< Request line: method. */
+#define		HTTP_PARSE_URI			1		/**< Request line: URI. */
+#define		HTTP_PARSE_VERSION		2		/**< Request line: HTTP version. */
+#define		HTTP_PARSE_HEADER_NAME	3		/**< Header name, or the blank line ending the header. */
+#define		HTTP_PARSE_HEADER_VALUE	4		/**< Header value. */
+#define		HTTP_PARSE_HEADER_END	5		/**< '\r' of the blank line seen. */
+#define		HTTP_PARSE_BODY			6		/**< Body, 'Content-Length' bytes. */
+#define		HTTP_PARSE_DONE			7		/**< Whole request parsed. */
+
+#define		HTTP_PARSER_TOKEN_SIZE	20
+
+typedef struct _st_http_parser
+{
+	uint8_t		state;						/**< parser state(HTTP_PARSE_METHOD...). */
+	uint8_t		header;						/**< header being parsed. */
+	uint8_t		pos;						/**< length of 'token'. */
+	uint8_t		match;						/**< matched length of the keyword searched in the header value. */
+	uint8_t		version;					/**< minor version of HTTP/1.x. */
+	uint8_t		connection;					/**< 'Connection' header value. */
+	uint8_t		content_len_seen;			/**< 'Content-Length' header already parsed. */
+	uint16_t	uri_len;					/**< length of 'URI' and the body stored so far. */
+	uint32_t	content_len;				/**< 'Content-Length' header value. */
+	char		token[HTTP_PARSER_TOKEN_SIZE];	/**< method, version or lower-case header name. */
+}st_http_parser;
+
 // HTTP Parsing functions
 void unescape_http_url(char * url);								/* convert escape character to ascii */
 void parse_http_request(st_http_request *, uint8_t *);			/* parse request from peer */
+void http_parser_init(st_http_parser *, st_http_request *);		/* reset the parser for the next request */
+uint16_t http_parser_execute(st_http_parser *, st_http_request *, uint8_t *, uint16_t);	/* parse received bytes, return consumed length */
+uint8_t * get_http_body(st_http_request *);						/* get the request body */
 void find_http_uri_type(uint8_t *, uint8_t *);					/* find MIME type of a file */
 void make_http_response_head(char *, char, uint32_t);			/* make response header */
 uint8_t * get_http_param_value(char* uri, char* param_name);	/* get the user-specific parameter value */
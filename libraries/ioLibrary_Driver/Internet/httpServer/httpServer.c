@@ -21,7 +21,8 @@
  * Private types/enumerations/variables
  ****************************************************************************/
 static uint8_t HTTPSock_Num[_WIZCHIP_SOCK_NUM_] = {0, };
-static st_http_request * http_request;				/**< Pointer to received HTTP request */
+static uint8_t HTTPSock_Cnt = 0;
+static uint8_t * http_request;						/**< Pointer to received HTTP request bytes */
 static st_http_request * parsed_http_request;		/**< Pointer to parsed HTTP request */
 static uint8_t * http_response;						/**< Pointer to HTTP response */
 
@@ -30,6 +31,30 @@ static uint8_t * http_response;						/**< Pointer to HTTP response */
 
 // Number of registered web content in code flash memory
 static uint16_t total_content_cnt = 0;
+
+// Server-sent events
+static uint8_t http_event_uri[MAX_CONTENT_NAME_LEN] = {0, };
+static void (*http_event_on_open)(uint8_t s) = NULL;
+static uint32_t http_event_drop = 0;
+
+typedef struct _st_http_event_queue
+{
+	uint16_t	len;
+	uint16_t	tx_free;	// getSn_TX_FSR() after the last send; a larger value means the client read something
+	uint8_t		buf[HTTP_EVENT_QUEUE_SIZE];
+}st_http_event_queue;
+
+static st_http_event_queue http_event_queue[_WIZCHIP_SOCK_NUM_];
+
+// REST handlers
+typedef struct _st_http_rest_route
+{
+	uint8_t				prefix[MAX_CONTENT_NAME_LEN];
+	http_rest_handler	handler;
+}st_http_rest_route;
+
+static st_http_rest_route http_rest_route[MAX_REST_HANDLER];
+static uint8_t http_rest_route_cnt = 0;
 /*****************************************************************************
  * Public types/enumerations/variables
  ****************************************************************************/
@@ -52,11 +77,21 @@ void httpServer_Sockinit(uint8_t cnt, uint8_t * socklist);
 static uint8_t getHTTPSocketNum(uint8_t seqnum);
 static int8_t getHTTPSequenceNum(uint8_t socket);
 static int8_t http_disconnect(uint8_t sn);
+static uint16_t http_recv_peek(uint8_t sn, uint8_t * buf, uint16_t len);
+static void http_recv_consume(uint8_t sn, uint16_t len);
+static void http_reclaim_idle_socket(void);
 
 static void http_process_handler(uint8_t s, st_http_request * p_http_request);
+static uint8_t http_rest_dispatch(uint8_t s, st_http_request * p_http_request, uint8_t * uri_name);
 static void send_http_response_header(uint8_t s, uint8_t content_type, uint32_t body_len, uint16_t http_status);
 static void send_http_response_body(uint8_t s, uint8_t * uri_name, uint8_t * buf, uint32_t start_addr, uint32_t file_len);
 static void send_http_response_cgi(uint8_t s, uint8_t * buf, uint8_t * http_body, uint16_t file_len);
+static uint8_t find_http_static_content(uint8_t * uri_name, uint8_t accept_gzip, uint16_t * content_num, uint32_t * file_len);
+static void send_http_response_static(uint8_t s, st_http_request * p_http_request, uint16_t content_num);
+static void send_http_response_stream(uint8_t s);
+static void send_http_event_stream_header(uint8_t s);
+static void send_http_event_queue(uint8_t s);
+static uint8_t http_event_stream_cnt(void);
 
 /*****************************************************************************
  * Public functions
@@ -76,6 +111,7 @@ void httpServer_Sockinit(uint8_t cnt, uint8_t * socklist)
 		// Mapping the H/W socket numbers to the sequential index numbers
 		HTTPSock_Num[i] = socklist[i];
 	}
+	HTTPSock_Cnt = cnt;
 }
 
 static uint8_t getHTTPSocketNum(uint8_t seqnum)
@@ -118,19 +154,20 @@ void httpServer_run(uint8_t seqnum)
 {
 	uint8_t s;	// socket number
 	uint16_t len;
-	uint32_t gettime = 0;
 
 #ifdef _HTTPSERVER_DEBUG_
 	uint8_t destip[4] = {0, };
 	uint16_t destport = 0;
 #endif
 
-	http_request = (st_http_request *)pHTTP_RX;		// Structure of HTTP Request
-	parsed_http_request = (st_http_request *)pHTTP_TX;
+	http_request = pHTTP_RX;		// Received bytes of HTTP Request
 
 	// Get the H/W socket number
 	s = getHTTPSocketNum(seqnum);
 
+	// Request parsed so far on this socket
+	parsed_http_request = &HTTPSock_Status[seqnum].request;
+
 	/* HTTP Service Start */
 	switch(getSn_SR(s))
 	{
@@ -139,6 +176,11 @@ void httpServer_run(uint8_t seqnum)
 			if(getSn_IR(s) & Sn_IR_CON)
 			{
 				setSn_IR(s, Sn_IR_CON);
+				HTTPSock_Status[seqnum].keep_alive = 0;
+				HTTPSock_Status[seqnum].last_active = get_httpServer_timecount();
+
+				// New client took the last listening socket; free the least recently used idle one for the next client
+				http_reclaim_idle_socket();
 			}
 
 			// HTTP Process states
@@ -146,14 +188,19 @@ void httpServer_run(uint8_t seqnum)
 			{
 
 				case STATE_HTTP_IDLE :
-					if ((len = getSn_RX_RSR(s)) > 0)
+					// A new request is only taken once the previous response has left the TX buffer,
+					// so a response written by a REST handler always fits and never waits for room
+					if (((len = getSn_RX_RSR(s)) > 0) && (getSn_TX_FSR(s) == getSn_TxMAX(s)))
 					{
 						if (len > DATA_BUF_SIZE) len = DATA_BUF_SIZE;
-						len = recv(s, (uint8_t *)http_request, len);
-
-						*(((uint8_t *)http_request) + len) = '\0';
-
-						parse_http_request(parsed_http_request, (uint8_t *)http_request);
+						len = http_recv_peek(s, http_request, len);
+
+						// Parse from where the previous bytes left off; only the bytes of this request are consumed,
+						// so a pipelined request stays in the socket RX buffer
+						len = http_parser_execute(&HTTPSock_Status[seqnum].parser, parsed_http_request, http_request, len);
+						http_recv_consume(s, len);
+						HTTPSock_Status[seqnum].last_active = get_httpServer_timecount();
+						if(HTTPSock_Status[seqnum].parser.state != HTTP_PARSE_DONE) break; // wait for the rest of the request
 #ifdef _HTTPSERVER_DEBUG_
 						getSn_DIPR(s, destip);
 						destport = getSn_DPORT(s);
@@ -166,23 +213,24 @@ void httpServer_run(uint8_t seqnum)
 #endif
 						// HTTP 'response' handler; includes send_http_response_header / body function
 						http_process_handler(s, parsed_http_request);
+						HTTPSock_Status[seqnum].keep_alive = parsed_http_request->KEEP_ALIVE && (parsed_http_request->METHOD != METHOD_ERR);
+						http_parser_init(&HTTPSock_Status[seqnum].parser, parsed_http_request);
 
-						gettime = get_httpServer_timecount();
-						// Check the TX socket buffer for End of HTTP response sends
-						while(getSn_TX_FSR(s) != (getSn_TxMAX(s)))
-						{
-							if((get_httpServer_timecount() - gettime) > 3)
-							{
-#ifdef _HTTPSERVER_DEBUG_
-								printf("> HTTPSocket[%d] : [State] STATE_HTTP_REQ_DONE: TX Buffer clear timeout\r\n", s);
-#endif
-								break;
-							}
-						}
+						// Event stream stays open; nothing more to wait for
+						if(HTTPSock_Status[seqnum].sock_status == STATE_HTTP_EVENT_STREAM) break;
 
 						if(HTTPSock_Status[seqnum].file_len > 0) HTTPSock_Status[seqnum].sock_status = STATE_HTTP_RES_INPROC;
 						else HTTPSock_Status[seqnum].sock_status = STATE_HTTP_RES_DONE; // Send the 'HTTP response' end
 					}
+					else if((get_httpServer_timecount() - HTTPSock_Status[seqnum].last_active) > HTTP_KEEP_ALIVE_TIMEOUT_SEC)
+					{
+#ifdef _HTTPSERVER_DEBUG_
+						printf("> HTTPSocket[%d] : Idle timeout\r\n", s);
+#endif
+						// No request on the persistent connection (or a stalled partial request)
+						HTTPSock_Status[seqnum].keep_alive = 0;
+						http_disconnect(s);
+					}
 					break;
 
 				case STATE_HTTP_RES_INPROC :
@@ -191,12 +239,50 @@ void httpServer_run(uint8_t seqnum)
 					printf("> HTTPSocket[%d] : [State] STATE_HTTP_RES_INPROC\r\n", s);
 #endif
 					// Repeatedly send remaining data to client
-					send_http_response_body(s, 0, http_response, 0, 0);
+					if(HTTPSock_Status[seqnum].storage_type == CODEFLASH) send_http_response_stream(s);
+					else send_http_response_body(s, 0, http_response, 0, 0);
 
-					if(HTTPSock_Status[seqnum].file_len == 0) HTTPSock_Status[seqnum].sock_status = STATE_HTTP_RES_DONE;
+					if(HTTPSock_Status[seqnum].file_len == 0)
+					{
+						HTTPSock_Status[seqnum].last_active = get_httpServer_timecount();
+						HTTPSock_Status[seqnum].sock_status = STATE_HTTP_RES_DONE;
+					}
+					break;
+
+				case STATE_HTTP_EVENT_STREAM :
+					// The client does not send anything on the stream; discard it
+					if((len = getSn_RX_RSR(s)) > 0)
+					{
+						if (len > DATA_BUF_SIZE) len = DATA_BUF_SIZE;
+						recv(s, (uint8_t *)http_request, len);
+					}
+					// Progress: the TX buffer is empty or drained since the last send
+					len = getSn_TX_FSR(s);
+					if((len == getSn_TxMAX(s)) || (len > http_event_queue[seqnum].tx_free))
+					{
+						HTTPSock_Status[seqnum].last_active = get_httpServer_timecount();
+					}
+					else if((get_httpServer_timecount() - HTTPSock_Status[seqnum].last_active) > HTTP_EVENT_STALL_TIMEOUT_SEC)
+					{
+#ifdef _HTTPSERVER_DEBUG_
+						printf("> HTTPSocket[%d] : Event stream stalled\r\n", s);
+#endif
+						// The unsent data would hold a graceful disconnect; close at once and listen again
+						close(s);
+						break;
+					}
+					send_http_event_queue(s);
+					http_event_queue[seqnum].tx_free = getSn_TX_FSR(s);
 					break;
 
 				case STATE_HTTP_RES_DONE :
+					// Check the TX socket buffer for End of HTTP response sends before closing;
+					// waits over the next httpServer_run() calls (up to HTTP_MAX_TIMEOUT_SEC) instead of blocking here
+					if(!HTTPSock_Status[seqnum].keep_alive && (getSn_TX_FSR(s) != getSn_TxMAX(s)) &&
+					   ((get_httpServer_timecount() - HTTPSock_Status[seqnum].last_active) <= HTTP_MAX_TIMEOUT_SEC))
+					{
+						break;
+					}
 #ifdef _HTTPSERVER_DEBUG_
 					printf("> HTTPSocket[%d] : [State] STATE_HTTP_RES_DONE\r\n", s);
 #endif
@@ -212,7 +298,9 @@ void httpServer_run(uint8_t seqnum)
 #ifdef _USE_WATCHDOG_
 					HTTPServer_WDT_Reset();
 #endif
-					http_disconnect(s);
+					// Persistent connection; the next (or already pipelined) request is parsed in STATE_HTTP_IDLE
+					HTTPSock_Status[seqnum].last_active = get_httpServer_timecount();
+					if(!HTTPSock_Status[seqnum].keep_alive) http_disconnect(s);
 					break;
 
 				default :
@@ -231,6 +319,14 @@ void httpServer_run(uint8_t seqnum)
 #ifdef _HTTPSERVER_DEBUG_
 			printf("> HTTPSocket[%d] : CLOSED\r\n", s);
 #endif
+			// Drop the request and the response in progress; the peer is gone
+			http_parser_init(&HTTPSock_Status[seqnum].parser, parsed_http_request);
+			HTTPSock_Status[seqnum].keep_alive = 0;
+			http_event_queue[seqnum].len = 0;
+			HTTPSock_Status[seqnum].file_len = 0;
+			HTTPSock_Status[seqnum].file_offset = 0;
+			HTTPSock_Status[seqnum].file_start = 0;
+			HTTPSock_Status[seqnum].sock_status = STATE_HTTP_IDLE;
 			if(socket(s, Sn_MR_TCP, HTTP_SERVER_PORT, 0x00) == s)    /* Reinitialize the socket */
 			{
 #ifdef _HTTPSERVER_DEBUG_
@@ -286,12 +382,24 @@ static void send_http_response_header(uint8_t s, uint8_t content_type, uint32_t
 #endif
 			memcpy(http_response, ERROR_REQUEST_PAGE, sizeof(ERROR_REQUEST_PAGE));
 			break;
+		case STATUS_TOO_LARGE:	// HTTP/1.1 413 Payload Too Large
+#ifdef _HTTPSERVER_DEBUG_
+			printf("> HTTPSocket[%d] : HTTP Response Header - STATUS_TOO_LARGE\r\n", s);
+#endif
+			memcpy(http_response, ERROR_TOO_LARGE_PAGE, sizeof(ERROR_TOO_LARGE_PAGE));
+			break;
 		case STATUS_NOT_FOUND:	// HTTP/1.1 404 Not Found
 #ifdef _HTTPSERVER_DEBUG_
 			printf("> HTTPSocket[%d] : HTTP Response Header - STATUS_NOT_FOUND\r\n", s);
 #endif
 			memcpy(http_response, ERROR_HTML_PAGE, sizeof(ERROR_HTML_PAGE));
 			break;
+		case STATUS_SERV_UNAVAIL:	// HTTP/1.1 503 Service Unavailable
+#ifdef _HTTPSERVER_DEBUG_
+			printf("> HTTPSocket[%d] : HTTP Response Header - STATUS_SERV_UNAVAIL\r\n", s);
+#endif
+			memcpy(http_response, ERROR_UNAVAIL_PAGE, sizeof(ERROR_UNAVAIL_PAGE));
+			break;
 		default:
 			break;
 	}
@@ -458,6 +566,173 @@ static void send_http_response_body(uint8_t s, uint8_t * uri_name, uint8_t * buf
 // ## 20141219 added end
 }
 
+/*
+ * Send the registered content straight from its storage (XIP flash or RAM) to the socket TX buffer.
+ * Every burst is as large as the free TX buffer, so no copy through 'buf' and no DATA_BUF_SIZE limit.
+ */
+static void send_http_response_stream(uint8_t s)
+{
+	int8_t get_seqnum;
+	int32_t ret;
+	uint32_t send_len;
+	uint16_t freesize;
+	st_http_socket * status;
+
+	if((get_seqnum = getHTTPSequenceNum(s)) == -1) return; // exception handling; invalid number
+	status = &HTTPSock_Status[get_seqnum];
+
+	while(status->file_offset < status->file_len)
+	{
+		freesize = getSn_TX_FSR(s);
+		if(!freesize) break;
+
+		send_len = status->file_len - status->file_offset;
+		if(send_len > freesize) send_len = freesize;
+
+		// SOCK_BUSY until the previous burst is SENDOK; resume on the next httpServer_run()
+		ret = send(s, web_content[status->file_start].content + status->file_offset, (uint16_t)send_len);
+		if(ret <= 0) break;
+		status->file_offset += ret;
+#ifdef _HTTPSERVER_DEBUG_
+		printf("> HTTPSocket[%d] : [Stream] HTTP Response body [ %ld ]byte, offset [ %ld ]\r\n", s, ret, status->file_offset);
+#endif
+	}
+
+	if(status->file_offset >= status->file_len)
+	{
+		status->file_start = 0;
+		status->file_len = 0;
+		status->file_offset = 0;
+	}
+}
+
+/*
+ * Find the registered content; the precompressed one (name + HTTP_GZIP_SUFFIX) is preferred
+ * when the client accepts gzip, and is also served when it is the only one registered.
+ */
+static uint8_t find_http_static_content(uint8_t * uri_name, uint8_t accept_gzip, uint16_t * content_num, uint32_t * file_len)
+{
+	uint8_t gz_name[MAX_CONTENT_NAME_LEN];
+
+	if(strlen((char *)uri_name) + sizeof(HTTP_GZIP_SUFFIX) > MAX_CONTENT_NAME_LEN)
+		return find_userReg_webContent(uri_name, content_num, file_len);
+
+	sprintf((char *)gz_name, "%s%s", uri_name, HTTP_GZIP_SUFFIX);
+	if(accept_gzip && find_userReg_webContent(gz_name, content_num, file_len)) return 1;
+	if(find_userReg_webContent(uri_name, content_num, file_len)) return 1;
+	return find_userReg_webContent(gz_name, content_num, file_len);
+}
+
+/*
+ * Send the registered content with its ETag, or '304 Not Modified' when the client already has it.
+ * The header is written to the TX buffer without a SEND command, so it leaves together with the first body burst.
+ */
+static void send_http_response_static(uint8_t s, st_http_request * p_http_request, uint16_t content_num)
+{
+	int8_t get_seqnum;
+	uint16_t len;
+	char etag[12];
+	httpServer_webContent * content = &web_content[content_num];
+
+	if((get_seqnum = getHTTPSequenceNum(s)) == -1) return; // exception handling; invalid number
+
+	sprintf(etag, "\"%08lx\"", (unsigned long)content->content_etag);
+
+	if(!content->content_live && p_http_request->IF_NONE_MATCH[0] &&
+	   (strstr((char *)p_http_request->IF_NONE_MATCH, etag) || !strcmp((char *)p_http_request->IF_NONE_MATCH, "*")))
+	{
+#ifdef _HTTPSERVER_DEBUG_
+		printf("> HTTPSocket[%d] : HTTP Response Header - STATUS_NOT_MODIF %s\r\n", s, etag);
+#endif
+		len = sprintf((char *)http_response, "%sETag: %s\r\nCache-Control: %s\r\n\r\n", RES_NOT_MODIFIED, etag, HTTP_CACHE_CONTROL);
+		send(s, http_response, len);
+		HTTPSock_Status[get_seqnum].file_len = 0;
+		return;
+	}
+
+	// Append ETag / Cache-Control / Content-Encoding in place of the blank line
+	make_http_response_head((char *)http_response, p_http_request->TYPE, content->content_len);
+	len = strlen((char *)http_response) - 2;
+	if(content->content_live)
+	{
+		len += sprintf((char *)http_response + len, "Cache-Control: no-store\r\n\r\n");
+	}
+	else
+	{
+		len += sprintf((char *)http_response + len, "ETag: %s\r\nCache-Control: %s\r\n%s\r\n",
+		               etag, HTTP_CACHE_CONTROL, content->content_gzip ? "Content-Encoding: gzip\r\n" : "");
+	}
+#ifdef _HTTPSERVER_DEBUG_
+	printf("> HTTPSocket[%d] : HTTP Response Header - STATUS_OK %s%s\r\n", s, etag, content->content_gzip ? " gzip" : "");
+#endif
+
+	if((p_http_request->METHOD == METHOD_HEAD) || (content->content_len == 0))
+	{
+		send(s, http_response, len);
+		HTTPSock_Status[get_seqnum].file_len = 0;
+		return;
+	}
+
+	if(getSn_TX_FSR(s) >= len) wiz_send_data(s, http_response, len);
+	else send(s, http_response, len);
+
+	HTTPSock_Status[get_seqnum].storage_type = CODEFLASH;
+	HTTPSock_Status[get_seqnum].file_start = content_num;
+	HTTPSock_Status[get_seqnum].file_len = content->content_len;
+	HTTPSock_Status[get_seqnum].file_offset = 0;
+	send_http_response_stream(s);
+}
+
+/* Open the server-sent events stream; the response has no length and never ends */
+static void send_http_event_stream_header(uint8_t s)
+{
+	int8_t get_seqnum;
+	uint16_t len;
+
+	if((get_seqnum = getHTTPSequenceNum(s)) == -1) return; // exception handling; invalid number
+
+#ifdef _HTTPSERVER_DEBUG_
+	printf("> HTTPSocket[%d] : HTTP Response Header - Event stream\r\n", s);
+#endif
+	len = sprintf((char *)http_response, "%s\r\nretry: %d\n\n", RES_EVENTHEAD_OK, HTTP_EVENT_RETRY_MS);
+	send(s, http_response, len);
+
+	http_event_queue[get_seqnum].len = 0;
+	http_event_queue[get_seqnum].tx_free = getSn_TX_FSR(s);
+	HTTPSock_Status[get_seqnum].last_active = get_httpServer_timecount();
+	HTTPSock_Status[get_seqnum].file_len = 0;
+	HTTPSock_Status[get_seqnum].sock_status = STATE_HTTP_EVENT_STREAM;
+
+	if(http_event_on_open) http_event_on_open(s);
+}
+
+/* Send the queued events in one burst once the previous burst is done and they fit in the TX buffer */
+static void send_http_event_queue(uint8_t s)
+{
+	int8_t get_seqnum;
+	st_http_event_queue * queue;
+
+	if((get_seqnum = getHTTPSequenceNum(s)) == -1) return; // exception handling; invalid number
+	queue = &http_event_queue[get_seqnum];
+
+	// Only whole queue is sent, so the queue always holds whole events and may be dropped safely
+	if(!queue->len || getSn_TX_FSR(s) < queue->len) return;
+	if(send(s, queue->buf, queue->len) == queue->len) queue->len = 0;
+}
+
+/* Number of open event streams */
+static uint8_t http_event_stream_cnt(void)
+{
+	uint8_t i;
+	uint8_t cnt = 0;
+
+	for(i = 0; i < HTTPSock_Cnt; i++)
+	{
+		if(HTTPSock_Status[i].sock_status == STATE_HTTP_EVENT_STREAM) cnt++;
+	}
+	return cnt;
+}
+
 static void send_http_response_cgi(uint8_t s, uint8_t * buf, uint8_t * http_body, uint16_t file_len)
 {
 	uint16_t send_len = 0;
@@ -484,6 +759,87 @@ static int8_t http_disconnect(uint8_t sn)
 }
 
 
+/*
+ * A client can only connect while one of the HTTP sockets is listening.
+ * When none is, close the persistent connection that has been idle the longest; it listens again on the next httpServer_run().
+ */
+static void http_reclaim_idle_socket(void)
+{
+	uint8_t i;
+	uint8_t sn;
+	int8_t lru = -1;
+
+	for(i = 0; i < HTTPSock_Cnt; i++)
+	{
+		sn = getHTTPSocketNum(i);
+		switch(getSn_SR(sn))
+		{
+			case SOCK_LISTEN:
+			case SOCK_INIT:
+			case SOCK_CLOSED:
+				return; // a client can still connect
+			case SOCK_ESTABLISHED:
+				if((HTTPSock_Status[i].sock_status == STATE_HTTP_IDLE) && HTTPSock_Status[i].keep_alive && !getSn_RX_RSR(sn))
+				{
+					if((lru < 0) || ((int32_t)(HTTPSock_Status[i].last_active - HTTPSock_Status[lru].last_active) < 0)) lru = i;
+				}
+				break;
+			default:
+				break;
+		}
+	}
+
+	if(lru >= 0)
+	{
+#ifdef _HTTPSERVER_DEBUG_
+		printf("> HTTPSocket[%d] : Reclaim idle connection\r\n", getHTTPSocketNum(lru));
+#endif
+		HTTPSock_Status[lru].keep_alive = 0;
+		http_disconnect(getHTTPSocketNum(lru));
+	}
+}
+
+/* Read received bytes without consuming them */
+static uint16_t http_recv_peek(uint8_t sn, uint8_t * buf, uint16_t len)
+{
+	uint16_t ptr = getSn_RX_RD(sn);
+
+	wiz_recv_data(sn, buf, len);
+	setSn_RX_RD(sn, ptr);
+	return len;
+}
+
+/* Consume the bytes the parser used */
+static void http_recv_consume(uint8_t sn, uint16_t len)
+{
+	if(!len) return;
+
+	wiz_recv_ignore(sn, len);
+	setSn_CR(sn, Sn_CR_RECV);
+	/* wait to process the command... */
+	while(getSn_CR(sn));
+}
+
+/* Hand the request to the REST handler whose prefix matches; returns 1 when the handler responded */
+static uint8_t http_rest_dispatch(uint8_t s, st_http_request * p_http_request, uint8_t * uri_name)
+{
+	uint8_t i;
+	size_t len;
+
+	for(i = 0; i < http_rest_route_cnt; i++)
+	{
+		len = strlen((char *)http_rest_route[i].prefix);
+		if(strncmp((char *)uri_name, (char *)http_rest_route[i].prefix, len)) continue;
+		if(uri_name[len] != '\0' && uri_name[len] != '/') continue;
+
+#ifdef _HTTPSERVER_DEBUG_
+		printf("> HTTPSocket[%d] : REST handler [%s]\r\n", s, http_rest_route[i].prefix);
+#endif
+		if(http_rest_route[i].handler(s, p_http_request, uri_name)) return 1;
+	}
+	return 0;
+}
+
 static void http_process_handler(uint8_t s, st_http_request * p_http_request)
 {
 	uint8_t * uri_name;
@@ -503,6 +859,13 @@ static void http_process_handler(uint8_t s, st_http_request * p_http_request)
 	http_response = pHTTP_RX;
 	file_len = 0;
 
+	// The body did not fit; handlers only ever see a complete body
+	if(p_http_request->BODY_TOO_LARGE)
+	{
+		send_http_response_header(s, 0, 0, STATUS_TOO_LARGE);
+		return;
+	}
+
 	//method Analyze
 	switch (p_http_request->METHOD)
 	{
@@ -516,6 +879,8 @@ static void http_process_handler(uint8_t s, st_http_request * p_http_request)
 			get_http_uri_name(p_http_request->URI, uri_buf);
 			uri_name = uri_buf;
 
+			if(http_rest_dispatch(s, p_http_request, uri_name)) break;
+
 			if (!strcmp((char *)uri_name, "/")) strcpy((char *)uri_name, INITIAL_WEBPAGE);	// If URI is "/", respond by index.html
 			if (!strcmp((char *)uri_name, "m")) strcpy((char *)uri_name, M_INITIAL_WEBPAGE);
 			if (!strcmp((char *)uri_name, "mobile")) strcpy((char *)uri_name, MOBILE_INITIAL_WEBPAGE);
@@ -527,7 +892,13 @@ static void http_process_handler(uint8_t s, st_http_request * p_http_request)
 			printf("> HTTPSocket[%d] : Request URI = %s\r\n", s, uri_name);
 #endif
 
-			if(p_http_request->TYPE == PTYPE_CGI)
+			if(http_event_uri[0] && !strcmp((char *)uri_name, (char *)http_event_uri))
+			{
+				// Keep one socket for requests; an open stream never ends on its own
+				if(http_event_stream_cnt() + 1 < HTTPSock_Cnt) send_http_event_stream_header(s);
+				else send_http_response_header(s, 0, 0, STATUS_SERV_UNAVAIL);
+			}
+			else if(p_http_request->TYPE == PTYPE_CGI)
 			{
 				content_found = http_get_cgi_handler(uri_name, pHTTP_TX, &file_len);
 				if(content_found && (file_len <= (DATA_BUF_SIZE-(strlen(RES_CGIHEAD_OK)+8))))
@@ -541,6 +912,13 @@ static void http_process_handler(uint8_t s, st_http_request * p_http_request)
 			}
 			else
 			{
+				// User registered web content is streamed without copying, with ETag and gzip support
+				if(find_http_static_content(uri_buf, p_http_request->ACCEPT_GZIP, &content_num, &file_len))
+				{
+					send_http_response_static(s, p_http_request, content_num);
+					break;
+				}
+
 				// Find the User registered index for web content
 				if(find_userReg_webContent(uri_buf, &content_num, &file_len))
 				{
@@ -607,8 +985,11 @@ static void http_process_handler(uint8_t s, st_http_request * p_http_request)
 			break;
 
 		case METHOD_POST :
-			mid((char *)p_http_request->URI, "/", " HTTP", (char *)uri_buf);
+			get_http_uri_name(p_http_request->URI, uri_buf);
 			uri_name = uri_buf;
+
+			if(http_rest_dispatch(s, p_http_request, uri_name)) break;
+
 			find_http_uri_type(&p_http_request->TYPE, uri_name);	// Check file type (HTML, TEXT, GIF, JPEG are included)
 
 #ifdef _HTTPSERVER_DEBUG_
@@ -659,28 +1040,125 @@ uint32_t get_httpServer_timecount(void)
 }
 
 void reg_httpServer_webContent(uint8_t * content_name, uint8_t * content)
+{
+	if(content == NULL) return;
+
+	reg_httpServer_binContent(content_name, content, strlen((char *)content));
+}
+
+/* Register the URI of the server-sent events stream; on_open is called when a client opens it */
+void reg_httpServer_eventSource(uint8_t * uri_name, void(*on_open)(uint8_t s))
+{
+	if(uri_name == NULL || strlen((char *)uri_name) >= MAX_CONTENT_NAME_LEN) return;
+
+	strcpy((char *)http_event_uri, (char *)uri_name);
+	http_event_on_open = on_open;
+}
+
+/*
+ * Queue an event to every open stream; sent by httpServer_run().
+ * Returns the number of streams the event was queued to.
+ */
+int8_t httpServer_send_event(uint8_t * event, uint8_t * data)
+{
+	uint8_t i;
+	int8_t cnt = 0;
+	uint16_t len;
+	st_http_event_queue * queue;
+	char line[HTTP_EVENT_QUEUE_SIZE];
+
+	len = snprintf(line, sizeof(line), "event: %s\ndata: %s\n\n", event, data);
+	if(len >= sizeof(line)) return 0;
+
+	for(i = 0; i < _WIZCHIP_SOCK_NUM_; i++)
+	{
+		if(HTTPSock_Status[i].sock_status != STATE_HTTP_EVENT_STREAM) continue;
+
+		queue = &http_event_queue[i];
+		if(queue->len + len > HTTP_EVENT_QUEUE_SIZE)
+		{
+			// Slow client; the queued events are older than this one
+			queue->len = 0;
+			http_event_drop++;
+		}
+		memcpy(queue->buf + queue->len, line, len);
+		queue->len += len;
+		cnt++;
+	}
+	return cnt;
+}
+
+uint32_t httpServer_get_event_drop(void)
+{
+	return http_event_drop;
+}
+
+/* Register a REST handler for 'prefix' and 'prefix/...' (no leading '/') */
+void reg_httpServer_restHandler(uint8_t * prefix, http_rest_handler handler)
+{
+	if(prefix == NULL || handler == NULL) return;
+	if(http_rest_route_cnt >= MAX_REST_HANDLER || strlen((char *)prefix) >= MAX_CONTENT_NAME_LEN) return;
+
+	strcpy((char *)http_rest_route[http_rest_route_cnt].prefix, (char *)prefix);
+	http_rest_route[http_rest_route_cnt].handler = handler;
+	http_rest_route_cnt++;
+}
+
+static httpServer_webContent * reg_content(uint8_t * content_name, const uint8_t * content, uint32_t content_len)
 {
 	uint16_t name_len;
-	uint32_t content_len;
+	httpServer_webContent * reg;
 
 	if(content_name == NULL || content == NULL)
 	{
-		return;
+		return NULL;
 	}
 	else if(total_content_cnt >= MAX_CONTENT_CALLBACK)
 	{
-		return;
+		return NULL;
 	}
 
 	name_len = strlen((char *)content_name);
-	content_len = strlen((char *)content);
+	reg = &web_content[total_content_cnt];
 
-	web_content[total_content_cnt].content_name = malloc(name_len+1);
-	strcpy((char *)web_content[total_content_cnt].content_name, (const char *)content_name);
-	web_content[total_content_cnt].content_len = content_len;
-	web_content[total_content_cnt].content = content;
+	reg->content_name = malloc(name_len+1);
+	strcpy((char *)reg->content_name, (const char *)content_name);
+	reg->content_len = content_len;
+	reg->content = (uint8_t *)content;
+	reg->content_etag = 0;
+	reg->content_live = 0;
+	reg->content_gzip = (name_len > strlen(HTTP_GZIP_SUFFIX)) &&
+	                    !strcmp((char *)content_name + name_len - strlen(HTTP_GZIP_SUFFIX), HTTP_GZIP_SUFFIX);
 
 	total_content_cnt++;
+	return reg;
+}
+
+/* Register the content by length, so precompressed or binary content may contain '\0' */
+void reg_httpServer_binContent(uint8_t * content_name, const uint8_t * content, uint32_t content_len)
+{
+	uint32_t i;
+	uint32_t hash = 2166136261UL;
+	httpServer_webContent * reg;
+
+	if((reg = reg_content(content_name, content, content_len)) == NULL) return;
+
+	// ETag; computed once here, the content does not change at run time
+	for(i = 0; i < content_len; i++)
+	{
+		hash ^= content[i];
+		hash *= 16777619UL;
+	}
+	reg->content_etag = hash;
+}
+
+/* Register memory that changes at run time (e.g. a log in XIP flash); streamed as is on every request, no ETag */
+void reg_httpServer_liveContent(uint8_t * content_name, const uint8_t * content, uint32_t content_len)
+{
+	httpServer_webContent * reg;
+
+	if((reg = reg_content(content_name, content, content_len)) == NULL) return;
+	reg->content_live = 1;
 }
 
 uint8_t display_reg_webContent_list(void)
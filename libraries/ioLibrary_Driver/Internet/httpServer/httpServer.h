@@ -8,6 +8,8 @@
 #ifndef	__HTTPSERVER_H__
 #define	__HTTPSERVER_H__
 
+#include "httpParser.h"
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -41,6 +43,7 @@ extern "C" {
 #define STATE_HTTP_REQ_DONE    		2           /* The end of HTTP request parse */
 #define STATE_HTTP_RES_INPROC  		3           /* Sending the HTTP response to HTTP client (in progress) */
 #define STATE_HTTP_RES_DONE    		4           /* The end of HTTP response send (HTTP transaction ended) */
+#define STATE_HTTP_EVENT_STREAM		5           /* Server-sent events stream open, events are pushed until the client closes */
 
 /*********************************************
 * HTTP Simple Return Value
@@ -58,6 +61,48 @@ extern "C" {
 * HTTP Timeout
 *********************************************/
 #define HTTP_MAX_TIMEOUT_SEC		3			// Sec.
+// Persistent connection is closed after this long without a request; needs httpServer_time_handler()
+#ifndef HTTP_KEEP_ALIVE_TIMEOUT_SEC
+#define HTTP_KEEP_ALIVE_TIMEOUT_SEC	5			// Sec.
+#endif
+
+/*********************************************
+* HTTP Static content cache
+*********************************************/
+// Cache-Control sent with the ETag; browsers revalidate and get '304 Not Modified'
+#ifndef HTTP_CACHE_CONTROL
+#define HTTP_CACHE_CONTROL			"no-cache"
+#endif
+// Suffix of precompressed content, served with 'Content-Encoding: gzip'
+#define HTTP_GZIP_SUFFIX			".gz"
+
+/*********************************************
+* HTTP Server-sent events
+*********************************************/
+// Per client queue; when an event does not fit, the older queued events are dropped (latest state wins)
+#ifndef HTTP_EVENT_QUEUE_SIZE
+#define HTTP_EVENT_QUEUE_SIZE		512
+#endif
+// Reconnect delay the browser uses after the stream is closed
+#define HTTP_EVENT_RETRY_MS			1000
+// One HTTP socket is always kept for requests, so at most (sockets - 1) streams are open and
+// the next one gets '503 Service Unavailable'; with a single HTTP socket there is no stream
+// A stream whose TX buffer has not drained for this long (client stopped reading) is closed; needs httpServer_time_handler()
+#ifndef HTTP_EVENT_STALL_TIMEOUT_SEC
+#define HTTP_EVENT_STALL_TIMEOUT_SEC	5			// Sec.
+#endif
+
+/*********************************************
+* HTTP REST handlers
+*********************************************/
+#define MAX_REST_HANDLER			8
+
+/*
+ * Called for a request under the registered prefix ('prefix' or 'prefix/...'), before the web content lookup.
+ * uri_name has no leading '/' and no query; the handler sends the whole response (e.g. http_json_response())
+ * and returns 1, or returns 0 to fall back to the web content.
+ */
+typedef uint8_t (*http_rest_handler)(uint8_t s, st_http_request * p_http_request, uint8_t * uri_name);
 
 typedef enum
 {
@@ -75,6 +120,10 @@ typedef struct _st_http_socket
 	uint32_t 		file_len;
 	uint32_t 		file_offset; // (start addr + sent size...)
 	uint8_t			storage_type; // Storage type; Code flash, SDcard, Data flash ...
+	uint8_t			keep_alive;	// Connection persists after the current response
+	uint32_t		last_active;	// httpServer_tick_1s of the last request (or stream TX progress); idle timeout and LRU reclaim
+	st_http_parser	parser;		// Parse state; a request may arrive over several httpServer_run() calls
+	st_http_request	request;	// Request parsed so far
 }st_http_socket;
 
 // Web content structure for file in code flash memory
@@ -85,6 +134,9 @@ typedef struct _httpServer_webContent
 	uint8_t	*	content_name;
 	uint32_t	content_len;
 	uint8_t * 	content;
+	uint32_t	content_etag;	// FNV-1a hash of the content
+	uint8_t		content_gzip;	// content is precompressed (name ends with HTTP_GZIP_SUFFIX)
+	uint8_t		content_live;	// content changes at run time; sent without ETag and never answered with 304
 }httpServer_webContent;
 
 
@@ -93,6 +145,12 @@ void reg_httpServer_cbfunc(void(*mcu_reset)(void), void(*wdt_reset)(void));
 void httpServer_run(uint8_t seqnum);
 
 void reg_httpServer_webContent(uint8_t * content_name, uint8_t * content);
+void reg_httpServer_eventSource(uint8_t * uri_name, void(*on_open)(uint8_t s));
+int8_t httpServer_send_event(uint8_t * event, uint8_t * data);
+void reg_httpServer_restHandler(uint8_t * prefix, http_rest_handler handler);
+uint32_t httpServer_get_event_drop(void);
+void reg_httpServer_binContent(uint8_t * content_name, const uint8_t * content, uint32_t content_len);
+void reg_httpServer_liveContent(uint8_t * content_name, const uint8_t * content, uint32_t content_len);
 uint8_t find_userReg_webContent(uint8_t * content_name, uint16_t * content_num, uint32_t * file_len);
 uint16_t read_userReg_webContent(uint16_t content_num, uint8_t * buf, uint32_t offset, uint16_t size);
 uint8_t display_reg_webContent_list(void);
@@ -44,7 +44,7 @@ uint8_t http_post_cgi_handler(uint8_t * uri_name, st_http_request * p_http_reque
 	uint16_t len = 0;
 	uint8_t val = 0;
 
-	if(predefined_set_cgi_processor(uri_name, p_http_request->URI, buf, &len))
+	if(predefined_set_cgi_processor(uri_name, get_http_body(p_http_request), buf, &len))
 	{
 		;
 	}
@@ -8,6 +8,7 @@
 //  there is dead code, ugliness and zero error handling... it is very much in a prove it can work state (which it does)
 
 #include <stdio.h>
+#include <string.h>
 #include "pico/stdlib.h"
 #include "pico/sd_card.h"
 #include "hardware/pio.h"
@@ -33,6 +34,18 @@
 #define sd_debug(format,args...) (void)0
 #endif
 
+// a breakpoint without a debugger attached is a hard fault; only stop when asked to
+#if PICO_SD_CARD_BREAKPOINT
+#define sd_breakpoint() __breakpoint()
+#else
+#define sd_breakpoint() (void)0
+#endif
+
+// number of ACMD41 polls before giving up on a card that never leaves the busy state
+#ifndef PICO_SD_INIT_RETRIES
+#define PICO_SD_INIT_RETRIES 1000
+#endif
+
 #define CMD(n) ((n)+0x40)
 
 static inline uint32_t sd_pio_cmd(uint cmd, uint32_t param)
@@ -101,8 +114,8 @@ inline static int safe_wait_tx_empty(pio_hw_t *pio, uint sm) {
         wooble++;
         if (wooble > 1000000) {
             check_pio_debug("stuck");
-            printf("stuck %d @ %d\n", sm, (int)pio->sm[sm].addr);
-            __breakpoint();
+            sd_debug("stuck %d @ %d\n", sm, (int)pio->sm[sm].addr);
+            sd_breakpoint();
             return SD_ERR_STUCK;
         }
     }
@@ -115,8 +128,8 @@ inline static int safe_wait_tx_not_full(pio_hw_t *pio, uint sm) {
         wooble++;
         if (wooble > 1000000) {
             check_pio_debug("stuck");
-            printf("stuck %d @ %d\n", sm, (int)pio->sm[sm].addr);
-            __breakpoint();
+            sd_debug("stuck %d @ %d\n", sm, (int)pio->sm[sm].addr);
+            sd_breakpoint();
             return SD_ERR_STUCK;
         }
     }
@@ -129,8 +142,8 @@ inline static int safe_dma_wait_for_finish(pio_hw_t *pio, uint sm, uint chan) {
         wooble++;
         if (wooble > 8000000) {
             check_pio_debug("stuck dma");
-            printf("stuck dma channel %d rem %08x %d @ %d\n", chan, (uint)dma_hw->ch[chan].transfer_count, sm, (int)pio->sm[sm].addr);
-            __breakpoint();
+            sd_debug("stuck dma channel %d rem %08x %d @ %d\n", chan, (uint)dma_hw->ch[chan].transfer_count, sm, (int)pio->sm[sm].addr);
+            sd_breakpoint();
             return SD_ERR_STUCK;
         }
     }
@@ -138,6 +151,27 @@ inline static int safe_dma_wait_for_finish(pio_hw_t *pio, uint sm, uint chan) {
 }
 
 
+// the card holds DAT0 low while it programs, the spec allows up to 500 ms for a write
+#ifndef PICO_SD_BUSY_TIMEOUT_US
+#define PICO_SD_BUSY_TIMEOUT_US 500000
+#endif
+
+// wait for the DAT state machine to get back to waiting_for_cmd, giving up rather than hanging the caller
+static int wait_dat_idle(void) {
+    int rc = safe_wait_tx_empty(sd_pio, SD_DAT_SM);
+    if (rc) return rc;
+    absolute_time_t timeout = make_timeout_time_us(PICO_SD_BUSY_TIMEOUT_US);
+    while (sd_pio->sm[SD_DAT_SM].addr != sd_cmd_or_dat_offset_no_arg_state_waiting_for_cmd) {
+        if (time_reached(timeout)) {
+            check_pio_debug("stuck");
+            sd_debug("stuck %d @ %d\n", SD_DAT_SM, (int)sd_pio->sm[SD_DAT_SM].addr);
+            sd_breakpoint();
+            return SD_ERR_STUCK;
+        }
+    }
+    return SD_OK;
+}
+
 static inline int acquiesce_sm(int sm) {
     check_pio_debug("ac1");
     int rc = safe_wait_tx_empty(sd_pio, sm);
@@ -379,7 +413,7 @@ int __noinline sd_command(uint64_t packed_command, uint32_t *receive_buf, uint b
                 {
                     if (cmd != w0 >> 24u)
                     {
-                        printf("tsk\n");
+                        sd_debug("tsk\n");
                     }
                     uint8_t crc = crc7_table[w0 >> 24u];
                     crc = crc7_table[crc ^ (uint8_t) (w0 >> 16u)];
@@ -388,14 +422,14 @@ int __noinline sd_command(uint64_t packed_command, uint32_t *receive_buf, uint b
                     crc = crc7_table[crc ^ (uint8_t) (w1 >> 24u)];
                     if ((crc | 1u) != (uint8_t) (w1 >> 16u))
                     {
-                        panic("bad crc %02x != %02x\n", crc | 1u, (uint8_t) (w1 >> 16u));
+                        sd_debug("bad crc %02x != %02x\n", crc | 1u, (uint8_t) (w1 >> 16u));
                         ok = false;
                     }
                 }
             }
             if (!ok)
             {
-                printf("bad response from card\n");
+                sd_debug("bad response from card\n");
                 return SD_ERR_BAD_RESPONSE;
             }
         }
@@ -475,7 +509,7 @@ void read_status(bool dump)
       sd_command(sd_make_command(13, rca_high, rca_low, 0, 0), response_buffer, 6);
       fixup_cmd_response_48(response_buffer);
       uint8_t *b = (uint8_t *)response_buffer;
-      printf("%02x %02x %02x %02x : %02x %02x\n", b[0], b[1], b[2], b[3], b[4], b[5]);
+      sd_debug("%02x %02x %02x %02x : %02x %02x\n", b[0], b[1], b[2], b[3], b[4], b[5]);
       if (dump) {
         print_status(response_buffer, false);
       }
@@ -490,7 +524,7 @@ void read_status(bool dump)
 
 int sd_set_wide_bus(bool wide)
 {
-  printf("Set bus width: %d\n", (wide ? 4 : 1));
+  sd_debug("Set bus width: %d\n", (wide ? 4 : 1));
     if (bus_width == bw_unknown || bus_width == (wide ? bw_narrow : bw_wide)) {
         if (wide && !allow_four_data_pins) {
             printf("May not select wide pus without 4 data pins\n");
@@ -612,23 +646,30 @@ static int sd_init( bool _allow_four_data_pins)
 
     uint32_t response_buffer[5];
     sd_command(sd_make_command(0, 0, 0, 0, 0), response_buffer, 0);
-    sd_command(sd_make_command(8, 0, 0, 1, 0xa5), response_buffer, 6); // VHS=b0001
+    // no card (or no pull-ups) leaves the response buffer untouched
+    memset(response_buffer, 0, sizeof(response_buffer));
+    int rc = sd_command(sd_make_command(8, 0, 0, 1, 0xa5), response_buffer, 6); // VHS=b0001
 
     uint8_t *byte_buf = (uint8_t *) response_buffer;
     fixup_cmd_response_48(response_buffer);
-    if (byte_buf[4] != 0xa5)
+    if (rc || byte_buf[4] != 0xa5)
     {
-        __breakpoint();
+        sd_breakpoint();
         printf("R7 check pattern doesn't match sent\r\n");
-        return -1;
+        return rc ? rc : SD_ERR_BAD_RESPONSE;
     }
 
+    int retries = PICO_SD_INIT_RETRIES;
     do
     {
+        if (!retries--)
+        {
+            printf("Card stays busy\r\n");
+            return SD_ERR_STUCK;
+        }
         sd_command(sd_make_command(55, 0, 0, 0, 0), response_buffer, 6);
         sd_command(sd_make_command(41, 0x40, 0x10, 0, 0), response_buffer, 6); // HCS=1, 3.2-3.3V only
         fixup_cmd_response_48(response_buffer);
-        assert(byte_buf[0] == 0x3f);
     }
     while (!(byte_buf[1] & 0x80u)); // repeat while nbusy bit is low
     printf("Card ready\r\n");
@@ -643,7 +684,7 @@ static int sd_init( bool _allow_four_data_pins)
     // wait for not busy after CMD7
     sd_wait();
 
-    int rc = sd_set_wide_bus(allow_four_data_pins);
+    rc = sd_set_wide_bus(allow_four_data_pins);
     if (!rc)
     {
         rc = sd_set_clock_divider(1); // as fast as possible please
@@ -765,10 +806,7 @@ int sd_readblocks_scatter_async(uint32_t *control_words, uint32_t block, uint bl
     }
 
     // todo further state checks
-    while (sd_pio->sm[SD_DAT_SM].addr != sd_cmd_or_dat_offset_no_arg_state_waiting_for_cmd) {
-        printf("oops %d\n", (uint)sd_pio->sm[SD_DAT_SM].addr);
-    }
-    assert(sd_pio->sm[SD_DAT_SM].addr == sd_cmd_or_dat_offset_no_arg_state_waiting_for_cmd);
+    if (wait_dat_idle()) return SD_ERR_STUCK;
     assert(pio_sm_is_rx_fifo_empty(sd_pio, SD_DAT_SM));
     assert(block_count <= PICO_SD_MAX_BLOCK_COUNT);
 
@@ -979,17 +1017,11 @@ int sd_writeblocks_async(const uint32_t *data, uint32_t sector_num, uint sector_
     *p++ = 0;
 
     // todo further state checks
-    while (sd_pio->sm[SD_DAT_SM].addr != sd_cmd_or_dat_offset_no_arg_state_waiting_for_cmd) {
-        printf("oops %d\n", (uint)sd_pio->sm[SD_DAT_SM].addr);
-
-    }
-    assert(sd_pio->sm[SD_DAT_SM].addr == sd_cmd_or_dat_offset_no_arg_state_waiting_for_cmd);
+    if (wait_dat_idle()) return SD_ERR_STUCK;
     assert(pio_sm_is_tx_fifo_empty(sd_pio, SD_DAT_SM));
     pio_sm_put(sd_pio, SD_DAT_SM, sd_pio_cmd(sd_cmd_or_dat_offset_state_inline_instruction, pio_encode_jmp(sd_cmd_or_dat_offset_no_arg_state_wait_high)));
-    while (sd_pio->sm[SD_DAT_SM].addr != sd_cmd_or_dat_offset_no_arg_state_waiting_for_cmd) {
-        printf("reps %d\n", (uint)sd_pio->sm[SD_DAT_SM].addr);
-
-    }
+    // a card still busy with the previous write keeps DAT0 low
+    if (wait_dat_idle()) return SD_ERR_STUCK;
 
     assert(sector_count);
     int rc = sd_set_wide_bus(false); // use 1 bit writes for now
@@ -1006,7 +1038,7 @@ int sd_writeblocks_async(const uint32_t *data, uint32_t sector_num, uint sector_
                         response_buffer, 6);
         if (!rc) rc = sd_command(sd_make_command(25, sector_num >> 24, sector_num >> 16, sector_num >> 8, sector_num & 0xffu), response_buffer, 6);
     }
-    read_status(true);
+    read_status(false);
     if (!rc)
     {
         pio_sm_set_enabled(sd_pio, SD_DAT_SM, false);
@@ -1014,7 +1046,7 @@ int sd_writeblocks_async(const uint32_t *data, uint32_t sector_num, uint sector_
         dma_sniffer_set_byte_swap_enabled(true);
         start_chain_dma_write(SD_DAT_SM, ctrl_words);
         pio_sm_set_enabled(sd_pio, SD_DAT_SM, true);
-        printf("dma chain data (rem %04x @ %08x) data (rem %04x @ %08x) pio data (rem %04x @ %08x) datsm @ %d\n",
+        sd_debug("dma chain data (rem %04x @ %08x) data (rem %04x @ %08x) pio data (rem %04x @ %08x) datsm @ %d\n",
                (uint) dma_hw->ch[sd_chain_dma_channel].transfer_count,
                (uint) dma_hw->ch[sd_chain_dma_channel].read_addr,
                (uint) dma_hw->ch[sd_data_dma_channel].transfer_count, (uint) dma_hw->ch[sd_data_dma_channel].read_addr,
@@ -1025,8 +1057,51 @@ int sd_writeblocks_async(const uint32_t *data, uint32_t sector_num, uint sector_
     return rc;
 }
 
+// R1 card status bits that fail a write: out of range, address, block length, erase sequence/param,
+// write protect, lock/unlock, command CRC, illegal command, card ECC, CC error and general error
+#define SD_R1_WRITE_ERRORS 0xfdf80000u
+#define SD_R1_READY_FOR_DATA (1u << 8u)
+#define SD_R1_STATE(r1) (((r1) >> 9u) & 0xfu)
+#define SD_STATE_TRAN 4u
+#define SD_STATE_RCV 6u
+
+// the PIO program only waits out the CRC status token and busy on DAT0, so ask the card (CMD13) whether
+// it took every block: with the block count preset by CMD23 it only returns to tran once all of them are
+// programmed, and stays in rcv when it rejected one
+static int write_status(void)
+{
+    uint32_t response_buffer[5];
+    uint8_t *b = (uint8_t *) response_buffer;
+    int rc = SD_ERR_STUCK;
+
+    int not_ready_retries = 3;
+    while (not_ready_retries--) {
+        rc = sd_command(sd_make_command(13, rca_high, rca_low, 0, 0), response_buffer, 6);
+        if (rc) continue;
+        fixup_cmd_response_48(response_buffer);
+        uint32_t r1 = ((uint32_t) b[1] << 24u) | ((uint32_t) b[2] << 16u) | ((uint32_t) b[3] << 8u) | b[4];
+        sd_debug("write status %08x\n", (uint)r1);
+        if (r1 & SD_R1_WRITE_ERRORS) {
+            return SD_ERR_BAD_RESPONSE;
+        }
+        if (SD_R1_STATE(r1) == SD_STATE_RCV) {
+            // the card dropped a block and still waits for data; stop the transfer so the next write can start
+            sd_command(sd_make_command(12, 0, 0, 0, 0), response_buffer, 6);
+            sd_wait();
+            return SD_ERR_CRC;
+        }
+        if (SD_R1_STATE(r1) == SD_STATE_TRAN && (r1 & SD_R1_READY_FOR_DATA)) {
+            return SD_OK;
+        }
+        // still programming
+        rc = SD_ERR_STUCK;
+        sleep_ms(1);
+    }
+    return rc;
+}
+
 bool sd_write_complete(int *status) {
-    printf("dma chain data (rem %04x @ %08x) data (rem %04x @ %08x) datsm @ %d\n",
+    sd_debug("dma chain data (rem %04x @ %08x) data (rem %04x @ %08x) datsm @ %d\n",
            (uint)dma_hw->ch[sd_chain_dma_channel].transfer_count, (uint)dma_hw->ch[sd_chain_dma_channel].read_addr,
            (uint)dma_hw->ch[sd_data_dma_channel].transfer_count, (uint)dma_hw->ch[sd_data_dma_channel].read_addr,
            (int)sd_pio->sm[SD_DAT_SM].addr);
@@ -1034,11 +1109,12 @@ bool sd_write_complete(int *status) {
     bool rc;
     if (dma_channel_is_busy(sd_chain_dma_channel) || dma_channel_is_busy(sd_data_dma_channel)) rc = false;
     else rc = sd_pio->sm[SD_DAT_SM].addr == sd_cmd_or_dat_offset_no_arg_state_waiting_for_cmd;
+    int s = SD_OK;
     if (rc) {
-        read_status(true);
-        printf("sniffo %08x\n", (uint)dma_hw->sniff_data);
+        sd_debug("sniffo %08x\n", (uint)dma_hw->sniff_data);
+        s = write_status();
     }
-    if (status) *status = SD_OK;
+    if (status) *status = s;
     return rc;
 }
 
@@ -1083,10 +1159,7 @@ int sd_read_sectors_1bit_crc_async(uint32_t *sector_buf, uint32_t sector, uint s
     *p++ = 0;
 
     // todo further state checks
-    while (sd_pio->sm[SD_DAT_SM].addr != sd_cmd_or_dat_offset_no_arg_state_waiting_for_cmd) {
-        printf("oops %d\n", (uint)sd_pio->sm[SD_DAT_SM].addr);
-    }
-    assert(sd_pio->sm[SD_DAT_SM].addr == sd_cmd_or_dat_offset_no_arg_state_waiting_for_cmd);
+    if (wait_dat_idle()) return SD_ERR_STUCK;
     assert(pio_sm_is_rx_fifo_empty(sd_pio, SD_DAT_SM));
     assert(sector_count <= PICO_SD_MAX_BLOCK_COUNT);
 
@@ -0,0 +1,394 @@
+/**
+ * @file clock.hpp
+ * @brief SNTPで合わせた時刻をns単位で返す
+ *        time_us_64()を基準に、SNTPのoffsetとdrift(周波数誤差)で傾きを補正した時刻を作る
+ *        小さいずれはslewで直し、時刻が戻らないようにする(CLOCK_STEP_NSを超えたときだけstep)
+ *        SNTPの処理はhardware alarmで必要なときだけ動かし、main loopを止めない
+ *        PTP(timesync.hpp)で同期しているときはそちらを使う
+ * @author Murakami Kantaro
+ * @date 2024-07-01
+ */
+#ifndef _CLOCK_HPP_
+#define _CLOCK_HPP_
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <pico/stdio.h>
+#include "port_common.h"
+#include "hardware/sync.h"
+
+#include "wizchip_conf.h"
+#include "socket.h"
+#include "w5x00_mem_profile.h"
+#include "sntp.h"
+#include "network.hpp"
+
+/**
+ * @brief NTP server
+ */
+#define CLOCK_NTP_SERVER {192, 168, 100, 1}
+#define CLOCK_SOCKET WIZCHIP_SOCKET_SNTP
+
+/**
+ * @brief 問い合わせの間隔
+ *        起動直後はCLOCK_BURST回まで短い間隔でdriftを早く推定する
+ */
+#define CLOCK_BURST 8
+#define CLOCK_BURST_MS 2000
+#define CLOCK_POLL_MS 16000
+#define CLOCK_RETRY_MS 4000
+
+/**
+ * @brief これより大きいoffsetはslewせずstepする
+ */
+#define CLOCK_STEP_NS 128000000LL
+/**
+ * @brief 補正する傾きの上限 (ppb)、RP2040の水晶の誤差より十分大きく、時刻が戻らない範囲
+ */
+#define CLOCK_MAX_RATE_PPB 500000LL
+/**
+ * @brief offsetのうちdriftの推定に使う割合 (1/n)
+ */
+#define CLOCK_FREQ_GAIN_DIV 4
+/**
+ * @brief round trip delayがこれまでの最小の2倍 + marginを超えるsampleは使わない(混雑で往復が非対称)
+ */
+#define CLOCK_FILTER_LEN 8
+#define CLOCK_DELAY_MARGIN_NS 500000LL
+/**
+ * @brief 基準点を更新する最長間隔、now_ns()の64bit乗算が溢れないようにする
+ */
+#define CLOCK_REBASE_US 60000000ULL
+
+/**
+ * @brief 時刻の基準
+ *        PTPのsample(timesync.hpp)が来ている間はSNTPに問い合わせない
+ */
+#define CLOCK_SOURCE_SNTP 0
+#define CLOCK_SOURCE_PTP 1
+#define CLOCK_PTP_HOLD_US 10000000ULL
+
+#define CLOCK_NTP_UNIX_OFFSET 2208988800ULL // 1900年から1970年までの秒数
+
+/**
+ * @brief now_ns()の計算に使う値
+ *        ns = baseNs + (us - baseUs) * 1000 + ((us - baseUs) * rateQ32 >> 32)
+ * @param baseUs 基準点のtime_us_64()
+ * @param baseNs 基準点の時刻 (UNIX時刻のns、同期前は起動からのns)
+ * @param rateQ32 傾きの補正、1usあたりのnsを2^32倍したもの
+ */
+typedef struct {
+    uint64_t baseUs;
+    int64_t baseNs;
+    int64_t rateQ32;
+} clock_params_t;
+
+static clock_params_t clockParams = {0, 0, 0};
+static volatile uint32_t clockParamsSeq = 0;
+
+static volatile bool clockDue = false;
+static alarm_id_t clockAlarm = 0;
+static bool clockWaiting = false;
+static bool clockSynced = false;
+static uint32_t clockSampleCount = 0;
+static uint64_t clockSlewEndUs = 0;
+static uint64_t clockLastUpdateUs = 0;
+static int64_t clockFreqPpb = 0;
+static int64_t clockLastOffsetNs = 0;
+static int64_t clockLastDelayNs = 0;
+static uint32_t clockStepCount = 0;
+static uint8_t clockSource = CLOCK_SOURCE_SNTP;
+static uint64_t clockLastPtpUs = 0;
+static int64_t clockDelayHistory[CLOCK_FILTER_LEN];
+static uint8_t clockDelayIndex = 0;
+static uint8_t clockDelayCount = 0;
+static uint8_t clockSntpBuf[MAX_SNTP_BUF_SIZE];
+
+/**
+ * @brief time_us_64()の値を時刻にする
+ *        core0, core1, 割り込みのどこから呼んでもよい(更新中なら読み直す)
+ * @param[in] us time_us_64()の値
+ * @return 時刻 (ns)
+ */
+static int64_t clockNsAt(uint64_t us){
+    clock_params_t p;
+    uint32_t seq;
+    int64_t elapsed;
+
+    do {
+        seq = clockParamsSeq;
+        __dmb();
+        p = clockParams;
+        __dmb();
+    } while ((seq & 1) || seq != clockParamsSeq);
+
+    elapsed = (int64_t)(us - p.baseUs);
+    return p.baseNs + elapsed * 1000 + ((elapsed * p.rateQ32) >> 32);
+}
+
+/**
+ * @brief 現在時刻
+ *        SNTPで同期した後はUNIX時刻(1970-01-01からのns)、同期前は起動からのns
+ * @return 時刻 (ns)
+ */
+uint64_t now_ns(){
+    return (uint64_t)clockNsAt(time_us_64());
+}
+
+/**
+ * @brief 今の時刻を基準点にして、時刻と傾きを変える
+ * @param[in] offsetNs 時刻に足す値
+ * @param[in] ratePpb 傾きの補正 (ppb)
+ */
+static void clockRebase(int64_t offsetNs, int64_t ratePpb){
+    uint64_t us = time_us_64();
+    int64_t ns = clockNsAt(us) + offsetNs;
+    uint32_t ints;
+
+    if (ratePpb > CLOCK_MAX_RATE_PPB){
+        ratePpb = CLOCK_MAX_RATE_PPB;
+    } else if (ratePpb < -CLOCK_MAX_RATE_PPB){
+        ratePpb = -CLOCK_MAX_RATE_PPB;
+    }
+    // 書き込み中に同じcoreの割り込みがnow_ns()を呼ぶと終わらないので割り込みを止める
+    ints = save_and_disable_interrupts();
+    clockParamsSeq++;
+    __dmb();
+    clockParams.baseUs = us;
+    clockParams.baseNs = ns;
+    clockParams.rateQ32 = ratePpb * 4294967296LL / 1000000;
+    __dmb();
+    clockParamsSeq++;
+    restore_interrupts(ints);
+}
+
+/**
+ * @brief NTP timestampをUNIX時刻のnsにする
+ */
+static int64_t clockNtpToNs(tstamp t){
+    uint64_t seconds = t >> 32;
+    uint64_t fraction = t & 0xFFFFFFFFULL;
+
+    // 2036年以降はNTP era 1
+    if (seconds < CLOCK_NTP_UNIX_OFFSET){
+        seconds += 0x100000000ULL;
+    }
+    return (int64_t)(seconds - CLOCK_NTP_UNIX_OFFSET) * 1000000000LL + (int64_t)((fraction * 1000000000ULL) >> 32);
+}
+
+/**
+ * @brief round trip delayが大きいsampleか
+ */
+static bool clockDelayRejected(int64_t delayNs){
+    int64_t minDelay = delayNs;
+
+    for (int i = 0; i < clockDelayCount; i++){
+        if (clockDelayHistory[i] < minDelay){
+            minDelay = clockDelayHistory[i];
+        }
+    }
+    clockDelayHistory[clockDelayIndex] = delayNs;
+    clockDelayIndex = (clockDelayIndex + 1) % CLOCK_FILTER_LEN;
+    if (clockDelayCount < CLOCK_FILTER_LEN){
+        clockDelayCount++;
+    }
+    return delayNs > minDelay * 2 + CLOCK_DELAY_MARGIN_NS;
+}
+
+/**
+ * @brief PTPのsampleが最近来ているか
+ */
+static bool clockPtpActive(){
+    return clockLastPtpUs != 0 && time_us_64() - clockLastPtpUs < CLOCK_PTP_HOLD_US;
+}
+
+/**
+ * @brief 1回の計測結果で時刻を補正する
+ * @param[in] offset 基準の時刻 - この時計の時刻 (ns)
+ * @param[in] delay round trip delay (ns)
+ * @param[in] source CLOCK_SOURCE_SNTP or CLOCK_SOURCE_PTP
+ * @param[in] intervalMs 次の計測までの時間、この間にoffsetをslewで戻す
+ */
+void clockAddSample(int64_t offset, int64_t delay, uint8_t source, uint32_t intervalMs){
+    uint64_t us = time_us_64();
+    int64_t interval;
+    bool rejected;
+
+    if (source == CLOCK_SOURCE_PTP){
+        clockLastPtpUs = us;
+    } else if (clockPtpActive()){
+        return;
+    }
+    if (source != clockSource){
+        // 経路が違うとdelayも違うのでfilterをやり直す
+        clockSource = source;
+        clockDelayCount = 0;
+    }
+    rejected = clockDelayRejected(delay);
+    clockLastDelayNs = delay;
+    if (clockSynced && rejected){
+        return;
+    }
+    clockLastOffsetNs = offset;
+
+    if (!clockSynced || offset > CLOCK_STEP_NS || offset < -CLOCK_STEP_NS){
+        clockRebase(offset, clockFreqPpb);
+        clockSlewEndUs = 0;
+        clockLastUpdateUs = us;
+        clockStepCount++;
+        if (!clockSynced){
+            printf("Clock : synchronized by %s, delay %ld us\r\n", (source == CLOCK_SOURCE_PTP) ? "PTP" : "SNTP", (long)(delay / 1000));
+        }
+        clockSynced = true;
+        return;
+    }
+
+    // 前回の補正から残ったoffsetは周波数誤差、その一部をdriftの推定に足す
+    interval = (int64_t)((us - clockLastUpdateUs) / 1000000);
+    if (interval < 1){
+        interval = 1;
+    }
+    clockFreqPpb += offset / interval / CLOCK_FREQ_GAIN_DIV;
+    if (clockFreqPpb > CLOCK_MAX_RATE_PPB){
+        clockFreqPpb = CLOCK_MAX_RATE_PPB;
+    } else if (clockFreqPpb < -CLOCK_MAX_RATE_PPB){
+        clockFreqPpb = -CLOCK_MAX_RATE_PPB;
+    }
+    clockLastUpdateUs = us;
+
+    // offsetは次の計測までの間に傾きで戻す(ns / s = ppb)
+    clockRebase(0, clockFreqPpb + offset * 1000 / intervalMs);
+    clockSlewEndUs = us + (uint64_t)intervalMs * 1000;
+}
+
+/**
+ * @brief SNTPの1回の結果で時刻を補正する
+ *        offset = ((T2 - T1) + (T3 - T4)) / 2, delay = (T4 - T1) - (T3 - T2)
+ */
+static void clockUpdate(const ntp_sample *sample){
+    int64_t t1 = clockNsAt(sample->t1);
+    int64_t t2 = clockNtpToNs(sample->t2);
+    int64_t t3 = clockNtpToNs(sample->t3);
+    int64_t t4 = clockNsAt(sample->t4);
+
+    clockSampleCount++;
+    clockAddSample(((t2 - t1) + (t3 - t4)) / 2, (t4 - t1) - (t3 - t2), CLOCK_SOURCE_SNTP, CLOCK_POLL_MS);
+}
+
+/**
+ * @brief hardware alarmの割り込みで呼ばれ、main loopにSNTPの処理を依頼する
+ */
+static int64_t clockAlarmCallback(alarm_id_t id, void *user_data){
+    clockAlarm = 0;
+    clockDue = true;
+    return 0;
+}
+
+/**
+ * @brief 次にSNTPで問い合わせる時刻をalarmに設定する
+ */
+static void clockSchedule(uint32_t delayMs){
+    if (clockAlarm > 0){
+        cancel_alarm(clockAlarm);
+    }
+    clockAlarm = add_alarm_in_ms(delayMs, clockAlarmCallback, NULL, true);
+    if (clockAlarm < 0){
+        clockAlarm = 0;
+        clockDue = true;
+    }
+}
+
+/**
+ * @brief SNTPを初期化して最初の問い合わせを予約する、initNetwork()の後に呼ぶ
+ */
+void initClock(){
+    uint8_t server[4] = CLOCK_NTP_SERVER;
+
+    SNTP_init(CLOCK_SOCKET, server, 0, clockSntpBuf);
+    SNTP_reg_clock(time_us_64);
+    clockSchedule(0);
+}
+
+/**
+ * @brief main loopから呼ぶ
+ *        応答を待っている間は毎回socketを見る(T4の精度はmain loopの周期で決まる)
+ */
+void runClock(){
+    ntp_sample sample;
+    int8_t ret;
+    uint64_t us = time_us_64();
+
+    // slewが終わったらdriftの補正だけにする、長く同期できなくても基準点は更新する
+    if ((clockSlewEndUs != 0 && us >= clockSlewEndUs) || us - clockParams.baseUs > CLOCK_REBASE_US){
+        clockSlewEndUs = 0;
+        clockRebase(0, clockFreqPpb);
+    }
+
+    if (!clockWaiting){
+        if (!clockDue){
+            return;
+        }
+        clockDue = false;
+        if (clockPtpActive()){
+            clockSchedule(CLOCK_POLL_MS);
+            return;
+        }
+        if (!networkAcquireSocket(NETWORK_SOCKET_OWNER_SNTP)){
+            // DHCPの交渉中
+            clockSchedule(CLOCK_BURST_MS);
+            return;
+        }
+        clockWaiting = true;
+    }
+
+    ret = SNTP_exchange(&sample);
+    if (ret == 0){
+        return;
+    }
+    clockWaiting = false;
+    networkReleaseSocket(NETWORK_SOCKET_OWNER_SNTP);
+    if (ret < 0){
+        clockSchedule(CLOCK_RETRY_MS);
+        return;
+    }
+    clockUpdate(&sample);
+    clockSchedule((clockSampleCount < CLOCK_BURST) ? CLOCK_BURST_MS : CLOCK_POLL_MS);
+}
+
+/**
+ * @brief SNTPで同期したか
+ */
+bool isClockSynced(){
+    return clockSynced;
+}
+
+/**
+ * @brief 最後のsampleのoffset (ns)
+ */
+int64_t getClockOffsetNs(){
+    return clockLastOffsetNs;
+}
+
+/**
+ * @brief 最後のsampleのround trip delay (ns)
+ */
+int64_t getClockDelayNs(){
+    return clockLastDelayNs;
+}
+
+/**
+ * @brief 推定したdrift (ppb)
+ */
+int32_t getClockDriftPpb(){
+    return (int32_t)clockFreqPpb;
+}
+
+/**
+ * @brief stepした回数(最初の同期を含む)
+ */
+uint32_t getClockStepCount(){
+    return clockStepCount;
+}
+
+#endif /* _CLOCK_HPP_ */
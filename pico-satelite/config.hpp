@@ -0,0 +1,619 @@
+/**
+ * @file config.hpp
+ * @brief ネットワーク、port、pin、baud rateの設定をflashの予約sectorに保存し、起動時にRAMに読む
+ *        値はconfigGet()で読む(RAMの配列を引くだけ)、起動後は変わらないのでcore1や割り込みから読んでもよい
+ *        変更はflashに書き、次の起動から使う(pinやsocketは起動時に設定するため)
+ *
+ *        2つのsectorに交互に書き、versionが新しくCRCが合う方を使う
+ *        書き込み中に電源が落ちても前のsectorが残るので、変更は全部か何もないかのどちらかになる
+ *        header(16byte) magic, CRC(formatから最後のentryまで), format, entry数, version(書いた回数)
+ *        entry(12byte)  key id, 0, value(64bit)
+ *        key idは変えない(消したkeyのidは使わない)、知らないidと範囲外の値は無視して初期値を使う
+ *
+ *        GET  /config         保存してある値、versionと再起動が必要か
+ *        POST /config         {"net.ip":"192.168.0.20","uart.baud":9600} 変えるkeyだけ
+ *        POST /config/reset   すべて初期値に戻す
+ *        POST /config/reboot  再起動して保存した値を使う
+ *        flashへの書き込みと再起動は、valveがすべて閉じていてコマンドが来ていないときだけ
+ * @author Murakami Kantaro
+ * @date 2024-07-01
+ */
+#ifndef _CONFIG_HPP_
+#define _CONFIG_HPP_
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <pico/stdio.h>
+#include "port_common.h"
+#include "hardware/watchdog.h"
+
+#include "httpServer.h"
+#include "httpParser.h"
+#include "httpJson.h"
+
+#include "w5x00_spi.h"
+#include "w5x00_gpio_irq.h"
+#include "w5x00_mem_profile.h"
+#include "storage.hpp"
+
+#if defined(RECORDER_BACKEND) && RECORDER_BACKEND == 1 // RECORDER_BACKEND_SD
+#include "pico/sd_card.h"
+#endif
+
+/**
+ * @brief measureの初期pin、UART1のTX(4, 8, 20, 24)とRX(5, 9, 21, 25)
+ *        SD cardのrecorderではDAT0-3(2-5)、valve(8)、W5x00(20, 21)を避けるとTX 24、RX 9しか残らない
+ *        measureは受けるだけなのでTXがPicoのVBUS検出(24)でも困らない
+ */
+#if defined(RECORDER_BACKEND) && RECORDER_BACKEND == 1
+#define CONFIG_MEASURE_TX_INIT 24
+#define CONFIG_MEASURE_RX_INIT 9
+#else
+#define CONFIG_MEASURE_TX_INIT 4
+#define CONFIG_MEASURE_RX_INIT 5
+#endif
+
+#define CONFIG_MAGIC 0x47464E43 // "CNFG"
+#define CONFIG_FORMAT 1
+/**
+ * @brief 保存する2面、leaseの下の予約sector
+ */
+#define CONFIG_SECTOR_A STORAGE_SECTOR_CONFIG_A
+#define CONFIG_SECTOR_B STORAGE_SECTOR_CONFIG_B
+#define CONFIG_NONE 0xFF
+/**
+ * @brief 1 sectorに入るentryの数、これより多いheaderは壊れているとみなす
+ */
+#define CONFIG_MAX_ENTRIES ((FLASH_SECTOR_SIZE - sizeof(config_header_t)) / sizeof(config_entry_t))
+/**
+ * @brief reboot requestの応答を送り終えてから再起動するまでの時間
+ */
+#define CONFIG_REBOOT_DELAY_MS 500
+
+/**
+ * @brief 値の種類
+ *        INT  JSONの数値、min - max
+ *        BOOL JSONのtrue/false
+ *        IP   "192.168.0.1"、valueは上位byteが先頭
+ *        MAC  "00:08:dc:12:34:56"、valueは上位byteが先頭
+ */
+#define CONFIG_TYPE_INT 0
+#define CONFIG_TYPE_BOOL 1
+#define CONFIG_TYPE_IP 2
+#define CONFIG_TYPE_MAC 3
+
+#define CONFIG_IP(a, b, c, d) (((uint64_t)(a) << 24) | ((b) << 16) | ((c) << 8) | (d))
+#define CONFIG_MAC(a, b, c, d, e, f) (((uint64_t)(a) << 40) | ((uint64_t)(b) << 32) | CONFIG_IP(c, d, e, f))
+
+/**
+ * @brief key、configKeys[]と同じ順
+ */
+enum {
+    CONFIG_NET_MAC = 0,
+    CONFIG_NET_IP,
+    CONFIG_NET_SN,
+    CONFIG_NET_GW,
+    CONFIG_NET_DNS,
+    CONFIG_NET_DHCP,
+    CONFIG_PORT_COMMAND,
+    CONFIG_PORT_TELEMETRY,
+    CONFIG_PORT_BROKER,
+    CONFIG_PORT_TIMESYNC,
+    CONFIG_PIN_O2,
+    CONFIG_PIN_FILL,
+    CONFIG_PIN_DUMP,
+    CONFIG_PIN_O2_INDICATOR,
+    CONFIG_PIN_FILL_INDICATOR,
+    CONFIG_PIN_DUMP_INDICATOR,
+    CONFIG_PIN_IGNITION_TX,
+    CONFIG_PIN_IGNITION_RX,
+    CONFIG_PIN_MEASURE_TX,
+    CONFIG_PIN_MEASURE_RX,
+    CONFIG_UART_BAUD,
+    CONFIG_NET_MEM_PROFILE,
+    CONFIG_KEY_NUM
+};
+
+typedef struct {
+    uint16_t id;
+    uint8_t type;
+    const char *name;
+    uint64_t init;
+    uint32_t min;
+    uint32_t max;
+} config_key_t;
+
+/**
+ * @brief keyと初期値
+ *        net.dhcpがtrueのときnet.ipは使わずlink-localで起動してleaseを待たない
+ *        net.memProfileはW5x00のsocket bufferの割り当て(WIZCHIP_MEM_PROFILE_xxx)、W5500で"/recorder.bin"をFTPで速く送るときはftp
+ *        pin.xxxは互いに重ならないこと、W5x00とSD cardのpinは使えない(configCheckPins())
+ *        ignitionはUART0、measureはUART1のTX/RXに使えるpinだけ(configUartPin())
+ */
+static const config_key_t configKeys[CONFIG_KEY_NUM] = {
+    {1, CONFIG_TYPE_MAC, "net.mac", CONFIG_MAC(0x00, 0x08, 0xDC, 0x12, 0x34, 0x56), 0, 0},
+    {2, CONFIG_TYPE_IP, "net.ip", CONFIG_IP(192, 168, 100, 100), 0, 0},
+    {3, CONFIG_TYPE_IP, "net.sn", CONFIG_IP(255, 255, 255, 0), 0, 0},
+    {4, CONFIG_TYPE_IP, "net.gw", CONFIG_IP(192, 168, 100, 1), 0, 0},
+    {5, CONFIG_TYPE_IP, "net.dns", CONFIG_IP(8, 8, 8, 8), 0, 0},
+    {6, CONFIG_TYPE_BOOL, "net.dhcp", 0, 0, 1},
+    {7, CONFIG_TYPE_INT, "port.command", 5000, 1, 65535},
+    {8, CONFIG_TYPE_INT, "port.telemetry", 5005, 1, 65535},
+    {9, CONFIG_TYPE_INT, "port.broker", 1883, 1, 65535},
+    {10, CONFIG_TYPE_INT, "port.timesync", 3190, 1, 65535},
+    {11, CONFIG_TYPE_INT, "pin.o2", 6, 0, 29},
+    {12, CONFIG_TYPE_INT, "pin.fill", 7, 0, 29},
+    {13, CONFIG_TYPE_INT, "pin.dump", 8, 0, 29},
+    {14, CONFIG_TYPE_INT, "pin.o2Indicator", 11, 0, 29},
+    {15, CONFIG_TYPE_INT, "pin.fillIndicator", 12, 0, 29},
+    {16, CONFIG_TYPE_INT, "pin.dumpIndicator", 13, 0, 29},
+    {17, CONFIG_TYPE_INT, "pin.ignitionTx", 0, 0, 29},
+    {18, CONFIG_TYPE_INT, "pin.ignitionRx", 1, 0, 29},
+    {19, CONFIG_TYPE_INT, "pin.measureTx", CONFIG_MEASURE_TX_INIT, 0, 29},
+    {20, CONFIG_TYPE_INT, "pin.measureRx", CONFIG_MEASURE_RX_INIT, 0, 29},
+    {21, CONFIG_TYPE_INT, "uart.baud", 115200, 300, 921600},
+    {22, CONFIG_TYPE_INT, "net.memProfile", WIZCHIP_MEM_PROFILE_DEFAULT, 0, WIZCHIP_MEM_PROFILE_NUM - 1},
+};
+
+typedef struct {
+    uint32_t magic;
+    uint32_t crc;
+    uint16_t format;
+    uint16_t count;
+    uint32_t version;
+} config_header_t;
+
+typedef struct {
+    uint16_t id;
+    uint16_t reserved;
+    uint32_t lo;
+    uint32_t hi;
+} config_entry_t;
+
+/**
+ * @brief configValueは起動時に読んだ値(使っている値)、configStoredはflashにある値
+ */
+static uint64_t configValue[CONFIG_KEY_NUM];
+static uint64_t configStored[CONFIG_KEY_NUM];
+static uint32_t configVersion = 0;
+static uint8_t configActive = CONFIG_NONE;
+static uint32_t configImage[(sizeof(config_header_t) + CONFIG_KEY_NUM * sizeof(config_entry_t) + 3) / 4];
+static bool (*configCanWrite)(void) = NULL;
+static uint64_t configRebootUs = 0;
+
+/**
+ * @brief 設定を読む
+ * @param[in] key CONFIG_xxx
+ * @return 値(INT, BOOL, IP)
+ */
+static inline uint32_t configGet(uint8_t key){
+    return (uint32_t)configValue[key];
+}
+
+/**
+ * @brief IP、MACの設定をbyte列で読む
+ * @param[in] key CONFIG_xxx
+ * @param[out] buf 先頭から上位byte
+ * @param[in] len IPは4、MACは6
+ */
+void configGetBytes(uint8_t key, uint8_t *buf, uint8_t len){
+    for (uint8_t i = 0; i < len; i++){
+        buf[i] = (uint8_t)(configValue[key] >> (8 * (len - 1 - i)));
+    }
+}
+
+static uint32_t configSectorOffset(uint8_t sector){
+    return (sector == 0) ? CONFIG_SECTOR_A : CONFIG_SECTOR_B;
+}
+
+/**
+ * @brief 値がkeyの範囲にあるか
+ */
+static bool configValid(uint8_t key, uint64_t value){
+    switch (configKeys[key].type){
+    case CONFIG_TYPE_INT:
+        return value >= configKeys[key].min && value <= configKeys[key].max;
+    case CONFIG_TYPE_BOOL:
+        return value <= 1;
+    case CONFIG_TYPE_IP:
+        return value <= 0xFFFFFFFF;
+    case CONFIG_TYPE_MAC:
+        // multicastのbitが立っていないこと
+        return value <= 0xFFFFFFFFFFFFULL && ((value >> 40) & 0x01) == 0;
+    }
+    return false;
+}
+
+/**
+ * @brief 他で使っているpinか
+ *        W5x00のSPI、RST、INTと、SD cardのrecorderではCLK、CMD、DAT0-3
+ */
+static bool configPinReserved(uint32_t pin){
+    if (pin == PIN_MISO || pin == PIN_CS || pin == PIN_SCK || pin == PIN_MOSI || pin == PIN_RST || pin == PIN_INT){
+        return true;
+    }
+#if defined(RECORDER_BACKEND) && RECORDER_BACKEND == 1
+    if (pin == PICO_SD_CLK_PIN || pin == PICO_SD_CMD_PIN || (pin >= PICO_SD_DAT0_PIN && pin < PICO_SD_DAT0_PIN + 4)){
+        return true;
+    }
+#endif
+    return false;
+}
+
+/**
+ * @brief pinがuartのTX/RXになれるか
+ *        GPIO 0-3はUART0、4-11はUART1、12-19はUART0、20-27はUART1、28-29はUART0で、4本ずつTX、RX、CTS、RTSの順
+ * @param[in] pin GPIO
+ * @param[in] uart 0 or 1
+ * @param[in] tx true: TX, false: RX
+ * @return true: なれる
+ */
+static bool configUartPin(uint32_t pin, uint8_t uart, bool tx){
+    return (pin & 3) == (tx ? 0u : 1u) && (((pin + 4) >> 3) & 1) == uart;
+}
+
+/**
+ * @brief keyをまたいだ確認、pin.xxxが重なっていないか、予約したpinを使っていないか、UARTのpinか
+ * @param[in] values 書く値
+ * @param[out] key 問題のあったkey
+ * @return NULL: 問題なし, エラーの内容
+ */
+static const char *configCheckPins(const uint64_t *values, uint8_t *key){
+    uint32_t used = 0;
+
+    for (*key = CONFIG_PIN_O2; *key <= CONFIG_PIN_MEASURE_RX; (*key)++){
+        if (configPinReserved((uint32_t)values[*key])){
+            return "reserved pin";
+        }
+        if (used & (1u << values[*key])){
+            return "duplicate pin";
+        }
+        used |= 1u << values[*key];
+    }
+    for (*key = CONFIG_PIN_IGNITION_TX; *key <= CONFIG_PIN_MEASURE_RX; (*key)++){
+        uint8_t uart = *key >= CONFIG_PIN_MEASURE_TX ? 1 : 0;
+        bool tx = *key == CONFIG_PIN_IGNITION_TX || *key == CONFIG_PIN_MEASURE_TX;
+        if (!configUartPin((uint32_t)values[*key], uart, tx)){
+            return uart ? "not a UART1 pin" : "not a UART0 pin";
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief sectorのheaderとCRCを確かめる
+ * @param[in] sector 0 or 1
+ * @param[out] version 書いた回数
+ * @return true: 使える
+ */
+static bool configCheckSector(uint8_t sector, uint32_t *version){
+    const config_header_t *h = (const config_header_t *)storageRead(configSectorOffset(sector));
+
+    if (h->magic != CONFIG_MAGIC || h->format != CONFIG_FORMAT || h->count > CONFIG_MAX_ENTRIES){
+        return false;
+    }
+    if (h->crc != storageCrc32((const uint8_t *)&h->format, sizeof(config_header_t) - 8 + h->count * sizeof(config_entry_t))){
+        return false;
+    }
+    *version = h->version;
+    return true;
+}
+
+/**
+ * @brief sectorのentryをconfigValueに読む
+ */
+static void configLoad(uint8_t sector){
+    const config_header_t *h = (const config_header_t *)storageRead(configSectorOffset(sector));
+    const config_entry_t *e = (const config_entry_t *)(h + 1);
+    uint64_t value;
+
+    for (uint16_t i = 0; i < h->count; i++){
+        value = ((uint64_t)e[i].hi << 32) | e[i].lo;
+        for (uint8_t key = 0; key < CONFIG_KEY_NUM; key++){
+            if (configKeys[key].id == e[i].id){
+                if (configValid(key, value)){
+                    configValue[key] = value;
+                }
+                break;
+            }
+        }
+    }
+}
+
+/**
+ * @brief 使っていない方のsectorにすべての値を書く、core0から呼ぶ
+ *        消去に数十msかかり、その間はcore1と割り込みが止まる
+ * @param[in] values 書く値
+ * @return NULL: 成功, エラーの内容
+ */
+static const char *configCommit(const uint64_t *values){
+    config_header_t *h = (config_header_t *)configImage;
+    config_entry_t *e = (config_entry_t *)(h + 1);
+    uint8_t next = (configActive == 0) ? 1 : 0;
+    size_t len = sizeof(config_header_t) + CONFIG_KEY_NUM * sizeof(config_entry_t);
+
+    for (uint8_t key = 0; key < CONFIG_KEY_NUM; key++){
+        e[key].id = configKeys[key].id;
+        e[key].reserved = 0;
+        e[key].lo = (uint32_t)values[key];
+        e[key].hi = (uint32_t)(values[key] >> 32);
+    }
+    h->magic = CONFIG_MAGIC;
+    h->format = CONFIG_FORMAT;
+    h->count = CONFIG_KEY_NUM;
+    h->version = configVersion + 1;
+    h->crc = storageCrc32((const uint8_t *)&h->format, len - 8);
+
+    if (!storageWriteSector(configSectorOffset(next), (const uint8_t *)configImage, len)){
+        return "flash";
+    }
+    if (memcmp(storageRead(configSectorOffset(next)), configImage, len) != 0){
+        return "verify";
+    }
+    configActive = next;
+    configVersion = h->version;
+    memcpy(configStored, values, sizeof(configStored));
+    printf("Config : version %lu saved\r\n", (unsigned long)configVersion);
+    return NULL;
+}
+
+/**
+ * @brief 保存した設定をRAMに読む、mainの最初(pinやnetworkの設定より前)に呼ぶ
+ *        2面のheaderとentryを確かめて読むだけなので1 ms以下
+ */
+void initConfig(){
+    uint64_t start = time_us_64();
+    uint32_t version[2];
+    bool valid[2];
+    uint8_t bad;
+
+    for (uint8_t key = 0; key < CONFIG_KEY_NUM; key++){
+        configValue[key] = configKeys[key].init;
+    }
+    valid[0] = configCheckSector(0, &version[0]);
+    valid[1] = configCheckSector(1, &version[1]);
+    if (valid[0] && valid[1]){
+        configActive = ((int32_t)(version[1] - version[0]) > 0) ? 1 : 0;
+    } else if (valid[0] || valid[1]){
+        configActive = valid[0] ? 0 : 1;
+    }
+    if (configActive != CONFIG_NONE){
+        configVersion = version[configActive];
+        configLoad(configActive);
+    }
+    if (configCheckPins(configValue, &bad) != NULL){
+        // 前のfirmwareで保存した重なったpinでvalveを動かさない
+        printf("Config : %s conflicts, using the default pins\r\n", configKeys[bad].name);
+        for (uint8_t key = CONFIG_PIN_O2; key <= CONFIG_PIN_MEASURE_RX; key++){
+            configValue[key] = configKeys[key].init;
+        }
+    }
+    memcpy(configStored, configValue, sizeof(configStored));
+    printf("Config : version %lu (%lu us)\r\n", (unsigned long)configVersion, (unsigned long)(time_us_64() - start));
+}
+
+/**
+ * @brief main loopから呼ぶ、reboot requestの後に再起動する
+ */
+void runConfig(){
+    if (configRebootUs == 0 || time_us_64() < configRebootUs){
+        return;
+    }
+    configRebootUs = 0;
+    if (configCanWrite != NULL && !configCanWrite()){
+        printf("Config : reboot cancelled\r\n");
+        return;
+    }
+    printf("Config : rebooting\r\n");
+    watchdog_reboot(0, 0, 0);
+}
+
+/**
+ * @brief requestのbodyから取り出した値とresponseの内容
+ */
+typedef struct {
+    uint64_t values[CONFIG_KEY_NUM];
+    const char *error;
+    char key[JSON_READER_KEY_SIZE];
+} config_request_t;
+
+/**
+ * @brief "192.168.0.1"や"00:08:dc:12:34:56"を読む
+ * @param[in] text 文字列
+ * @param[in] n byte数
+ * @param[in] base 10 or 16
+ * @param[out] value 上位byteが先頭
+ * @return true: 成功
+ */
+static bool configParseOctets(const char *text, uint8_t n, int base, uint64_t *value){
+    char *end;
+    unsigned long octet;
+
+    *value = 0;
+    for (uint8_t i = 0; i < n; i++){
+        octet = strtoul(text, &end, base);
+        if (end == text || octet > 255){
+            return false;
+        }
+        *value = (*value << 8) | octet;
+        if (i < n - 1){
+            if (*end != '.' && *end != ':' && *end != '-'){
+                return false;
+            }
+            end++;
+        }
+        text = end;
+    }
+    return *text == '\0';
+}
+
+/**
+ * @brief bodyのmemberごとにjson_reader_feed()から呼ばれる
+ */
+static void configOnMember(void *arg, const char *name, uint8_t type, const char *text){
+    config_request_t *req = (config_request_t *)arg;
+    uint64_t value = 0;
+    char *end;
+    bool ok = false;
+    uint8_t key;
+
+    if (req->error != NULL){
+        return;
+    }
+    for (key = 0; key < CONFIG_KEY_NUM; key++){
+        if (!strcmp(name, configKeys[key].name)){
+            break;
+        }
+    }
+    if (key == CONFIG_KEY_NUM){
+        req->error = "unknown key";
+    } else {
+        switch (configKeys[key].type){
+        case CONFIG_TYPE_INT:
+            if (type == JSON_TYPE_NUMBER){
+                value = strtoul(text, &end, 10);
+                ok = (*end == '\0');
+            }
+            break;
+        case CONFIG_TYPE_BOOL:
+            ok = (type == JSON_TYPE_TRUE || type == JSON_TYPE_FALSE);
+            value = (type == JSON_TYPE_TRUE);
+            break;
+        case CONFIG_TYPE_IP:
+            ok = (type == JSON_TYPE_STRING) && configParseOctets(text, 4, 10, &value);
+            break;
+        case CONFIG_TYPE_MAC:
+            ok = (type == JSON_TYPE_STRING) && configParseOctets(text, 6, 16, &value);
+            break;
+        }
+        if (ok && configValid(key, value)){
+            req->values[key] = value;
+            return;
+        }
+        req->error = "invalid value";
+    }
+    strncpy(req->key, name, sizeof(req->key) - 1);
+    req->key[sizeof(req->key) - 1] = '\0';
+}
+
+static void configRender(st_json_writer *w, void *arg){
+    const config_request_t *req = (const config_request_t *)arg;
+    char text[18];
+    uint64_t value;
+
+    json_object_begin(w, NULL);
+    if (req->error != NULL){
+        json_write_string(w, "error", req->error);
+        if (req->key[0] != '\0'){
+            json_write_string(w, "key", req->key);
+        }
+    }
+    json_write_int(w, "version", (int32_t)configVersion);
+    json_write_bool(w, "reboot", memcmp(configStored, configValue, sizeof(configValue)) != 0);
+    json_object_begin(w, "config");
+    for (uint8_t key = 0; key < CONFIG_KEY_NUM; key++){
+        value = configStored[key];
+        switch (configKeys[key].type){
+        case CONFIG_TYPE_INT:
+            json_write_int(w, configKeys[key].name, (int32_t)value);
+            break;
+        case CONFIG_TYPE_BOOL:
+            json_write_bool(w, configKeys[key].name, value != 0);
+            break;
+        case CONFIG_TYPE_IP:
+            snprintf(text, sizeof(text), "%u.%u.%u.%u", (unsigned)(value >> 24) & 0xFF, (unsigned)(value >> 16) & 0xFF,
+                     (unsigned)(value >> 8) & 0xFF, (unsigned)value & 0xFF);
+            json_write_string(w, configKeys[key].name, text);
+            break;
+        case CONFIG_TYPE_MAC:
+            snprintf(text, sizeof(text), "%02x:%02x:%02x:%02x:%02x:%02x", (unsigned)(value >> 40) & 0xFF,
+                     (unsigned)(value >> 32) & 0xFF, (unsigned)(value >> 24) & 0xFF, (unsigned)(value >> 16) & 0xFF,
+                     (unsigned)(value >> 8) & 0xFF, (unsigned)value & 0xFF);
+            json_write_string(w, configKeys[key].name, text);
+            break;
+        }
+    }
+    json_object_end(w);
+    json_object_end(w);
+}
+
+/**
+ * @brief "config"のrequestを処理する
+ */
+static uint8_t configHandler(uint8_t s, st_http_request *http, uint8_t *uri_name){
+    static config_request_t req;
+    st_json_reader reader;
+    const char *name = (const char *)uri_name + strlen("config");
+    uint8_t bad;
+
+    req.error = NULL;
+    req.key[0] = '\0';
+    memcpy(req.values, configStored, sizeof(req.values));
+
+    if (http->METHOD == METHOD_GET && *name == '\0'){
+        http_json_response(s, STATUS_OK, configRender, &req);
+        return 1;
+    }
+    if (http->METHOD != METHOD_POST){
+        return 0;
+    }
+
+    if (!strcmp(name, "/reboot")){
+        if (configCanWrite != NULL && !configCanWrite()){
+            req.error = "busy";
+        } else {
+            configRebootUs = time_us_64() + (uint64_t)CONFIG_REBOOT_DELAY_MS * 1000;
+        }
+        http_json_response(s, (req.error == NULL) ? STATUS_ACCEPTED : STATUS_SERV_UNAVAIL, configRender, &req);
+        return 1;
+    }
+    if (!strcmp(name, "/reset")){
+        for (uint8_t key = 0; key < CONFIG_KEY_NUM; key++){
+            req.values[key] = configKeys[key].init;
+        }
+    } else if (*name == '\0'){
+        json_reader_init(&reader, configOnMember, &req);
+        if (http->BODY_LEN == 0 || json_reader_feed(&reader, get_http_body(http), http->BODY_LEN) != JSON_READER_DONE){
+            req.error = (req.error != NULL) ? req.error : "json";
+        }
+        if (req.error != NULL){
+            http_json_response(s, STATUS_BAD_REQ, configRender, &req);
+            return 1;
+        }
+    } else {
+        return 0;
+    }
+    if ((req.error = configCheckPins(req.values, &bad)) != NULL){
+        strncpy(req.key, configKeys[bad].name, sizeof(req.key) - 1);
+        req.key[sizeof(req.key) - 1] = '\0';
+        http_json_response(s, STATUS_BAD_REQ, configRender, &req);
+        return 1;
+    }
+
+    if (memcmp(req.values, configStored, sizeof(req.values)) != 0){
+        if (configCanWrite != NULL && !configCanWrite()){
+            req.error = "busy";
+            http_json_response(s, STATUS_SERV_UNAVAIL, configRender, &req);
+            return 1;
+        }
+        if ((req.error = configCommit(req.values)) != NULL){
+            http_json_response(s, STATUS_INT_SERR, configRender, &req);
+            return 1;
+        }
+    }
+    http_json_response(s, STATUS_OK, configRender, &req);
+    return 1;
+}
+
+/**
+ * @brief 設定のREST APIを登録する、initDashboard()の後に呼ぶ
+ * @param[in] canWrite flashに書いて(再起動して)よいときtrueを返す関数、NULLならいつでも
+ */
+void initConfigApi(bool (*canWrite)(void)){
+    configCanWrite = canWrite;
+    reg_httpServer_restHandler((uint8_t *)"config", configHandler);
+}
+
+#endif /* _CONFIG_HPP_ */
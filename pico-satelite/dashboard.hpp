@@ -0,0 +1,155 @@
+/**
+ * @file dashboard.hpp
+ * @brief valveの状態をブラウザに表示するdashboard
+ *        HTTPのserver-sent eventsで状態の変化をpushする
+ * @author Murakami Kantaro
+ * @date 2024-07-01
+ */
+#ifndef _DASHBOARD_HPP_
+#define _DASHBOARD_HPP_
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <pico/stdio.h>
+#include "port_common.h"
+
+#include "wizchip_conf.h"
+#include "w5x00_mem_profile.h"
+#include "httpServer.h"
+
+/**
+ * @brief HTTPに使うsocket、W5100Sは1つ、W5500は2つ
+ *        1つはrequestのために空けておくので、event streamはW5500で1つ、W5100Sでは開けない(503)
+ */
+#define DASHBOARD_SOCKET_START WIZCHIP_SOCKET_HTTP
+#define DASHBOARD_SOCKET_NUM (WIZCHIP_SOCKET_HTTP_END - WIZCHIP_SOCKET_HTTP)
+#define DASHBOARD_SOCKET_MASK (((1 << DASHBOARD_SOCKET_NUM) - 1) << DASHBOARD_SOCKET_START)
+
+/**
+ * @brief eventの最短間隔(50 Hz)、この間の変化はまとめて最新の状態だけを送る
+ */
+#define DASHBOARD_EVENT_INTERVAL_US 20000
+#define DASHBOARD_SAMPLE_NUM 4
+
+/**
+ * @brief httpServerのDATA_BUF_SIZEと同じ、requestは一度にこれだけ読んで続きから解析する(後ろに'\0'は書かない)
+ */
+#define DASHBOARD_BUF_SIZE 2048
+
+static uint8_t dashboardTxBuf[DASHBOARD_BUF_SIZE];
+static uint8_t dashboardRxBuf[DASHBOARD_BUF_SIZE];
+
+static struct repeating_timer dashboardTickTimer;
+static volatile uint8_t dashboardValveBits = 0;
+static volatile int32_t dashboardSamples[DASHBOARD_SAMPLE_NUM] = {0};
+static volatile bool dashboardDirty = false;
+static uint64_t dashboardLastEventUs = 0;
+
+static const char dashboardPage[] =
+    "<!DOCTYPE html><html><head><meta charset=\"utf-8\"><title>pico-satelite</title></head><body>"
+    "<h1>pico-satelite</h1><table>"
+    "<tr><td>O2</td><td id=\"o2\">-</td></tr>"
+    "<tr><td>N2O Fill</td><td id=\"fill\">-</td></tr>"
+    "<tr><td>N2O Dump</td><td id=\"dump\">-</td></tr>"
+    "<tr><td>Sample</td><td id=\"sample\">-</td></tr>"
+    "</table><script>"
+    "function connect(){var es=new EventSource('/events');"
+    "es.addEventListener('state',function(e){var s=JSON.parse(e.data);"
+    "['o2','fill','dump'].forEach(function(k){document.getElementById(k).textContent=s[k]?'OPEN':'CLOSE';});"
+    "document.getElementById('sample').textContent=s.sample.join(', ');});"
+    "es.onerror=function(){if(es.readyState==2)setTimeout(connect,5000);};}"
+    "connect();"
+    "</script></body></html>";
+
+/**
+ * @brief valveの状態が変わったときに呼ぶ、割り込みから呼んでもよい
+ *        送信はrunDashboard()で行う
+ * @param[in] valveBits 開いているvalveのbit
+ */
+void dashboardNotifyValve(uint8_t valveBits){
+    dashboardValveBits = valveBits;
+    dashboardDirty = true;
+}
+
+/**
+ * @brief 計測値が変わったときに呼ぶ、割り込みから呼んでもよい
+ * @param[in] channel 計測channel
+ * @param[in] value 計測値
+ */
+void dashboardNotifySample(uint8_t channel, int32_t value){
+    if (channel >= DASHBOARD_SAMPLE_NUM){
+        return;
+    }
+    dashboardSamples[channel] = value;
+    dashboardDirty = true;
+}
+
+/**
+ * @brief ブラウザがevent streamを開いたとき、現在の状態を送る
+ * @param[in] s socket番号
+ */
+static void dashboardOnOpen(uint8_t s){
+    dashboardDirty = true;
+}
+
+/**
+ * @brief 状態が変わっていればeventを作って各clientのqueueに積む
+ */
+static void dashboardPublish(){
+    char data[128];
+    uint8_t bits;
+    uint64_t now = time_us_64();
+
+    if (!dashboardDirty || (now - dashboardLastEventUs) < DASHBOARD_EVENT_INTERVAL_US){
+        return;
+    }
+    dashboardDirty = false;
+    dashboardLastEventUs = now;
+
+    bits = dashboardValveBits;
+    snprintf(data, sizeof(data),
+        "{\"t\":%lu,\"o2\":%d,\"fill\":%d,\"dump\":%d,\"sample\":[%ld,%ld,%ld,%ld]}",
+        (unsigned long)(now / 1000),
+        (bits >> 0) & 1, (bits >> 1) & 1, (bits >> 2) & 1,
+        (long)dashboardSamples[0], (long)dashboardSamples[1],
+        (long)dashboardSamples[2], (long)dashboardSamples[3]);
+    httpServer_send_event((uint8_t *)"state", (uint8_t *)data);
+}
+
+/**
+ * @brief HTTP serverの1秒tick、keep-aliveのidle timeoutに使う
+ * @param[in] t repeating timerの情報
+ * @return true: タイマを継続する
+ */
+static bool dashboardTickCallback(struct repeating_timer *t){
+    httpServer_time_handler();
+    return true;
+}
+
+/**
+ * @brief HTTP serverを初期化してdashboardとevent streamを登録する、network初期化後に呼ぶ
+ */
+void initDashboard(){
+    static uint8_t socketList[DASHBOARD_SOCKET_NUM];
+    for (int i = 0; i < DASHBOARD_SOCKET_NUM; i++){
+        socketList[i] = DASHBOARD_SOCKET_START + i;
+    }
+    httpServer_init(dashboardTxBuf, dashboardRxBuf, DASHBOARD_SOCKET_NUM, socketList);
+    reg_httpServer_webContent((uint8_t *)"index.html", (uint8_t *)dashboardPage);
+    reg_httpServer_eventSource((uint8_t *)"events", dashboardOnOpen);
+    add_repeating_timer_ms(-1000, dashboardTickCallback, NULL, &dashboardTickTimer);
+}
+
+/**
+ * @brief main loopから呼ぶ、HTTPの各socketを1回ずつ処理する
+ *        送信はTXバッファに空きがあるときだけ行うので、command socketの処理を待たせない
+ */
+void runDashboard(){
+    dashboardPublish();
+    for (int i = 0; i < DASHBOARD_SOCKET_NUM; i++){
+        httpServer_run(i);
+    }
+}
+
+#endif /* _DASHBOARD_HPP_ */
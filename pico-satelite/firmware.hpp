@@ -0,0 +1,537 @@
+/**
+ * @file firmware.hpp
+ * @brief TFTPで新しいfirmwareをflashの後半(slot B)に受け取り、SHA-256を確認してから書き換える
+ *        受信中もvalveの制御は止めない、sectorの書き込みはcommandが来ていないときに1つずつ行う
+ *        書き換え(slot Bからslot Aへのcopy)はRAMのコードで行い、終わったらresetする
+ *        copy中に電源が落ちるとUSB(BOOTSEL)からの書き直しが要る(firmwareCopy())
+ *
+ *        GET  /firmware          状態
+ *        POST /firmware          {"file":"pico-satelite.bin","size":n,"sha256":"..."}
+ *                                requestしたhostのTFTP serverからslot Bに受け取る
+ *        POST /firmware/install  確認済みのfirmwareに書き換えてresetする(すべてのvalveが閉じているときだけ)
+ * @author Murakami Kantaro
+ * @date 2024-07-01
+ */
+#ifndef _FIRMWARE_HPP_
+#define _FIRMWARE_HPP_
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <pico/stdio.h>
+#include "port_common.h"
+#include "hardware/flash.h"
+#include "hardware/sync.h"
+#include "hardware/watchdog.h"
+#include "pico/multicore.h"
+
+#include "wizchip_conf.h"
+#include "socket.h"
+#include "w5x00_mem_profile.h"
+#include "tftp.h"
+#include "httpServer.h"
+#include "httpParser.h"
+#include "httpJson.h"
+#include "mbedtls/sha256.h"
+
+#include "sequence.hpp"
+#include "storage.hpp"
+#include "network.hpp"
+
+/**
+ * @brief TFTPのsocket、受信している間はDHCPなどは待たせる
+ */
+#define FIRMWARE_SOCKET WIZCHIP_SOCKET_TFTP
+/**
+ * @brief 受け取る領域
+ */
+#define FIRMWARE_SLOT_OFFSET STORAGE_FIRMWARE_OFFSET
+#define FIRMWARE_SLOT_SIZE STORAGE_FIRMWARE_SIZE
+/**
+ * @brief TFTPのblockの大きさ(RFC 2348)、windowの数(RFC 7440)はsocketの受信bufferに入るだけ
+ */
+#define FIRMWARE_BLOCK_MAX TFTP_BLK_SIZE_MAX
+/**
+ * @brief install requestの応答を送り終えてから書き換えるまでの時間
+ */
+#define FIRMWARE_INSTALL_DELAY_MS 200
+/**
+ * @brief tftp_timeout_handler()を呼ぶ間隔(TFTPのtimeoutは秒単位)
+ */
+#define FIRMWARE_TFTP_TICK_MS 1000
+
+#define FIRMWARE_STATE_IDLE 0
+#define FIRMWARE_STATE_DOWNLOAD 1
+#define FIRMWARE_STATE_VERIFY 2
+#define FIRMWARE_STATE_READY 3
+#define FIRMWARE_STATE_INSTALL 4
+#define FIRMWARE_STATE_ERROR 5
+
+static const char *const firmwareStateName[] = {
+    "idle", "download", "verify", "ready", "install", "error"
+};
+
+/**
+ * @brief sector単位のbuffer、片方にTFTPのblockを貯めている間にもう片方をflashに書く
+ */
+static uint8_t firmwareBuf[2][FLASH_SECTOR_SIZE];
+static uint8_t firmwareFill = 0;
+static uint32_t firmwareFillLen = 0;
+static bool firmwarePending = false;
+static uint32_t firmwarePendingOffset = 0;
+static uint32_t firmwarePendingLen = 0;
+
+static uint8_t firmwareRxBuf[MAX_MTU_SIZE];
+static uint8_t firmwareState = FIRMWARE_STATE_IDLE;
+static const char *firmwareError = "";
+static uint32_t firmwareSize = 0;
+static uint32_t firmwareReceived = 0;
+static uint32_t firmwareWritten = 0;
+static uint32_t firmwareVerified = 0;
+static uint8_t firmwareSha256[32];
+static mbedtls_sha256_context firmwareSha;
+static uint64_t firmwareStartUs = 0;
+static uint64_t firmwareTickUs = 0;
+static uint64_t firmwareInstallUs = 0;
+
+/**
+ * @brief 受け取りを止める
+ * @param[in] error 理由、NULLなら止めるだけ
+ */
+static void firmwareAbort(const char *error){
+    if (firmwareState == FIRMWARE_STATE_DOWNLOAD){
+        TFTP_exit();
+        networkReleaseSocket(NETWORK_SOCKET_OWNER_FIRMWARE);
+    }
+    firmwarePending = false;
+    firmwareState = (error != NULL) ? FIRMWARE_STATE_ERROR : FIRMWARE_STATE_IDLE;
+    firmwareError = (error != NULL) ? error : "";
+    if (error != NULL){
+        printf("Firmware : %s\r\n", error);
+    }
+}
+
+/**
+ * @brief 貯めたsectorを書き込み待ちにして、もう片方のbufferに切り替える
+ */
+static void firmwareSwap(){
+    firmwarePending = true;
+    firmwarePendingOffset = firmwareReceived - firmwareFillLen;
+    firmwarePendingLen = firmwareFillLen;
+    firmwareFill ^= 1;
+    firmwareFillLen = 0;
+}
+
+/**
+ * @brief 書き込み待ちのsectorをflashに書く
+ *        消去の間(数十ms)は割り込みもcore1も止まるが、W5x00は次のblockを受信し続ける
+ * @return true: 書いた, false: core1が止まらなかった
+ */
+static bool firmwareFlush(){
+    if (!storageWriteSector(FIRMWARE_SLOT_OFFSET + firmwarePendingOffset, firmwareBuf[firmwareFill ^ 1], firmwarePendingLen)){
+        return false;
+    }
+    firmwareWritten += firmwarePendingLen;
+    firmwarePending = false;
+    return true;
+}
+
+/**
+ * @brief tftp.cがblockを受け取るたびに呼ぶ、bufferに貯めるだけでflashには書かない
+ *        応答(ACK)はこの後すぐに送られる
+ */
+void save_data(uint8_t *data, uint32_t data_len, uint16_t block_number){
+    uint32_t n;
+
+    if (firmwareState != FIRMWARE_STATE_DOWNLOAD){
+        return;
+    }
+    if (firmwareReceived + data_len > firmwareSize){
+        firmwareAbort("larger than size");
+        return;
+    }
+    while (data_len > 0){
+        if (firmwareFillLen == FLASH_SECTOR_SIZE){
+            if (firmwarePending && !firmwareFlush()){
+                firmwareAbort("flash busy");
+                return;
+            }
+            firmwareSwap();
+        }
+        n = FLASH_SECTOR_SIZE - firmwareFillLen;
+        if (n > data_len){
+            n = data_len;
+        }
+        memcpy(firmwareBuf[firmwareFill] + firmwareFillLen, data, n);
+        firmwareFillLen += n;
+        firmwareReceived += n;
+        data += n;
+        data_len -= n;
+    }
+}
+
+/**
+ * @brief 受け取ったimageがRP2040で起動できる形か確かめる
+ *        boot2(256Byte)の後ろのvector tableがSRAMのstackとflashのreset handlerを指していること
+ * @return true: 起動できる形
+ */
+static bool firmwareCheckImage(){
+    const uint32_t *vector = (const uint32_t *)storageRead(FIRMWARE_SLOT_OFFSET + 0x100);
+    return firmwareSize > 0x108 &&
+           vector[0] > SRAM_BASE && vector[0] <= SRAM_END &&
+           vector[1] > XIP_BASE && vector[1] < XIP_BASE + firmwareSize;
+}
+
+/**
+ * @brief slot Bのsectorをbufに読む、RAMで動かす
+ * @param[in] offset slotの先頭からのoffset
+ */
+static void __no_inline_not_in_flash_func(firmwareReadSlot)(uint32_t offset){
+    uint32_t *buf = (uint32_t *)firmwareBuf[0];
+    const volatile uint32_t *src = (const volatile uint32_t *)(XIP_BASE + FIRMWARE_SLOT_OFFSET + offset);
+
+    for (uint32_t i = 0; i < FLASH_SECTOR_SIZE / 4; i++){
+        buf[i] = src[i];
+    }
+}
+
+/**
+ * @brief slot Bをslot Aにcopyしてresetする、flashのコードは呼べないのですべてRAMで動かす
+ *        割り込みを禁止しcore1を止めてから呼ぶ、戻らない
+ *        copyの途中(数秒)で電源が落ちたときに古いimageと新しいimageの混ざったものを起動しないように、
+ *        先頭sector(boot2とvector table)を最初に消し、boot2のpageを最後に書く
+ *        先頭が消えている間はboot2のCRCが合わずbootromがUSB(BOOTSEL)で起動するので、USBから書き直せば戻る
+ *        slotを選んで起動するboot stageはないので、この間の電源断はnetworkからは直せない
+ * @param[in] size copyする長さ(sectorの倍数)
+ */
+static void __no_inline_not_in_flash_func(firmwareCopy)(uint32_t size){
+    // 数秒かかるのでwatchdogは止める
+    hw_clear_bits(&watchdog_hw->ctrl, WATCHDOG_CTRL_ENABLE_BITS);
+    flash_range_erase(0, FLASH_SECTOR_SIZE);
+    for (uint32_t offset = FLASH_SECTOR_SIZE; offset < size; offset += FLASH_SECTOR_SIZE){
+        firmwareReadSlot(offset);
+        flash_range_erase(offset, FLASH_SECTOR_SIZE);
+        flash_range_program(offset, firmwareBuf[0], FLASH_SECTOR_SIZE);
+    }
+    firmwareReadSlot(0);
+    for (uint32_t page = FLASH_SECTOR_SIZE; page > 0; page -= FLASH_PAGE_SIZE){
+        flash_range_program(page - FLASH_PAGE_SIZE, firmwareBuf[0] + page - FLASH_PAGE_SIZE, FLASH_PAGE_SIZE);
+    }
+    // 通常の起動(scratch[4] = 0)でresetする
+    watchdog_hw->scratch[4] = 0;
+    watchdog_hw->ctrl = WATCHDOG_CTRL_TRIGGER_BITS;
+    while (true){
+        tight_loop_contents();
+    }
+}
+
+/**
+ * @brief 確認済みのfirmwareに書き換える
+ */
+static void firmwareInstall(){
+    uint32_t size = (firmwareSize + FLASH_SECTOR_SIZE - 1) & ~(FLASH_SECTOR_SIZE - 1);
+
+    emergencyShutdown();
+    printf("Firmware : installing %lu bytes\r\n", (unsigned long)firmwareSize);
+    sleep_ms(10);
+    if (storageCore1Running){
+        multicore_lockout_start_blocking();
+    }
+    save_and_disable_interrupts();
+    firmwareCopy(size);
+}
+
+/**
+ * @brief すべてのvalveが閉じているか
+ */
+static bool firmwareValvesClosed(){
+    return getO2ValveStatus() == COMMAND_CLOSE &&
+           getN2OFillValveStatus() == COMMAND_CLOSE &&
+           getN2ODumpValveStatus() == COMMAND_CLOSE;
+}
+
+/**
+ * @brief 16進の文字列をbyte列にする
+ * @return true: lenByteちょうど
+ */
+static bool firmwareParseHex(const char *hex, uint8_t *out, size_t len){
+    char byte[3] = {0};
+    char *end;
+
+    if (strlen(hex) != len * 2){
+        return false;
+    }
+    for (size_t i = 0; i < len; i++){
+        byte[0] = hex[2 * i];
+        byte[1] = hex[2 * i + 1];
+        out[i] = (uint8_t)strtoul(byte, &end, 16);
+        if (*end != '\0'){
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief 受け取りを始める
+ * @param[in] serverIp TFTP server
+ * @param[in] file file名
+ * @param[in] size 長さ
+ * @param[in] sha256 imageのSHA-256
+ * @return NULL: 開始した, それ以外: 理由
+ */
+static const char *firmwareStart(const uint8_t *serverIp, const char *file, uint32_t size, const uint8_t *sha256){
+    if (firmwareState == FIRMWARE_STATE_DOWNLOAD || firmwareState == FIRMWARE_STATE_VERIFY ||
+        firmwareState == FIRMWARE_STATE_INSTALL){
+        return "busy";
+    }
+    if (!networkAcquireSocket(NETWORK_SOCKET_OWNER_FIRMWARE)){
+        return "socket busy";
+    }
+    firmwareSize = size;
+    memcpy(firmwareSha256, sha256, sizeof(firmwareSha256));
+    firmwareFill = 0;
+    firmwareFillLen = 0;
+    firmwarePending = false;
+    firmwareReceived = 0;
+    firmwareWritten = 0;
+    firmwareVerified = 0;
+    firmwareError = "";
+    firmwareState = FIRMWARE_STATE_DOWNLOAD;
+    firmwareStartUs = time_us_64();
+    firmwareTickUs = firmwareStartUs;
+
+    TFTP_init(FIRMWARE_SOCKET, firmwareRxBuf);
+    // W5x00の受信bufferにはUDP headerの8Byteがblockごとに付く
+    TFTP_set_options(FIRMWARE_BLOCK_MAX, (getSn_RXBUF_SIZE(FIRMWARE_SOCKET) * 1024) / (FIRMWARE_BLOCK_MAX + 4 + 8));
+    TFTP_read_request(((uint32_t)serverIp[0] << 24) | ((uint32_t)serverIp[1] << 16) |
+                      ((uint32_t)serverIp[2] << 8) | serverIp[3], (uint8_t *)file);
+    printf("Firmware : downloading %s from %d.%d.%d.%d\r\n", file, serverIp[0], serverIp[1], serverIp[2], serverIp[3]);
+    return NULL;
+}
+
+/**
+ * @brief 受信中の処理、blockを受け取ってから溜まったsectorを書く
+ *        sectorの消去中に次のblockがW5x00に届くので、書き込みと受信が重なる
+ */
+static void firmwareDownload(){
+    int ret;
+    uint64_t now = time_us_64();
+
+    if (now - firmwareTickUs >= (uint64_t)FIRMWARE_TFTP_TICK_MS * 1000){
+        firmwareTickUs += (uint64_t)FIRMWARE_TFTP_TICK_MS * 1000;
+        tftp_timeout_handler();
+    }
+    // 書き込み待ちがあっても、空いているbufferに次のblockが入るなら受け取る
+    // windowの間は届いているblockをまとめて受け取る
+    for (int i = 0; i < TFTP_WINDOW_SIZE_MAX; i++){
+        if (firmwarePending && firmwareFillLen + FIRMWARE_BLOCK_MAX > FLASH_SECTOR_SIZE){
+            break;
+        }
+        if (i > 0 && getSn_RX_RSR(FIRMWARE_SOCKET) == 0){
+            break;
+        }
+        ret = TFTP_run();
+        if (firmwareState != FIRMWARE_STATE_DOWNLOAD){
+            return;
+        }
+        if (ret == TFTP_FAIL){
+            firmwareAbort("tftp failed");
+            return;
+        }
+        if (ret == TFTP_SUCCESS){
+            TFTP_exit();
+            networkReleaseSocket(NETWORK_SOCKET_OWNER_FIRMWARE);
+            firmwareState = FIRMWARE_STATE_VERIFY;
+            break;
+        }
+    }
+    // commandを受信しているときは、そちらの処理が終わってから書く
+    if (firmwarePending && getSn_RX_RSR(WIZCHIP_SOCKET_COMMAND) == 0){
+        firmwareFlush();
+    }
+}
+
+/**
+ * @brief 受信後の処理、残りを書いてからflashの内容を1 sectorずつhashする
+ */
+static void firmwareVerify(){
+    uint32_t n;
+    uint8_t digest[32];
+
+    if (firmwarePending){
+        if (getSn_RX_RSR(WIZCHIP_SOCKET_COMMAND) == 0){
+            firmwareFlush();
+        }
+        return;
+    }
+    if (firmwareFillLen > 0){
+        firmwareSwap();
+        return;
+    }
+    if (firmwareReceived != firmwareSize){
+        firmwareAbort("size mismatch");
+        return;
+    }
+    if (firmwareVerified == 0){
+        mbedtls_sha256_init(&firmwareSha);
+        mbedtls_sha256_starts(&firmwareSha, 0);
+    }
+    n = firmwareSize - firmwareVerified;
+    if (n > FLASH_SECTOR_SIZE){
+        n = FLASH_SECTOR_SIZE;
+    }
+    mbedtls_sha256_update(&firmwareSha, storageRead(FIRMWARE_SLOT_OFFSET + firmwareVerified), n);
+    firmwareVerified += n;
+    if (firmwareVerified < firmwareSize){
+        return;
+    }
+    mbedtls_sha256_finish(&firmwareSha, digest);
+    mbedtls_sha256_free(&firmwareSha);
+    if (memcmp(digest, firmwareSha256, sizeof(digest)) != 0){
+        firmwareAbort("sha256 mismatch");
+        return;
+    }
+    if (!firmwareCheckImage()){
+        firmwareAbort("not an RP2040 image");
+        return;
+    }
+    firmwareState = FIRMWARE_STATE_READY;
+    printf("Firmware : %lu bytes verified in %lu ms\r\n", (unsigned long)firmwareSize,
+           (unsigned long)((time_us_64() - firmwareStartUs) / 1000));
+}
+
+/**
+ * @brief main loopから呼ぶ、command socketの処理の後に呼ぶ
+ */
+void runFirmware(){
+    switch (firmwareState){
+        case FIRMWARE_STATE_DOWNLOAD:
+            firmwareDownload();
+            break;
+        case FIRMWARE_STATE_VERIFY:
+            firmwareVerify();
+            break;
+        case FIRMWARE_STATE_INSTALL:
+            if (time_us_64() >= firmwareInstallUs){
+                firmwareInstall();
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+/**
+ * @brief requestのbody
+ */
+typedef struct {
+    char file[FILE_NAME_SIZE];
+    bool hasFile;
+    uint32_t size;
+    uint8_t sha256[32];
+    bool hasSha256;
+    const char *error;
+} firmware_request_t;
+
+static void firmwareOnMember(void *arg, const char *key, uint8_t type, const char *value){
+    firmware_request_t *req = (firmware_request_t *)arg;
+
+    if (!strcmp(key, "file") && type == JSON_TYPE_STRING){
+        req->hasFile = strlen(value) < sizeof(req->file);
+        if (req->hasFile){
+            strcpy(req->file, value);
+        }
+    } else if (!strcmp(key, "size") && type == JSON_TYPE_NUMBER){
+        req->size = (uint32_t)strtoul(value, NULL, 10);
+    } else if (!strcmp(key, "sha256") && type == JSON_TYPE_STRING){
+        req->hasSha256 = firmwareParseHex(value, req->sha256, sizeof(req->sha256));
+    }
+}
+
+static void firmwareRenderStatus(st_json_writer *w, void *arg){
+    firmware_request_t *req = (firmware_request_t *)arg;
+    json_object_begin(w, NULL);
+    json_write_string(w, "state", firmwareStateName[firmwareState]);
+    if (req != NULL && req->error != NULL){
+        json_write_string(w, "error", req->error);
+    } else if (firmwareState == FIRMWARE_STATE_ERROR){
+        json_write_string(w, "error", firmwareError);
+    }
+    json_write_int(w, "size", (int32_t)firmwareSize);
+    json_write_int(w, "received", (int32_t)firmwareReceived);
+    json_write_int(w, "written", (int32_t)firmwareWritten);
+    json_write_int(w, "verified", (int32_t)firmwareVerified);
+    json_object_end(w);
+}
+
+/**
+ * @brief "firmware"のrequestを処理する
+ */
+static uint8_t firmwareHandler(uint8_t s, st_http_request *http, uint8_t *uri_name){
+    firmware_request_t req = {0};
+    st_json_reader reader;
+    uint8_t serverIp[4];
+    const char *name = (const char *)uri_name + strlen("firmware");
+
+    if (http->METHOD == METHOD_GET && *name == '\0'){
+        http_json_response(s, STATUS_OK, firmwareRenderStatus, NULL);
+        return 1;
+    }
+    if (http->METHOD != METHOD_POST){
+        return 0;
+    }
+
+    if (!strcmp(name, "/install")){
+        if (firmwareState != FIRMWARE_STATE_READY){
+            req.error = "not ready";
+        } else if (!firmwareValvesClosed()){
+            req.error = "valve open";
+        } else {
+            firmwareState = FIRMWARE_STATE_INSTALL;
+            firmwareInstallUs = time_us_64() + (uint64_t)FIRMWARE_INSTALL_DELAY_MS * 1000;
+        }
+        http_json_response(s, (req.error == NULL) ? STATUS_ACCEPTED : STATUS_SERV_UNAVAIL, firmwareRenderStatus, &req);
+        return 1;
+    }
+    if (*name != '\0'){
+        return 0;
+    }
+
+    json_reader_init(&reader, firmwareOnMember, &req);
+    if (http->BODY_LEN == 0 || json_reader_feed(&reader, get_http_body(http), http->BODY_LEN) != JSON_READER_DONE){
+        req.error = "json";
+    } else if (!req.hasFile){
+        req.error = "file";
+    } else if (req.size == 0 || req.size > FIRMWARE_SLOT_SIZE){
+        req.error = "size";
+    } else if (!req.hasSha256){
+        req.error = "sha256";
+    }
+    if (req.error != NULL){
+        http_json_response(s, STATUS_BAD_REQ, firmwareRenderStatus, &req);
+        return 1;
+    }
+
+    // requestしたhostのTFTP serverから受け取る
+    getSn_DIPR(s, serverIp);
+    req.error = firmwareStart(serverIp, req.file, req.size, req.sha256);
+    http_json_response(s, (req.error == NULL) ? STATUS_ACCEPTED : STATUS_SERV_UNAVAIL, firmwareRenderStatus, &req);
+    return 1;
+}
+
+/**
+ * @brief firmware更新のREST APIを登録する、initDashboard()の後に呼ぶ
+ */
+void initFirmware(){
+    extern char __flash_binary_end;
+    uint32_t programSize = (uint32_t)((uintptr_t)&__flash_binary_end - XIP_BASE);
+
+    if (programSize > FIRMWARE_SLOT_OFFSET || programSize > FIRMWARE_SLOT_SIZE){
+        printf("Firmware : program (%lu bytes) does not fit the update slot\r\n", (unsigned long)programSize);
+    }
+    reg_httpServer_restHandler((uint8_t *)"firmware", firmwareHandler);
+}
+
+#endif /* _FIRMWARE_HPP_ */
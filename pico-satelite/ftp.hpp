@@ -0,0 +1,63 @@
+/**
+ * @file ftp.hpp
+ * @brief 試験の後にflight recorderの記録をFTP(passive mode)で吸い出す
+ *        file systemはなく、"/recorder.bin"だけを読み出し専用で見せる(中身はtools/recorder_dump.pyで読む)
+ *        RETRはmain loopを止めず、1回のrunFtp()でdata socketのTXの空きいっぱいを1回sendする
+ *        flashはXIPからそのまま、SDはcore1が読んだ4 sectorずつ送る
+ *        W5500だけ(W5100Sには空いているsocketがない)、command socketは使わない
+ *
+ *        $ curl -o recorder.bin ftp://<IP>/recorder.bin
+ * @author Murakami Kantaro
+ * @date 2024-07-01
+ */
+#ifndef _FTP_HPP_
+#define _FTP_HPP_
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <pico/stdio.h>
+#include "port_common.h"
+
+#include "wizchip_conf.h"
+#include "socket.h"
+#include "w5x00_mem_profile.h"
+#include "ftpd.h"
+
+#include "recorder.hpp"
+
+#if defined(WIZCHIP_SOCKET_FTP) && (RECORDER_BACKEND != RECORDER_BACKEND_NONE)
+#define FTP_ENABLED 1
+#else
+#define FTP_ENABLED 0
+#endif
+
+/**
+ * @brief ftpd_run()の作業buffer、制御connectionの受信とLISTの応答に使う
+ */
+#define FTP_BUF_SIZE _MAX_SS
+
+#if FTP_ENABLED
+static uint8_t ftpBuf[FTP_BUF_SIZE];
+#endif
+
+/**
+ * @brief FTP serverを初期化する
+ */
+void initFtp(){
+#if FTP_ENABLED
+    reg_ftpd_file("recorder.bin", getRecorderImageSize, readRecorderImage);
+    ftpd_init(WIZCHIP_SOCKET_FTP, WIZCHIP_SOCKET_FTP_DATA);
+#endif
+}
+
+/**
+ * @brief main loopから呼ぶ、command socketの処理の後に呼ぶ
+ */
+void runFtp(){
+#if FTP_ENABLED
+    ftpd_run(ftpBuf);
+#endif
+}
+
+#endif /* _FTP_HPP_ */
@@ -0,0 +1,94 @@
+/**
+ * @file heartbeat.hpp
+ * @brief GSEとのheartbeatを監視し、途絶えたときにvalveを閉じるdeadman
+ * @author Murakami Kantaro
+ * @date 2024-07-01
+ */
+#ifndef _HEARTBEAT_HPP_
+#define _HEARTBEAT_HPP_
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <pico/stdio.h>
+#include "port_common.h"
+#include "hardware/watchdog.h"
+
+#include "sequence.hpp"
+
+/**
+ * @brief 有効なフレームがこの時間届かなければすべてのValveを閉じる
+ *        Valveが閉じるまでの最大時間は HEARTBEAT_TIMEOUT_MS + HEARTBEAT_CHECK_MS
+ */
+#define HEARTBEAT_TIMEOUT_MS 1000
+#define HEARTBEAT_CHECK_MS 10
+/**
+ * @brief main loopがこの時間watchdogを更新しなければリセットする
+ *        リセット後はGPIOが入力に戻るのでValveは閉じる
+ *        main loopの中で待つところはこれより短くする(ignitionの応答はIG_RESPONSE_TIMEOUT_US、socketのcloseは待たない)
+ */
+#define WATCHDOG_TIMEOUT_MS 500
+
+const uint32_t HEADER_HEARTBEAT = 0xFFFFFFF4;
+
+static struct repeating_timer heartbeatTimer;
+static volatile uint64_t heartbeatLastUs = 0;
+static volatile bool heartbeatArmed = false;
+static volatile uint32_t deadmanTripCount = 0;
+
+/**
+ * @brief ハードウェアタイマの割り込みで呼ばれ、heartbeatが途絶えていればValveを閉じる
+ * @param[in] t repeating timerの情報
+ * @return true: タイマを継続する
+ */
+bool heartbeatTimerCallback(struct repeating_timer *t){
+    if (heartbeatArmed && (time_us_64() - heartbeatLastUs) > (uint64_t)HEARTBEAT_TIMEOUT_MS * 1000){
+        heartbeatArmed = false;
+        emergencyShutdown();
+        deadmanTripCount++;
+    }
+    return true;
+}
+
+/**
+ * @brief deadmanのタイマとwatchdogを開始する
+ */
+void initHeartbeat(){
+    if (watchdog_caused_reboot()){
+        printf("Rebooted by watchdog\r\n");
+    }
+    add_repeating_timer_ms(-HEARTBEAT_CHECK_MS, heartbeatTimerCallback, NULL, &heartbeatTimer);
+    watchdog_enable(WATCHDOG_TIMEOUT_MS, true);
+}
+
+/**
+ * @brief 有効なフレームを受信したときに呼び、deadmanを(再)開始する
+ */
+void feedHeartbeat(){
+    heartbeatLastUs = time_us_64();
+    heartbeatArmed = true;
+}
+
+/**
+ * @brief GSEとの接続が切れたときに呼び、deadmanを止める
+ */
+void disarmHeartbeat(){
+    heartbeatArmed = false;
+}
+
+/**
+ * @brief main loopから呼び、watchdogを更新する
+ */
+void feedWatchdog(){
+    watchdog_update();
+}
+
+/**
+ * @brief deadmanでValveを閉じた回数を取得する
+ * @return 回数
+ */
+uint32_t getDeadmanTripCount(){
+    return deadmanTripCount;
+}
+
+#endif /* _HEARTBEAT_HPP_ */
@@ -12,11 +12,25 @@
 
 #include "wizchip_conf.h"
 #include "w5x00_spi.h"
+#include "w5x00_mem_profile.h"
+#include "w5x00_tx_queue.h"
+#include "w5x00_link.h"
 
 #include "loopback.h"
 #include "socket.h"
 
 #include "sequence.hpp"
+#include "heartbeat.hpp"
+#include "dashboard.hpp"
+#include "rest.hpp"
+#include "network.hpp"
+#include "clock.hpp"
+#include "timesync.hpp"
+#include "metrics.hpp"
+#include "snmp_mib.hpp"
+#include "firmware.hpp"
+#include "ftp.hpp"
+#include "config.hpp"
 
 
 /* Clock */
@@ -24,34 +38,25 @@
 /* Buffer */
 #define ETHERNET_BUF_MAX_SIZE (1024 * 2)
 /* Port */
-#define PORT 5000
+#define PORT ((uint16_t)configGet(CONFIG_PORT_COMMAND))
+/* Socket memory profile */
+#define MEM_PROFILE ((uint8_t)configGet(CONFIG_NET_MEM_PROFILE))
 
 #define HIGH 1
 #define LOW 0
 
 const uint8_t SOCKET_NUM = 0;
 
-#define INDICATOR_O2_VALVE 11
-#define INDICATOR_N2O_FILL_VALVE 12
-#define INDICATOR_N2O_DUMP_VALVE 13
-
 /**
- * @brief ネットワーク情報
+ * @brief ネットワーク情報、起動時に設定(config.hppのnet.xxx)から作る
  * @param mac MACアドレス
  * @param ip IPアドレス
  * @param sn サブネットマスク
  * @param gw ゲートウェイ
  * @param dns DNSサーバ
- * @param dhcp DHCPの有効/無効
+ * @param dhcp DHCPの有効/無効、NETINFO_DHCPのときipは使わずlink-localで起動してleaseを待たない
  */
-static wiz_NetInfo g_net_info ={
-    .mac = {0x00, 0x08, 0xDC, 0x12, 0x34, 0x56},
-    .ip = {192, 168, 100, 100},
-    .sn = {255, 255, 255, 0},
-    .gw = {192, 168, 100, 1},
-    .dns = {8, 8, 8, 8},
-    .dhcp = NETINFO_STATIC
-};
+static wiz_NetInfo g_net_info;
 
 /**
  * @brief 受信バッファ
@@ -60,6 +65,16 @@ static uint8_t g_buf[ETHERNET_BUF_MAX_SIZE] = {
     0,
 };
 
+/**
+ * @brief g_bufの先頭に残っている、後半がまだ届いていないコマンドの長さ(8未満)
+ */
+static uint16_t g_pending_len = 0;
+
+/**
+ * @brief 1つのコマンド(header, command)と応答の長さ
+ */
+#define FRAME_SIZE 8
+
 /**
  * @brief システムクロックの周波数を設定する
  */
@@ -109,102 +124,89 @@ void convert2Uint8Array(uint32_t header, uint32_t command, uint8_t* array) {
 
 /**
  * @brief valveを制御する関数
+ *        応答はTXキューに積むだけなので、送信はwizchip_tx_queue_flush()で行う
  * @param[in] header uint32_t型のheader
  * @param[in] command uint32_t型のcommand
  * @return 0:正常終了, -1:エラー
  */
 int actionActuator(uint32_t header, uint32_t command){
     uint32_t ret;
-    uint8_t sendBuf[8]; 
-    switch (header){
-        case HEADER_FILL:
-            if (command == COMMAND_OPEN){
-                ret = onFillSequence();
-                convert2Uint8Array(header, ret, sendBuf);
-                send(SOCKET_NUM, (uint8_t*)&sendBuf, 8);
-            } else if (command == COMMAND_STATUS){
-                ret = getN2OFillValveStatus();
-                convert2Uint8Array(header, ret, sendBuf);
-                send(SOCKET_NUM, (uint8_t*)&sendBuf, 8);
-            } else if (command == COMMAND_CLOSE){
-                ret = offFillSequence();
-                convert2Uint8Array(header, ret, sendBuf);
-                send(SOCKET_NUM, (uint8_t*)&sendBuf, 8);
-            } else {
-                ret = COMMAND_ERORR;
-                convert2Uint8Array(header, ret, sendBuf);
-                send(SOCKET_NUM, (uint8_t*)&sendBuf, 8);
-                return -1;
-            }
-            break;
-        case HEADER_DUMP:
-            if (command == COMMAND_OPEN){
-                ret = onDumpSequence();
-                convert2Uint8Array(header, ret, sendBuf);
-                send(SOCKET_NUM, (uint8_t*)&sendBuf, 8);
-            } else if (command == COMMAND_STATUS){
-                ret = getN2ODumpValveStatus();
-                convert2Uint8Array(header, ret, sendBuf);
-                send(SOCKET_NUM, (uint8_t*)&sendBuf, 8);
-            } else if (command == COMMAND_CLOSE){
-                ret = offDumpSequence();
-                convert2Uint8Array(header, ret, sendBuf);
-                send(SOCKET_NUM, (uint8_t*)&sendBuf, 8);
-            } else {
-                ret = COMMAND_ERORR;
-                convert2Uint8Array(header, ret, sendBuf);
-                send(SOCKET_NUM, (uint8_t*)&sendBuf, 8);
-                return -1;
-            }
-            break;
-        case HEADER_PURGE:
-            if (command == COMMAND_OPEN){
-                ret = onPurgeSequence();
-                convert2Uint8Array(header, ret, sendBuf);
-                send(SOCKET_NUM, (uint8_t*)&sendBuf, 8);
-            } else if (command == COMMAND_STATUS){
-                ret = getN2ODumpValveStatus();
-                convert2Uint8Array(header, ret, sendBuf);
-                send(SOCKET_NUM, (uint8_t*)&sendBuf, 8);
-            } else if (command == COMMAND_CLOSE){
-                ret = offPurgeSequence();
-                convert2Uint8Array(header, ret, sendBuf);
-                send(SOCKET_NUM, (uint8_t*)&sendBuf, 8);
-            } else {
-                ret = COMMAND_ERORR;
-                convert2Uint8Array(header, ret, sendBuf);
-                send(SOCKET_NUM, (uint8_t*)&sendBuf, 8);
-                return -1;
-            }
-            break;
-        case HEADER_IGNITION:
-            if (command == COMMAND_OPEN){
-                ret = onIgnitionSequence();
-                convert2Uint8Array(header, ret, sendBuf);
-                send(SOCKET_NUM, (uint8_t*)&sendBuf, 8);
-            } else if (command == COMMAND_STATUS){
-                ret = getO2ValveStatus();
-                convert2Uint8Array(header, ret, sendBuf);
-                send(SOCKET_NUM, (uint8_t*)&sendBuf, 8);
-            } else if (command == COMMAND_CLOSE){
-                ret = offIgnitionSequence();
-                convert2Uint8Array(header, ret, sendBuf);
-                send(SOCKET_NUM, (uint8_t*)&sendBuf, 8);
-            } else {
-                ret = COMMAND_ERORR;
-                convert2Uint8Array(header, ret, sendBuf);
-                send(SOCKET_NUM, (uint8_t*)&sendBuf, 8);
-                return -1;
-            }
-            break;
-        default:
-            ret = COMMAND_ERORR;
-            convert2Uint8Array(header, ret, sendBuf);
-            send(SOCKET_NUM, (uint8_t*)&sendBuf, 8);
-            return -1;
-            break;
+    int status = 0;
+    uint8_t sendBuf[8];
+    if (header == HEADER_HEARTBEAT){
+        // commandをそのまま返してGSE側で往復時間を測れるようにする
+        ret = command;
+    } else {
+        status = executeSequence(header, command, &ret);
+    }
+    convert2Uint8Array(header, ret, sendBuf);
+    // 受信は応答を積める分だけにしているので、通常は空きがある
+    if (wizchip_tx_queue_write(SOCKET_NUM, sendBuf, FRAME_SIZE) != FRAME_SIZE){
+        wizchip_tx_queue_flush(SOCKET_NUM);
+        if (wizchip_tx_queue_write(SOCKET_NUM, sendBuf, FRAME_SIZE) != FRAME_SIZE){
+            printf("%d:Response dropped\r\n", SOCKET_NUM);
+        }
     }
-    return 0;
+    return status;
+}
+
+/**
+ * @brief リンク断のときの安全動作、GSEとの通信が遮断されたときと同じくすべてのValveを閉じる
+ */
+static void onLinkDown(void){
+    emergencyShutdown();
+}
+
+/**
+ * @brief リンク復帰のとき、送信されなかった応答を破棄する(socketはlink monitorが閉じる)
+ *        flapの回数と復帰までの時間の最大も出す
+ */
+static void onLinkUp(void){
+    print_link_information();
+    wizchip_tx_queue_reset(SOCKET_NUM);
+    g_pending_len = 0;
+    networkOnLinkUp();
+}
+
+/**
+ * @brief DHCPでIPアドレスが変わったとき、古いアドレスの接続は使えないので
+ *        GSEとの通信が遮断されたときと同じくすべてのValveを閉じてsocketを閉じる
+ */
+static void onAddressChanged(void){
+    emergencyShutdown();
+    disarmHeartbeat();
+    wizchip_tx_queue_reset(SOCKET_NUM);
+    g_pending_len = 0;
+    close(SOCKET_NUM);
+    for (int i = 0; i < DASHBOARD_SOCKET_NUM; i++){
+        close(DASHBOARD_SOCKET_START + i);
+    }
+#if FTP_ENABLED
+    close(WIZCHIP_SOCKET_FTP);
+    close(WIZCHIP_SOCKET_FTP_DATA);
+#endif
+}
+
+/**
+ * @brief 設定からネットワーク情報を作る
+ */
+static void loadNetInfo(void){
+    configGetBytes(CONFIG_NET_MAC, g_net_info.mac, 6);
+    configGetBytes(CONFIG_NET_IP, g_net_info.ip, 4);
+    configGetBytes(CONFIG_NET_SN, g_net_info.sn, 4);
+    configGetBytes(CONFIG_NET_GW, g_net_info.gw, 4);
+    configGetBytes(CONFIG_NET_DNS, g_net_info.dns, 4);
+    g_net_info.dhcp = configGet(CONFIG_NET_DHCP) ? NETINFO_DHCP : NETINFO_STATIC;
+}
+
+/**
+ * @brief flight recorderや設定がflashに書いて(設定は再起動して)よいか
+ *        書き込み中はcore1と割り込みが止まるので、valveがすべて閉じていて次のコマンドが来ていないときだけ
+ * @return true: 書いてよい
+ */
+static bool canWriteFlash(void){
+    return getO2ValveStatus() == COMMAND_CLOSE && getN2OFillValveStatus() == COMMAND_CLOSE &&
+           getN2ODumpValveStatus() == COMMAND_CLOSE && getSn_RX_RSR(SOCKET_NUM) == 0;
 }
 
 int main()
@@ -215,6 +217,12 @@ int main()
     set_clock_khz();
 
     stdio_init_all();
+    // pinやportを使う前に保存した設定を読む
+    initConfig();
+    loadNetInfo();
+    // valveを操作する前にflight recorderのbufferとtelemetryのqueueを用意する
+    initRecorder(canWriteFlash);
+    initTelemetry();
     // -------------initialize GPIO------------------
     gpio_init(O2_VALVE);
     gpio_init(N2O_FILL_VALVE);
@@ -228,18 +236,39 @@ int main()
     gpio_set_dir(INDICATOR_O2_VALVE, GPIO_OUT);
     gpio_set_dir(INDICATOR_N2O_FILL_VALVE, GPIO_OUT);
     gpio_set_dir(INDICATOR_N2O_DUMP_VALVE, GPIO_OUT);
+    // UART0: Ignition, UART1: Measure
+    initUartPins();
     // ----------------------------------------------
     wizchip_spi_initialize();
     wizchip_cris_initialize();
 
     wizchip_reset();
+    wizchip_mem_profile_select(MEM_PROFILE);
     wizchip_initialize();
     wizchip_check();
+#if WIZCHIP_BENCHMARK
+    // socketを開く前にSPIの転送速度を測る(SATELITE_SPI_BENCHMARK)
+    wizchip_benchmark(SOCKET_NUM);
+#endif
 
-    network_initialize(g_net_info);
+    initNetwork(&g_net_info, onAddressChanged, canWriteFlash);
+    wizchip_tx_queue_initialize(SOCKET_NUM);
+    wizchip_link_monitor_initialize((1 << SOCKET_NUM) | DASHBOARD_SOCKET_MASK, onLinkDown, onLinkUp);
+    initHeartbeat();
+    startTelemetry();
+    initDashboard();
+    initRestApi();
+    initFirmware();
+    initRecorderApi();
+    initConfigApi(canWriteFlash);
+    initClock();
+    initTimesync();
+    initSnmp();
+    initFtp();
 
     /* Get network information */
     print_network_information(g_net_info);
+    printf(" Memory profile : %s\n", wizchip_mem_profile_name(wizchip_mem_profile_get()));
 
     /* Infinite loop */
     while (1)
@@ -248,6 +277,22 @@ int main()
         uint16_t size = 0, sentsize = 0;
         uint8_t destip[4];
         uint16_t destport;
+        uint16_t room;
+        uint64_t rxUs;
+        uint8_t ioMode;
+
+        // main loopが止まったらwatchdogでリセットする
+        feedWatchdog();
+        // PHYのリンク状態を監視する(ケーブル未接続でも起動はブロックしない)
+        wizchip_link_monitor_run();
+        // DHCPはalarmが来たときだけ処理する
+        runNetwork();
+        // SNTPで時刻を合わせる、応答待ちの間は毎回socketを見る
+        runClock();
+        // DAQがいればPTPでさらに細かく合わせる
+        runTimesync();
+        // 計測器から届いた値をtelemetryとdashboardに流す
+        runMeasure();
 
         switch (getSn_SR(SOCKET_NUM))    // Get Sn_SR register
         {
@@ -265,24 +310,48 @@ int main()
                 );
                 // Set Sn_IR register
                 setSn_IR(SOCKET_NUM,Sn_IR_CON);
+                // 接続した時点からheartbeatの監視を始める
+                feedHeartbeat();
             }
+            // 応答を積めるコマンドの数だけ読む、残りは受信バッファに置いておく(TCPのflow controlで相手が待つ)
+            room = (wizchip_tx_queue_get_free(SOCKET_NUM) / FRAME_SIZE) * FRAME_SIZE + (FRAME_SIZE - 1) - g_pending_len;
+            if (room > sizeof(g_buf) - g_pending_len) room = sizeof(g_buf) - g_pending_len;
             // 受信バッファにデータがあるか確認
-            if((size = getSn_RX_RSR(SOCKET_NUM)) > 0){
-                if (size > DATA_BUF_SIZE) size = DATA_BUF_SIZE;
-                ret = recv(SOCKET_NUM, g_buf, size);
+            if(wizchip_tx_queue_get_free(SOCKET_NUM) >= FRAME_SIZE && (size = getSn_RX_RSR(SOCKET_NUM)) > 0){
+                // 処理時間は受信を見つけた時点から測る
+                rxUs = time_us_64();
+                if (size > room) size = room;
+                ret = recv(SOCKET_NUM, g_buf + g_pending_len, size);
+                if (ret <= 0){
+                    break;
+                }
                 size = (uint16_t) ret;
                 sentsize = 0;
                 printf("Received data size: %d\r\n", size);
                 { // 受信データを出力
                     printf("Received data: ");
                     for (int i = 0; i < size; i++){
-                        printf("%x", g_buf[i]);
+                        printf("%x", g_buf[g_pending_len + i]);
                     }
                     printf("\r\n");
                 }
-                uint32_t header = convert2Uint32(g_buf);
-                uint32_t command = convert2Uint32(g_buf + 4);
-                actionActuator(header, command);
+                // 前回の残りとつなげる
+                size += g_pending_len;
+                // 受信データに含まれるコマンドをすべて処理し、応答はまとめて1回で送信する
+                for (int i = 0; i + FRAME_SIZE <= size; i += FRAME_SIZE){
+                    uint32_t header = convert2Uint32(g_buf + i);
+                    uint32_t command = convert2Uint32(g_buf + i + 4);
+                    // 有効なフレームだけがdeadmanを延長する
+                    int status = actionActuator(header, command);
+                    if (status == 0){
+                        feedHeartbeat();
+                    }
+                    metricsRecordCommand((uint32_t)(time_us_64() - rxUs), status == 0);
+                    recorderPushCommand(header, command, status == 0);
+                }
+                // 後半がまだ届いていないコマンドは次の受信まで残す
+                g_pending_len = size % FRAME_SIZE;
+                memmove(g_buf, g_buf + size - g_pending_len, g_pending_len);
                 /* loopback処理
                 while(size != sentsize)
                 {
@@ -298,16 +367,20 @@ int main()
                 }
                 //*/
             }
+            // 前回の送信が完了していれば積まれている応答を送信する
+            wizchip_tx_queue_flush(SOCKET_NUM);
 
             break;
         case SOCK_CLOSE_WAIT:
-            if ((ret = disconnect(SOCKET_NUM)) != SOCK_OK)
-            {
-                break;
-                //return ret;
-            }
             // socket close->GSEとの通信が遮断されたときすべてのValveを閉じる
             emergencyShutdown();
+            disarmHeartbeat();
+            wizchip_tx_queue_reset(SOCKET_NUM);
+            g_pending_len = 0;
+            // FINのACKを待つとwatchdogより長く止まるので待たない、CLOSEDになればSOCK_CLOSEDで開き直す(socket()でblockingに戻る)
+            ioMode = SOCK_IO_NONBLOCK;
+            ctlsocket(SOCKET_NUM, CS_SET_IOMODE, &ioMode);
+            disconnect(SOCKET_NUM);
             printf("%d:Socket Closed\r\n", SOCKET_NUM);
             break;
         case SOCK_INIT:
@@ -318,6 +391,8 @@ int main()
             }
             break;
         case SOCK_CLOSED:
+            wizchip_tx_queue_reset(SOCKET_NUM);
+            g_pending_len = 0;
             if ((ret = socket(SOCKET_NUM, Sn_MR_TCP, PORT, 0)) == 0)
             {
                 break;
@@ -327,5 +402,14 @@ int main()
         default:
             break;
         };
+
+        // command socketの処理が終わってからdashboard, SNMP, FTP, firmware更新, flight recorder(flash), 設定の再起動を処理する
+        runDashboard();
+        runSnmp();
+        runFtp();
+        runMetrics();
+        runFirmware();
+        runRecorder();
+        runConfig();
     }
 }
@@ -0,0 +1,107 @@
+/**
+ * @file metrics.hpp
+ * @brief コマンドの処理時間とSPIの異常を数える(SNMPで読む)
+ *        処理時間はcommand socketで受信を見つけてから応答をTXキューに積むまで
+ * @author Murakami Kantaro
+ * @date 2024-07-01
+ */
+#ifndef _METRICS_HPP_
+#define _METRICS_HPP_
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <pico/stdio.h>
+#include "port_common.h"
+
+#include "w5x00_spi.h"
+
+/**
+ * @brief 処理時間のhistogramの上限(us)、最後はそれ以上すべて
+ */
+#define METRICS_BUCKET_NUM 8
+static const uint32_t metricsBucketBoundUs[METRICS_BUCKET_NUM] = {
+    50, 100, 200, 500, 1000, 2000, 5000, UINT32_MAX
+};
+
+/**
+ * @brief SPIを確認する間隔
+ */
+#define METRICS_SPI_CHECK_MS 1000
+
+static uint32_t metricsCommandCount = 0;
+static uint32_t metricsCommandErrorCount = 0;
+static uint32_t metricsBucketCount[METRICS_BUCKET_NUM];
+static uint32_t metricsMaxLatencyUs = 0;
+static uint64_t metricsSpiCheckUs = 0;
+
+/**
+ * @brief コマンドを1つ処理したときに呼ぶ
+ * @param[in] latencyUs 受信してから応答を積むまでの時間
+ * @param[in] ok true: 正常なコマンド
+ */
+void metricsRecordCommand(uint32_t latencyUs, bool ok){
+    int i = 0;
+
+    metricsCommandCount++;
+    if (!ok){
+        metricsCommandErrorCount++;
+    }
+    while (latencyUs > metricsBucketBoundUs[i]){
+        i++;
+    }
+    metricsBucketCount[i]++;
+    if (latencyUs > metricsMaxLatencyUs){
+        metricsMaxLatencyUs = latencyUs;
+    }
+}
+
+/**
+ * @brief main loopから呼ぶ、METRICS_SPI_CHECK_MSごとにversion registerを読み返す
+ */
+void runMetrics(){
+    uint64_t now = time_us_64();
+
+    if (now - metricsSpiCheckUs < (uint64_t)METRICS_SPI_CHECK_MS * 1000){
+        return;
+    }
+    metricsSpiCheckUs = now;
+    if (wizchip_spi_verify() < 0){
+        printf("SPI : version register mismatch\r\n");
+    }
+}
+
+/**
+ * @brief 処理したコマンドの数を取得する
+ * @return 数
+ */
+uint32_t getMetricsCommandCount(){
+    return metricsCommandCount;
+}
+
+/**
+ * @brief 異常なコマンドの数を取得する
+ * @return 数
+ */
+uint32_t getMetricsCommandErrorCount(){
+    return metricsCommandErrorCount;
+}
+
+/**
+ * @brief histogramの1つのbucketの数を取得する
+ * @param[in] bucket 0 - METRICS_BUCKET_NUM-1
+ * @return 数
+ */
+uint32_t getMetricsBucketCount(int bucket){
+    return metricsBucketCount[bucket];
+}
+
+/**
+ * @brief 最大の処理時間を取得する
+ * @return 時間(us)
+ */
+uint32_t getMetricsMaxLatencyUs(){
+    return metricsMaxLatencyUs;
+}
+
+#endif /* _METRICS_HPP_ */
@@ -0,0 +1,371 @@
+/**
+ * @file network.hpp
+ * @brief IPアドレスの設定
+ *        DHCPのときは保存したlease(なければlink-localアドレス)ですぐにserverを始め、leaseはbackgroundで取得する
+ *        保存したleaseがあればDISCOVERせずにREQUEST(INIT-REBOOT)だけで再取得する
+ *        DHCPの処理はhardware alarmで必要なときだけ動かし、main loopを止めない
+ * @author Murakami Kantaro
+ * @date 2024-07-01
+ */
+#ifndef _NETWORK_HPP_
+#define _NETWORK_HPP_
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <pico/stdio.h>
+#include "port_common.h"
+
+#include "wizchip_conf.h"
+#include "socket.h"
+#include "w5x00_spi.h"
+#include "w5x00_mem_profile.h"
+#include "dhcp.h"
+#include "storage.hpp"
+
+/**
+ * @brief DHCPに使うsocket、leaseを保持している間は閉じておく(その間はSNTPとPTPが使う)
+ */
+#define NETWORK_DHCP_SOCKET WIZCHIP_SOCKET_DHCP
+
+/**
+ * @brief DHCP socketを共有するもの(SNTP, PTP, SNMP, firmwareのTFTP)、使っている間は他は開かない
+ *        SNMPは待ち受けているだけなので、他が使うときは閉じて譲る
+ */
+#define NETWORK_SOCKET_OWNER_DHCP 1
+#define NETWORK_SOCKET_OWNER_SNTP 2
+#define NETWORK_SOCKET_OWNER_PTP 3
+#define NETWORK_SOCKET_OWNER_SNMP 4
+#define NETWORK_SOCKET_OWNER_FIRMWARE 5
+
+/**
+ * @brief 応答を待っている間にDHCP socketを見る間隔
+ */
+#define NETWORK_DHCP_POLL_MS 20
+/**
+ * @brief DISCOVERに応答がなかったとき、次に試すまでの時間
+ */
+#define NETWORK_DHCP_RETRY_MS 30000
+/**
+ * @brief leaseの更新(T1)を待つとき、一度に待つ最長時間
+ */
+#define NETWORK_DHCP_MAX_SLEEP_MS (3600 * 1000)
+
+/**
+ * @brief DHCPのmessage buffer (dhcp.cのRIP_MSG_SIZE)
+ */
+#define NETWORK_DHCP_BUF_SIZE 548
+
+/**
+ * @brief flashに保存するlease
+ */
+#define NETWORK_LEASE_MAGIC 0x50434844 // "DHCP"
+#define NETWORK_LEASE_SECTOR STORAGE_SECTOR_LEASE
+
+typedef struct {
+    uint32_t magic;
+    uint8_t ip[4];
+    uint8_t sn[4];
+    uint8_t gw[4];
+    uint8_t dns[4];
+    uint8_t server[4];
+    uint32_t leaseTime;
+    uint32_t crc;
+} network_lease_t;
+
+static uint8_t networkDhcpBuf[NETWORK_DHCP_BUF_SIZE];
+static wiz_NetInfo networkInfo;
+static volatile bool networkDhcpDue = false;
+static alarm_id_t networkDhcpAlarm = 0;
+static void (*networkAddressChanged)(void) = NULL;
+static volatile bool networkLeaseDirty = false;
+static network_lease_t networkPendingLease;
+static bool networkLeasePending = false;
+static bool (*networkCanWrite)(void) = NULL;
+static uint64_t networkBoundUs = 0;
+static uint8_t networkSocketOwner = 0;
+
+/**
+ * @brief 共有のUDP socketを使い始める
+ * @param[in] owner NETWORK_SOCKET_OWNER_xxx
+ * @return true: 使ってよい, false: 他が使っている
+ */
+bool networkAcquireSocket(uint8_t owner){
+    if (networkSocketOwner == NETWORK_SOCKET_OWNER_SNMP && owner != NETWORK_SOCKET_OWNER_SNMP){
+        close(NETWORK_DHCP_SOCKET);
+        networkSocketOwner = 0;
+    }
+    if (networkSocketOwner != 0 && networkSocketOwner != owner){
+        return false;
+    }
+    networkSocketOwner = owner;
+    return true;
+}
+
+/**
+ * @brief 共有のUDP socketを閉じた後に呼ぶ
+ * @param[in] owner NETWORK_SOCKET_OWNER_xxx
+ */
+void networkReleaseSocket(uint8_t owner){
+    if (networkSocketOwner == owner){
+        networkSocketOwner = 0;
+    }
+}
+
+/**
+ * @brief DHCPの時刻、hardware timerから秒を数える
+ * @return 起動からの秒数
+ */
+static uint32_t networkClock1s(){
+    return (uint32_t)(time_us_64() / 1000000);
+}
+
+/**
+ * @brief hardware alarmの割り込みで呼ばれ、main loopにDHCPの処理を依頼する
+ *        SPIは割り込みから触らない
+ */
+static int64_t networkDhcpAlarmCallback(alarm_id_t id, void *user_data){
+    networkDhcpAlarm = 0;
+    networkDhcpDue = true;
+    return 0;
+}
+
+/**
+ * @brief 次にDHCPを処理する時刻をalarmに設定する
+ * @param[in] delayMs 今からの時間
+ */
+static void networkScheduleDhcp(uint32_t delayMs){
+    if (networkDhcpAlarm > 0){
+        cancel_alarm(networkDhcpAlarm);
+    }
+    networkDhcpAlarm = add_alarm_in_ms(delayMs, networkDhcpAlarmCallback, NULL, true);
+    if (networkDhcpAlarm < 0){
+        // alarmが足りないときは次のloopで処理する
+        networkDhcpAlarm = 0;
+        networkDhcpDue = true;
+    }
+}
+
+/**
+ * @brief MACアドレスからlink-localアドレス(169.254.1.0 - 169.254.254.255)を決める
+ * @param[in] mac MACアドレス
+ * @param[out] ip link-localアドレス
+ */
+static void networkLinkLocal(const uint8_t *mac, uint8_t *ip){
+    uint32_t hash = 2166136261u;
+    for (int i = 0; i < 6; i++){
+        hash = (hash ^ mac[i]) * 16777619u;
+    }
+    ip[0] = 169;
+    ip[1] = 254;
+    ip[2] = (uint8_t)(1 + (hash % 254));
+    ip[3] = (uint8_t)(hash >> 8);
+}
+
+/**
+ * @brief flashに保存したleaseを読む
+ * @param[out] lease lease
+ * @return true: 有効なleaseがある
+ */
+static bool networkLoadLease(network_lease_t *lease){
+    memcpy(lease, storageRead(NETWORK_LEASE_SECTOR), sizeof(network_lease_t));
+    return lease->magic == NETWORK_LEASE_MAGIC &&
+           lease->crc == storageCrc32((const uint8_t *)lease, offsetof(network_lease_t, crc));
+}
+
+/**
+ * @brief DHCPで取得したleaseを保存待ちにする、保存済みと同じなら何もしない
+ */
+static void networkQueueLease(){
+    network_lease_t *lease = &networkPendingLease;
+    network_lease_t stored;
+
+    memset(lease, 0, sizeof(network_lease_t));
+    lease->magic = NETWORK_LEASE_MAGIC;
+    getIPfromDHCP(lease->ip);
+    getSNfromDHCP(lease->sn);
+    getGWfromDHCP(lease->gw);
+    getDNSfromDHCP(lease->dns);
+    getServerIPfromDHCP(lease->server);
+    lease->leaseTime = getDHCPLeasetime();
+    lease->crc = storageCrc32((const uint8_t *)lease, offsetof(network_lease_t, crc));
+
+    networkLeasePending = !(networkLoadLease(&stored) && memcmp(&stored, lease, sizeof(network_lease_t)) == 0);
+}
+
+/**
+ * @brief 保存待ちのleaseをflashに書く、書いてよくなるまで待つ(書き込み中はcore1と割り込みが止まる)
+ */
+static void networkSaveLease(){
+    if (!networkLeasePending || (networkCanWrite != NULL && !networkCanWrite())){
+        return;
+    }
+    networkLeasePending = false;
+    if (!storageWriteSector(NETWORK_LEASE_SECTOR, (const uint8_t *)&networkPendingLease, sizeof(network_lease_t))){
+        printf("DHCP : failed to save the lease\r\n");
+    }
+}
+
+/**
+ * @brief アドレスをW5x00に設定する、変わったときは登録されたcallbackを呼ぶ
+ */
+static void networkApply(const uint8_t *ip, const uint8_t *sn, const uint8_t *gw){
+    bool changed = memcmp(networkInfo.ip, ip, 4) != 0;
+
+    memcpy(networkInfo.ip, ip, 4);
+    memcpy(networkInfo.sn, sn, 4);
+    memcpy(networkInfo.gw, gw, 4);
+    setSIPR(networkInfo.ip);
+    setSUBR(networkInfo.sn);
+    setGAR(networkInfo.gw);
+    if (changed){
+        printf("IP address : %d.%d.%d.%d\r\n", ip[0], ip[1], ip[2], ip[3]);
+        if (networkAddressChanged != NULL){
+            networkAddressChanged();
+        }
+    }
+}
+
+/**
+ * @brief DHCPでleaseを取得・更新したとき(chipのsoftware resetはしない)
+ */
+static void networkOnLeaseAssigned(){
+    uint8_t ip[4], sn[4], gw[4];
+    getIPfromDHCP(ip);
+    getSNfromDHCP(sn);
+    getGWfromDHCP(gw);
+    getDNSfromDHCP(networkInfo.dns);
+    networkApply(ip, sn, gw);
+    // flashの書き込みはDHCP_run()から戻ってから行う
+    networkLeaseDirty = true;
+    if (networkBoundUs == 0){
+        networkBoundUs = time_us_64();
+        printf("DHCP : bound %lu ms after boot\r\n", (unsigned long)(networkBoundUs / 1000));
+    }
+}
+
+/**
+ * @brief leaseされたアドレスが他で使われていたとき、今のアドレスのままDISCOVERからやり直す
+ */
+static void networkOnLeaseConflict(){
+    printf("DHCP : leased address is in use\r\n");
+}
+
+/**
+ * @brief DHCPを(再)開始する、今のアドレスはleaseが取れるまで使い続ける
+ * @param[in] reboot true: 今のアドレスをREQUESTする(INIT-REBOOT)
+ */
+static void networkStartDhcp(bool reboot){
+    if (reboot){
+        DHCP_init_reboot(NETWORK_DHCP_SOCKET, networkDhcpBuf, networkInfo.ip);
+    } else {
+        DHCP_init(NETWORK_DHCP_SOCKET, networkDhcpBuf);
+    }
+    // DHCP_init()が消したSIPRとGARを戻す
+    setSIPR(networkInfo.ip);
+    setGAR(networkInfo.gw);
+    networkScheduleDhcp(0);
+}
+
+/**
+ * @brief ネットワークを初期化する、DHCPの応答は待たない
+ * @param[in] info MACと、staticのときはアドレス、dhcpがNETINFO_DHCPならDHCPを使う
+ * @param[in] onAddressChanged DHCPでアドレスが変わったときに呼ぶ(古いアドレスの接続を閉じる)
+ * @param[in] canWrite leaseをflashに書いてよいときtrueを返す関数、NULLならいつでも書く
+ */
+void initNetwork(const wiz_NetInfo *info, void (*onAddressChanged)(void), bool (*canWrite)(void)){
+    network_lease_t lease;
+
+    networkInfo = *info;
+    networkAddressChanged = onAddressChanged;
+    networkCanWrite = canWrite;
+    if (networkInfo.dhcp != NETINFO_DHCP){
+        network_initialize(networkInfo);
+        return;
+    }
+
+    reg_dhcp_cbfunc(networkOnLeaseAssigned, networkOnLeaseAssigned, networkOnLeaseConflict);
+    reg_dhcp_clock(networkClock1s);
+
+    if (networkLoadLease(&lease)){
+        // 前回のleaseですぐにserverを始め、DHCP serverには確認だけする
+        memcpy(networkInfo.ip, lease.ip, 4);
+        memcpy(networkInfo.sn, lease.sn, 4);
+        memcpy(networkInfo.gw, lease.gw, 4);
+        memcpy(networkInfo.dns, lease.dns, 4);
+        network_initialize(networkInfo);
+        networkStartDhcp(true);
+        return;
+    }
+
+    networkLinkLocal(networkInfo.mac, networkInfo.ip);
+    networkInfo.sn[0] = 255;
+    networkInfo.sn[1] = 255;
+    networkInfo.sn[2] = 0;
+    networkInfo.sn[3] = 0;
+    memset(networkInfo.gw, 0, 4);
+    network_initialize(networkInfo);
+    networkStartDhcp(false);
+}
+
+/**
+ * @brief リンク復帰のとき、別のnetworkにつながった可能性があるのでDHCPをやり直す
+ */
+void networkOnLinkUp(){
+    if (networkInfo.dhcp == NETINFO_DHCP){
+        // link-localでなければ今のアドレスをREQUESTする
+        networkStartDhcp(networkInfo.ip[0] != 169 || networkInfo.ip[1] != 254);
+    }
+}
+
+/**
+ * @brief main loopから呼ぶ、alarmが来たときだけDHCP_run()を1回呼ぶ、保存待ちのleaseは書いてよくなったら書く
+ */
+void runNetwork(){
+    uint8_t ret;
+    uint32_t next;
+
+    networkSaveLease();
+    if (!networkDhcpDue){
+        return;
+    }
+    networkDhcpDue = false;
+    if (!networkAcquireSocket(NETWORK_SOCKET_OWNER_DHCP)){
+        // SNTPかPTPの応答待ちが終わってから
+        networkScheduleDhcp(NETWORK_DHCP_POLL_MS);
+        return;
+    }
+
+    ret = DHCP_run();
+    if (networkLeaseDirty){
+        networkLeaseDirty = false;
+        networkQueueLease();
+        networkSaveLease();
+    }
+    if (ret == DHCP_FAILED){
+        // DHCP serverがない、今のアドレスのまま後で試す(INIT-REBOOTならNAKが来るまでREQUESTを続ける)
+        close(NETWORK_DHCP_SOCKET);
+        networkReleaseSocket(NETWORK_SOCKET_OWNER_DHCP);
+        networkScheduleDhcp(NETWORK_DHCP_RETRY_MS);
+        return;
+    }
+    if (DHCP_in_progress()){
+        networkScheduleDhcp(NETWORK_DHCP_POLL_MS);
+        return;
+    }
+
+    // leaseの更新(T1)まではsocketを閉じて何もしない、DHCP_run()が開き直す
+    close(NETWORK_DHCP_SOCKET);
+    networkReleaseSocket(NETWORK_SOCKET_OWNER_DHCP);
+    next = DHCP_time_to_next();
+    if (next == 0xFFFFFFFF){
+        return;
+    }
+    if (next > NETWORK_DHCP_MAX_SLEEP_MS / 1000){
+        next = NETWORK_DHCP_MAX_SLEEP_MS / 1000;
+    }
+    networkScheduleDhcp(next * 1000);
+}
+
+#endif /* _NETWORK_HPP_ */
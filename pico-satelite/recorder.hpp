@@ -0,0 +1,956 @@
+/**
+ * @file recorder.hpp
+ * @brief コマンド、valveの状態変化、計測値をSD cardまたは内蔵flashに追記するflight recorder
+ *        GSEとの通信が切れても機体側に履歴を残す
+ *        recordはRAMのblockに貯め、埋まったblockを順に書く
+ *
+ *        SD    cardはfilesystemを使わずrawで使う(専用のcard、`dd`で吸い出す)
+ *              RAMのblockは2面、core1がDMAで複数sectorまとめて書く
+ *              blockは先頭から順に書き、headerのseqはblockの番号
+ *              起動時は「volumeとseqとCRCが合うblock」の境界を二分探索して続きから書く
+ *        FLASH SD cardのない基板用、flashの上の方(STORAGE_LOG_OFFSET)をringにして直近の履歴を残す
+ *              書き込み中はcore1を止めて割り込みを禁止するので、core0がsequenceの合間
+ *              (valveがすべて閉じていてコマンドが来ていない)にだけ書く、それまではRAMのblockに貯める
+ *              slotはseq % RECORDER_MAX_BLOCKS、先のsectorを消しておき(erase-ahead)、blockはpage単位でまとめて書く
+ *              ringを回るのですべてのsectorが同じ回数消される
+ *              起動時は全slotのheaderを読んで一番新しいseqの次から書く
+ *
+ *        先頭sector  superblock: magic, version, block sector数, volume, slot数, data sector, CRC
+ *        data sector~ block: header(32byte) + record(20byte) x RECORDER_BLOCK_RECORDS
+ *        CRCはblock全体(CRCの欄は0)、書き込み中に電源が落ちても壊れるのは最後の1 blockだけ
+ *
+ *        GET  /recorder      状態
+ *        POST /recorder/new  新しいvolumeを作り、前の記録を無効にする(吸い出した後に使う)
+ *        GET  /recorder.bin  flashのsuperblockとringをそのまま返す(FLASHのとき、tools/recorder_dump.pyで読む)
+ *        FTPのrecorder.binはgetRecorderImageSize()とreadRecorderImage()で読む(ftp.hpp)
+ * @author Murakami Kantaro
+ * @date 2024-07-01
+ */
+#ifndef _RECORDER_HPP_
+#define _RECORDER_HPP_
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <pico/stdio.h>
+#include "port_common.h"
+#include "hardware/structs/rosc.h"
+
+#include "httpServer.h"
+#include "httpParser.h"
+#include "httpJson.h"
+
+#include "storage.hpp"
+#include "clock.hpp"
+
+/**
+ * @brief 記録先
+ *        SDはpico-extrasのpico_sd_card(PIO1, DMA channel 8-11)を使う、pinはCMakeでPICO_SD_*_PINを指定する
+ */
+#define RECORDER_BACKEND_NONE 0
+#define RECORDER_BACKEND_SD 1
+#define RECORDER_BACKEND_FLASH 2
+#ifndef RECORDER_BACKEND
+#define RECORDER_BACKEND RECORDER_BACKEND_NONE
+#endif
+
+#if RECORDER_BACKEND == RECORDER_BACKEND_SD
+#include "hardware/dma.h"
+#include "pico/sd_card.h"
+#endif
+
+/**
+ * @brief blockの大きさ
+ *        SDは1回のmulti-block write(CMD25)で書く、pico_sd_cardの1回の書き込みは(PICO_SD_MAX_BLOCK_COUNT - 1) / 4 sectorまで
+ *        flashは8 page、1 sectorに2 block
+ */
+#define RECORDER_SECTOR_SIZE 512
+#define RECORDER_SUPER_SECTOR 0
+#define RECORDER_BLOCK_SECTORS 4
+#define RECORDER_BLOCK_SIZE (RECORDER_BLOCK_SECTORS * RECORDER_SECTOR_SIZE)
+
+#if RECORDER_BACKEND == RECORDER_BACKEND_FLASH
+/**
+ * @brief flashの配置、先頭sectorがsuperblock、残りがring
+ *        2MBのflashでは123 sector、246 block
+ */
+#define RECORDER_FLASH_OFFSET STORAGE_LOG_OFFSET
+#define RECORDER_FLASH_SIZE STORAGE_LOG_SIZE
+#define RECORDER_DATA_SECTOR (FLASH_SECTOR_SIZE / RECORDER_SECTOR_SIZE)
+#define RECORDER_MAX_BLOCKS ((RECORDER_FLASH_SIZE - FLASH_SECTOR_SIZE) / RECORDER_BLOCK_SIZE)
+#define RECORDER_BLOCKS_PER_SECTOR (FLASH_SECTOR_SIZE / RECORDER_BLOCK_SIZE)
+/**
+ * @brief 書く位置より先に消しておくblockの数
+ *        sequenceが終わった後は消去なし(programだけ)で貯めたblockを書ける
+ */
+#define RECORDER_ERASE_AHEAD_BLOCKS (4 * RECORDER_BLOCKS_PER_SECTOR)
+#define RECORDER_RING 1
+/**
+ * @brief 書くcore、flashはcore1を止めて書くのでcore0
+ */
+#define RECORDER_CORE 0
+/**
+ * @brief sequenceの間はflashに書かないので、その間の分をRAMに貯める(1 blockで約100 record)
+ */
+#ifndef RECORDER_RAM_BLOCKS
+#define RECORDER_RAM_BLOCKS 16
+#endif
+#define RECORDER_FLUSH_MS 2000
+#else
+/**
+ * @brief cardの配置
+ *        RECORDER_MAX_BLOCKSは1 GiB分、cardはそれより大きいこと
+ */
+#define RECORDER_DATA_SECTOR 2048
+#define RECORDER_MAX_BLOCKS (1024 * 1024 * 1024 / RECORDER_BLOCK_SIZE)
+#define RECORDER_RING 0
+/**
+ * @brief 書くcore、SDはDMAで書くので待ち時間をcore1(telemetry)が受け持つ
+ */
+#define RECORDER_CORE 1
+#ifndef RECORDER_RAM_BLOCKS
+#define RECORDER_RAM_BLOCKS 2
+#endif
+#define RECORDER_FLUSH_MS 500
+/**
+ * @brief 起動時とvolumeの作成で書き込みの完了を待つ上限
+ */
+#define RECORDER_SD_TIMEOUT_MS 1000
+#endif
+
+#define RECORDER_SUPER_MAGIC 0x52465350 // "PSFR"
+#define RECORDER_BLOCK_MAGIC 0x424C5350 // "PSLB"
+#define RECORDER_VERSION 1
+
+#define RECORDER_HEADER_LEN 32
+#define RECORDER_RECORD_LEN 20
+#define RECORDER_BLOCK_RECORDS ((RECORDER_BLOCK_SIZE - RECORDER_HEADER_LEN) / RECORDER_RECORD_LEN)
+
+/**
+ * RECORDER_FLUSH_MS: 最初のrecordからこの時間が経ったらblockが埋まっていなくても書く(電源断で失う時間の上限)
+ *                    flashは消去回数を抑えるため長め
+ */
+
+/**
+ * @brief 書き込みに失敗したときに待つ時間と、cardを諦めるまでの連続失敗回数
+ */
+#define RECORDER_RETRY_MS 100
+#define RECORDER_RETRY_MAX 20
+
+/**
+ * @brief record type、VALVEとSAMPLEはtelemetryと同じ値
+ *        VALVE   id 0, value 開いているvalveのbit
+ *        SAMPLE  id channel, value 計測値
+ *        COMMAND id 0:正常 1:エラー, arg header, value command
+ *        BOOT    起動した、arg 0, value 0
+ *        DROP    RAMのblockが空かず捨てたrecordの数をvalueに入れる
+ */
+#define RECORDER_TYPE_VALVE 0x01
+#define RECORDER_TYPE_SAMPLE 0x02
+#define RECORDER_TYPE_COMMAND 0x03
+#define RECORDER_TYPE_BOOT 0x04
+#define RECORDER_TYPE_DROP 0x05
+
+#define RECORDER_STATE_OFF 0
+#define RECORDER_STATE_INIT 1
+#define RECORDER_STATE_READY 2
+#define RECORDER_STATE_FULL 3
+#define RECORDER_STATE_FAILED 4
+
+static const char *const recorderStateName[] = {
+    "off", "init", "ready", "full", "failed"
+};
+
+/**
+ * @brief RAMのblockのring、recorderFillにrecordを貯めている間に、recorderWriteから順に書く
+ *        recorderBusyがtrueのblockは書く側(RECORDER_CORE)のもの、falseのblockにだけrecordを追加する
+ */
+static uint32_t recorderBuf[RECORDER_RAM_BLOCKS][RECORDER_BLOCK_SIZE / 4];
+static uint32_t recorderScratch[RECORDER_BLOCK_SIZE / 4];
+static volatile bool recorderBusy[RECORDER_RAM_BLOCKS];
+static uint16_t recorderCount[RECORDER_RAM_BLOCKS];
+static uint8_t recorderFill = 0;
+static uint8_t recorderWrite = 0;
+static uint64_t recorderFillUs = 0;
+static critical_section_t recorderLock;
+static bool recorderReady = false;
+static bool (*recorderCanWrite)(void) = NULL;
+
+static volatile uint8_t recorderState = RECORDER_STATE_OFF;
+static volatile bool recorderNewVolume = false;
+static bool recorderWriting = false;
+static uint32_t recorderVolume = 0;
+static volatile uint32_t recorderTail = 0;
+static uint32_t recorderPendingDrop = 0;
+static volatile uint32_t recorderDropCount = 0;
+static volatile uint32_t recorderErrorCount = 0;
+static uint32_t recorderRetry = 0;
+static uint64_t recorderRetryUs = 0;
+
+/**
+ * @brief 値をlittle endianで書き込む
+ */
+static void recorderPutLE(uint8_t *buf, uint64_t value, int len){
+    for (int i = 0; i < len; i++){
+        buf[i] = (uint8_t)value;
+        value >>= 8;
+    }
+}
+
+/**
+ * @brief little endianの値を読む
+ */
+static uint32_t recorderGetLE32(const uint8_t *buf){
+    return (uint32_t)buf[0] | ((uint32_t)buf[1] << 8) | ((uint32_t)buf[2] << 16) | ((uint32_t)buf[3] << 24);
+}
+
+/**
+ * @brief 貯めているblockを書く側に渡し、次のblockに切り替える、recorderLockの中で呼ぶ
+ */
+static void recorderSwap(){
+    recorderBusy[recorderFill] = true;
+    recorderFill = (recorderFill + 1) % RECORDER_RAM_BLOCKS;
+    recorderCount[recorderFill] = 0;
+}
+
+/**
+ * @brief 貯めているblockの末尾にrecordを1つ書く、recorderLockの中で呼ぶ
+ */
+static void recorderAppend(uint64_t timeNs, uint8_t type, uint8_t id, uint32_t arg, int32_t value){
+    uint8_t *p = (uint8_t *)recorderBuf[recorderFill] + RECORDER_HEADER_LEN + recorderCount[recorderFill] * RECORDER_RECORD_LEN;
+
+    recorderPutLE(p, timeNs, 8);
+    p[8] = type;
+    p[9] = id;
+    recorderPutLE(p + 10, 0, 2);
+    recorderPutLE(p + 12, arg, 4);
+    recorderPutLE(p + 16, (uint32_t)value, 4);
+    if (recorderCount[recorderFill]++ == 0){
+        recorderFillUs = time_us_64();
+    }
+}
+
+/**
+ * @brief recordを追記する
+ *        core0、core1、割り込みのどこから呼んでもよい、RAMのblockがすべて書き込み待ちなら捨てて数える
+ * @param[in] timeNs 発生時刻 (now_ns)
+ * @param[in] type record type
+ * @param[in] id typeごとの番号
+ * @param[in] arg typeごとの値
+ * @param[in] value 値
+ */
+void recorderPush(uint64_t timeNs, uint8_t type, uint8_t id, uint32_t arg, int32_t value){
+    if (!recorderReady || (recorderState != RECORDER_STATE_INIT && recorderState != RECORDER_STATE_READY)){
+        return;
+    }
+    critical_section_enter_blocking(&recorderLock);
+    if (recorderBusy[recorderFill]){
+        recorderPendingDrop++;
+        recorderDropCount++;
+        critical_section_exit(&recorderLock);
+        return;
+    }
+    // 捨てたことを先に残す
+    if (recorderPendingDrop > 0 && recorderCount[recorderFill] < RECORDER_BLOCK_RECORDS - 1){
+        recorderAppend(timeNs, RECORDER_TYPE_DROP, 0, 0, (int32_t)recorderPendingDrop);
+        recorderPendingDrop = 0;
+    }
+    recorderAppend(timeNs, type, id, arg, value);
+    if (recorderCount[recorderFill] >= RECORDER_BLOCK_RECORDS){
+        recorderSwap();
+    }
+    critical_section_exit(&recorderLock);
+}
+
+/**
+ * @brief GSEから受け取ったコマンドを記録する
+ * @param[in] header header
+ * @param[in] command command
+ * @param[in] ok true: 正常なコマンド
+ */
+void recorderPushCommand(uint32_t header, uint32_t command, bool ok){
+    recorderPush(now_ns(), RECORDER_TYPE_COMMAND, ok ? 0 : 1, header, (int32_t)command);
+}
+
+/**
+ * @brief blockのheaderを書いてCRCを付ける
+ * @param[in,out] block block
+ * @param[in] seq blockの番号
+ * @param[in] count recordの数
+ */
+static void recorderSeal(uint8_t *block, uint32_t seq, uint16_t count){
+    uint8_t *end = block + RECORDER_HEADER_LEN + count * RECORDER_RECORD_LEN;
+
+    memset(block, 0, RECORDER_HEADER_LEN);
+    memset(end, 0, block + RECORDER_BLOCK_SIZE - end);
+    recorderPutLE(block, RECORDER_BLOCK_MAGIC, 4);
+    recorderPutLE(block + 4, recorderVolume, 4);
+    recorderPutLE(block + 8, seq, 4);
+    recorderPutLE(block + 12, count, 2);
+    recorderPutLE(block + 14, RECORDER_RECORD_LEN, 2);
+    recorderPutLE(block + 16, storageCrc32(block, RECORDER_BLOCK_SIZE), 4);
+}
+
+/**
+ * @brief 読んだblockがこのvolumeのseq番目として正しいか
+ */
+static bool recorderCheckBlock(uint8_t *block, uint32_t seq){
+    uint32_t crc;
+
+    if (recorderGetLE32(block) != RECORDER_BLOCK_MAGIC || recorderGetLE32(block + 4) != recorderVolume ||
+        recorderGetLE32(block + 8) != seq || (uint16_t)(block[12] | (block[13] << 8)) > RECORDER_BLOCK_RECORDS){
+        return false;
+    }
+    crc = recorderGetLE32(block + 16);
+    memset(block + 16, 0, 4);
+    return storageCrc32(block, RECORDER_BLOCK_SIZE) == crc;
+}
+
+/**
+ * @brief volumeの識別子を作る、ROSCの乱数bitと時刻から
+ */
+static uint32_t recorderRandom(){
+    uint32_t value = (uint32_t)time_us_64();
+    for (int i = 0; i < 32; i++){
+        value = (value << 1) ^ (value >> 31) ^ (rosc_hw->randombit & 1);
+    }
+    return value;
+}
+
+/**
+ * @brief superblockを作る
+ * @param[out] super RECORDER_SECTOR_SIZEのbuffer
+ */
+static void recorderBuildSuper(uint8_t *super){
+    memset(super, 0, RECORDER_SECTOR_SIZE);
+    recorderPutLE(super, RECORDER_SUPER_MAGIC, 4);
+    recorderPutLE(super + 4, RECORDER_VERSION, 2);
+    recorderPutLE(super + 6, RECORDER_BLOCK_SECTORS, 2);
+    recorderPutLE(super + 8, recorderVolume, 4);
+    recorderPutLE(super + 12, RECORDER_MAX_BLOCKS, 4);
+    recorderPutLE(super + 16, RECORDER_DATA_SECTOR, 4);
+    recorderPutLE(super + 20, storageCrc32(super, 20), 4);
+}
+
+/**
+ * @brief superblockがこの配置のものか
+ */
+static bool recorderCheckSuper(const uint8_t *super){
+    return recorderGetLE32(super) == RECORDER_SUPER_MAGIC && (super[4] | (super[5] << 8)) == RECORDER_VERSION &&
+           (super[6] | (super[7] << 8)) == RECORDER_BLOCK_SECTORS && recorderGetLE32(super + 12) == RECORDER_MAX_BLOCKS &&
+           recorderGetLE32(super + 16) == RECORDER_DATA_SECTOR && recorderGetLE32(super + 20) == storageCrc32(super, 20);
+}
+
+#if RECORDER_BACKEND == RECORDER_BACKEND_SD
+/**
+ * @brief cardのsectorを読む
+ */
+static bool recorderReadSectors(uint32_t *buf, uint32_t sector, uint count){
+    return sd_readblocks_sync(buf, sector, count) == SD_OK;
+}
+
+/**
+ * @brief cardにsectorを書いて終わるまで待つ(起動時とvolumeの作成だけで使う)
+ */
+static bool recorderWriteSectorsSync(const uint32_t *buf, uint32_t sector, uint count){
+    int status = SD_OK;
+    uint64_t start = time_us_64();
+    if (sd_writeblocks_async(buf, sector, count) != SD_OK){
+        return false;
+    }
+    while (!sd_write_complete(&status)){
+        if (time_us_64() - start > (uint64_t)RECORDER_SD_TIMEOUT_MS * 1000){
+            return false;
+        }
+        tight_loop_contents();
+    }
+    return status == SD_OK;
+}
+
+/**
+ * @brief 新しいvolumeのsuperblockを書く
+ * @return true: 成功
+ */
+static bool recorderFormat(){
+    recorderVolume = recorderRandom();
+    recorderBuildSuper((uint8_t *)recorderScratch);
+    recorderTail = 0;
+    return recorderWriteSectorsSync(recorderScratch, RECORDER_SUPER_SECTOR, 1);
+}
+
+/**
+ * @brief superblockを読み、書かれている最後のblockの次を二分探索で探す
+ *        blockは順に書くので、正しいblockは先頭から途切れずに並んでいる
+ * @return true: 続きから書ける
+ */
+static bool recorderRecover(){
+    uint8_t *super = (uint8_t *)recorderScratch;
+    uint32_t lo = 0;
+    uint32_t hi = RECORDER_MAX_BLOCKS;
+    int reads = 0;
+
+    if (!recorderReadSectors(recorderScratch, RECORDER_SUPER_SECTOR, 1)){
+        return false;
+    }
+    if (!recorderCheckSuper(super)){
+        printf("Recorder : no volume, formatting\r\n");
+        return recorderFormat();
+    }
+    recorderVolume = recorderGetLE32(super + 8);
+
+    // [0, lo)は正しい、[hi, MAX)は書かれていない
+    while (lo < hi){
+        uint32_t mid = lo + (hi - lo) / 2;
+        bool valid = recorderReadSectors(recorderScratch, RECORDER_DATA_SECTOR + mid * RECORDER_BLOCK_SECTORS, RECORDER_BLOCK_SECTORS) &&
+                     recorderCheckBlock((uint8_t *)recorderScratch, mid);
+        reads++;
+        if (valid){
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    recorderTail = lo;
+    printf("Recorder : volume %08lx, %lu blocks (%d reads)\r\n", (unsigned long)recorderVolume, (unsigned long)recorderTail, reads);
+    return true;
+}
+
+/**
+ * @brief cardを初期化して続きの位置を探す、core1の最初で呼ぶ(数百msかかることがある)
+ */
+static void recorderBackendStart(){
+    int rc;
+
+    // pico_sd_cardは固定のDMA channelを使う、他に取られていないことを確かめる
+    dma_channel_claim(8);
+    dma_channel_claim(9);
+    dma_channel_claim(10);
+    dma_channel_claim(11);
+    rc = sd_init_4pins();
+    if (rc != SD_OK){
+        printf("Recorder : no SD card (%d)\r\n", rc);
+        recorderState = RECORDER_STATE_FAILED;
+        return;
+    }
+    if (!recorderRecover()){
+        printf("Recorder : cannot read the SD card\r\n");
+        recorderState = RECORDER_STATE_FAILED;
+        return;
+    }
+    recorderState = (recorderTail >= RECORDER_MAX_BLOCKS) ? RECORDER_STATE_FULL : RECORDER_STATE_READY;
+}
+
+/**
+ * @brief blockの書き込みを始める
+ * @return true: 始めた
+ */
+static bool recorderBackendWrite(const uint32_t *block, uint32_t seq){
+    return sd_writeblocks_async(block, RECORDER_DATA_SECTOR + seq * RECORDER_BLOCK_SECTORS, RECORDER_BLOCK_SECTORS) == SD_OK;
+}
+
+/**
+ * @brief 書き込みが終わったか
+ * @param[out] ok true: 成功
+ */
+static bool recorderBackendComplete(bool *ok){
+    int status = SD_OK;
+    if (!sd_write_complete(&status)){
+        return false;
+    }
+    *ok = (status == SD_OK);
+    return true;
+}
+
+/**
+ * @brief DMAで書くのでいつでも書ける、消去も要らない
+ */
+static bool recorderBackendBusy(){
+    return false;
+}
+
+static bool recorderBackendMaintain(bool pending){
+    return false;
+}
+
+/**
+ * @brief 吸い出し(FTP)用のbuffer、cardはcore1だけが触るので、core0の要求をcore1が読んで渡す
+ *        recorderImageSectorはbufにあるsector(UINT32_MAXは空)、recorderImageRequestは次に読むsector
+ */
+static uint32_t recorderImageBuf[RECORDER_BLOCK_SIZE / 4];
+static volatile uint32_t recorderImageSector = UINT32_MAX;
+static volatile uint32_t recorderImageRequest = UINT32_MAX;
+static volatile bool recorderImageError = false;
+
+/**
+ * @brief core0から要求されたsectorを読む、書き込み中でないときにcore1から呼ぶ
+ * @return true: 読んだ(このloopではもう書かない)
+ */
+static bool recorderBackendServe(){
+    uint32_t sector = recorderImageRequest;
+
+    if (sector == UINT32_MAX){
+        return false;
+    }
+    recorderImageSector = UINT32_MAX;
+    if (recorderReadSectors(recorderImageBuf, sector, RECORDER_BLOCK_SECTORS)){
+        recorderImageSector = sector;
+    } else {
+        recorderImageError = true;
+    }
+    recorderImageRequest = UINT32_MAX;
+    return true;
+}
+
+/**
+ * @brief 吸い出す大きさ、先頭sectorから書いたblockの終わりまで(`dd`で吸い出したものと同じ配置)
+ */
+uint32_t getRecorderImageSize(){
+    if (recorderState != RECORDER_STATE_READY && recorderState != RECORDER_STATE_FULL){
+        return 0;
+    }
+    recorderImageSector = UINT32_MAX;
+    recorderImageError = false;
+    return (RECORDER_DATA_SECTOR + recorderTail * RECORDER_BLOCK_SECTORS) * RECORDER_SECTOR_SIZE;
+}
+
+/**
+ * @brief 吸い出すdataを取得する、core0から呼ぶ
+ *        bufにないときはcore1に読ませて0を返す(次のloopでまた呼ぶ)
+ * @param[in] offset 先頭からのbyte数
+ * @param[out] data dataの先頭
+ * @param[in] len 欲しい長さ
+ * @return dataの長さ、0: まだ読んでいない, -1: 読み出しの失敗
+ */
+int32_t readRecorderImage(uint32_t offset, const uint8_t **data, uint32_t len){
+    uint32_t sector = recorderImageSector;
+    uint32_t skip;
+
+    if (sector != UINT32_MAX && offset / RECORDER_SECTOR_SIZE >= sector &&
+        offset / RECORDER_SECTOR_SIZE < sector + RECORDER_BLOCK_SECTORS){
+        skip = offset - sector * RECORDER_SECTOR_SIZE;
+        *data = (const uint8_t *)recorderImageBuf + skip;
+        return (int32_t)MIN(len, RECORDER_BLOCK_SIZE - skip);
+    }
+    if (recorderImageError){
+        return -1;
+    }
+    recorderImageRequest = offset / RECORDER_SECTOR_SIZE;
+    return 0;
+}
+#elif RECORDER_BACKEND == RECORDER_BACKEND_FLASH
+/**
+ * @brief seqがこれより前のslotは消してある(recorderTail <= recorderErased)、sectorの境界
+ */
+static uint32_t recorderErased = 0;
+static bool recorderFlashOk = false;
+
+/**
+ * @brief seq番目のblockを書くslotのoffset
+ */
+static uint32_t recorderSlotOffset(uint32_t seq){
+    return RECORDER_FLASH_OFFSET + RECORDER_DATA_SECTOR * RECORDER_SECTOR_SIZE + (seq % RECORDER_MAX_BLOCKS) * RECORDER_BLOCK_SIZE;
+}
+
+/**
+ * @brief flashが消えている(すべて0xFF)か
+ */
+static bool recorderIsErased(uint32_t offset, size_t len){
+    const uint32_t *p = (const uint32_t *)storageRead(offset);
+    for (size_t i = 0; i < len / 4; i++){
+        if (p[i] != 0xFFFFFFFF){
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief 新しいvolumeのsuperblockを書く
+ *        ringの位置は続きから使い、sectorの消去回数を揃える
+ * @return true: 成功
+ */
+static bool recorderFormat(){
+    recorderVolume = recorderRandom();
+    recorderBuildSuper((uint8_t *)recorderScratch);
+    return storageWriteSector(RECORDER_FLASH_OFFSET, (const uint8_t *)recorderScratch, RECORDER_SECTOR_SIZE);
+}
+
+/**
+ * @brief 全slotのheaderを読み、一番新しいblockの次から書く
+ *        XIPで読むだけなのでcore1から呼んでよい(1 ms程度)、superblockがなければcore0に作らせる
+ */
+static void recorderBackendStart(){
+    const uint8_t *super = storageRead(RECORDER_FLASH_OFFSET);
+    const uint8_t *block;
+    uint32_t last = 0;
+    uint32_t seq;
+    uint32_t sectorEnd;
+    bool found = false;
+
+    if (!recorderCheckSuper(super)){
+        printf("Recorder : no volume, formatting\r\n");
+        recorderTail = 0;
+        recorderErased = 0;
+        recorderNewVolume = true;
+        recorderState = RECORDER_STATE_READY;
+        return;
+    }
+    recorderVolume = recorderGetLE32(super + 8);
+
+    for (uint32_t slot = 0; slot < RECORDER_MAX_BLOCKS; slot++){
+        block = storageRead(recorderSlotOffset(slot));
+        if (recorderGetLE32(block) != RECORDER_BLOCK_MAGIC || recorderGetLE32(block + 4) != recorderVolume){
+            continue;
+        }
+        seq = recorderGetLE32(block + 8);
+        if (seq % RECORDER_MAX_BLOCKS == slot && (!found || seq > last)){
+            last = seq;
+            found = true;
+        }
+    }
+    recorderTail = 0;
+    if (found){
+        // 書きかけの可能性があるのは最後のblockだけ
+        memcpy(recorderScratch, storageRead(recorderSlotOffset(last)), RECORDER_BLOCK_SIZE);
+        recorderTail = recorderCheckBlock((uint8_t *)recorderScratch, last) ? last + 1 : last;
+    }
+
+    sectorEnd = (recorderTail / RECORDER_BLOCKS_PER_SECTOR + 1) * RECORDER_BLOCKS_PER_SECTOR;
+    if (recorderIsErased(recorderSlotOffset(recorderTail), (sectorEnd - recorderTail) * RECORDER_BLOCK_SIZE)){
+        recorderErased = sectorEnd;
+        while (recorderErased - recorderTail < RECORDER_ERASE_AHEAD_BLOCKS &&
+               recorderIsErased(recorderSlotOffset(recorderErased), FLASH_SECTOR_SIZE)){
+            recorderErased += RECORDER_BLOCKS_PER_SECTOR;
+        }
+    } else {
+        // 書きかけのsectorの残りは使わず、次のsectorを消してから書く
+        if (recorderTail % RECORDER_BLOCKS_PER_SECTOR != 0){
+            recorderTail = sectorEnd;
+        }
+        recorderErased = recorderTail;
+    }
+    printf("Recorder : volume %08lx, next block %lu, %lu erased ahead\r\n", (unsigned long)recorderVolume,
+           (unsigned long)recorderTail, (unsigned long)(recorderErased - recorderTail));
+    recorderState = RECORDER_STATE_READY;
+}
+
+/**
+ * @brief sequenceの途中(valveが開いている)やコマンドが来ているときは書かない
+ */
+static bool recorderBackendBusy(){
+    return recorderCanWrite != NULL && !recorderCanWrite();
+}
+
+/**
+ * @brief 書く位置が消えていなければ、または消してある先が足りなければ1 sector消す
+ *        消すとringの一番古い2 blockがなくなる
+ * @param[in] pending 書くblockがある
+ * @return true: 消した(このloopではもう書かない)
+ */
+static bool recorderBackendMaintain(bool pending){
+    if (recorderErased > recorderTail && (pending || recorderErased - recorderTail >= RECORDER_ERASE_AHEAD_BLOCKS)){
+        return false;
+    }
+    if (storageEraseSector(recorderSlotOffset(recorderErased))){
+        recorderErased += RECORDER_BLOCKS_PER_SECTOR;
+    } else {
+        recorderErrorCount++;
+    }
+    return true;
+}
+
+/**
+ * @brief blockを消してあるslotに書く(8 pageをまとめて1回で)
+ */
+static bool recorderBackendWrite(const uint32_t *block, uint32_t seq){
+    recorderFlashOk = storageProgram(recorderSlotOffset(seq), (const uint8_t *)block, RECORDER_BLOCK_SIZE);
+    return true;
+}
+
+static bool recorderBackendComplete(bool *ok){
+    *ok = recorderFlashOk;
+    return true;
+}
+
+/**
+ * @brief XIPで直接読むので要求はない
+ */
+static bool recorderBackendServe(){
+    return false;
+}
+
+/**
+ * @brief 吸い出す大きさ、superblockとring全体
+ */
+uint32_t getRecorderImageSize(){
+    return RECORDER_FLASH_SIZE;
+}
+
+/**
+ * @brief 吸い出すdataを取得する、XIPのaddressをそのまま返す
+ *        書き込みはmain loopで行うので、送っている間に変わることはない(次のchunkとの間で変わることはある)
+ * @param[in] offset 先頭からのbyte数
+ * @param[out] data dataの先頭
+ * @param[in] len 欲しい長さ
+ * @return dataの長さ
+ */
+int32_t readRecorderImage(uint32_t offset, const uint8_t **data, uint32_t len){
+    *data = storageRead(RECORDER_FLASH_OFFSET + offset);
+    return (int32_t)len;
+}
+#else
+static void recorderBackendStart(){
+    recorderState = RECORDER_STATE_OFF;
+}
+
+static bool recorderBackendBusy(){
+    return true;
+}
+
+static bool recorderBackendMaintain(bool pending){
+    return false;
+}
+
+static bool recorderBackendWrite(const uint32_t *block, uint32_t seq){
+    return false;
+}
+
+static bool recorderBackendComplete(bool *ok){
+    *ok = false;
+    return true;
+}
+
+static bool recorderFormat(){
+    return false;
+}
+
+static bool recorderBackendServe(){
+    return false;
+}
+
+uint32_t getRecorderImageSize(){
+    return 0;
+}
+
+int32_t readRecorderImage(uint32_t offset, const uint8_t **data, uint32_t len){
+    return -1;
+}
+#endif
+
+/**
+ * @brief 書き込み待ちのblockを捨てる、RECORDER_COREから呼ぶ
+ */
+static void recorderDiscard(){
+    critical_section_enter_blocking(&recorderLock);
+    for (int i = 0; i < RECORDER_RAM_BLOCKS; i++){
+        recorderBusy[i] = false;
+        recorderCount[i] = 0;
+    }
+    recorderFill = 0;
+    recorderWrite = 0;
+    critical_section_exit(&recorderLock);
+}
+
+/**
+ * @brief core0とcore1の両方のloopから呼ぶ、RECORDER_COREのときだけ処理する
+ *        書き込み中なら完了を見て、終わっていれば次の埋まったblockの書き込みを始める
+ *        flashは1回の呼び出しで消去かprogramを1つだけ行い、core0を止める時間を抑える
+ *        RECORDER_FLUSH_MS経ったblockは埋まっていなくても渡す
+ */
+void runRecorder(){
+    uint64_t now = time_us_64();
+    uint8_t *block;
+    bool ok;
+
+    if (get_core_num() != RECORDER_CORE || (recorderState != RECORDER_STATE_READY && recorderState != RECORDER_STATE_FULL)){
+        return;
+    }
+    if (recorderWriting){
+        if (!recorderBackendComplete(&ok)){
+            return;
+        }
+        recorderWriting = false;
+        if (ok){
+            recorderRetry = 0;
+            recorderTail++;
+            recorderBusy[recorderWrite] = false;
+            recorderWrite = (recorderWrite + 1) % RECORDER_RAM_BLOCKS;
+            if (!RECORDER_RING && recorderTail >= RECORDER_MAX_BLOCKS){
+                printf("Recorder : full\r\n");
+                recorderState = RECORDER_STATE_FULL;
+                return;
+            }
+        } else {
+            recorderErrorCount++;
+            recorderRetryUs = now + RECORDER_RETRY_MS * 1000;
+        }
+    }
+    if (recorderBackendServe() || recorderState != RECORDER_STATE_READY){
+        return;
+    }
+
+    critical_section_enter_blocking(&recorderLock);
+    if (!recorderBusy[recorderFill] && recorderCount[recorderFill] > 0 &&
+        now - recorderFillUs > (uint64_t)RECORDER_FLUSH_MS * 1000){
+        recorderSwap();
+    }
+    critical_section_exit(&recorderLock);
+
+    if (recorderBackendBusy() || now < recorderRetryUs){
+        return;
+    }
+    if (recorderNewVolume){
+        recorderNewVolume = false;
+        if (!recorderFormat()){
+            recorderErrorCount++;
+        }
+        recorderDiscard();
+        printf("Recorder : new volume %08lx\r\n", (unsigned long)recorderVolume);
+        return;
+    }
+    if (recorderBackendMaintain(recorderBusy[recorderWrite]) || !recorderBusy[recorderWrite]){
+        return;
+    }
+    block = (uint8_t *)recorderBuf[recorderWrite];
+    recorderSeal(block, recorderTail, recorderCount[recorderWrite]);
+    if (recorderBackendWrite(recorderBuf[recorderWrite], recorderTail)){
+        recorderWriting = true;
+        return;
+    }
+    recorderErrorCount++;
+    recorderRetryUs = now + RECORDER_RETRY_MS * 1000;
+    if (++recorderRetry >= RECORDER_RETRY_MAX){
+        printf("Recorder : write failed\r\n");
+        recorderState = RECORDER_STATE_FAILED;
+    }
+}
+
+/**
+ * @brief bufferを用意する、valveを操作する前に呼ぶ
+ *        記録先を開くまでのrecordもbufferに貯まる
+ * @param[in] canWrite flashに書いてよいときtrueを返す関数(sequenceの合間)、NULLならいつでも書く
+ */
+void initRecorder(bool (*canWrite)(void)){
+    critical_section_init(&recorderLock);
+    recorderCanWrite = canWrite;
+    recorderReady = true;
+#if RECORDER_BACKEND != RECORDER_BACKEND_NONE
+    recorderState = RECORDER_STATE_INIT;
+#endif
+    recorderPush(now_ns(), RECORDER_TYPE_BOOT, 0, 0, 0);
+}
+
+/**
+ * @brief 記録先を開いて続きの位置を探す、core1の最初で呼ぶ(core0の起動を待たせない)
+ */
+void startRecorder(){
+    if (recorderState == RECORDER_STATE_INIT){
+        recorderBackendStart();
+    }
+}
+
+/**
+ * @brief RAMのblockがすべて書き込み待ちで捨てたrecordの数を取得する
+ * @return 数
+ */
+uint32_t getRecorderDropCount(){
+    return recorderDropCount;
+}
+
+/**
+ * @brief 書き込みに失敗した回数を取得する
+ * @return 数
+ */
+uint32_t getRecorderErrorCount(){
+    return recorderErrorCount;
+}
+
+/**
+ * @brief 次に書くblockの番号を取得する(SDは書いたblockの数)
+ * @return 番号
+ */
+uint32_t getRecorderBlockCount(){
+    return recorderTail;
+}
+
+/**
+ * @brief responseに書く状態、core1が書き換えるのでrenderの前に1回だけ読む
+ */
+typedef struct {
+    const char *error;
+    uint8_t state;
+    uint32_t volume;
+    uint32_t tail;
+    uint32_t dropped;
+    uint32_t errors;
+} recorder_status_t;
+
+static void recorderSnapshot(recorder_status_t *status, const char *error){
+    status->error = error;
+    status->state = recorderState;
+    status->volume = recorderVolume;
+    status->tail = recorderTail;
+    status->dropped = recorderDropCount;
+    status->errors = recorderErrorCount;
+}
+
+static void recorderRenderStatus(st_json_writer *w, void *arg){
+    const recorder_status_t *status = (const recorder_status_t *)arg;
+    char volume[9];
+
+    snprintf(volume, sizeof(volume), "%08lx", (unsigned long)status->volume);
+    json_object_begin(w, NULL);
+    json_write_string(w, "state", recorderStateName[status->state]);
+    if (status->error != NULL){
+        json_write_string(w, "error", status->error);
+    }
+    json_write_string(w, "volume", volume);
+    json_write_int(w, "blocks", (int32_t)status->tail);
+    json_write_int(w, "capacity", (int32_t)RECORDER_MAX_BLOCKS);
+    json_write_bool(w, "ring", RECORDER_RING);
+    json_write_int(w, "blockSize", RECORDER_BLOCK_SIZE);
+    json_write_int(w, "dropped", (int32_t)status->dropped);
+    json_write_int(w, "errors", (int32_t)status->errors);
+    json_object_end(w);
+}
+
+/**
+ * @brief "recorder"のrequestを処理する
+ */
+static uint8_t recorderHandler(uint8_t s, st_http_request *http, uint8_t *uri_name){
+    const char *name = (const char *)uri_name + strlen("recorder");
+    recorder_status_t status;
+
+    if (http->METHOD == METHOD_GET && *name == '\0'){
+        recorderSnapshot(&status, NULL);
+        http_json_response(s, STATUS_OK, recorderRenderStatus, &status);
+        return 1;
+    }
+    if (http->METHOD == METHOD_POST && !strcmp(name, "/new")){
+        if (recorderState != RECORDER_STATE_READY && recorderState != RECORDER_STATE_FULL){
+            recorderSnapshot(&status, "not ready");
+            http_json_response(s, STATUS_SERV_UNAVAIL, recorderRenderStatus, &status);
+            return 1;
+        }
+        // 書き込みはRECORDER_COREが行う
+        recorderNewVolume = true;
+        recorderState = RECORDER_STATE_READY;
+        recorderSnapshot(&status, NULL);
+        http_json_response(s, STATUS_ACCEPTED, recorderRenderStatus, &status);
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * @brief flight recorderのREST APIを登録する、initDashboard()の後に呼ぶ
+ */
+void initRecorderApi(){
+    reg_httpServer_restHandler((uint8_t *)"recorder", recorderHandler);
+#if RECORDER_BACKEND == RECORDER_BACKEND_FLASH
+    // 書き込みはmain loopの中で行うので、送信中のbufferが書き換わることはない(次のchunkで変わることはある)
+    reg_httpServer_liveContent((uint8_t *)"recorder.bin", (const uint8_t *)storageRead(RECORDER_FLASH_OFFSET), RECORDER_FLASH_SIZE);
+#endif
+}
+
+#endif /* _RECORDER_HPP_ */
@@ -0,0 +1,278 @@
+/**
+ * @file rest.hpp
+ * @brief HTTPのJSON REST APIでvalveを制御する
+ *        binaryのコマンドと同じexecuteSequence()を呼び、有効なコマンドはdeadmanを延長する
+ *
+ *        GET  /valve                 全valveの状態
+ *        GET  /valve/{name}          1つのvalveの状態
+ *        POST /valve/{name}          {"command":"open"|"close"|"status"}
+ *        POST /heartbeat             deadmanを延長する、{"seq":n}はそのまま返す
+ *        name: fill, dump, purge, ignition
+ *        POSTはContent-Type: application/jsonとX-Token: REST_TOKENが要る
+ * @author Murakami Kantaro
+ * @date 2024-07-01
+ */
+#ifndef _REST_HPP_
+#define _REST_HPP_
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <pico/stdio.h>
+#include "port_common.h"
+
+#include "httpServer.h"
+#include "httpParser.h"
+#include "httpJson.h"
+
+#include "sequence.hpp"
+#include "heartbeat.hpp"
+
+#define REST_VALVE_NUM 4
+
+/**
+ * @brief POSTに要るX-Tokenの値、CMakeのSATELITE_REST_TOKENで指定する
+ *        指定しないときはPOSTをすべて断る
+ */
+#ifndef REST_TOKEN
+#define REST_TOKEN ""
+#endif
+
+/**
+ * @brief REST APIのvalve名とbinaryのheaderの対応
+ */
+typedef struct {
+    const char *name;
+    uint32_t header;
+} rest_valve_t;
+
+static const rest_valve_t restValves[REST_VALVE_NUM] = {
+    {"fill", HEADER_FILL},
+    {"dump", HEADER_DUMP},
+    {"purge", HEADER_PURGE},
+    {"ignition", HEADER_IGNITION},
+};
+
+/**
+ * @brief requestのbodyから取り出した値とresponseの内容
+ */
+typedef struct {
+    const rest_valve_t *valve;
+    uint32_t command;
+    bool hasCommand;
+    int32_t seq;
+    bool hasSeq;
+    uint32_t result;
+    uint32_t results[REST_VALVE_NUM];
+    uint32_t deadmanTrip;
+    uint32_t timeMs;
+    const char *error;
+} rest_context_t;
+
+/**
+ * @brief sequenceの戻り値をJSONの文字列にする
+ */
+static const char *restResultName(uint32_t result){
+    if (result == COMMAND_OPEN){
+        return "open";
+    } else if (result == COMMAND_CLOSE){
+        return "close";
+    }
+    return "error";
+}
+
+/**
+ * @brief URIのvalve名からvalveを探す
+ * @param[in] name "valve/"の後ろ
+ * @return valve, 見つからなければNULL
+ */
+static const rest_valve_t *restFindValve(const char *name){
+    for (int i = 0; i < REST_VALVE_NUM; i++){
+        if (!strcmp(name, restValves[i].name)){
+            return &restValves[i];
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief bodyのmemberごとにjson_reader_feed()から呼ばれる
+ */
+static void restOnMember(void *arg, const char *key, uint8_t type, const char *value){
+    rest_context_t *ctx = (rest_context_t *)arg;
+
+    if (!strcmp(key, "command") && type == JSON_TYPE_STRING){
+        ctx->hasCommand = true;
+        if (!strcmp(value, "open")){
+            ctx->command = COMMAND_OPEN;
+        } else if (!strcmp(value, "close")){
+            ctx->command = COMMAND_CLOSE;
+        } else if (!strcmp(value, "status")){
+            ctx->command = COMMAND_STATUS;
+        } else {
+            ctx->hasCommand = false;
+        }
+    } else if (!strcmp(key, "seq") && type == JSON_TYPE_NUMBER){
+        ctx->seq = (int32_t)strtol(value, NULL, 10);
+        ctx->hasSeq = true;
+    }
+}
+
+/**
+ * @brief requestのbodyをJSONとして読む、bodyがなければ何もしない
+ * @return true: 正常, false: JSONのobjectではない
+ */
+static bool restParseBody(st_http_request *req, rest_context_t *ctx){
+    st_json_reader reader;
+
+    if (req->BODY_LEN == 0){
+        return true;
+    }
+    json_reader_init(&reader, restOnMember, ctx);
+    return json_reader_feed(&reader, get_http_body(req), req->BODY_LEN) == JSON_READER_DONE;
+}
+
+static void restRenderError(st_json_writer *w, void *arg){
+    rest_context_t *ctx = (rest_context_t *)arg;
+    json_object_begin(w, NULL);
+    json_write_string(w, "error", ctx->error);
+    json_object_end(w);
+}
+
+/**
+ * @brief render関数は2回呼ばれる(長さを数えてから書く)ので、状態はhandlerでctxに取っておく
+ */
+static void restRenderValves(st_json_writer *w, void *arg){
+    rest_context_t *ctx = (rest_context_t *)arg;
+    json_object_begin(w, NULL);
+    for (int i = 0; i < REST_VALVE_NUM; i++){
+        json_write_string(w, restValves[i].name, restResultName(ctx->results[i]));
+    }
+    json_write_int(w, "deadman_trip", (int32_t)ctx->deadmanTrip);
+    json_object_end(w);
+}
+
+static void restRenderValve(st_json_writer *w, void *arg){
+    rest_context_t *ctx = (rest_context_t *)arg;
+    json_object_begin(w, NULL);
+    json_write_string(w, "valve", ctx->valve->name);
+    json_write_string(w, "state", restResultName(ctx->result));
+    json_object_end(w);
+}
+
+static void restRenderHeartbeat(st_json_writer *w, void *arg){
+    rest_context_t *ctx = (rest_context_t *)arg;
+    json_object_begin(w, NULL);
+    if (ctx->hasSeq){
+        json_write_int(w, "seq", ctx->seq);
+    }
+    json_write_int(w, "t", (int32_t)ctx->timeMs);
+    json_object_end(w);
+}
+
+/**
+ * @brief エラーをJSONで返す
+ */
+static uint8_t restError(uint8_t s, uint16_t status, const char *error){
+    rest_context_t ctx = {0};
+    ctx.error = error;
+    http_json_response(s, status, restRenderError, &ctx);
+    return 1;
+}
+
+/**
+ * @brief valveやdeadmanを動かすPOSTを受けてよいか確かめる
+ *        application/json以外のPOSTはブラウザが別のoriginのpageからpreflightなしに送れるので断る(CSRF)
+ *        preflightのOPTIONSには応えないので、別のoriginからapplication/jsonでは送れない
+ * @return 1: 断って応答した, 0: 処理してよい
+ */
+static uint8_t restRejectPost(uint8_t s, st_http_request *req){
+    if (!req->CONTENT_JSON){
+        return restError(s, STATUS_UNSUPPORTED, "content type");
+    }
+    if (REST_TOKEN[0] == '\0' || strcmp((const char *)req->TOKEN, REST_TOKEN) != 0){
+        return restError(s, STATUS_UNAUTH, "token");
+    }
+    return 0;
+}
+
+/**
+ * @brief "valve"以下のrequestを処理する
+ * @return 1: 応答した, 0: web contentに任せる(HEAD)
+ */
+static uint8_t restValveHandler(uint8_t s, st_http_request *req, uint8_t *uri_name){
+    rest_context_t ctx = {0};
+    const char *name = (const char *)uri_name + strlen("valve");
+
+    if (req->METHOD == METHOD_HEAD){
+        return 0;
+    }
+    if (*name == '\0'){
+        if (req->METHOD != METHOD_GET){
+            return restError(s, STATUS_BAD_REQ, "method");
+        }
+        for (int i = 0; i < REST_VALVE_NUM; i++){
+            executeSequence(restValves[i].header, COMMAND_STATUS, &ctx.results[i]);
+        }
+        ctx.deadmanTrip = getDeadmanTripCount();
+        http_json_response(s, STATUS_OK, restRenderValves, &ctx);
+        return 1;
+    }
+
+    ctx.valve = restFindValve(name + 1);
+    if (ctx.valve == NULL){
+        return restError(s, STATUS_NOT_FOUND, "valve");
+    }
+    ctx.command = COMMAND_STATUS;
+    if (req->METHOD == METHOD_POST){
+        if (restRejectPost(s, req)){
+            return 1;
+        }
+        if (!restParseBody(req, &ctx)){
+            return restError(s, STATUS_BAD_REQ, "json");
+        }
+        if (!ctx.hasCommand){
+            return restError(s, STATUS_BAD_REQ, "command");
+        }
+    }
+
+    executeSequence(ctx.valve->header, ctx.command, &ctx.result);
+    if (req->METHOD == METHOD_POST){
+        // binaryのコマンドと同じく、有効なコマンドはdeadmanを延長する
+        feedHeartbeat();
+    }
+    http_json_response(s, (ctx.result == COMMAND_ERORR) ? STATUS_INT_SERR : STATUS_OK, restRenderValve, &ctx);
+    return 1;
+}
+
+/**
+ * @brief "heartbeat"のrequestを処理する
+ */
+static uint8_t restHeartbeatHandler(uint8_t s, st_http_request *req, uint8_t *uri_name){
+    rest_context_t ctx = {0};
+
+    if (req->METHOD != METHOD_POST || uri_name[strlen("heartbeat")] != '\0'){
+        return 0;
+    }
+    if (restRejectPost(s, req)){
+        return 1;
+    }
+    if (!restParseBody(req, &ctx)){
+        return restError(s, STATUS_BAD_REQ, "json");
+    }
+    feedHeartbeat();
+    ctx.timeMs = (uint32_t)(time_us_64() / 1000);
+    http_json_response(s, STATUS_OK, restRenderHeartbeat, &ctx);
+    return 1;
+}
+
+/**
+ * @brief REST APIをHTTP serverに登録する、initDashboard()の後に呼ぶ
+ */
+void initRestApi(){
+    reg_httpServer_restHandler((uint8_t *)"valve", restValveHandler);
+    reg_httpServer_restHandler((uint8_t *)"heartbeat", restHeartbeatHandler);
+}
+
+#endif /* _REST_HPP_ */
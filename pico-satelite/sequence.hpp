@@ -4,24 +4,30 @@
  * @author Murakami Kantaro
  * @date 2024-07-01 
  */
+#ifndef _SEQUENCE_HPP_
+#define _SEQUENCE_HPP_
+
 #include <stdio.h>
 #include <string.h>
 #include <stdint.h>
 #include <pico/stdio.h>
 #include "port_common.h"
 
+#include "config.hpp"
 #include "uart2rs232c.hpp"
+#include "telemetry.hpp"
+#include "dashboard.hpp"
 
 #define HIGH 1
 #define LOW 0
 
-#define O2_VALVE 6
-#define N2O_FILL_VALVE 7
-#define N2O_DUMP_VALVE 8
+#define O2_VALVE configGet(CONFIG_PIN_O2)
+#define N2O_FILL_VALVE configGet(CONFIG_PIN_FILL)
+#define N2O_DUMP_VALVE configGet(CONFIG_PIN_DUMP)
 
-#define INDICATOR_O2_VALVE 11
-#define INDICATOR_N2O_FILL_VALVE 12
-#define INDICATOR_N2O_DUMP_VALVE 13
+#define INDICATOR_O2_VALVE configGet(CONFIG_PIN_O2_INDICATOR)
+#define INDICATOR_N2O_FILL_VALVE configGet(CONFIG_PIN_FILL_INDICATOR)
+#define INDICATOR_N2O_DUMP_VALVE configGet(CONFIG_PIN_DUMP_INDICATOR)
 
 const uint32_t HEADER_FILL      = 0xFFFFFFF0;
 const uint32_t HEADER_DUMP      = 0xFFFFFFF1;
@@ -32,6 +38,43 @@ const uint32_t COMMAND_STATUS   = 0x00000001;
 const uint32_t COMMAND_OPEN     = 0x00000002;
 const uint32_t COMMAND_ERORR    = 0x99999999;
 
+/**
+ * @brief telemetryで送るvalveのbit
+ */
+#define VALVE_BIT_O2        (1 << 0)
+#define VALVE_BIT_N2O_FILL  (1 << 1)
+#define VALVE_BIT_N2O_DUMP  (1 << 2)
+
+/**
+ * @brief 開いているvalveをbitで取得してtelemetryに記録し、dashboardに通知する
+ */
+void recordValveState(){
+    uint8_t bits = 0;
+    if (gpio_get(O2_VALVE) == HIGH){
+        bits |= VALVE_BIT_O2;
+    }
+    if (gpio_get(N2O_FILL_VALVE) == HIGH){
+        bits |= VALVE_BIT_N2O_FILL;
+    }
+    if (gpio_get(N2O_DUMP_VALVE) == HIGH){
+        bits |= VALVE_BIT_N2O_DUMP;
+    }
+    telemetryPushValve(bits);
+    dashboardNotifyValve(bits);
+}
+
+/**
+ * @brief main loopから呼ぶ、計測器から届いた値をtelemetryに記録し、dashboardに通知する
+ */
+void runMeasure(){
+    uint8_t channel;
+    int32_t value;
+    while (readMeasure(&channel, &value)){
+        telemetryPushSample(channel, value);
+        dashboardNotifySample(channel, value);
+    }
+}
+
 /**
  * @brief Fill操作、N2O main Valve (Fill Valve)をOPENにする
  * @return COMMAND_OPEN
@@ -39,6 +82,7 @@ const uint32_t COMMAND_ERORR    = 0x99999999;
 uint32_t onFillSequence(){
     gpio_put(N2O_FILL_VALVE, HIGH);
     gpio_put(INDICATOR_N2O_FILL_VALVE, HIGH);
+    recordValveState();
     return COMMAND_OPEN;
 }
 
@@ -49,6 +93,7 @@ uint32_t onFillSequence(){
 uint32_t offFillSequence(){
     gpio_put(N2O_FILL_VALVE, LOW);
     gpio_put(INDICATOR_N2O_FILL_VALVE, LOW);
+    recordValveState();
     return COMMAND_CLOSE;
 }
 
@@ -61,6 +106,7 @@ uint32_t onDumpSequence(){
     gpio_put(INDICATOR_N2O_DUMP_VALVE, HIGH);
     gpio_put(N2O_FILL_VALVE, LOW);
     gpio_put(INDICATOR_N2O_FILL_VALVE, LOW);
+    recordValveState();
     return COMMAND_OPEN;
 }
 
@@ -73,6 +119,7 @@ uint32_t offDumpSequence(){
     gpio_put(INDICATOR_N2O_DUMP_VALVE, LOW);
     gpio_put(N2O_FILL_VALVE, LOW);
     gpio_put(INDICATOR_N2O_FILL_VALVE, LOW);
+    recordValveState();
     return COMMAND_CLOSE;
 }
 
@@ -83,6 +130,7 @@ uint32_t offDumpSequence(){
 uint32_t onPurgeSequence(){
     gpio_put(N2O_DUMP_VALVE, HIGH);
     gpio_put(INDICATOR_N2O_DUMP_VALVE, HIGH);
+    recordValveState();
     return COMMAND_OPEN;
 }
 
@@ -93,6 +141,7 @@ uint32_t onPurgeSequence(){
 uint32_t offPurgeSequence(){
     gpio_put(N2O_DUMP_VALVE, LOW);
     gpio_put(INDICATOR_N2O_DUMP_VALVE, LOW);
+    recordValveState();
     return COMMAND_CLOSE;
 }
 
@@ -106,8 +155,10 @@ uint32_t onIgnitionSequence(){
     if(!sendOnIgnition()){
         gpio_put(O2_VALVE, LOW);
         gpio_put(INDICATOR_O2_VALVE, LOW);
+        recordValveState();
         return COMMAND_ERORR;
     }
+    recordValveState();
     return COMMAND_OPEN;
 }
 
@@ -119,8 +170,10 @@ uint32_t offIgnitionSequence(){
     gpio_put(O2_VALVE, LOW);
     gpio_put(INDICATOR_O2_VALVE, LOW);
     if(!sendOffIgnition()){
+        recordValveState();
         return COMMAND_ERORR;
     }
+    recordValveState();
     return COMMAND_CLOSE;
 }
 
@@ -157,6 +210,67 @@ uint32_t getO2ValveStatus(){
     return COMMAND_CLOSE;
 }
 
+/**
+ * @brief header(valve)とcommandに対応するシーケンスを実行する
+ *        binaryのコマンドとREST APIで同じ処理を使う
+ * @param[in] header HEADER_FILL, HEADER_DUMP, HEADER_PURGE, HEADER_IGNITION
+ * @param[in] command COMMAND_OPEN, COMMAND_STATUS, COMMAND_CLOSE
+ * @param[out] result シーケンスの戻り値、エラーのときはCOMMAND_ERORR
+ * @return 0:正常終了, -1:headerかcommandが不正
+ */
+int executeSequence(uint32_t header, uint32_t command, uint32_t *result){
+    *result = COMMAND_ERORR;
+    switch (header){
+        case HEADER_FILL:
+            if (command == COMMAND_OPEN){
+                *result = onFillSequence();
+            } else if (command == COMMAND_STATUS){
+                *result = getN2OFillValveStatus();
+            } else if (command == COMMAND_CLOSE){
+                *result = offFillSequence();
+            } else {
+                return -1;
+            }
+            break;
+        case HEADER_DUMP:
+            if (command == COMMAND_OPEN){
+                *result = onDumpSequence();
+            } else if (command == COMMAND_STATUS){
+                *result = getN2ODumpValveStatus();
+            } else if (command == COMMAND_CLOSE){
+                *result = offDumpSequence();
+            } else {
+                return -1;
+            }
+            break;
+        case HEADER_PURGE:
+            if (command == COMMAND_OPEN){
+                *result = onPurgeSequence();
+            } else if (command == COMMAND_STATUS){
+                *result = getN2ODumpValveStatus();
+            } else if (command == COMMAND_CLOSE){
+                *result = offPurgeSequence();
+            } else {
+                return -1;
+            }
+            break;
+        case HEADER_IGNITION:
+            if (command == COMMAND_OPEN){
+                *result = onIgnitionSequence();
+            } else if (command == COMMAND_STATUS){
+                *result = getO2ValveStatus();
+            } else if (command == COMMAND_CLOSE){
+                *result = offIgnitionSequence();
+            } else {
+                return -1;
+            }
+            break;
+        default:
+            return -1;
+    }
+    return 0;
+}
+
 /**
  * @brief Emergency Shutdown、全てのValveをCLOSEにする
  */
@@ -167,4 +281,7 @@ void emergencyShutdown(){
     gpio_put(INDICATOR_N2O_FILL_VALVE, LOW);
     gpio_put(N2O_DUMP_VALVE, LOW);
     gpio_put(INDICATOR_N2O_DUMP_VALVE, LOW);
+    recordValveState();
 }
+
+#endif /* _SEQUENCE_HPP_ */
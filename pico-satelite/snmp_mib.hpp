@@ -0,0 +1,223 @@
+/**
+ * @file snmp_mib.hpp
+ * @brief SNMP agent(v1, community "public")でvalveの状態、コマンドの処理時間、SPIとリンクの異常を読む
+ *        snmpData[]はOIDの順に並べる(snmp.cは二分探索でGET/GETNEXTを処理する)
+ *        1.3.6.1.4.1.99999 (PEN未取得の仮の番号)
+ *          .1.n.0   valveの状態 1:open, 0:close (n = 1:O2, 2:N2O fill, 3:N2O dump)
+ *          .2.1.0   処理したコマンドの数
+ *          .2.2.0   異常なコマンドの数
+ *          .2.3.0   deadmanでValveを閉じた回数
+ *          .2.4.0   最大の処理時間(us)
+ *          .3.1.b.0 処理時間のhistogram、b番目のbucketの数
+ *          .3.2.b.0 b番目のbucketの上限(us)
+ *          .4.1.0   SPIの読み返しの失敗回数
+ *          .4.2.0   SPIの読み返しの回数
+ *          .5.1.0   リンクの状態 1:up, 0:down
+ *          .5.2.0   リンク断の回数
+ *          .5.3.0   最後のリンク断から復帰までの時間(ms)
+ *          .5.4.0   リンク断から復帰までの最長時間(ms)
+ *          .6.1.0   telemetryのqueueが満杯で捨てたrecordの数
+ *          .6.2.0   telemetryの送信に失敗したbatchの数
+ * @author Murakami Kantaro
+ * @date 2024-07-01
+ */
+#ifndef _SNMP_MIB_HPP_
+#define _SNMP_MIB_HPP_
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <pico/stdio.h>
+#include "port_common.h"
+
+#include "wizchip_conf.h"
+#include "socket.h"
+#include "w5x00_spi.h"
+#include "w5x00_mem_profile.h"
+#include "w5x00_link.h"
+#include "snmp.h"
+#include "snmp_custom.h"
+
+#include "sequence.hpp"
+#include "heartbeat.hpp"
+#include "telemetry.hpp"
+#include "network.hpp"
+#include "metrics.hpp"
+
+/**
+ * @brief SNMP agentのsocket、W5100Sでは他が使わない間だけDHCP socketで待ち受ける
+ */
+#define SNMP_SOCKET WIZCHIP_SOCKET_SNMP
+/**
+ * @brief snmpd_run()を呼ぶ間隔、1回で1つのrequestを処理する
+ */
+#define SNMP_POLL_MS 10
+
+/**
+ * @brief enterpriseのOID(1.3.6.1.4.1.99999)をBERにしたもの
+ */
+#define SNMP_MIB_ENTERPRISE 0x2b, 6, 1, 4, 1, 0x86, 0x8d, 0x1f
+
+/**
+ * @brief 値を読むgetfunctionを作る
+ */
+#define SNMP_MIB_GETTER(name, expr)              \
+    static void name(void *ptr, uint8_t *len){   \
+        *(uint32_t *)ptr = (uint32_t)(expr);     \
+        *len = 4;                                \
+    }
+
+static uint64_t snmpPollUs = 0;
+
+static uint32_t snmpMibLink(int item){
+    wizchip_link_stats_t stats;
+    wizchip_link_get_stats(&stats);
+    switch (item){
+        case 1:
+            return stats.link == PHY_LINK_ON;
+        case 2:
+            return stats.flaps;
+        case 3:
+            return stats.last_recover_ms;
+        default:
+            return stats.max_recover_ms;
+    }
+}
+
+static uint32_t snmpMibSpi(bool errors){
+    uint32_t checks, errorCount;
+    wizchip_spi_get_errors(&checks, &errorCount);
+    return errors ? errorCount : checks;
+}
+
+SNMP_MIB_GETTER(snmpMibUptime, time_us_64() / 10000)
+SNMP_MIB_GETTER(snmpMibO2Valve, getO2ValveStatus() == COMMAND_OPEN)
+SNMP_MIB_GETTER(snmpMibFillValve, getN2OFillValveStatus() == COMMAND_OPEN)
+SNMP_MIB_GETTER(snmpMibDumpValve, getN2ODumpValveStatus() == COMMAND_OPEN)
+SNMP_MIB_GETTER(snmpMibCommands, getMetricsCommandCount())
+SNMP_MIB_GETTER(snmpMibCommandErrors, getMetricsCommandErrorCount())
+SNMP_MIB_GETTER(snmpMibDeadmanTrips, getDeadmanTripCount())
+SNMP_MIB_GETTER(snmpMibMaxLatency, getMetricsMaxLatencyUs())
+SNMP_MIB_GETTER(snmpMibBucket1, getMetricsBucketCount(0))
+SNMP_MIB_GETTER(snmpMibBucket2, getMetricsBucketCount(1))
+SNMP_MIB_GETTER(snmpMibBucket3, getMetricsBucketCount(2))
+SNMP_MIB_GETTER(snmpMibBucket4, getMetricsBucketCount(3))
+SNMP_MIB_GETTER(snmpMibBucket5, getMetricsBucketCount(4))
+SNMP_MIB_GETTER(snmpMibBucket6, getMetricsBucketCount(5))
+SNMP_MIB_GETTER(snmpMibBucket7, getMetricsBucketCount(6))
+SNMP_MIB_GETTER(snmpMibBucket8, getMetricsBucketCount(7))
+SNMP_MIB_GETTER(snmpMibSpiErrors, snmpMibSpi(true))
+SNMP_MIB_GETTER(snmpMibSpiChecks, snmpMibSpi(false))
+SNMP_MIB_GETTER(snmpMibLinkState, snmpMibLink(1))
+SNMP_MIB_GETTER(snmpMibLinkFlaps, snmpMibLink(2))
+SNMP_MIB_GETTER(snmpMibLinkLastRecover, snmpMibLink(3))
+SNMP_MIB_GETTER(snmpMibLinkMaxRecover, snmpMibLink(4))
+SNMP_MIB_GETTER(snmpMibTelemetryDrops, getTelemetryDropCount())
+SNMP_MIB_GETTER(snmpMibTelemetrySendFails, getTelemetrySendFailCount())
+
+/**
+ * @brief OIDの順に並べること
+ */
+dataEntryType snmpData[] = {
+    // sysDescr
+    {8, {0x2b, 6, 1, 2, 1, 1, 1, 0}, SNMPDTYPE_OCTET_STRING, 30, {"pico-satelite valve controller"}, NULL, NULL},
+    // sysObjectID
+    {8, {0x2b, 6, 1, 2, 1, 1, 2, 0}, SNMPDTYPE_OBJ_ID, 8, {"\x2b\x06\x01\x04\x01\x86\x8d\x1f"}, NULL, NULL},
+    // sysUpTime
+    {8, {0x2b, 6, 1, 2, 1, 1, 3, 0}, SNMPDTYPE_TIME_TICKS, 0, {""}, snmpMibUptime, NULL},
+    // sysName
+    {8, {0x2b, 6, 1, 2, 1, 1, 5, 0}, SNMPDTYPE_OCTET_STRING, 13, {"pico-satelite"}, NULL, NULL},
+
+    // valve
+    {11, {SNMP_MIB_ENTERPRISE, 1, 1, 0}, SNMPDTYPE_INTEGER, 4, {""}, snmpMibO2Valve, NULL},
+    {11, {SNMP_MIB_ENTERPRISE, 1, 2, 0}, SNMPDTYPE_INTEGER, 4, {""}, snmpMibFillValve, NULL},
+    {11, {SNMP_MIB_ENTERPRISE, 1, 3, 0}, SNMPDTYPE_INTEGER, 4, {""}, snmpMibDumpValve, NULL},
+
+    // command
+    {11, {SNMP_MIB_ENTERPRISE, 2, 1, 0}, SNMPDTYPE_COUNTER, 4, {""}, snmpMibCommands, NULL},
+    {11, {SNMP_MIB_ENTERPRISE, 2, 2, 0}, SNMPDTYPE_COUNTER, 4, {""}, snmpMibCommandErrors, NULL},
+    {11, {SNMP_MIB_ENTERPRISE, 2, 3, 0}, SNMPDTYPE_COUNTER, 4, {""}, snmpMibDeadmanTrips, NULL},
+    {11, {SNMP_MIB_ENTERPRISE, 2, 4, 0}, SNMPDTYPE_GAUGE, 4, {""}, snmpMibMaxLatency, NULL},
+
+    // latency histogram
+    {12, {SNMP_MIB_ENTERPRISE, 3, 1, 1, 0}, SNMPDTYPE_COUNTER, 4, {""}, snmpMibBucket1, NULL},
+    {12, {SNMP_MIB_ENTERPRISE, 3, 1, 2, 0}, SNMPDTYPE_COUNTER, 4, {""}, snmpMibBucket2, NULL},
+    {12, {SNMP_MIB_ENTERPRISE, 3, 1, 3, 0}, SNMPDTYPE_COUNTER, 4, {""}, snmpMibBucket3, NULL},
+    {12, {SNMP_MIB_ENTERPRISE, 3, 1, 4, 0}, SNMPDTYPE_COUNTER, 4, {""}, snmpMibBucket4, NULL},
+    {12, {SNMP_MIB_ENTERPRISE, 3, 1, 5, 0}, SNMPDTYPE_COUNTER, 4, {""}, snmpMibBucket5, NULL},
+    {12, {SNMP_MIB_ENTERPRISE, 3, 1, 6, 0}, SNMPDTYPE_COUNTER, 4, {""}, snmpMibBucket6, NULL},
+    {12, {SNMP_MIB_ENTERPRISE, 3, 1, 7, 0}, SNMPDTYPE_COUNTER, 4, {""}, snmpMibBucket7, NULL},
+    {12, {SNMP_MIB_ENTERPRISE, 3, 1, 8, 0}, SNMPDTYPE_COUNTER, 4, {""}, snmpMibBucket8, NULL},
+    {12, {SNMP_MIB_ENTERPRISE, 3, 2, 1, 0}, SNMPDTYPE_GAUGE, 4, {""}, NULL, NULL},
+    {12, {SNMP_MIB_ENTERPRISE, 3, 2, 2, 0}, SNMPDTYPE_GAUGE, 4, {""}, NULL, NULL},
+    {12, {SNMP_MIB_ENTERPRISE, 3, 2, 3, 0}, SNMPDTYPE_GAUGE, 4, {""}, NULL, NULL},
+    {12, {SNMP_MIB_ENTERPRISE, 3, 2, 4, 0}, SNMPDTYPE_GAUGE, 4, {""}, NULL, NULL},
+    {12, {SNMP_MIB_ENTERPRISE, 3, 2, 5, 0}, SNMPDTYPE_GAUGE, 4, {""}, NULL, NULL},
+    {12, {SNMP_MIB_ENTERPRISE, 3, 2, 6, 0}, SNMPDTYPE_GAUGE, 4, {""}, NULL, NULL},
+    {12, {SNMP_MIB_ENTERPRISE, 3, 2, 7, 0}, SNMPDTYPE_GAUGE, 4, {""}, NULL, NULL},
+    {12, {SNMP_MIB_ENTERPRISE, 3, 2, 8, 0}, SNMPDTYPE_GAUGE, 4, {""}, NULL, NULL},
+
+    // SPI
+    {11, {SNMP_MIB_ENTERPRISE, 4, 1, 0}, SNMPDTYPE_COUNTER, 4, {""}, snmpMibSpiErrors, NULL},
+    {11, {SNMP_MIB_ENTERPRISE, 4, 2, 0}, SNMPDTYPE_COUNTER, 4, {""}, snmpMibSpiChecks, NULL},
+
+    // link
+    {11, {SNMP_MIB_ENTERPRISE, 5, 1, 0}, SNMPDTYPE_INTEGER, 4, {""}, snmpMibLinkState, NULL},
+    {11, {SNMP_MIB_ENTERPRISE, 5, 2, 0}, SNMPDTYPE_COUNTER, 4, {""}, snmpMibLinkFlaps, NULL},
+    {11, {SNMP_MIB_ENTERPRISE, 5, 3, 0}, SNMPDTYPE_GAUGE, 4, {""}, snmpMibLinkLastRecover, NULL},
+    {11, {SNMP_MIB_ENTERPRISE, 5, 4, 0}, SNMPDTYPE_GAUGE, 4, {""}, snmpMibLinkMaxRecover, NULL},
+
+    // telemetry
+    {11, {SNMP_MIB_ENTERPRISE, 6, 1, 0}, SNMPDTYPE_COUNTER, 4, {""}, snmpMibTelemetryDrops, NULL},
+    {11, {SNMP_MIB_ENTERPRISE, 6, 2, 0}, SNMPDTYPE_COUNTER, 4, {""}, snmpMibTelemetrySendFails, NULL},
+};
+
+const int32_t maxData = (sizeof(snmpData) / sizeof(dataEntryType));
+
+/**
+ * @brief snmpd_init()から呼ばれる、固定の値を入れる
+ */
+void initTable(){
+    static const uint8_t boundOid[] = {SNMP_MIB_ENTERPRISE, 3, 2, 1, 0};
+
+    for (int32_t i = 0; i < maxData; i++){
+        if (snmpData[i].oidlen == sizeof(boundOid) && !memcmp(snmpData[i].oid, boundOid, sizeof(boundOid) - 2)){
+            snmpData[i].u.intval = metricsBucketBoundUs[snmpData[i].oid[10] - 1];
+        }
+    }
+}
+
+/**
+ * @brief snmpd_init()から呼ばれる、trapは送らない(trap用のsocketがない)
+ */
+void initial_Trap(uint8_t *managerIP, uint8_t *agentIP){
+}
+
+/**
+ * @brief SNMP agentを初期化する
+ */
+void initSnmp(){
+    snmpd_init(NULL, NULL, SNMP_SOCKET, SNMP_SOCKET);
+}
+
+/**
+ * @brief main loopから呼ぶ、SNMP_POLL_MSごとにrequestを1つ処理する
+ *        command socketの処理の後に呼ぶ
+ */
+void runSnmp(){
+    uint64_t now = time_us_64();
+
+    if (now - snmpPollUs < (uint64_t)SNMP_POLL_MS * 1000){
+        return;
+    }
+    snmpPollUs = now;
+#if (SNMP_SOCKET == WIZCHIP_SOCKET_BULK)
+    // DHCP, SNTP, PTPが使っている間は待ち受けない(使うときは閉じられる)
+    if (!networkAcquireSocket(NETWORK_SOCKET_OWNER_SNMP)){
+        return;
+    }
+#endif
+    snmpd_run();
+}
+
+#endif /* _SNMP_MIB_HPP_ */
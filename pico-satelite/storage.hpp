@@ -0,0 +1,179 @@
+/**
+ * @file storage.hpp
+ * @brief 内蔵flashの予約sectorに設定などを保存する
+ *        書き込み中はcore1を止め、割り込みを禁止する(flashからの実行ができないため)
+ * @author Murakami Kantaro
+ * @date 2024-07-01
+ */
+#ifndef _STORAGE_HPP_
+#define _STORAGE_HPP_
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <pico/stdio.h>
+#include "port_common.h"
+#include "pico/multicore.h"
+#include "hardware/flash.h"
+#include "hardware/sync.h"
+
+/**
+ * @brief 予約sector、flashの末尾から使う(programは先頭から置かれる)
+ */
+#define STORAGE_SECTOR_LEASE (PICO_FLASH_SIZE_BYTES - FLASH_SECTOR_SIZE)
+
+/**
+ * @brief 設定を交互に書く2面、leaseの下
+ */
+#define STORAGE_SECTOR_CONFIG_A (PICO_FLASH_SIZE_BYTES - 3 * FLASH_SECTOR_SIZE)
+#define STORAGE_SECTOR_CONFIG_B (PICO_FLASH_SIZE_BYTES - 2 * FLASH_SECTOR_SIZE)
+
+/**
+ * @brief 新しいfirmwareを受け取る領域、flashの後半の先頭から
+ *        programはこれより小さくなければならない
+ */
+#define STORAGE_FIRMWARE_OFFSET (PICO_FLASH_SIZE_BYTES / 2)
+#define STORAGE_FIRMWARE_SIZE (512 * 1024)
+
+/**
+ * @brief flashの末尾の予約sector(lease, 設定2面, 予備)、これより下はflight recorderのringに使う
+ */
+#define STORAGE_RESERVED_SIZE (4 * FLASH_SECTOR_SIZE)
+
+/**
+ * @brief flight recorderのring、firmwareの領域の後ろから予約sectorの手前まで
+ */
+#define STORAGE_LOG_OFFSET (STORAGE_FIRMWARE_OFFSET + STORAGE_FIRMWARE_SIZE)
+#define STORAGE_LOG_SIZE (PICO_FLASH_SIZE_BYTES - STORAGE_RESERVED_SIZE - STORAGE_LOG_OFFSET)
+
+/**
+ * @brief core1を止めるまで待つ時間、core1が動いていなければ待たずに書く
+ */
+#define STORAGE_LOCKOUT_TIMEOUT_US 10000
+
+static bool storageCore1Running = false;
+
+/**
+ * @brief core1がflash書き込みのときに止まれるようにする、core1の最初で呼ぶ
+ */
+void storageCore1Init(){
+    multicore_lockout_victim_init();
+    storageCore1Running = true;
+}
+
+/**
+ * @brief sectorの内容を読む(XIPでそのまま読める)
+ * @param[in] offset flash先頭からのoffset
+ * @return 内容へのpointer
+ */
+const uint8_t *storageRead(uint32_t offset){
+    return (const uint8_t *)(XIP_BASE + offset);
+}
+
+/**
+ * @brief CRC-32 (IEEE 802.3)
+ * @param[in] data データ
+ * @param[in] len 長さ
+ * @return CRC
+ */
+uint32_t storageCrc32(const uint8_t *data, size_t len){
+    uint32_t crc = 0xFFFFFFFF;
+    for (size_t i = 0; i < len; i++){
+        crc ^= data[i];
+        for (int j = 0; j < 8; j++){
+            crc = (crc >> 1) ^ (0xEDB88320 & (0 - (crc & 1)));
+        }
+    }
+    return ~crc;
+}
+
+/**
+ * @brief core1を止めて割り込みを禁止する、flashを書く前に呼ぶ
+ * @param[out] ints 割り込みの状態
+ * @return true: 成功, false: core1が止まらなかった
+ */
+static bool storageLock(uint32_t *ints){
+    if (storageCore1Running && !multicore_lockout_start_timeout_us(STORAGE_LOCKOUT_TIMEOUT_US)){
+        return false;
+    }
+    *ints = save_and_disable_interrupts();
+    return true;
+}
+
+/**
+ * @brief storageLock()で止めたものを戻す
+ */
+static void storageUnlock(uint32_t ints){
+    restore_interrupts(ints);
+    if (storageCore1Running){
+        multicore_lockout_end_blocking();
+    }
+}
+
+/**
+ * @brief sectorを消してdataを書く
+ *        消去に数十msかかり、その間は割り込みもcore1も止まる
+ * @param[in] offset sectorのoffset
+ * @param[in] data データ
+ * @param[in] len 長さ、FLASH_SECTOR_SIZE以下
+ * @return true: 成功, false: core1が止まらなかった
+ */
+bool storageWriteSector(uint32_t offset, const uint8_t *data, size_t len){
+    static uint8_t page[FLASH_PAGE_SIZE];
+    uint32_t ints;
+
+    if (len > FLASH_SECTOR_SIZE){
+        return false;
+    }
+    if (!storageLock(&ints)){
+        return false;
+    }
+    flash_range_erase(offset, FLASH_SECTOR_SIZE);
+    for (size_t pos = 0; pos < len; pos += FLASH_PAGE_SIZE){
+        size_t n = (len - pos < FLASH_PAGE_SIZE) ? len - pos : FLASH_PAGE_SIZE;
+        memset(page, 0xFF, sizeof(page));
+        memcpy(page, data + pos, n);
+        flash_range_program(offset + pos, page, FLASH_PAGE_SIZE);
+    }
+    storageUnlock(ints);
+    return true;
+}
+
+/**
+ * @brief sectorを消すだけ、書くのはstorageProgram()で後から行う
+ * @param[in] offset sectorのoffset
+ * @return true: 成功, false: core1が止まらなかった
+ */
+bool storageEraseSector(uint32_t offset){
+    uint32_t ints;
+
+    if (!storageLock(&ints)){
+        return false;
+    }
+    flash_range_erase(offset, FLASH_SECTOR_SIZE);
+    storageUnlock(ints);
+    return true;
+}
+
+/**
+ * @brief 消してあるpageにまとめて書く、消去がない分数msで終わる
+ * @param[in] offset pageのoffset
+ * @param[in] data データ
+ * @param[in] len 長さ、FLASH_PAGE_SIZEの倍数
+ * @return true: 成功, false: core1が止まらなかった
+ */
+bool storageProgram(uint32_t offset, const uint8_t *data, size_t len){
+    uint32_t ints;
+
+    if ((offset | len) % FLASH_PAGE_SIZE != 0){
+        return false;
+    }
+    if (!storageLock(&ints)){
+        return false;
+    }
+    flash_range_program(offset, data, len);
+    storageUnlock(ints);
+    return true;
+}
+
+#endif /* _STORAGE_HPP_ */
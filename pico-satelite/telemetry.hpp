@@ -0,0 +1,388 @@
+/**
+ * @file telemetry.hpp
+ * @brief valveの状態変化と計測値をmulticast(またはMQTT)で送信する
+ *        multicastは1回の送信で全ての受信者(GSE, logger, display)に届き、送信の負荷が受信者の数によらない
+ *        送信はcore1で行い、core0のコマンド処理を遅らせない
+ *        core1が使うのはTELEMETRY_SOCKETだけ、SPIの転送とsocket.cの共有bitはwizchip_cris(core間のspin lock)で守る
+ * @author Murakami Kantaro
+ * @date 2024-07-01
+ */
+#ifndef _TELEMETRY_HPP_
+#define _TELEMETRY_HPP_
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <pico/stdio.h>
+#include "port_common.h"
+#include "pico/multicore.h"
+#include "pico/util/queue.h"
+
+#include "wizchip_conf.h"
+#include "socket.h"
+#include "MQTTClient.h"
+#include "timer.h"
+#include "w5x00_mem_profile.h"
+#include "storage.hpp"
+#include "config.hpp"
+#include "clock.hpp"
+#include "recorder.hpp"
+
+/**
+ * @brief 送信方法
+ */
+#define TELEMETRY_TRANSPORT_MULTICAST 0
+#define TELEMETRY_TRANSPORT_MQTT 1
+#ifndef TELEMETRY_TRANSPORT
+#define TELEMETRY_TRANSPORT TELEMETRY_TRANSPORT_MULTICAST
+#endif
+
+/**
+ * @brief multicast group
+ *        TTLを1にしてtest standのsegmentの外に出さない
+ *        switchのIGMP snoopingで忘れられないよう、定期的にsocketを開き直してjoinを送る
+ */
+#define TELEMETRY_GROUP_IP {239, 255, 0, 1}
+#define TELEMETRY_GROUP_PORT ((uint16_t)configGet(CONFIG_PORT_TELEMETRY))
+#define TELEMETRY_GROUP_TTL 1
+#define TELEMETRY_REJOIN_MS 60000
+#define TELEMETRY_IDLE_US 1000
+
+/**
+ * @brief MQTT broker
+ */
+#define TELEMETRY_BROKER_IP {192, 168, 100, 1}
+#define TELEMETRY_BROKER_PORT ((uint16_t)configGet(CONFIG_PORT_BROKER))
+#define TELEMETRY_CLIENT_ID "pico-satelite"
+#define TELEMETRY_TOPIC "satelite/tlm"
+#define TELEMETRY_KEEPALIVE_S 30
+#define TELEMETRY_COMMAND_TIMEOUT_MS 1000
+#define TELEMETRY_RETRY_MS 1000
+
+/**
+ * @brief telemetryを送信するsocket
+ */
+#define TELEMETRY_SOCKET WIZCHIP_SOCKET_TELEMETRY
+
+/**
+ * @brief batch
+ *        1回の送信(datagram / PUBLISH)に最大TELEMETRY_BATCH_MAX個のrecordをまとめる
+ *        最初のrecordからTELEMETRY_BATCH_MS経過したら数が揃わなくても送信する
+ *        1回のSPI転送が短くなるようpayloadを小さく保ち、core0を待たせる時間を抑える
+ */
+#define TELEMETRY_QUEUE_LEN 256
+#define TELEMETRY_BATCH_MAX 24
+#define TELEMETRY_BATCH_MS 20
+
+/**
+ * @brief record type
+ *        MQTT 3.1.1にはtopic aliasがないので、topicは1つにしてrecordの種類をtypeで区別する
+ */
+#define TELEMETRY_TYPE_VALVE 0x01
+#define TELEMETRY_TYPE_SAMPLE 0x02
+
+#define TELEMETRY_VERSION 0x02
+#define TELEMETRY_HEADER_LEN 12
+#define TELEMETRY_RECORD_LEN 10
+#define TELEMETRY_PAYLOAD_MAX (TELEMETRY_HEADER_LEN + TELEMETRY_BATCH_MAX * TELEMETRY_RECORD_LEN)
+
+/**
+ * @brief telemetryの1件
+ * @param time_ns 発生時刻 (now_ns)
+ * @param type TELEMETRY_TYPE_VALVE or TELEMETRY_TYPE_SAMPLE
+ * @param id valveのときは0、計測値のときはchannel
+ * @param value valveのときは開いているvalveのbit、計測値のときは値
+ */
+typedef struct {
+    uint64_t time_ns;
+    uint8_t type;
+    uint8_t id;
+    int32_t value;
+} telemetry_record_t;
+
+static queue_t telemetryQueue;
+static bool telemetryReady = false;
+static uint32_t telemetryDropCount = 0;
+static uint32_t telemetrySendFailCount = 0;
+
+/**
+ * @brief recordをqueueに積み、flight recorderにも残す
+ *        core0、core1、割り込みのどこから呼んでもよい、queueが満杯なら捨てて数える
+ * @param[in] type record type
+ * @param[in] id valveは0、計測値はchannel
+ * @param[in] value 値
+ */
+void telemetryPush(uint8_t type, uint8_t id, int32_t value){
+    telemetry_record_t record;
+    if (!telemetryReady){
+        return;
+    }
+    record.time_ns = now_ns();
+    record.type = type;
+    record.id = id;
+    record.value = value;
+    recorderPush(record.time_ns, type, id, 0, value);
+    if (!queue_try_add(&telemetryQueue, &record)){
+        telemetryDropCount++;
+    }
+}
+
+/**
+ * @brief valveの状態変化を記録する
+ * @param[in] valveBits 開いているvalveのbit
+ */
+void telemetryPushValve(uint8_t valveBits){
+    telemetryPush(TELEMETRY_TYPE_VALVE, 0, valveBits);
+}
+
+/**
+ * @brief 計測値を記録する
+ * @param[in] channel 計測channel
+ * @param[in] value 計測値
+ */
+void telemetryPushSample(uint8_t channel, int32_t value){
+    telemetryPush(TELEMETRY_TYPE_SAMPLE, channel, value);
+}
+
+/**
+ * @brief 値をbig endianで書き込む
+ */
+static void telemetryPutBE(uint8_t *buf, uint64_t value, int len){
+    for (int i = len - 1; i >= 0; i--){
+        buf[i] = (uint8_t)value;
+        value >>= 8;
+    }
+}
+
+/**
+ * @brief queueからrecordを取り出してpayloadを作る
+ *        header: version(1) count(1) seq(2) base_time_ns(8)
+ *        seqはbatchごとに1増える(65535の次は0)、受信者はseqの抜けで欠落を数える
+ *        record: type(1) id(1) dt_us(4, signed) value(4)
+ *        base_time_nsはSNTPで同期した後はUNIX時刻、同期前は起動からの時間
+ *        batchの途中でstepするとdt_usが負になることがある
+ * @param[out] payload 送信するpayload
+ * @param[in] seq batchの通し番号
+ * @return payloadの長さ, recordがなければ0
+ */
+static int telemetryBuildBatch(uint8_t *payload, uint16_t seq){
+    telemetry_record_t record;
+    uint64_t base = 0;
+    uint64_t deadline = 0;
+    int count = 0;
+    uint8_t *p = payload + TELEMETRY_HEADER_LEN;
+
+    while (count < TELEMETRY_BATCH_MAX){
+        if (!queue_try_remove(&telemetryQueue, &record)){
+            if (count == 0 || time_us_64() >= deadline){
+                break;
+            }
+            continue;
+        }
+        if (count == 0){
+            base = record.time_ns;
+            deadline = time_us_64() + TELEMETRY_BATCH_MS * 1000;
+        }
+        p[0] = record.type;
+        p[1] = record.id;
+        telemetryPutBE(p + 2, (uint32_t)((int64_t)(record.time_ns - base) / 1000), 4);
+        telemetryPutBE(p + 6, (uint32_t)record.value, 4);
+        p += TELEMETRY_RECORD_LEN;
+        count++;
+    }
+    if (count == 0){
+        return 0;
+    }
+    payload[0] = TELEMETRY_VERSION;
+    payload[1] = (uint8_t)count;
+    telemetryPutBE(payload + 2, seq, 2);
+    telemetryPutBE(payload + 4, base, 8);
+    return TELEMETRY_HEADER_LEN + count * TELEMETRY_RECORD_LEN;
+}
+
+/**
+ * @brief multicastのsocketを開く、開くとW5x00がIGMPのjoinを送る
+ * @return true: 成功
+ */
+static bool telemetryOpenMulticast(){
+    uint8_t group[4] = TELEMETRY_GROUP_IP;
+    // 01:00:5e + groupの下位23bit
+    uint8_t mac[6] = {0x01, 0x00, 0x5e, (uint8_t)(group[1] & 0x7F), group[2], group[3]};
+
+    close(TELEMETRY_SOCKET);
+    setSn_DIPR(TELEMETRY_SOCKET, group);
+    setSn_DPORT(TELEMETRY_SOCKET, TELEMETRY_GROUP_PORT);
+    setSn_DHAR(TELEMETRY_SOCKET, mac);
+    if (socket(TELEMETRY_SOCKET, Sn_MR_UDP, TELEMETRY_GROUP_PORT, Sn_MR_MULTI) != TELEMETRY_SOCKET){
+        return false;
+    }
+    setSn_TTL(TELEMETRY_SOCKET, TELEMETRY_GROUP_TTL);
+    return true;
+}
+
+/**
+ * @brief multicastで送信するloop
+ *        送信できなかったbatchもseqを進め、受信者からは欠落に見えるようにする
+ */
+static void telemetryMulticastLoop(){
+    static uint8_t payload[TELEMETRY_PAYLOAD_MAX];
+    uint8_t group[4] = TELEMETRY_GROUP_IP;
+    uint64_t joinedUs = 0;
+    bool opened = false;
+    uint16_t seq = 0;
+    int len;
+
+    while (true){
+        runRecorder();
+        if (!opened || time_us_64() - joinedUs > (uint64_t)TELEMETRY_REJOIN_MS * 1000){
+            opened = telemetryOpenMulticast();
+            joinedUs = time_us_64();
+            if (!opened){
+                sleep_ms(TELEMETRY_RETRY_MS);
+                continue;
+            }
+            printf("%d:Telemetry multicast %d.%d.%d.%d:%d\r\n", TELEMETRY_SOCKET, group[0], group[1], group[2], group[3], TELEMETRY_GROUP_PORT);
+        }
+
+        len = telemetryBuildBatch(payload, seq);
+        if (len == 0){
+            // SPIをcore0に譲る
+            sleep_us(TELEMETRY_IDLE_US);
+            continue;
+        }
+        if (sendto(TELEMETRY_SOCKET, payload, len, group, TELEMETRY_GROUP_PORT) != len){
+            telemetrySendFailCount++;
+            opened = getSn_SR(TELEMETRY_SOCKET) == SOCK_UDP;
+        }
+        seq++;
+    }
+}
+
+/**
+ * @brief brokerに接続する
+ * @return true: 接続成功, false: 失敗
+ */
+static bool telemetryConnect(Network *n, MQTTClient *c, uint8_t *sendBuf, int sendLen, uint8_t *readBuf, int readLen){
+    uint8_t brokerIp[4] = TELEMETRY_BROKER_IP;
+    MQTTPacket_connectData data = MQTTPacket_connectData_initializer;
+
+    if (ConnectNetwork(n, brokerIp, TELEMETRY_BROKER_PORT) != SOCK_OK){
+        close(n->my_socket);
+        return false;
+    }
+    MQTTClientInit(c, n, TELEMETRY_COMMAND_TIMEOUT_MS, sendBuf, sendLen, readBuf, readLen);
+    data.MQTTVersion = 4;
+    data.clientID.cstring = (char *)TELEMETRY_CLIENT_ID;
+    data.keepAliveInterval = TELEMETRY_KEEPALIVE_S;
+    data.cleansession = 1;
+    if (MQTTConnect(c, &data) != SUCCESSS){
+        close(n->my_socket);
+        return false;
+    }
+    printf("%d:Telemetry connected\r\n", n->my_socket);
+    return true;
+}
+
+/**
+ * @brief MQTTで送信するloop
+ *        QoS0で1batchずつPUBLISHし、送信が終わるまで次のbatchを作らない(socketあたり1packet)
+ */
+static void telemetryMqttLoop(){
+    static uint8_t rxRing[512];
+    static uint8_t txBuf[TELEMETRY_PAYLOAD_MAX + 64];
+    static uint8_t sendBuf[TELEMETRY_PAYLOAD_MAX + 64];
+    static uint8_t readBuf[256];
+    static uint8_t payload[TELEMETRY_PAYLOAD_MAX];
+    Network n;
+    MQTTClient c;
+    MQTTMessage message;
+    uint16_t seq = 0;
+    bool connected = false;
+    int len;
+
+    NewBufferedNetwork(&n, TELEMETRY_SOCKET, rxRing, sizeof(rxRing), txBuf, sizeof(txBuf));
+
+    while (true){
+        runRecorder();
+        if (!connected || getSn_SR(TELEMETRY_SOCKET) != SOCK_ESTABLISHED){
+            if (connected){
+                printf("%d:Telemetry disconnected\r\n", TELEMETRY_SOCKET);
+                close(TELEMETRY_SOCKET);
+            }
+            NewBufferedNetwork(&n, TELEMETRY_SOCKET, rxRing, sizeof(rxRing), txBuf, sizeof(txBuf));
+            connected = telemetryConnect(&n, &c, sendBuf, sizeof(sendBuf), readBuf, sizeof(readBuf));
+            if (!connected){
+                sleep_ms(TELEMETRY_RETRY_MS);
+                continue;
+            }
+        }
+
+        len = telemetryBuildBatch(payload, seq);
+        if (len > 0){
+            message.qos = QOS0;
+            message.retained = 0;
+            message.dup = 0;
+            message.id = 0;
+            message.payload = payload;
+            message.payloadlen = len;
+            if (MQTTPublish(&c, TELEMETRY_TOPIC, &message) == SUCCESSS){
+                seq++;
+            }
+            // 前のbatchの送信完了(SENDOK)まではsend()が次のbatchを送らないので、socketあたり1packetになる
+            w5x00_flush(&n);
+        }
+        // keepaliveとbrokerからのpacketを処理する
+        MQTTYield(&c, 1);
+    }
+}
+
+/**
+ * @brief core1で動くtelemetry送信loop、flight recorderの書き込みもここで行う
+ */
+void telemetryCore1Entry(){
+    // flashの書き込み中はcore1もflashから実行できないので止められるようにする
+    storageCore1Init();
+    // cardの初期化は時間がかかるのでcore0の起動を待たせない
+    startRecorder();
+#if TELEMETRY_TRANSPORT == TELEMETRY_TRANSPORT_MULTICAST
+    telemetryMulticastLoop();
+#else
+    telemetryMqttLoop();
+#endif
+}
+
+/**
+ * @brief telemetryのqueueを初期化する、valveを操作する前に呼ぶ
+ */
+void initTelemetry(){
+    queue_init(&telemetryQueue, sizeof(telemetry_record_t), TELEMETRY_QUEUE_LEN);
+    telemetryReady = true;
+}
+
+/**
+ * @brief core1でtelemetryの送信を開始する(MQTTのときはtimerも動かす)、network初期化後に呼ぶ
+ */
+void startTelemetry(){
+#if TELEMETRY_TRANSPORT == TELEMETRY_TRANSPORT_MQTT
+    wizchip_1ms_timer_initialize(MilliTimer_Handler);
+#endif
+    multicore_launch_core1(telemetryCore1Entry);
+}
+
+/**
+ * @brief queueが満杯で捨てたrecordの数を取得する
+ * @return 数
+ */
+uint32_t getTelemetryDropCount(){
+    return telemetryDropCount;
+}
+
+/**
+ * @brief 送信できなかったbatchの数を取得する
+ * @return 数
+ */
+uint32_t getTelemetrySendFailCount(){
+    return telemetrySendFailCount;
+}
+
+#endif /* _TELEMETRY_HPP_ */
@@ -0,0 +1,325 @@
+/**
+ * @file timesync.hpp
+ * @brief 試験設備のDAQ(master)とPTPのtwo-step方式で時刻を合わせる
+ *        受信と送信完了の時刻はW5x00のINTnの割り込みで取り、main loopがsocketを見る時刻のずれを入れない
+ *
+ *        slave(この基板)                master(tools/timesync_master.py)
+ *        SYNC_REQ        ------------>
+ *                        <------------  SYNC          t1: masterの送信時刻
+ *        t2: INTn(RECV)  <------------  FOLLOW_UP(t1)
+ *        DELAY_REQ       ------------>
+ *        t3: INTn(SENDOK)               t4: masterの受信時刻
+ *                        <------------  DELAY_RESP(t4)
+ *        offset = ((t1 - t2) + (t4 - t3)) / 2, delay = (t4 - t1) - (t3 - t2)
+ *
+ *        message: magic "TS"(2) version(1) type(1) seq(2) reserved(2) timestamp_ns(8), big endian
+ * @author Murakami Kantaro
+ * @date 2024-07-01
+ */
+#ifndef _TIMESYNC_HPP_
+#define _TIMESYNC_HPP_
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <pico/stdio.h>
+#include "port_common.h"
+
+#include "wizchip_conf.h"
+#include "socket.h"
+#include "w5x00_mem_profile.h"
+#include "w5x00_gpio_irq.h"
+#include "network.hpp"
+#include "clock.hpp"
+#include "config.hpp"
+
+/**
+ * @brief master
+ */
+#define TIMESYNC_MASTER_IP {192, 168, 100, 1}
+#define TIMESYNC_PORT ((uint16_t)configGet(CONFIG_PORT_TIMESYNC))
+#define TIMESYNC_SOCKET WIZCHIP_SOCKET_TIMESYNC
+
+/**
+ * @brief 同期の間隔、masterがいないときは間隔を空ける
+ */
+#define TIMESYNC_INTERVAL_MS 1000
+#define TIMESYNC_RETRY_MS 8000
+#define TIMESYNC_TIMEOUT_US 100000
+
+#define TIMESYNC_MAGIC 0x5453 // "TS"
+#define TIMESYNC_VERSION 0x01
+#define TIMESYNC_MSG_LEN 16
+
+#define TIMESYNC_TYPE_SYNC_REQ 0x00
+#define TIMESYNC_TYPE_SYNC 0x01
+#define TIMESYNC_TYPE_FOLLOW_UP 0x02
+#define TIMESYNC_TYPE_DELAY_REQ 0x03
+#define TIMESYNC_TYPE_DELAY_RESP 0x04
+
+#define TIMESYNC_STATE_IDLE 0
+#define TIMESYNC_STATE_SYNC 1
+#define TIMESYNC_STATE_FOLLOW_UP 2
+#define TIMESYNC_STATE_DELAY_RESP 3
+
+static volatile bool timesyncDue = false;
+static alarm_id_t timesyncAlarm = 0;
+static uint8_t timesyncState = TIMESYNC_STATE_IDLE;
+static uint16_t timesyncSeq = 0;
+static uint64_t timesyncStartUs = 0;
+static uint32_t timesyncIrqCount = 0;
+static uint64_t timesyncT2Us = 0;
+static uint64_t timesyncT3Us = 0;
+static int64_t timesyncT1Ns = 0;
+static uint32_t timesyncMissCount = 0;
+
+/**
+ * @brief hardware alarmの割り込みで呼ばれ、main loopに同期を依頼する
+ */
+static int64_t timesyncAlarmCallback(alarm_id_t id, void *user_data){
+    timesyncAlarm = 0;
+    timesyncDue = true;
+    return 0;
+}
+
+/**
+ * @brief 次に同期する時刻をalarmに設定する
+ */
+static void timesyncSchedule(uint32_t delayMs){
+    if (timesyncAlarm > 0){
+        cancel_alarm(timesyncAlarm);
+    }
+    timesyncAlarm = add_alarm_in_ms(delayMs, timesyncAlarmCallback, NULL, true);
+    if (timesyncAlarm < 0){
+        timesyncAlarm = 0;
+        timesyncDue = true;
+    }
+}
+
+/**
+ * @brief 値をbig endianで読み書きする
+ */
+static void timesyncPutBE(uint8_t *buf, uint64_t value, int len){
+    for (int i = len - 1; i >= 0; i--){
+        buf[i] = (uint8_t)value;
+        value >>= 8;
+    }
+}
+
+static uint64_t timesyncGetBE(const uint8_t *buf, int len){
+    uint64_t value = 0;
+    for (int i = 0; i < len; i++){
+        value = (value << 8) | buf[i];
+    }
+    return value;
+}
+
+/**
+ * @brief 割り込みを止め、socketを閉じて共有socketを返す
+ * @param[in] nextMs 次の同期までの時間
+ */
+static void timesyncFinish(uint32_t nextMs){
+    uint8_t mask = 0;
+
+    ctlsocket(TIMESYNC_SOCKET, CS_SET_INTMASK, (void *)&mask);
+    close(TIMESYNC_SOCKET);
+    networkReleaseSocket(NETWORK_SOCKET_OWNER_PTP);
+    timesyncState = TIMESYNC_STATE_IDLE;
+    timesyncSchedule(nextMs);
+}
+
+/**
+ * @brief 前の割り込みからこのsocketでINTnが1回以上落ちたか、落ちていればその時刻を返す
+ *        command socketのSENDOKで落ちた分は数えない
+ * @param[out] timeUs INTnが落ちた時刻 (time_us_64)
+ * @return true: 新しい割り込みがある
+ */
+static bool timesyncIrqTime(uint64_t *timeUs){
+    uint32_t count = wizchip_gpio_interrupt_get_timestamp(TIMESYNC_SOCKET, timeUs);
+    bool fired = (count - timesyncIrqCount) == 1;
+
+    // 2回以上落ちていたら、どれが目的のpacketかわからない
+    timesyncIrqCount = count;
+    return fired;
+}
+
+/**
+ * @brief messageを送る、送信完了(SENDOK)の割り込みを待ってから戻る
+ * @return true: 送信完了
+ */
+static bool timesyncSend(uint8_t type, int64_t timestampNs){
+    uint8_t master[4] = TIMESYNC_MASTER_IP;
+    uint8_t msg[TIMESYNC_MSG_LEN];
+
+    timesyncPutBE(msg, TIMESYNC_MAGIC, 2);
+    msg[2] = TIMESYNC_VERSION;
+    msg[3] = type;
+    timesyncPutBE(msg + 4, timesyncSeq, 2);
+    timesyncPutBE(msg + 6, 0, 2);
+    timesyncPutBE(msg + 8, (uint64_t)timestampNs, 8);
+    // sendto()がSENDOKを消すのでINTnが戻り、次の受信でまた落ちる
+    return sendto(TIMESYNC_SOCKET, msg, TIMESYNC_MSG_LEN, master, TIMESYNC_PORT) == TIMESYNC_MSG_LEN;
+}
+
+/**
+ * @brief 受信したmessageを読む、RECVの割り込みを消して次のINTnに備える
+ * @param[out] type message type
+ * @param[out] timestampNs timestamp
+ * @return true: このseqへのmessage
+ */
+static bool timesyncReceive(uint8_t *type, int64_t *timestampNs){
+    uint8_t msg[TIMESYNC_MSG_LEN];
+    uint8_t addr[4];
+    uint16_t port;
+    uint8_t ir = SIK_RECEIVED;
+    int32_t len;
+
+    len = recvfrom(TIMESYNC_SOCKET, msg, TIMESYNC_MSG_LEN, addr, &port);
+    // 次のpacketがbufferに残っていても消す、残りはRX_RSRで見る
+    ctlsocket(TIMESYNC_SOCKET, CS_CLR_INTERRUPT, (void *)&ir);
+    if (len != TIMESYNC_MSG_LEN || timesyncGetBE(msg, 2) != TIMESYNC_MAGIC || msg[2] != TIMESYNC_VERSION ||
+        timesyncGetBE(msg + 4, 2) != timesyncSeq){
+        return false;
+    }
+    *type = msg[3];
+    *timestampNs = (int64_t)timesyncGetBE(msg + 8, 8);
+    return true;
+}
+
+/**
+ * @brief 同期を始める: socketを開き、受信と送信完了だけをINTnに出してSYNC_REQを送る
+ */
+static void timesyncStart(){
+    uint8_t mask = SIK_RECEIVED | SIK_SENT;
+    uint8_t ir = SIK_ALL;
+    uint64_t timeUs;
+
+    if (!networkAcquireSocket(NETWORK_SOCKET_OWNER_PTP)){
+        // DHCPかSNTPが使っている
+        timesyncSchedule(TIMESYNC_INTERVAL_MS);
+        return;
+    }
+    if (socket(TIMESYNC_SOCKET, Sn_MR_UDP, TIMESYNC_PORT, 0) != TIMESYNC_SOCKET){
+        networkReleaseSocket(NETWORK_SOCKET_OWNER_PTP);
+        timesyncSchedule(TIMESYNC_RETRY_MS);
+        return;
+    }
+    ctlsocket(TIMESYNC_SOCKET, CS_CLR_INTERRUPT, (void *)&ir);
+    ctlsocket(TIMESYNC_SOCKET, CS_SET_INTMASK, (void *)&mask);
+
+    timesyncSeq++;
+    timesyncStartUs = time_us_64();
+    if (!timesyncSend(TIMESYNC_TYPE_SYNC_REQ, 0)){
+        timesyncFinish(TIMESYNC_RETRY_MS);
+        return;
+    }
+    // SYNC_REQのSENDOKは数えない
+    timesyncIrqTime(&timeUs);
+    timesyncState = TIMESYNC_STATE_SYNC;
+}
+
+/**
+ * @brief SYNC, FOLLOW_UP, DELAY_RESPを順に受け取る
+ */
+static void timesyncPoll(){
+    uint8_t type;
+    int64_t timestampNs;
+    uint64_t irqUs;
+    bool fired;
+    int64_t t1, t2, t3, t4;
+
+    if (time_us_64() - timesyncStartUs > TIMESYNC_TIMEOUT_US){
+        timesyncMissCount++;
+        timesyncFinish(TIMESYNC_RETRY_MS);
+        return;
+    }
+    if (getSn_RX_RSR(TIMESYNC_SOCKET) == 0){
+        return;
+    }
+
+    // 受信の割り込みの時刻は、packetを読む前に取っておく
+    fired = timesyncIrqTime(&irqUs);
+    if (!timesyncReceive(&type, &timestampNs)){
+        return;
+    }
+
+    switch (timesyncState){
+    case TIMESYNC_STATE_SYNC:
+        if (type != TIMESYNC_TYPE_SYNC || !fired){
+            timesyncFinish(TIMESYNC_INTERVAL_MS);
+            return;
+        }
+        timesyncT2Us = irqUs;
+        timesyncState = TIMESYNC_STATE_FOLLOW_UP;
+        break;
+
+    case TIMESYNC_STATE_FOLLOW_UP:
+        if (type != TIMESYNC_TYPE_FOLLOW_UP){
+            timesyncFinish(TIMESYNC_INTERVAL_MS);
+            return;
+        }
+        timesyncT1Ns = timestampNs;
+        // DELAY_REQの送信完了の時刻がt3
+        timesyncIrqTime(&irqUs);
+        if (!timesyncSend(TIMESYNC_TYPE_DELAY_REQ, 0) || !timesyncIrqTime(&irqUs)){
+            timesyncFinish(TIMESYNC_INTERVAL_MS);
+            return;
+        }
+        timesyncT3Us = irqUs;
+        timesyncState = TIMESYNC_STATE_DELAY_RESP;
+        break;
+
+    case TIMESYNC_STATE_DELAY_RESP:
+        if (type != TIMESYNC_TYPE_DELAY_RESP){
+            timesyncFinish(TIMESYNC_INTERVAL_MS);
+            return;
+        }
+        t1 = timesyncT1Ns;
+        t2 = clockNsAt(timesyncT2Us);
+        t3 = clockNsAt(timesyncT3Us);
+        t4 = timestampNs;
+        clockAddSample(((t1 - t2) + (t4 - t3)) / 2, (t4 - t1) - (t3 - t2), CLOCK_SOURCE_PTP, TIMESYNC_INTERVAL_MS);
+        timesyncFinish(TIMESYNC_INTERVAL_MS);
+        break;
+
+    default:
+        break;
+    }
+}
+
+/**
+ * @brief INTnの割り込みを有効にして最初の同期を予約する、initClock()の後に呼ぶ
+ *        INTnはcommand socketのTXキューと共有する(socketごとにmaskとcallbackを持つ)
+ */
+void initTimesync(){
+    uint8_t mask = 0;
+
+    wizchip_gpio_interrupt_initialize(TIMESYNC_SOCKET, NULL);
+    // 同期している間だけ割り込みを出す
+    ctlsocket(TIMESYNC_SOCKET, CS_SET_INTMASK, (void *)&mask);
+    timesyncSchedule(TIMESYNC_INTERVAL_MS);
+}
+
+/**
+ * @brief main loopから呼ぶ
+ */
+void runTimesync(){
+    if (timesyncState != TIMESYNC_STATE_IDLE){
+        timesyncPoll();
+        return;
+    }
+    if (!timesyncDue){
+        return;
+    }
+    timesyncDue = false;
+    timesyncStart();
+}
+
+/**
+ * @brief masterから応答がなかった回数
+ */
+uint32_t getTimesyncMissCount(){
+    return timesyncMissCount;
+}
+
+#endif /* _TIMESYNC_HPP_ */
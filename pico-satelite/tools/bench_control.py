@@ -0,0 +1,94 @@
+#!/usr/bin/env python3
+"""Compare request throughput of the binary control protocol and the JSON REST API.
+
+Both send STATUS requests back to back on one connection and report requests per second.
+
+    python3 bench_control.py 192.168.100.100 --count 1000 --token <SATELITE_REST_TOKEN>
+"""
+import argparse
+import socket
+import struct
+import time
+
+HEADER_FILL = 0xFFFFFFF0
+COMMAND_STATUS = 0x00000001
+BINARY_PORT = 5000
+HTTP_PORT = 80
+
+
+def recv_exact(sock, n):
+    buf = b""
+    while len(buf) < n:
+        chunk = sock.recv(n - len(buf))
+        if not chunk:
+            raise ConnectionError("connection closed")
+        buf += chunk
+    return buf
+
+
+def bench_binary(host, count):
+    frame = struct.pack(">II", HEADER_FILL, COMMAND_STATUS)
+    with socket.create_connection((host, BINARY_PORT)) as sock:
+        sock.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+        start = time.perf_counter()
+        for _ in range(count):
+            sock.sendall(frame)
+            header, _ = struct.unpack(">II", recv_exact(sock, 8))
+            if header != HEADER_FILL:
+                raise ValueError("unexpected header 0x%08x" % header)
+        return count / (time.perf_counter() - start)
+
+
+def read_http_response(sock, pending):
+    while b"\r\n\r\n" not in pending:
+        chunk = sock.recv(1024)
+        if not chunk:
+            raise ConnectionError("connection closed")
+        pending += chunk
+    head, _, rest = pending.partition(b"\r\n\r\n")
+    length = 0
+    for line in head.split(b"\r\n")[1:]:
+        name, _, value = line.partition(b":")
+        if name.strip().lower() == b"content-length":
+            length = int(value)
+    while len(rest) < length:
+        chunk = sock.recv(1024)
+        if not chunk:
+            raise ConnectionError("connection closed")
+        rest += chunk
+    if not head.startswith(b"HTTP/1.1 200"):
+        raise ValueError(head.split(b"\r\n")[0].decode())
+    return rest[length:]
+
+
+def bench_rest(host, count, token):
+    body = b'{"command":"status"}'
+    request = (b"POST /valve/fill HTTP/1.1\r\nHost: " + host.encode() +
+               b"\r\nConnection: keep-alive\r\nX-Token: " + token.encode() +
+               b"\r\nContent-Type: application/json\r\nContent-Length: " +
+               str(len(body)).encode() + b"\r\n\r\n" + body)
+    with socket.create_connection((host, HTTP_PORT)) as sock:
+        sock.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+        pending = b""
+        start = time.perf_counter()
+        for _ in range(count):
+            sock.sendall(request)
+            pending = read_http_response(sock, pending)
+        return count / (time.perf_counter() - start)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("host")
+    parser.add_argument("--count", type=int, default=1000)
+    parser.add_argument("--token", default="", help="SATELITE_REST_TOKEN of the firmware")
+    args = parser.parse_args()
+
+    binary = bench_binary(args.host, args.count)
+    print("binary : %8.1f req/s" % binary)
+    rest = bench_rest(args.host, args.count, args.token)
+    print("rest   : %8.1f req/s (%.2fx binary)" % (rest, rest / binary))
+
+
+if __name__ == "__main__":
+    main()
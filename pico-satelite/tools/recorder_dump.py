@@ -0,0 +1,123 @@
+#!/usr/bin/env python3
+"""Decode the flight recorder from an SD card image or from the controller's flash.
+
+The card has no filesystem. Copy it raw and decode the copy:
+
+    sudo dd if=/dev/sdX of=card.img bs=1M count=1100
+    python3 recorder_dump.py card.img
+
+With the flash backend the controller serves the log region over HTTP:
+
+    python3 recorder_dump.py --host 192.168.0.10 --save flash.bin
+    python3 recorder_dump.py --ring flash.bin
+
+On a W5500 board the same image is also served as recorder.bin over FTP (passive mode). An SD card
+image from FTP has the `dd` layout, a flash image is a ring:
+
+    curl -o recorder.bin ftp://192.168.0.10/recorder.bin
+    python3 recorder_dump.py --ring recorder.bin     # flash
+    python3 recorder_dump.py recorder.bin            # SD card
+
+An SD card is written from the first block on, so blocks are read in order until the first one
+whose volume, sequence number or CRC does not match. The flash is a ring: every slot is read,
+blocks of the current volume whose CRC matches are kept and printed in sequence order.
+"""
+import argparse
+import binascii
+import io
+import struct
+import sys
+import urllib.request
+
+SECTOR = 512
+SUPER_MAGIC = 0x52465350
+BLOCK_MAGIC = 0x424C5350
+VERSION = 1
+SUPER = struct.Struct("<IHHIIII")
+HEADER = struct.Struct("<IIIHHI")
+HEADER_LEN = 32
+RECORD = struct.Struct("<QBBHIi")
+TYPE_NAMES = {0x01: "valve", 0x02: "sample", 0x03: "command", 0x04: "boot", 0x05: "drop"}
+
+
+def read_super(f):
+    f.seek(0)
+    data = f.read(SECTOR)
+    magic, version, block_sectors, volume, max_blocks, data_sector, crc = SUPER.unpack_from(data)
+    if magic != SUPER_MAGIC or version != VERSION or binascii.crc32(data[:20]) != crc:
+        sys.exit("no recorder volume on this image")
+    return volume, block_sectors * SECTOR, max_blocks, data_sector
+
+
+def read_block(f, volume, block_size, data_sector, slot):
+    """Return (seq, records) of the block in slot, or None if it is not a valid block of volume."""
+    f.seek((data_sector * SECTOR) + slot * block_size)
+    block = bytearray(f.read(block_size))
+    if len(block) != block_size:
+        return None
+    magic, vol, seq, count, record_len, crc = HEADER.unpack_from(block)
+    block[16:20] = b"\0\0\0\0"
+    if magic != BLOCK_MAGIC or vol != volume or binascii.crc32(block) != crc:
+        return None
+    return seq, [RECORD.unpack_from(block, HEADER_LEN + i * record_len) for i in range(count)]
+
+
+def blocks(f, volume, block_size, max_blocks, data_sector):
+    for slot in range(max_blocks):
+        block = read_block(f, volume, block_size, data_sector, slot)
+        if block is None or block[0] != slot:
+            return
+        yield block
+
+
+def ring_blocks(f, volume, block_size, max_blocks, data_sector):
+    found = []
+    for slot in range(max_blocks):
+        block = read_block(f, volume, block_size, data_sector, slot)
+        if block is not None and block[0] % max_blocks == slot:
+            found.append(block)
+    return sorted(found, key=lambda block: block[0])
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("image", nargs="?", help="SD card image or a saved recorder.bin")
+    parser.add_argument("--host", help="read recorder.bin from the controller at this address")
+    parser.add_argument("--save", help="also write what was read from --host to this file")
+    parser.add_argument("--ring", action="store_true", help="the image is a saved recorder.bin (flash ring)")
+    args = parser.parse_args()
+    if (args.image is None) == (args.host is None):
+        parser.error("give an image or --host")
+
+    if args.host:
+        with urllib.request.urlopen("http://%s/recorder.bin" % args.host, timeout=30) as response:
+            data = response.read()
+        if args.save:
+            with open(args.save, "wb") as out:
+                out.write(data)
+        f = io.BytesIO(data)
+    else:
+        f = open(args.image, "rb")
+
+    with f:
+        volume, block_size, max_blocks, data_sector = read_super(f)
+        print("volume %08x" % volume)
+        if args.host or args.ring:
+            found = ring_blocks(f, volume, block_size, max_blocks, data_sector)
+        else:
+            found = blocks(f, volume, block_size, max_blocks, data_sector)
+        count = 0
+        for seq, records in found:
+            count += 1
+            for t_ns, kind, ident, _, arg, value in records:
+                name = TYPE_NAMES.get(kind, kind)
+                if kind == 0x03:
+                    print("%d.%09d %s %s header=%08x command=%08x" % (t_ns // 1000000000, t_ns % 1000000000, name,
+                          "ok" if ident == 0 else "error", arg, value & 0xFFFFFFFF))
+                else:
+                    print("%d.%09d %s %d %d" % (t_ns // 1000000000, t_ns % 1000000000, name, ident, value))
+        print("%d blocks" % count)
+
+
+if __name__ == "__main__":
+    main()
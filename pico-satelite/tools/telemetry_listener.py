@@ -0,0 +1,116 @@
+#!/usr/bin/env python3
+"""Join the telemetry multicast group, decode batches and count lost datagrams.
+
+Any number of listeners (GSE, logger, display) can run at once. The controller sends each
+batch only once.
+
+    python3 telemetry_listener.py --iface 192.168.100.1 --records
+
+Every batch carries a 16-bit sequence number that goes up by one per batch. A jump counts as
+lost batches. A number already seen or older counts as late (reordered or duplicated).
+"""
+import argparse
+import socket
+import struct
+import time
+
+GROUP = "239.255.0.1"
+PORT = 5005
+VERSION = 0x02
+HEADER = struct.Struct(">BBHQ")
+RECORD = struct.Struct(">BBil")
+TYPE_NAMES = {0x01: "valve", 0x02: "sample"}
+
+
+class SourceStats:
+    def __init__(self):
+        self.expected = None
+        self.received = 0
+        self.lost = 0
+        self.late = 0
+
+    def update(self, seq):
+        self.received += 1
+        if self.expected is None:
+            self.expected = (seq + 1) & 0xFFFF
+            return 0
+        gap = (seq - self.expected) & 0xFFFF
+        if gap >= 0x8000:
+            # behind the expected number: reordered or duplicated
+            self.late += 1
+            return 0
+        self.lost += gap
+        self.expected = (seq + 1) & 0xFFFF
+        return gap
+
+    def loss_ratio(self):
+        total = self.received + self.lost
+        return self.lost / total if total else 0.0
+
+
+def open_socket(group, port, iface):
+    sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM, socket.IPPROTO_UDP)
+    sock.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+    if hasattr(socket, "SO_REUSEPORT"):
+        sock.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEPORT, 1)
+    sock.bind(("", port))
+    mreq = socket.inet_aton(group) + socket.inet_aton(iface)
+    sock.setsockopt(socket.IPPROTO_IP, socket.IP_ADD_MEMBERSHIP, mreq)
+    return sock
+
+
+def decode(data):
+    if len(data) < HEADER.size or data[0] != VERSION:
+        return None
+    version, count, seq, base_ns = HEADER.unpack_from(data)
+    if len(data) != HEADER.size + count * RECORD.size:
+        return None
+    records = []
+    for i in range(count):
+        kind, ident, dt_us, value = RECORD.unpack_from(data, HEADER.size + i * RECORD.size)
+        records.append((base_ns + dt_us * 1000, TYPE_NAMES.get(kind, kind), ident, value))
+    return seq, records
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("--group", default=GROUP)
+    parser.add_argument("--port", type=int, default=PORT)
+    parser.add_argument("--iface", default="0.0.0.0", help="address of the interface to join on")
+    parser.add_argument("--records", action="store_true", help="print every record")
+    parser.add_argument("--interval", type=float, default=5.0, help="seconds between loss reports")
+    args = parser.parse_args()
+
+    sock = open_socket(args.group, args.port, args.iface)
+    sources = {}
+    next_report = time.monotonic() + args.interval
+    sock.settimeout(args.interval)
+
+    while True:
+        try:
+            data, addr = sock.recvfrom(2048)
+        except socket.timeout:
+            data = None
+        if data is not None:
+            batch = decode(data)
+            if batch is None:
+                print("%s: malformed datagram (%d bytes)" % (addr[0], len(data)))
+            else:
+                seq, records = batch
+                stats = sources.setdefault(addr[0], SourceStats())
+                gap = stats.update(seq)
+                if gap:
+                    print("%s: %d batch(es) lost before seq %d" % (addr[0], gap, seq))
+                if args.records:
+                    for t_ns, kind, ident, value in records:
+                        print("%s %d.%09d %s %d %d" % (addr[0], t_ns // 1000000000, t_ns % 1000000000, kind, ident, value))
+
+        if time.monotonic() >= next_report:
+            next_report += args.interval
+            for source, stats in sources.items():
+                print("%s: received %d lost %d late %d loss %.3f%%" %
+                      (source, stats.received, stats.lost, stats.late, stats.loss_ratio() * 100))
+
+
+if __name__ == "__main__":
+    main()
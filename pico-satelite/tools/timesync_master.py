@@ -0,0 +1,82 @@
+#!/usr/bin/env python3
+"""Reference master for the two-step time sync in timesync.hpp.
+
+Run it on the test-stand DAQ host. The controller then follows the host's CLOCK_REALTIME,
+so controller telemetry timestamps and DAQ samples share one timebase.
+
+    python3 timesync_master.py --verbose
+
+Receive times come from the kernel (SO_TIMESTAMPNS) when available. The SYNC transmit time
+is read right after sendto() returns. Both are software timestamps on the host side. The
+controller side uses the W5x00 INTn interrupt.
+"""
+import argparse
+import socket
+import struct
+import time
+
+PORT = 3190
+MAGIC = 0x5453
+VERSION = 0x01
+MSG = struct.Struct(">HBBHHq")
+
+TYPE_SYNC_REQ = 0x00
+TYPE_SYNC = 0x01
+TYPE_FOLLOW_UP = 0x02
+TYPE_DELAY_REQ = 0x03
+TYPE_DELAY_RESP = 0x04
+
+SO_TIMESTAMPNS = getattr(socket, "SO_TIMESTAMPNS", 35)
+TIMESPEC = struct.Struct("@ll")
+
+
+def receive(sock):
+    """Return (data, address, receive time in ns)."""
+    data, ancdata, _, addr = sock.recvmsg(64, socket.CMSG_SPACE(TIMESPEC.size))
+    for level, kind, cdata in ancdata:
+        if level == socket.SOL_SOCKET and kind == SO_TIMESTAMPNS and len(cdata) >= TIMESPEC.size:
+            sec, nsec = TIMESPEC.unpack_from(cdata)
+            return data, addr, sec * 1000000000 + nsec
+    return data, addr, time.time_ns()
+
+
+def send(sock, addr, kind, seq, timestamp=0):
+    sock.sendto(MSG.pack(MAGIC, VERSION, kind, seq, 0, timestamp), addr)
+    return time.time_ns()
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("--bind", default="0.0.0.0")
+    parser.add_argument("--port", type=int, default=PORT)
+    parser.add_argument("--verbose", action="store_true")
+    args = parser.parse_args()
+
+    sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    try:
+        sock.setsockopt(socket.SOL_SOCKET, SO_TIMESTAMPNS, 1)
+    except OSError:
+        print("kernel receive timestamps unavailable, using time.time_ns()")
+    sock.bind((args.bind, args.port))
+
+    sync_sent = {}
+    while True:
+        data, addr, rx_ns = receive(sock)
+        if len(data) != MSG.size:
+            continue
+        magic, version, kind, seq, _, _ = MSG.unpack(data)
+        if magic != MAGIC or version != VERSION:
+            continue
+
+        if kind == TYPE_SYNC_REQ:
+            t1 = send(sock, addr, TYPE_SYNC, seq)
+            send(sock, addr, TYPE_FOLLOW_UP, seq, t1)
+            sync_sent[addr] = (seq, t1)
+        elif kind == TYPE_DELAY_REQ:
+            send(sock, addr, TYPE_DELAY_RESP, seq, rx_ns)
+            if args.verbose and sync_sent.get(addr, (None,))[0] == seq:
+                print("%s seq %5d t1 %d t4 %d" % (addr[0], seq, sync_sent[addr][1], rx_ns))
+
+
+if __name__ == "__main__":
+    main()
@@ -1,15 +1,20 @@
+#ifndef _UART2RS232C_HPP_
+#define _UART2RS232C_HPP_
+
 #include <stdio.h>
 #include <string.h>
 #include <stdint.h>
 #include <pico/stdio.h>
 #include "port_common.h"
 
-#define BAUD_RATE 115200
+#include "config.hpp"
+
+#define BAUD_RATE configGet(CONFIG_UART_BAUD)
 
-#define RS232C_TX_IGNITION 0
-#define RS232C_RX_IGNITION 1
-#define RS232C_TX_MEASURE 6
-#define RS232C_RX_MEASURE 7
+#define RS232C_TX_IGNITION configGet(CONFIG_PIN_IGNITION_TX)
+#define RS232C_RX_IGNITION configGet(CONFIG_PIN_IGNITION_RX)
+#define RS232C_TX_MEASURE configGet(CONFIG_PIN_MEASURE_TX)
+#define RS232C_RX_MEASURE configGet(CONFIG_PIN_MEASURE_RX)
 
 /**
  * @brief 4byte同じデータにしてエンディアンを考慮しない設計
@@ -22,6 +27,20 @@ const uint8_t IG_CMD_LEN = sizeof(onIgnition)/sizeof(onIgnition[0]);
 
 const uint8_t IG_CMD_SUCCESS = 0x01;
 const uint8_t IG_CMD_FAILURE = 0x00;
+/**
+ * @brief ignitionの応答を待つ最長時間、main loopを止めるのでWATCHDOG_TIMEOUT_MSより十分短くする
+ */
+#define IG_RESPONSE_TIMEOUT_US 100000
+
+/**
+ * @brief 計測器から届く1件、0xA5 channel 値(int32, big endian)の6byte
+ *        先頭の0xA5で区切りを合わせる
+ */
+#define MEASURE_SYNC 0xA5
+#define MEASURE_FRAME_LEN 6
+
+static uint8_t measureFrame[MEASURE_FRAME_LEN];
+static uint8_t measureLen = 0;
 
 /**
  * @brief Inirialize UART0: Ignition, UART1: Measure
@@ -39,18 +58,29 @@ void initUartPins(){
     uart_set_format(uart1, 8, 1, UART_PARITY_NONE);
 }
 
+/**
+ * @brief Send the ignition command, and wait for the response up to IG_RESPONSE_TIMEOUT_US
+ *        前の遅れて届いた応答は捨ててから送る
+ * @param[in] cmd onIgnition or offIgnition
+ * @return true: success, false: failure or no response
+ */
+static bool sendIgnitionCommand(const uint8_t *cmd){
+    while (uart_is_readable(uart0)){
+        uart_getc(uart0);
+    }
+    uart_write_blocking(uart0, cmd, IG_CMD_LEN);
+    if (!uart_is_readable_within_us(uart0, IG_RESPONSE_TIMEOUT_US)){
+        return false;
+    }
+    return uart_getc(uart0) == IG_CMD_SUCCESS;
+}
+
 /**
  * @brief Send ON ignition command, and check the response
  * @return true: success, false: failure
  */
 bool sendOnIgnition(){
-    uart_write_blocking(uart0, onIgnition, IG_CMD_LEN);
-    uint8_t rx[1];
-    uart_read_blocking(uart0, rx, 1);
-    if(rx[0] != IG_CMD_SUCCESS){
-        return false;
-    }
-    return true;
+    return sendIgnitionCommand(onIgnition);
 }
 
 /**
@@ -58,11 +88,31 @@ bool sendOnIgnition(){
  * @return true: success, false: failure
  */
 bool sendOffIgnition(){
-    uart_write_blocking(uart0, offIgnition, IG_CMD_LEN);
-    uint8_t rx[1];
-    uart_read_blocking(uart0, rx, 1);
-    if(rx[0] != IG_CMD_SUCCESS){
-        return false;
+    return sendIgnitionCommand(offIgnition);
+}
+
+/**
+ * @brief 計測器から届いたbyteを読む、待たない
+ * @param[out] channel 計測channel
+ * @param[out] value 計測値
+ * @return true: 1件そろった, false: まだ届いていない
+ */
+bool readMeasure(uint8_t *channel, int32_t *value){
+    while (uart_is_readable(uart1)){
+        uint8_t c = (uint8_t)uart_getc(uart1);
+        if (measureLen == 0 && c != MEASURE_SYNC){
+            continue;
+        }
+        measureFrame[measureLen++] = c;
+        if (measureLen == MEASURE_FRAME_LEN){
+            measureLen = 0;
+            *channel = measureFrame[1];
+            *value = (int32_t)(((uint32_t)measureFrame[2] << 24) | ((uint32_t)measureFrame[3] << 16) |
+                               ((uint32_t)measureFrame[4] << 8) | measureFrame[5]);
+            return true;
+        }
     }
-    return true;
+    return false;
 }
+
+#endif /* _UART2RS232C_HPP_ */
@@ -24,13 +24,37 @@
 /*! \brief Initialize w5x00 gpio interrupt callback function
  *  \ingroup w5x00_gpio_irq
  *
- *  Add a w5x00 interrupt callback.
+ *  Add a w5x00 interrupt callback for one socket. Each socket keeps its own callback and the socket
+ *  interrupt mask is OR'd into the sockets registered before, so several users can share INTn.
+ *  The callback runs from the GPIO interrupt and must clear the Sn_IR bits it handles.
  *
  *  \param socket socket number
- *  \param callback the gpio interrupt callback function
+ *  \param callback the gpio interrupt callback function, NULL to only timestamp the socket
  */
 void wizchip_gpio_interrupt_initialize(uint8_t socket, void (*callback)(void));
 
+/*! \brief Get the time of the last w5x00 interrupt of a socket
+ *  \ingroup w5x00_gpio_irq
+ *
+ *  The time is taken first thing in the GPIO interrupt, so it follows the INTn falling edge
+ *  within the interrupt latency rather than whenever the main loop polls the socket.
+ *  INTn only falls again after the pending interrupts of every socket are cleared.
+ *
+ *  \param socket socket number
+ *  \param time_us time_us_64() at the last falling edge of INTn that the socket raised
+ *  \return number of such edges so far, compare two values to tell whether a new one arrived
+ */
+uint32_t wizchip_gpio_interrupt_get_timestamp(uint8_t socket, uint64_t *time_us);
+
+/*! \brief Run the socket callbacks if INTn is low
+ *  \ingroup w5x00_gpio_irq
+ *
+ *  A socket whose interrupt is left pending (e.g. cleared later by the main loop) holds INTn low,
+ *  and an interrupt of another socket raised meanwhile gives no falling edge. Call this from the
+ *  main loop while waiting for a callback. Nothing is timestamped.
+ */
+void wizchip_gpio_interrupt_service(void);
+
 /*! \brief Assign gpio interrupt callback function
  *  \ingroup w5x00_gpio_irq
  *
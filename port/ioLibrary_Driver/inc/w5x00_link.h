@@ -0,0 +1,76 @@
+/**
+ * Copyright (c) 2022 WIZnet Co.,Ltd
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#ifndef _W5X00_LINK_H_
+#define _W5X00_LINK_H_
+
+/**
+ * ----------------------------------------------------------------------------------------------------
+ * Macros
+ * ----------------------------------------------------------------------------------------------------
+ */
+/* Link */
+#define WIZCHIP_LINK_POLL_MS 50
+
+/**
+ * ----------------------------------------------------------------------------------------------------
+ * Variables
+ * ----------------------------------------------------------------------------------------------------
+ */
+/* Statistics */
+typedef struct wizchip_link_stats_t
+{
+    uint8_t link;                // PHY_LINK_ON or PHY_LINK_OFF
+    uint32_t flaps;              // link-down events since boot
+    uint32_t last_recover_ms;    // time from the last link-down to link-up
+    uint32_t max_recover_ms;     // longest time from link-down to link-up
+    uint64_t last_change_us;     // time_us_64() of the last link change
+} wizchip_link_stats_t;
+
+/**
+ * ----------------------------------------------------------------------------------------------------
+ * Functions
+ * ----------------------------------------------------------------------------------------------------
+ */
+/* Link */
+/*! \brief Initialize PHY link monitor
+ *  \ingroup w5x00_link
+ *
+ *  Read the current PHY link once and return without waiting for the cable.
+ *
+ *  \param socket_mask bit mask of sockets closed on link-up so the main loop reopens them
+ *  \param link_down_callback safe-state action called once on link loss, may be NULL
+ *  \param link_up_callback called once on link recovery after the sockets are closed, may be NULL
+ */
+void wizchip_link_monitor_initialize(uint8_t socket_mask, void (*link_down_callback)(void), void (*link_up_callback)(void));
+
+/*! \brief Run PHY link monitor
+ *  \ingroup w5x00_link
+ *
+ *  Call it from the main loop. The PHY is read at most every WIZCHIP_LINK_POLL_MS,
+ *  other calls only compare the time.
+ *
+ *  \return PHY_LINK_ON or PHY_LINK_OFF
+ */
+uint8_t wizchip_link_monitor_run(void);
+
+/*! \brief Get PHY link statistics
+ *  \ingroup w5x00_link
+ *
+ *  \param stats link state, flap count and time-to-recover
+ */
+void wizchip_link_get_stats(wizchip_link_stats_t *stats);
+
+/*! \brief Print PHY link statistics
+ *  \ingroup w5x00_link
+ *
+ *  Print link state, flap count and time-to-recover.
+ *
+ *  \param none
+ */
+void print_link_information(void);
+
+#endif /* _W5X00_LINK_H_ */
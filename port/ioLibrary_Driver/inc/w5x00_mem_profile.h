@@ -0,0 +1,101 @@
+/**
+ * Copyright (c) 2022 WIZnet Co.,Ltd
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#ifndef _W5X00_MEM_PROFILE_H_
+#define _W5X00_MEM_PROFILE_H_
+
+/**
+ * ----------------------------------------------------------------------------------------------------
+ * Macros
+ * ----------------------------------------------------------------------------------------------------
+ */
+/* Socket roles */
+#define WIZCHIP_SOCKET_COMMAND 0
+#define WIZCHIP_SOCKET_TELEMETRY 1
+#define WIZCHIP_SOCKET_BULK 2
+#define WIZCHIP_SOCKET_HTTP 3 // first HTTP socket, HTTP uses every socket up to WIZCHIP_SOCKET_HTTP_END
+#define WIZCHIP_SOCKET_DHCP WIZCHIP_SOCKET_BULK // UDP, opened only while DHCP is negotiating
+#define WIZCHIP_SOCKET_SNTP WIZCHIP_SOCKET_BULK // UDP, shared with DHCP, opened only for one time exchange
+#define WIZCHIP_SOCKET_TIMESYNC WIZCHIP_SOCKET_BULK // UDP, shared with DHCP, INTn timestamps receive and SENDOK
+#define WIZCHIP_SOCKET_TFTP WIZCHIP_SOCKET_BULK // UDP, shared with DHCP, held for a whole firmware download
+#if (_WIZCHIP_ == W5500)
+#define WIZCHIP_SOCKET_FTP 5 // TCP, FTP control connection
+#define WIZCHIP_SOCKET_FTP_DATA 6 // TCP, FTP data connection
+#define WIZCHIP_SOCKET_SNMP 7 // UDP, SNMP agent
+#define WIZCHIP_SOCKET_HTTP_END 5
+#else
+#define WIZCHIP_SOCKET_SNMP WIZCHIP_SOCKET_BULK // UDP, shared with DHCP, listens only while nothing else needs the socket
+#define WIZCHIP_SOCKET_HTTP_END _WIZCHIP_SOCK_NUM_
+#endif
+
+/* W5500 buffer layout */
+//#define USE_W5500_RX_BUF_8KB // if you want to boot with 8 KB of W5500 RX memory given to socket 0, uncomment.
+
+/* Profile */
+enum
+{
+    WIZCHIP_MEM_PROFILE_COMMAND = 0, // every socket gets an even share, nothing needs more
+    WIZCHIP_MEM_PROFILE_TELEMETRY,   // telemetry socket gets most of the TX memory
+    WIZCHIP_MEM_PROFILE_BULK,        // bulk transfer socket gets most of the TX and RX memory
+#if (_WIZCHIP_ == W5500)
+    WIZCHIP_MEM_PROFILE_RX_8KB,  // command socket gets half of the RX memory, every other socket keeps some
+    WIZCHIP_MEM_PROFILE_FTP,     // FTP data socket gets most of the TX memory
+#endif
+    WIZCHIP_MEM_PROFILE_NUM
+};
+
+#if (_WIZCHIP_ == W5500) && defined(USE_W5500_RX_BUF_8KB)
+#define WIZCHIP_MEM_PROFILE_DEFAULT WIZCHIP_MEM_PROFILE_RX_8KB
+#else
+#define WIZCHIP_MEM_PROFILE_DEFAULT WIZCHIP_MEM_PROFILE_COMMAND
+#endif
+
+/**
+ * ----------------------------------------------------------------------------------------------------
+ * Functions
+ * ----------------------------------------------------------------------------------------------------
+ */
+/* Profile */
+/*! \brief Select boot memory profile
+ *  \ingroup w5x00_mem_profile
+ *
+ *  Select the profile wizchip_initialize() passes to CW_INIT_WIZCHIP.
+ *  Call it before wizchip_initialize() with the profile number read from stored configuration.
+ *  Socket buffers are laid out back to back and every profile resizes the command socket, so a
+ *  profile is only ever chosen at boot, never switched under open connections.
+ *  An unknown profile number keeps WIZCHIP_MEM_PROFILE_DEFAULT.
+ *
+ *  \param profile profile number
+ *  \return 0 on success, -1 if profile is unknown
+ */
+int8_t wizchip_mem_profile_select(uint8_t profile);
+
+/*! \brief Get selected memory profile
+ *  \ingroup w5x00_mem_profile
+ *
+ *  \return profile number
+ */
+uint8_t wizchip_mem_profile_get(void);
+
+/*! \brief Get memory size table of a profile
+ *  \ingroup w5x00_mem_profile
+ *
+ *  Get the {TX, RX} size table in KB, laid out as CW_INIT_WIZCHIP expects.
+ *
+ *  \param profile profile number
+ *  \return pointer to 2 * _WIZCHIP_SOCK_NUM_ sizes, NULL if profile is unknown
+ */
+const uint8_t *wizchip_mem_profile_memsize(uint8_t profile);
+
+/*! \brief Get memory profile name
+ *  \ingroup w5x00_mem_profile
+ *
+ *  \param profile profile number
+ *  \return profile name
+ */
+const char *wizchip_mem_profile_name(uint8_t profile);
+
+#endif /* _W5X00_MEM_PROFILE_H_ */
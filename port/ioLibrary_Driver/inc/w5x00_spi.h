@@ -24,6 +24,10 @@
 /* Use SPI DMA */
 //#define USE_SPI_DMA // if you want to use SPI DMA, uncomment.
 
+/* Benchmark */
+#define WIZCHIP_BENCHMARK_LEN (1024 * 2)
+#define WIZCHIP_BENCHMARK_LOOP 256
+
 /**
  * ----------------------------------------------------------------------------------------------------
  * Functions
@@ -70,27 +74,27 @@ static uint8_t wizchip_read(void);
  */
 static void wizchip_write(uint8_t tx_data);
 
-#ifdef USE_SPI_DMA
-/*! \brief Configure all DMA parameters and optionally start transfer
+/*! \brief Read a burst from an SPI device
  *  \ingroup w5x00_spi
  *
- *  Configure all DMA parameters and read from DMA
+ *  With USE_SPI_DMA, configure all DMA parameters and read from DMA.
+ *  Otherwise read the whole burst with one spi_read_blocking call so the SPI FIFO stays full.
  *
  *  \param pBuf Buffer of data to read
  *  \param len element count (each element is of size transfer_data_size)
  */
 static void wizchip_read_burst(uint8_t *pBuf, uint16_t len);
 
-/*! \brief Configure all DMA parameters and optionally start transfer
+/*! \brief Write a burst to an SPI device
  *  \ingroup w5x00_spi
  *
- *  Configure all DMA parameters and write to DMA
+ *  With USE_SPI_DMA, configure all DMA parameters and write to DMA.
+ *  Otherwise write the whole burst with one spi_write_blocking call so the SPI FIFO stays full.
  *
  *  \param pBuf Buffer of data to write
  *  \param len element count (each element is of size transfer_data_size)
  */
 static void wizchip_write_burst(uint8_t *pBuf, uint16_t len);
-#endif
 
 /*! \brief Enter a critical section
  *  \ingroup w5x00_spi
@@ -148,7 +152,8 @@ void wizchip_reset(void);
  *
  *  Set callback function to read/write byte using SPI.
  *  Set callback function for WIZchip select/deselect.
- *  Set memory size of W5x00 chip and monitor PHY link status.
+ *  Set memory size of W5x00 chip from the selected memory profile and check PHY link status.
+ *  Does not wait for the link, see wizchip_link_monitor_run().
  *
  *  \param none
  */
@@ -163,6 +168,36 @@ void wizchip_initialize(void);
  */
 void wizchip_check(void);
 
+/*! \brief Verify SPI access
+ *  \ingroup w5x00_spi
+ *
+ *  Read the version register and count a mismatch as an SPI error.
+ *  Unlike wizchip_check() it never blocks, call it periodically at run time.
+ *
+ *  \return 0 if the version register reads back correctly, -1 otherwise
+ */
+int8_t wizchip_spi_verify(void);
+
+/*! \brief Get SPI error counts
+ *  \ingroup w5x00_spi
+ *
+ *  \param checks number of wizchip_spi_verify() calls
+ *  \param errors number of failed checks
+ */
+void wizchip_spi_get_errors(uint32_t *checks, uint32_t *errors);
+
+/*! \brief Measure SPI buffer throughput
+ *  \ingroup w5x00_spi
+ *
+ *  Copy WIZCHIP_BENCHMARK_LEN bytes to and from the TX/RX memory of a closed socket
+ *  WIZCHIP_BENCHMARK_LOOP times and print the throughput in KB/s.
+ *  Run the same firmware with WIZNET_CHIP set to W5100S and W5500 to compare the chips.
+ *  Call it after wizchip_initialize() and before the socket is opened.
+ *
+ *  \param sn socket number
+ */
+void wizchip_benchmark(uint8_t sn);
+
 /* Network */
 /*! \brief Initialize network
  *  \ingroup w5x00_spi
@@ -0,0 +1,109 @@
+/**
+ * Copyright (c) 2022 WIZnet Co.,Ltd
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#ifndef _W5X00_TX_QUEUE_H_
+#define _W5X00_TX_QUEUE_H_
+
+/**
+ * ----------------------------------------------------------------------------------------------------
+ * Macros
+ * ----------------------------------------------------------------------------------------------------
+ */
+/* Queue */
+#define WIZCHIP_TX_QUEUE_SIZE 512
+
+/**
+ * ----------------------------------------------------------------------------------------------------
+ * Variables
+ * ----------------------------------------------------------------------------------------------------
+ */
+/* Statistics */
+typedef struct wizchip_tx_queue_stats_t
+{
+    uint32_t writes;    // wizchip_tx_queue_write() calls accepted
+    uint32_t flushes;   // Sn_CR_SEND commands issued
+    uint32_t completed; // SENDOK interrupts handled
+    uint32_t timeouts;  // TIMEOUT interrupts handled
+} wizchip_tx_queue_stats_t;
+
+/**
+ * ----------------------------------------------------------------------------------------------------
+ * Functions
+ * ----------------------------------------------------------------------------------------------------
+ */
+/* Queue */
+/*! \brief Initialize TX queue of a TCP socket
+ *  \ingroup w5x00_tx_queue
+ *
+ *  Route the SENDOK and TIMEOUT interrupts of the socket to INTn and clear the staging buffer.
+ *  Send completion is then tracked from the GPIO interrupt instead of polling Sn_IR.
+ *
+ *  \param sn socket number
+ */
+void wizchip_tx_queue_initialize(uint8_t sn);
+
+/*! \brief Stage data for sending
+ *  \ingroup w5x00_tx_queue
+ *
+ *  Copy data to the RAM staging buffer of the socket. Nothing is sent until wizchip_tx_queue_flush().
+ *  Small writes made while a previous SEND is in flight are coalesced into the next flush.
+ *
+ *  \param sn socket number
+ *  \param buf data to send
+ *  \param len data length
+ *  \return len on success, SOCK_BUSY if the staging buffer has no room for len bytes
+ */
+int32_t wizchip_tx_queue_write(uint8_t sn, const uint8_t *buf, uint16_t len);
+
+/*! \brief Send staged data
+ *  \ingroup w5x00_tx_queue
+ *
+ *  Copy the whole staging buffer to the socket TX memory and issue one Sn_CR_SEND.
+ *  Never waits: returns SOCK_BUSY while the previous SEND has not completed, the command register
+ *  is still busy or the TX memory has no room.
+ *
+ *  \param sn socket number
+ *  \return number of bytes sent, 0 if nothing is staged, SOCK_BUSY or a SOCKERR_* code
+ */
+int32_t wizchip_tx_queue_flush(uint8_t sn);
+
+/*! \brief Get free space of the staging buffer
+ *  \ingroup w5x00_tx_queue
+ *
+ *  Read no more requests than there is room to stage their responses, the rest stays in the socket
+ *  RX buffer and TCP flow control holds the peer back.
+ *
+ *  \param sn socket number
+ *  \return bytes wizchip_tx_queue_write() accepts now
+ */
+uint16_t wizchip_tx_queue_get_free(uint8_t sn);
+
+/*! \brief Check if data is staged or in flight
+ *  \ingroup w5x00_tx_queue
+ *
+ *  \param sn socket number
+ *  \return true if data is staged or the last SEND has not completed
+ */
+bool wizchip_tx_queue_pending(uint8_t sn);
+
+/*! \brief Drop staged data
+ *  \ingroup w5x00_tx_queue
+ *
+ *  Call it when the socket is closed or disconnected.
+ *
+ *  \param sn socket number
+ */
+void wizchip_tx_queue_reset(uint8_t sn);
+
+/*! \brief Get TX queue statistics
+ *  \ingroup w5x00_tx_queue
+ *
+ *  \param sn socket number
+ *  \param stats statistics of the socket
+ */
+void wizchip_tx_queue_get_stats(uint8_t sn, wizchip_tx_queue_stats_t *stats);
+
+#endif /* _W5X00_TX_QUEUE_H_ */
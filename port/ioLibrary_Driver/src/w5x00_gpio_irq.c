@@ -13,6 +13,7 @@
 
 #include "pico/stdlib.h"
 #include "hardware/gpio.h"
+#include "hardware/sync.h"
 
 #include "wizchip_conf.h"
 #include "socket.h"
@@ -23,7 +24,13 @@
  * Variables
  * ----------------------------------------------------------------------------------------------------
  */
-static void (*callback_ptr)(void);
+static void (*callback_ptr[_WIZCHIP_SOCK_NUM_])(void);
+static uint8_t irq_sockets = 0;
+static bool irq_installed = false;
+
+/* Written from the INTn interrupt */
+static volatile uint64_t irq_time_us[_WIZCHIP_SOCK_NUM_];
+static volatile uint32_t irq_count[_WIZCHIP_SOCK_NUM_];
 
 /**
  * ----------------------------------------------------------------------------------------------------
@@ -39,21 +46,84 @@ void wizchip_gpio_interrupt_initialize(uint8_t socket, void (*callback)(void))
     reg_val = (SIK_CONNECTED | SIK_DISCONNECTED | SIK_RECEIVED | SIK_TIMEOUT); // except SendOK
     ret_val = ctlsocket(socket, CS_SET_INTMASK, (void *)&reg_val);
 
+    callback_ptr[socket] = callback;
+    irq_sockets |= (1 << socket);
+
+    /* Keep the sockets registered before, INTn is shared by all of them */
 #if (_WIZCHIP_ == W5100S)
-    reg_val = (1 << socket);
+    reg_val = irq_sockets;
 #elif (_WIZCHIP_ == W5500)
-    reg_val = ((1 << socket) << 8);
+    reg_val = ((uint16_t)irq_sockets << 8);
 #endif
     ret_val = ctlwizchip(CW_SET_INTRMASK, (void *)&reg_val);
 
-    callback_ptr = callback;
-    gpio_set_irq_enabled_with_callback(PIN_INT, GPIO_IRQ_EDGE_FALL, true, &wizchip_gpio_interrupt_callback);
+    if (!irq_installed)
+    {
+        irq_installed = true;
+        gpio_set_irq_enabled_with_callback(PIN_INT, GPIO_IRQ_EDGE_FALL, true, &wizchip_gpio_interrupt_callback);
+    }
 }
 
-static void wizchip_gpio_interrupt_callback(uint gpio, uint32_t events)
+uint32_t wizchip_gpio_interrupt_get_timestamp(uint8_t socket, uint64_t *time_us)
+{
+    uint32_t ints;
+    uint32_t count;
+
+    ints = save_and_disable_interrupts();
+    *time_us = irq_time_us[socket];
+    count = irq_count[socket];
+    restore_interrupts(ints);
+
+    return count;
+}
+
+static void wizchip_gpio_interrupt_dispatch(bool stamp)
+{
+    uint64_t now = time_us_64();
+    intr_kind intr;
+    uint8_t sir;
+    uint8_t sn;
+
+    ctlwizchip(CW_GET_INTERRUPT, (void *)&intr);
+    sir = (uint8_t)((uint16_t)intr >> 8) & irq_sockets;
+
+    for (sn = 0; sn < _WIZCHIP_SOCK_NUM_; sn++)
+    {
+        if (!(sir & (1 << sn)))
+        {
+            continue;
+        }
+
+        /* INTn was high before the edge, so every socket pending now raised it */
+        if (stamp)
+        {
+            irq_time_us[sn] = now;
+            irq_count[sn]++;
+        }
+
+        if (callback_ptr[sn] != NULL)
+        {
+            callback_ptr[sn]();
+        }
+    }
+}
+
+void wizchip_gpio_interrupt_service(void)
 {
-    if (callback_ptr != NULL)
+    uint32_t ints;
+
+    if (gpio_get(PIN_INT))
     {
-        callback_ptr();
+        return;
     }
-}
\ No newline at end of file
+
+    ints = save_and_disable_interrupts();
+    wizchip_gpio_interrupt_dispatch(false);
+    restore_interrupts(ints);
+}
+
+static void wizchip_gpio_interrupt_callback(uint gpio, uint32_t events)
+{
+    /* Take the time before anything else, it is used to timestamp received and sent packets */
+    wizchip_gpio_interrupt_dispatch(true);
+}
@@ -0,0 +1,144 @@
+/**
+ * Copyright (c) 2022 WIZnet Co.,Ltd
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+/**
+ * ----------------------------------------------------------------------------------------------------
+ * Includes
+ * ----------------------------------------------------------------------------------------------------
+ */
+#include <stdio.h>
+
+#include "port_common.h"
+
+#include "wizchip_conf.h"
+#include "socket.h"
+#include "w5x00_link.h"
+
+/**
+ * ----------------------------------------------------------------------------------------------------
+ * Variables
+ * ----------------------------------------------------------------------------------------------------
+ */
+/* Link */
+static uint8_t g_link_socket_mask = 0;
+static void (*g_link_down_callback)(void) = NULL;
+static void (*g_link_up_callback)(void) = NULL;
+static uint64_t g_link_next_poll_us = 0;
+static uint64_t g_link_down_us = 0;
+static wizchip_link_stats_t g_link_stats = {
+    .link = PHY_LINK_OFF,
+};
+
+/**
+ * ----------------------------------------------------------------------------------------------------
+ * Functions
+ * ----------------------------------------------------------------------------------------------------
+ */
+static uint8_t wizchip_link_read(void)
+{
+    uint8_t link;
+
+    if (ctlwizchip(CW_GET_PHYLINK, (void *)&link) == -1)
+    {
+        return PHY_LINK_OFF;
+    }
+
+    return link;
+}
+
+void wizchip_link_monitor_initialize(uint8_t socket_mask, void (*link_down_callback)(void), void (*link_up_callback)(void))
+{
+    g_link_socket_mask = socket_mask;
+    g_link_down_callback = link_down_callback;
+    g_link_up_callback = link_up_callback;
+
+    g_link_stats.link = wizchip_link_read();
+    g_link_stats.last_change_us = time_us_64();
+    g_link_down_us = g_link_stats.last_change_us;
+    g_link_next_poll_us = g_link_stats.last_change_us + WIZCHIP_LINK_POLL_MS * 1000;
+
+    if (g_link_stats.link == PHY_LINK_OFF)
+    {
+        printf(" PHY link down, waiting in background\n");
+    }
+}
+
+uint8_t wizchip_link_monitor_run(void)
+{
+    uint64_t now = time_us_64();
+    uint8_t link;
+    uint32_t recover_ms;
+
+    if (now < g_link_next_poll_us)
+    {
+        return g_link_stats.link;
+    }
+
+    g_link_next_poll_us = now + WIZCHIP_LINK_POLL_MS * 1000;
+
+    link = wizchip_link_read();
+
+    if (link == g_link_stats.link)
+    {
+        return link;
+    }
+
+    g_link_stats.link = link;
+    g_link_stats.last_change_us = now;
+
+    if (link == PHY_LINK_OFF)
+    {
+        g_link_down_us = now;
+        g_link_stats.flaps++;
+
+        printf(" PHY link down (flaps : %lu)\n", (unsigned long)g_link_stats.flaps);
+
+        if (g_link_down_callback != NULL)
+        {
+            g_link_down_callback();
+        }
+    }
+    else
+    {
+        recover_ms = (uint32_t)((now - g_link_down_us) / 1000);
+        g_link_stats.last_recover_ms = recover_ms;
+
+        if (recover_ms > g_link_stats.max_recover_ms)
+        {
+            g_link_stats.max_recover_ms = recover_ms;
+        }
+
+        /* Connections did not survive the link loss, let the main loop reopen the sockets */
+        for (uint8_t sn = 0; sn < _WIZCHIP_SOCK_NUM_; sn++)
+        {
+            if (g_link_socket_mask & (1 << sn))
+            {
+                close(sn);
+            }
+        }
+
+        printf(" PHY link up (recovered in %lu ms)\n", (unsigned long)recover_ms);
+
+        if (g_link_up_callback != NULL)
+        {
+            g_link_up_callback();
+        }
+    }
+
+    return link;
+}
+
+void wizchip_link_get_stats(wizchip_link_stats_t *stats)
+{
+    *stats = g_link_stats;
+}
+
+void print_link_information(void)
+{
+    printf(" PHY link    : %s\n", g_link_stats.link == PHY_LINK_ON ? "up" : "down");
+    printf(" Link flaps  : %lu\n", (unsigned long)g_link_stats.flaps);
+    printf(" Recover     : last %lu ms, max %lu ms\n", (unsigned long)g_link_stats.last_recover_ms, (unsigned long)g_link_stats.max_recover_ms);
+}
@@ -0,0 +1,100 @@
+/**
+ * Copyright (c) 2022 WIZnet Co.,Ltd
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+/**
+ * ----------------------------------------------------------------------------------------------------
+ * Includes
+ * ----------------------------------------------------------------------------------------------------
+ */
+#include <stdio.h>
+
+#include "port_common.h"
+
+#include "wizchip_conf.h"
+#include "socket.h"
+#include "w5x00_mem_profile.h"
+
+/**
+ * ----------------------------------------------------------------------------------------------------
+ * Variables
+ * ----------------------------------------------------------------------------------------------------
+ */
+/* {TX, RX} size in KB per socket */
+#if (_WIZCHIP_ == W5100S)
+// W5100S sizes must be 1, 2, 4 or 8 KB and each direction must add up to 8 KB
+static const uint8_t g_mem_profile_table[WIZCHIP_MEM_PROFILE_NUM][2][_WIZCHIP_SOCK_NUM_] = {
+    {{2, 2, 2, 2}, {2, 2, 2, 2}}, // WIZCHIP_MEM_PROFILE_COMMAND
+    {{1, 4, 2, 1}, {2, 2, 2, 2}}, // WIZCHIP_MEM_PROFILE_TELEMETRY
+    {{1, 1, 4, 2}, {1, 1, 4, 2}}, // WIZCHIP_MEM_PROFILE_BULK
+};
+#elif (_WIZCHIP_ == W5500)
+// W5500 sizes must be 0, 1, 2, 4, 8 or 16 KB and each direction must add up to 16 KB or less
+// Every socket is in use, so none may get 0 KB; a socket with no RX memory never receives anything
+static const uint8_t g_mem_profile_table[WIZCHIP_MEM_PROFILE_NUM][2][_WIZCHIP_SOCK_NUM_] = {
+    {{2, 2, 2, 2, 2, 2, 2, 2}, {2, 2, 2, 2, 2, 2, 2, 2}},  // WIZCHIP_MEM_PROFILE_COMMAND
+    {{1, 8, 2, 1, 1, 1, 1, 1}, {2, 2, 2, 2, 2, 2, 2, 2}},  // WIZCHIP_MEM_PROFILE_TELEMETRY
+    {{1, 1, 8, 2, 1, 1, 1, 1}, {1, 1, 8, 2, 1, 1, 1, 1}},  // WIZCHIP_MEM_PROFILE_BULK
+    {{2, 2, 2, 2, 2, 2, 2, 2}, {8, 1, 2, 1, 1, 1, 1, 1}},  // WIZCHIP_MEM_PROFILE_RX_8KB
+    {{1, 2, 1, 1, 1, 1, 8, 1}, {2, 2, 2, 2, 2, 2, 2, 2}},  // WIZCHIP_MEM_PROFILE_FTP
+};
+#endif
+
+static const char *g_mem_profile_name[WIZCHIP_MEM_PROFILE_NUM] = {
+    "command",
+    "telemetry",
+    "bulk",
+#if (_WIZCHIP_ == W5500)
+    "rx-8kb",
+    "ftp",
+#endif
+};
+
+static uint8_t g_mem_profile = WIZCHIP_MEM_PROFILE_DEFAULT;
+
+/**
+ * ----------------------------------------------------------------------------------------------------
+ * Functions
+ * ----------------------------------------------------------------------------------------------------
+ */
+/* Profile */
+int8_t wizchip_mem_profile_select(uint8_t profile)
+{
+    if (profile >= WIZCHIP_MEM_PROFILE_NUM)
+    {
+        printf(" Unknown memory profile %d, using %s\n", profile, g_mem_profile_name[g_mem_profile]);
+
+        return -1;
+    }
+
+    g_mem_profile = profile;
+
+    return 0;
+}
+
+uint8_t wizchip_mem_profile_get(void)
+{
+    return g_mem_profile;
+}
+
+const uint8_t *wizchip_mem_profile_memsize(uint8_t profile)
+{
+    if (profile >= WIZCHIP_MEM_PROFILE_NUM)
+    {
+        return NULL;
+    }
+
+    return &g_mem_profile_table[profile][0][0];
+}
+
+const char *wizchip_mem_profile_name(uint8_t profile)
+{
+    if (profile >= WIZCHIP_MEM_PROFILE_NUM)
+    {
+        return "unknown";
+    }
+
+    return g_mem_profile_name[profile];
+}
@@ -15,6 +15,7 @@
 
 #include "wizchip_conf.h"
 #include "w5x00_spi.h"
+#include "w5x00_mem_profile.h"
 
 /**
  * ----------------------------------------------------------------------------------------------------
@@ -23,6 +24,10 @@
  */
 static critical_section_t g_wizchip_cri_sec;
 
+/* SPI health */
+static uint32_t g_spi_checks = 0;
+static uint32_t g_spi_errors = 0;
+
 #ifdef USE_SPI_DMA
 static uint dma_tx;
 static uint dma_rx;
@@ -122,6 +127,16 @@ static void wizchip_write_burst(uint8_t *pBuf, uint16_t len)
     dma_start_channel_mask((1u << dma_tx) | (1u << dma_rx));
     dma_channel_wait_for_finish_blocking(dma_rx);
 }
+#else
+static void wizchip_read_burst(uint8_t *pBuf, uint16_t len)
+{
+    spi_read_blocking(SPI_PORT, 0xFF, pBuf, len);
+}
+
+static void wizchip_write_burst(uint8_t *pBuf, uint16_t len)
+{
+    spi_write_blocking(SPI_PORT, pBuf, len);
+}
 #endif
 
 static void wizchip_critical_section_lock(void)
@@ -189,17 +204,11 @@ void wizchip_initialize(void)
 
     /* SPI function register */
     reg_wizchip_spi_cbfunc(wizchip_read, wizchip_write);
-#ifdef USE_SPI_DMA
     reg_wizchip_spiburst_cbfunc(wizchip_read_burst, wizchip_write_burst);
-#endif
 
     /* W5x00 initialize */
     uint8_t temp;
-#if (_WIZCHIP_ == W5100S)
-    uint8_t memsize[2][4] = {{2, 2, 2, 2}, {2, 2, 2, 2}};
-#elif (_WIZCHIP_ == W5500)
-    uint8_t memsize[2][8] = {{2, 2, 2, 2, 2, 2, 2, 2}, {2, 2, 2, 2, 2, 2, 2, 2}};
-#endif
+    const uint8_t *memsize = wizchip_mem_profile_memsize(wizchip_mem_profile_get());
 
     if (ctlwizchip(CW_INIT_WIZCHIP, (void *)memsize) == -1)
     {
@@ -208,16 +217,13 @@ void wizchip_initialize(void)
         return;
     }
 
-    /* Check PHY link status */
-    do
+    /* Check PHY link status, the link monitor takes over from here so boot never waits for the cable */
+    if (ctlwizchip(CW_GET_PHYLINK, (void *)&temp) == -1)
     {
-        if (ctlwizchip(CW_GET_PHYLINK, (void *)&temp) == -1)
-        {
-            printf(" Unknown PHY link status\n");
+        printf(" Unknown PHY link status\n");
 
-            return;
-        }
-    } while (temp == PHY_LINK_OFF);
+        return;
+    }
 }
 
 void wizchip_check(void)
@@ -243,6 +249,79 @@ void wizchip_check(void)
 #endif
 }
 
+int8_t wizchip_spi_verify(void)
+{
+    uint8_t version;
+
+    g_spi_checks++;
+#if (_WIZCHIP_ == W5100S)
+    version = getVER();
+    if (version != 0x51)
+#elif (_WIZCHIP_ == W5500)
+    version = getVERSIONR();
+    if (version != 0x04)
+#endif
+    {
+        g_spi_errors++;
+
+        return -1;
+    }
+
+    return 0;
+}
+
+void wizchip_spi_get_errors(uint32_t *checks, uint32_t *errors)
+{
+    *checks = g_spi_checks;
+    *errors = g_spi_errors;
+}
+
+void wizchip_benchmark(uint8_t sn)
+{
+    static uint8_t buf[WIZCHIP_BENCHMARK_LEN];
+    uint8_t tmp_str[8] = {
+        0,
+    };
+    uint16_t len;
+    uint32_t total;
+    uint64_t start;
+    uint64_t tx_us;
+    uint64_t rx_us;
+
+    /* Never copy more than the smaller of the socket's TX/RX memory */
+    len = MIN(getSn_TxMAX(sn), getSn_RxMAX(sn));
+    len = MIN(len, WIZCHIP_BENCHMARK_LEN);
+
+    if (len == 0)
+    {
+        printf(" Benchmark skipped : socket %d has no buffer memory\n", sn);
+
+        return;
+    }
+
+    total = (uint32_t)len * WIZCHIP_BENCHMARK_LOOP;
+
+    start = time_us_64();
+    for (int i = 0; i < WIZCHIP_BENCHMARK_LOOP; i++)
+    {
+        wiz_send_data(sn, buf, len);
+    }
+    tx_us = time_us_64() - start;
+
+    start = time_us_64();
+    for (int i = 0; i < WIZCHIP_BENCHMARK_LOOP; i++)
+    {
+        wiz_recv_data(sn, buf, len);
+    }
+    rx_us = time_us_64() - start;
+
+    ctlwizchip(CW_GET_ID, (void *)tmp_str);
+
+    printf(" %s benchmark : %lu bytes per direction\n", (char *)tmp_str, (unsigned long)total);
+    printf(" TX : %lu us, %lu KB/s\n", (unsigned long)tx_us, (unsigned long)(((uint64_t)total * 1000000 / 1024) / (tx_us ? tx_us : 1)));
+    printf(" RX : %lu us, %lu KB/s\n", (unsigned long)rx_us, (unsigned long)(((uint64_t)total * 1000000 / 1024) / (rx_us ? rx_us : 1)));
+}
+
 /* Network */
 void network_initialize(wiz_NetInfo net_info)
 {
@@ -0,0 +1,204 @@
+/**
+ * Copyright (c) 2022 WIZnet Co.,Ltd
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+/**
+ * ----------------------------------------------------------------------------------------------------
+ * Includes
+ * ----------------------------------------------------------------------------------------------------
+ */
+#include <stdio.h>
+#include <string.h>
+
+#include "port_common.h"
+
+#include "wizchip_conf.h"
+#include "socket.h"
+#include "w5x00_gpio_irq.h"
+#include "w5x00_tx_queue.h"
+
+/**
+ * ----------------------------------------------------------------------------------------------------
+ * Variables
+ * ----------------------------------------------------------------------------------------------------
+ */
+/* Queue */
+static uint8_t g_tx_queue_buf[_WIZCHIP_SOCK_NUM_][WIZCHIP_TX_QUEUE_SIZE];
+static uint16_t g_tx_queue_len[_WIZCHIP_SOCK_NUM_];
+
+/* Written from the INTn interrupt; one byte per socket, so a plain store never rewrites another socket's flag */
+static volatile uint8_t g_tx_queue_in_flight[_WIZCHIP_SOCK_NUM_];
+static volatile uint8_t g_tx_queue_timeout[_WIZCHIP_SOCK_NUM_];
+static uint8_t g_tx_queue_enabled = 0;
+static wizchip_tx_queue_stats_t g_tx_queue_stats[_WIZCHIP_SOCK_NUM_];
+
+/**
+ * ----------------------------------------------------------------------------------------------------
+ * Functions
+ * ----------------------------------------------------------------------------------------------------
+ */
+static void wizchip_tx_queue_interrupt_callback(void)
+{
+    uint8_t sn;
+    uint8_t ir;
+
+    for (sn = 0; sn < _WIZCHIP_SOCK_NUM_; sn++)
+    {
+        if (!(g_tx_queue_enabled & (1 << sn)))
+        {
+            continue;
+        }
+
+        ir = getSn_IR(sn) & (Sn_IR_SENDOK | Sn_IR_TIMEOUT);
+
+        if (ir == 0)
+        {
+            continue;
+        }
+
+        /* Clear every unmasked bit, otherwise INTn stays low and no further edge is seen */
+        setSn_IR(sn, ir);
+
+        if (ir & Sn_IR_SENDOK)
+        {
+            g_tx_queue_stats[sn].completed++;
+        }
+
+        if (ir & Sn_IR_TIMEOUT)
+        {
+            g_tx_queue_timeout[sn] = 1;
+            g_tx_queue_stats[sn].timeouts++;
+        }
+
+        g_tx_queue_in_flight[sn] = 0;
+    }
+}
+
+void wizchip_tx_queue_initialize(uint8_t sn)
+{
+    uint8_t reg_val;
+
+    wizchip_tx_queue_reset(sn);
+    memset(&g_tx_queue_stats[sn], 0, sizeof(g_tx_queue_stats[sn]));
+    g_tx_queue_enabled |= (1 << sn);
+
+    wizchip_gpio_interrupt_initialize(sn, wizchip_tx_queue_interrupt_callback);
+
+    /* Only SENDOK and TIMEOUT, the main loop keeps polling Sn_SR and the other Sn_IR bits */
+    reg_val = (SIK_SENT | SIK_TIMEOUT);
+    ctlsocket(sn, CS_SET_INTMASK, (void *)&reg_val);
+    ctlsocket(sn, CS_CLR_INTERRUPT, (void *)&reg_val);
+}
+
+int32_t wizchip_tx_queue_write(uint8_t sn, const uint8_t *buf, uint16_t len)
+{
+    if (sn >= _WIZCHIP_SOCK_NUM_)
+    {
+        return SOCKERR_SOCKNUM;
+    }
+
+    if (len == 0)
+    {
+        return SOCKERR_DATALEN;
+    }
+
+    if (len > WIZCHIP_TX_QUEUE_SIZE - g_tx_queue_len[sn])
+    {
+        return SOCK_BUSY;
+    }
+
+    memcpy(&g_tx_queue_buf[sn][g_tx_queue_len[sn]], buf, len);
+    g_tx_queue_len[sn] += len;
+    g_tx_queue_stats[sn].writes++;
+
+    return (int32_t)len;
+}
+
+int32_t wizchip_tx_queue_flush(uint8_t sn)
+{
+    uint8_t status;
+    uint16_t len;
+
+    if (sn >= _WIZCHIP_SOCK_NUM_)
+    {
+        return SOCKERR_SOCKNUM;
+    }
+
+    if (g_tx_queue_timeout[sn])
+    {
+        wizchip_tx_queue_reset(sn);
+        close(sn);
+
+        return SOCKERR_TIMEOUT;
+    }
+
+    len = g_tx_queue_len[sn];
+
+    if (len == 0)
+    {
+        return 0;
+    }
+
+    if (g_tx_queue_in_flight[sn])
+    {
+        /* SENDOK gives no edge while another socket holds INTn low */
+        wizchip_gpio_interrupt_service();
+
+        if (g_tx_queue_in_flight[sn])
+        {
+            return SOCK_BUSY;
+        }
+    }
+
+    status = getSn_SR(sn);
+
+    if ((status != SOCK_ESTABLISHED) && (status != SOCK_CLOSE_WAIT))
+    {
+        return SOCKERR_SOCKSTATUS;
+    }
+
+    /* The previous command has not been accepted yet */
+    if (getSn_CR(sn))
+    {
+        return SOCK_BUSY;
+    }
+
+    if (getSn_TX_FSR(sn) < len)
+    {
+        return SOCK_BUSY;
+    }
+
+    wiz_send_data(sn, g_tx_queue_buf[sn], len);
+
+    g_tx_queue_in_flight[sn] = 1;
+    g_tx_queue_len[sn] = 0;
+    g_tx_queue_stats[sn].flushes++;
+
+    setSn_CR(sn, Sn_CR_SEND);
+
+    return (int32_t)len;
+}
+
+uint16_t wizchip_tx_queue_get_free(uint8_t sn)
+{
+    return WIZCHIP_TX_QUEUE_SIZE - g_tx_queue_len[sn];
+}
+
+bool wizchip_tx_queue_pending(uint8_t sn)
+{
+    return (g_tx_queue_len[sn] != 0) || g_tx_queue_in_flight[sn];
+}
+
+void wizchip_tx_queue_reset(uint8_t sn)
+{
+    g_tx_queue_len[sn] = 0;
+    g_tx_queue_in_flight[sn] = 0;
+    g_tx_queue_timeout[sn] = 0;
+}
+
+void wizchip_tx_queue_get_stats(uint8_t sn, wizchip_tx_queue_stats_t *stats)
+{
+    *stats = g_tx_queue_stats[sn];
+}